@@ -557,6 +557,26 @@ VImage::call(const char *operation_name, VOption *options)
 	call_option_string(operation_name, nullptr, options);
 }
 
+static void *
+metrics_append(VipsMetrics *metrics, void *a, void *b)
+{
+	std::vector<VipsMetrics> *result = (std::vector<VipsMetrics> *) a;
+
+	result->push_back(*metrics);
+
+	return nullptr;
+}
+
+std::vector<VipsMetrics>
+VImage::metrics()
+{
+	std::vector<VipsMetrics> result;
+
+	vips_metrics_map(metrics_append, &result, nullptr);
+
+	return result;
+}
+
 VImage
 VImage::new_from_file(const char *name, VOption *options)
 {
@@ -848,6 +848,22 @@ public:
 	static void
 	call(const char *operation_name, VOption *options = nullptr);
 
+	/**
+	 * Get the per-operation counters, one element for each operation
+	 * nickname that has been seen. See vips_metrics_map().
+	 */
+	static std::vector<VipsMetrics>
+	metrics();
+
+	/**
+	 * Set all per-operation counters back to zero.
+	 */
+	static void
+	metrics_reset()
+	{
+		vips_metrics_reset();
+	}
+
 	/**
 	 * Make a new image which, when written to, will create a large memory
 	 * object. See VImage::write().
@@ -2433,6 +2449,7 @@ public:
 	 *
 	 * **Optional parameters**
 	 *   - **shift** -- Shift integer values up and down, bool.
+	 *   - **round** -- Round float values to the nearest integer, bool.
 	 *
 	 * @param format Format to cast to.
 	 * @param options Set of options.
@@ -6000,6 +6017,7 @@ public:
 	 *   - **access** -- Expected access pattern, VipsAccess.
 	 *   - **threaded** -- Allow threaded access, bool.
 	 *   - **persistent** -- Keep cache between evaluations, bool.
+	 *   - **cache_dir** -- Directory for a persistent on-disc tile cache, const char *.
 	 *
 	 * @param options Set of options.
 	 * @return Output image.
@@ -6083,6 +6101,8 @@ public:
 	 * Save image to file in vips format.
 	 *
 	 * **Optional parameters**
+	 *   - **compression** -- Compress tiles with this codec, VipsForeignVipsCompression.
+	 *   - **tile_size** -- Tile size in pixels for compressed images, int.
 	 *   - **profile** -- Filename of ICC profile to embed, const char *.
 	 *   - **keep** -- Which metadata to retain, VipsForeignKeep.
 	 *   - **background** -- Background value, std::vector<double>.
@@ -6097,6 +6117,8 @@ public:
 	 * Save image to target in vips format.
 	 *
 	 * **Optional parameters**
+	 *   - **compression** -- Compress tiles with this codec, VipsForeignVipsCompression.
+	 *   - **tile_size** -- Tile size in pixels for compressed images, int.
 	 *   - **profile** -- Filename of ICC profile to embed, const char *.
 	 *   - **keep** -- Which metadata to retain, VipsForeignKeep.
 	 *   - **background** -- Background value, std::vector<double>.
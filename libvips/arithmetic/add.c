@@ -38,6 +38,8 @@
  * 	- rewrite as a class
  * 2/12/13
  * 	- remove vector code, gcc autovec with -O3 is now as fast
+ * 16/10/26
+ * 	- add Highway path for the common formats
  */
 
 /*
@@ -81,6 +83,7 @@
 #include <math.h>
 
 #include <vips/vips.h>
+#include <vips/vector.h>
 
 #include "binary.h"
 
@@ -111,6 +114,12 @@ add_buffer(VipsArithmetic *arithmetic, VipsPel *out, VipsPel **in, int width)
 
 	int x;
 
+#ifdef HAVE_HWY
+	if (vips_vector_isenabled() &&
+		vips_add_hwy(vips_image_get_format(im), out, in, sz))
+		return;
+#endif /*HAVE_HWY*/
+
 	/* Add all input types. Keep types here in sync with
 	 * vips_add_format_table[] below.
 	 */
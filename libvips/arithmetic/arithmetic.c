@@ -8,6 +8,9 @@
  * 	  corresponding pixel in the input)
  * 	- LUT-able: ie. arithmetic (image) can be exactly replaced by
  * 	  maplut (image, arithmetic (lut)) for 8/16 bit int images
+ *
+ * 16/10/26
+ * 	- fuse chains of arithmetic operations into a single generate
  */
 
 /*
@@ -97,6 +100,12 @@
  * save as 16-bit PNG). Use vips_copy() to change the interpretation without
  * changing pixels.
  *
+ * Chains of arithmetic operations, for example a vips_linear() followed by
+ * vips_abs() and vips_multiply(), are run together: each tile is computed by
+ * passing scanlines through every operation in turn, with no pixel buffers in
+ * between. An operation is only merged into the one after it if nothing else
+ * uses its output. Set `VIPS_NOFUSE` or use `--vips-nofuse` to turn this off.
+ *
  * For binary arithmetic operations, type promotion occurs in two stages.
  * First, the two input images are cast up to the smallest common format,
  * that is, the type with the smallest range that can represent the full
@@ -517,6 +526,39 @@ vips__bandalike(const char *domain,
 	return 0;
 }
 
+/* Set FALSE to stop arithmetic operations fusing, see
+ * vips_arithmetic_fuse().
+ */
+gboolean vips__fuse_enabled = TRUE;
+
+/* The most operations we run in one generate, and the most inputs each can
+ * have.
+ */
+#define VIPS_ARITHMETIC_FUSE_MAX (8)
+#define VIPS_ARITHMETIC_FUSE_INPUTS (4)
+
+/* One operation in a fused chain. Each input is either a leaf image
+ * (index >= 0), or the output of an earlier step (-1 - step index).
+ */
+typedef struct _VipsArithmeticStep {
+	VipsArithmetic *arithmetic;
+	int n;
+	int input[VIPS_ARITHMETIC_FUSE_INPUTS];
+} VipsArithmeticStep;
+
+/* A fused chain of operations. Steps are in evaluation order, the last step
+ * is the operation that owns the plan.
+ */
+typedef struct _VipsArithmeticFuse {
+	int n_steps;
+	VipsArithmeticStep step[VIPS_ARITHMETIC_FUSE_MAX];
+
+	/* The images we make regions on, NULL-terminated.
+	 */
+	int n_leaves;
+	VipsImage *leaf[VIPS_ARITHMETIC_FUSE_MAX * VIPS_ARITHMETIC_FUSE_INPUTS + 1];
+} VipsArithmeticFuse;
+
 /* Our sequence value.
  */
 typedef struct {
@@ -530,6 +572,13 @@ typedef struct {
 	 */
 	VipsPel **p;
 
+	/* For fused chains, a line buffer for each step, and the input
+	 * pointers for each step.
+	 */
+	VipsPel *buf[VIPS_ARITHMETIC_FUSE_MAX];
+	int buf_width;
+	VipsPel *in[VIPS_ARITHMETIC_FUSE_MAX][VIPS_ARITHMETIC_FUSE_INPUTS + 1];
+
 } VipsArithmeticSequence;
 
 static int
@@ -537,9 +586,9 @@ vips_arithmetic_stop(void *vseq, void *a, void *b)
 {
 	VipsArithmeticSequence *seq = (VipsArithmeticSequence *) vseq;
 
-	if (seq->ir) {
-		int i;
+	int i;
 
+	if (seq->ir) {
 		for (i = 0; seq->ir[i]; i++)
 			VIPS_UNREF(seq->ir[i]);
 		VIPS_FREE(seq->ir);
@@ -547,6 +596,9 @@ vips_arithmetic_stop(void *vseq, void *a, void *b)
 
 	VIPS_FREE(seq->p);
 
+	for (i = 0; i < VIPS_ARITHMETIC_FUSE_MAX; i++)
+		VIPS_FREEF(vips_tracked_free, seq->buf[i]);
+
 	VIPS_FREE(seq);
 
 	return 0;
@@ -567,6 +619,9 @@ vips_arithmetic_start(VipsImage *out, void *a, void *b)
 	seq->arithmetic = arithmetic;
 	seq->ir = NULL;
 	seq->p = NULL;
+	for (i = 0; i < VIPS_ARITHMETIC_FUSE_MAX; i++)
+		seq->buf[i] = NULL;
+	seq->buf_width = 0;
 
 	/* How many images?
 	 */
@@ -639,6 +694,247 @@ vips_arithmetic_gen(VipsRegion *out_region,
 	return 0;
 }
 
+static int vips_arithmetic_fuse_gen(VipsRegion *out_region,
+	void *vseq, void *a, void *b, gboolean *stop);
+
+/* If @image was made by an arithmetic operation, return it.
+ */
+VipsArithmetic *
+vips__arithmetic_producer(VipsImage *image)
+{
+	if ((image->generate_fn == vips_arithmetic_gen ||
+			image->generate_fn == vips_arithmetic_fuse_gen) &&
+		VIPS_IS_ARITHMETIC(image->client2))
+		return VIPS_ARITHMETIC(image->client2);
+
+	return NULL;
+}
+
+/* Is @image used by anything other than the @n images in @users?
+ */
+static gboolean
+vips_arithmetic_shared(VipsImage *image, VipsImage **users, int n)
+{
+	gboolean shared;
+	GSList *p;
+	int i;
+
+	shared = FALSE;
+	g_mutex_lock(vips__global_lock);
+	for (p = image->downstream; p; p = p->next) {
+		for (i = 0; i < n; i++)
+			if (p->data == users[i])
+				break;
+		if (i == n)
+			shared = TRUE;
+	}
+	g_mutex_unlock(vips__global_lock);
+
+	return shared;
+}
+
+/* Can we run the operation that made input @i of @consumer inline? It must
+ * be another arithmetic operation, and nothing but @consumer must be using
+ * its pixels.
+ *
+ * ready[i] is a vips_image_decode() copy of in[i], perhaps cast, bandalike
+ * and sizealike as well. We can only look through the copy: anything else
+ * changes the pixels.
+ */
+static VipsArithmetic *
+vips_arithmetic_fusable(VipsArithmetic *consumer, int i)
+{
+	VipsImage *in = consumer->in[i];
+	VipsImage *ready = consumer->ready[i];
+
+	VipsArithmetic *arithmetic;
+
+	if (!(arithmetic = vips__arithmetic_producer(in)) ||
+		arithmetic->n > VIPS_ARITHMETIC_FUSE_INPUTS)
+		return NULL;
+
+	if (in->Coding != VIPS_CODING_NONE ||
+		ready->Xsize != in->Xsize ||
+		ready->Ysize != in->Ysize ||
+		ready->Bands != in->Bands ||
+		ready->BandFmt != in->BandFmt)
+		return NULL;
+
+	/* Our decode copies must be the only users of in[i]. There can be
+	 * several, for example for x * x. Our own out is not attached to the
+	 * copies yet, so nothing should be using them.
+	 */
+	if (vips_arithmetic_shared(in, consumer->ready, consumer->n) ||
+		vips_arithmetic_shared(ready, NULL, 0))
+		return NULL;
+
+	return arithmetic;
+}
+
+/* Add @arithmetic and any operations we can fuse above it to the plan.
+ * @depth is the number of steps, including this one, still waiting to be
+ * added. Return the step index.
+ */
+static int
+vips_arithmetic_fuse_add(VipsArithmeticFuse *fuse,
+	VipsArithmetic *arithmetic, int depth)
+{
+	int input[VIPS_ARITHMETIC_FUSE_INPUTS];
+	VipsArithmeticStep *step;
+	int i, j;
+
+	/* x * x, for example, will reach the same operation twice.
+	 */
+	for (i = 0; i < fuse->n_steps; i++)
+		if (fuse->step[i].arithmetic == arithmetic)
+			return i;
+
+	/* Inputs first, so steps are in evaluation order.
+	 */
+	for (i = 0; i < arithmetic->n; i++) {
+		VipsImage *image = arithmetic->ready[i];
+		VipsArithmetic *upstream;
+
+		if (fuse->n_steps + depth < VIPS_ARITHMETIC_FUSE_MAX &&
+			(upstream = vips_arithmetic_fusable(arithmetic, i)))
+			input[i] = -1 -
+				vips_arithmetic_fuse_add(fuse, upstream, depth + 1);
+		else {
+			for (j = 0; j < fuse->n_leaves; j++)
+				if (fuse->leaf[j] == image)
+					break;
+			if (j == fuse->n_leaves)
+				fuse->leaf[fuse->n_leaves++] = image;
+			input[i] = j;
+		}
+	}
+
+	step = &fuse->step[fuse->n_steps];
+	step->arithmetic = arithmetic;
+	step->n = arithmetic->n;
+	for (i = 0; i < arithmetic->n; i++)
+		step->input[i] = input[i];
+
+	return fuse->n_steps++;
+}
+
+/* Chains of arithmetic operations normally have a region and a pixel buffer
+ * between each pair. Where an input to this operation was made by another
+ * arithmetic operation that nothing else is using, we can instead run the
+ * two process_line functions one after the other over a line buffer, and
+ * only prepare regions on the inputs to the whole chain.
+ *
+ * This must be called before out is attached to our inputs.
+ *
+ * Fusing is off for --vips-nofuse or VIPS_NOFUSE.
+ */
+static void
+vips_arithmetic_fuse(VipsArithmetic *arithmetic)
+{
+	VipsArithmeticFuse *fuse;
+	int i;
+
+	if (!vips__fuse_enabled ||
+		arithmetic->n > VIPS_ARITHMETIC_FUSE_INPUTS)
+		return;
+
+	for (i = 0; i < arithmetic->n; i++)
+		if (vips_arithmetic_fusable(arithmetic, i))
+			break;
+	if (i == arithmetic->n)
+		return;
+
+	if (!(fuse = VIPS_NEW(arithmetic, VipsArithmeticFuse)))
+		return;
+	fuse->n_steps = 0;
+	fuse->n_leaves = 0;
+	vips_arithmetic_fuse_add(fuse, arithmetic, 1);
+	fuse->leaf[fuse->n_leaves] = NULL;
+
+#ifdef DEBUG
+	printf("vips_arithmetic_fuse: ");
+	vips_object_print_name(VIPS_OBJECT(arithmetic));
+	printf(" runs %d steps over %d inputs\n",
+		fuse->n_steps, fuse->n_leaves);
+#endif /*DEBUG*/
+
+	arithmetic->fuse = fuse;
+}
+
+static int
+vips_arithmetic_fuse_gen(VipsRegion *out_region,
+	void *vseq, void *a, void *b, gboolean *stop)
+{
+	VipsArithmeticSequence *seq = (VipsArithmeticSequence *) vseq;
+	VipsRegion **ir = seq->ir;
+	VipsArithmetic *arithmetic = VIPS_ARITHMETIC(b);
+	VipsArithmeticFuse *fuse = arithmetic->fuse;
+	VipsRect *r = &out_region->valid;
+
+	VipsPel *q;
+	int i, j, y;
+
+	/* Line buffers for each step but the last, which writes to the
+	 * output region.
+	 */
+	if (r->width > seq->buf_width) {
+		for (i = 0; i < fuse->n_steps - 1; i++) {
+			VIPS_FREEF(vips_tracked_free, seq->buf[i]);
+			if (!(seq->buf[i] = vips_tracked_malloc(r->width *
+					  VIPS_IMAGE_SIZEOF_PEL(fuse->step[i].arithmetic->out))))
+				return -1;
+		}
+		seq->buf_width = r->width;
+	}
+
+	if (vips_reorder_prepare_many(out_region->im, ir, r))
+		return -1;
+	for (i = 0; ir[i]; i++)
+		seq->p[i] = (VipsPel *)
+			VIPS_REGION_ADDR(ir[i], r->left, r->top);
+	q = (VipsPel *) VIPS_REGION_ADDR(out_region, r->left, r->top);
+
+	/* Steps read from earlier steps' line buffers, which never move.
+	 */
+	for (i = 0; i < fuse->n_steps; i++) {
+		VipsArithmeticStep *step = &fuse->step[i];
+
+		for (j = 0; j < step->n; j++)
+			if (step->input[j] < 0)
+				seq->in[i][j] = seq->buf[-1 - step->input[j]];
+		seq->in[i][j] = NULL;
+	}
+
+	VIPS_GATE_START("vips_arithmetic_fuse_gen: work");
+
+	for (y = 0; y < r->height; y++) {
+		for (i = 0; i < fuse->n_steps; i++) {
+			VipsArithmeticStep *step = &fuse->step[i];
+			VipsArithmeticClass *class =
+				VIPS_ARITHMETIC_GET_CLASS(step->arithmetic);
+
+			for (j = 0; j < step->n; j++)
+				if (step->input[j] >= 0)
+					seq->in[i][j] = seq->p[step->input[j]];
+
+			class->process_line(step->arithmetic,
+				i == fuse->n_steps - 1 ? q : seq->buf[i],
+				seq->in[i], r->width);
+		}
+
+		for (i = 0; ir[i]; i++)
+			seq->p[i] += VIPS_REGION_LSKIP(ir[i]);
+		q += VIPS_REGION_LSKIP(out_region);
+	}
+
+	VIPS_GATE_STOP("vips_arithmetic_fuse_gen: work");
+
+	VIPS_COUNT_PIXELS(out_region,
+		VIPS_OBJECT_GET_CLASS(arithmetic)->nickname);
+
+	return 0;
+}
+
 static int
 vips_arithmetic_build(VipsObject *object)
 {
@@ -690,8 +986,24 @@ vips_arithmetic_build(VipsObject *object)
 	 */
 	arithmetic->ready = size;
 
-	if (vips_image_pipeline_array(arithmetic->out,
-			VIPS_DEMAND_STYLE_THINSTRIP, arithmetic->ready))
+	/* Run any upstream arithmetic inline. We must check for this before
+	 * out is attached, since that adds us downstream of our inputs.
+	 */
+	vips_arithmetic_fuse(arithmetic);
+
+	/* A fused chain reads the leaves of the chain directly, so they are
+	 * the inputs vips_reorder_prepare_many() must see. The header still
+	 * comes from our own inputs.
+	 */
+	if (arithmetic->fuse) {
+		if (vips_image_pipeline_array(arithmetic->out,
+				VIPS_DEMAND_STYLE_THINSTRIP, arithmetic->fuse->leaf) ||
+			vips__image_copy_fields_array(arithmetic->out,
+				arithmetic->ready))
+			return -1;
+	}
+	else if (vips_image_pipeline_array(arithmetic->out,
+				 VIPS_DEMAND_STYLE_THINSTRIP, arithmetic->ready))
 		return -1;
 
 	arithmetic->out->Bands = arithmetic->ready[0]->Bands;
@@ -701,6 +1013,17 @@ vips_arithmetic_build(VipsObject *object)
 		arithmetic->out->BandFmt =
 			aclass->format_table[arithmetic->ready[0]->BandFmt];
 
+	if (arithmetic->fuse) {
+		if (vips_image_generate(arithmetic->out,
+				vips_arithmetic_start,
+				vips_arithmetic_fuse_gen,
+				vips_arithmetic_stop,
+				arithmetic->fuse->leaf, arithmetic))
+			return -1;
+
+		return 0;
+	}
+
 	if (vips_image_generate(arithmetic->out,
 			vips_arithmetic_start,
 			vips_arithmetic_gen,
@@ -0,0 +1,775 @@
+/* Highway paths for the common arithmetic operations
+ *
+ * 16/10/26
+ * 	- initial implementation
+ */
+
+/*
+
+	This file is part of VIPS.
+
+	VIPS is free software; you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+	02110-1301  USA
+
+ */
+
+/*
+
+	These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <glib/gi18n-lib.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <vips/vips.h>
+#include <vips/vector.h>
+#include <vips/debug.h>
+#include <vips/internal.h>
+
+#include "parithmetic.h"
+
+#ifdef HAVE_HWY
+
+#undef HWY_TARGET_INCLUDE
+#define HWY_TARGET_INCLUDE "libvips/arithmetic/arithmetic_hwy.cpp"
+#include <hwy/foreach_target.h>
+#include <hwy/highway.h>
+
+namespace HWY_NAMESPACE {
+
+using namespace hwy::HWY_NAMESPACE;
+
+using DU8 = ScalableTag<uint8_t>;
+using DI8 = ScalableTag<int8_t>;
+using DU16 = ScalableTag<uint16_t>;
+using DI16 = ScalableTag<int16_t>;
+using DU32 = ScalableTag<uint32_t>;
+using DI32 = ScalableTag<int32_t>;
+using DF32 = ScalableTag<float>;
+constexpr DU8 du8;
+constexpr DI8 di8;
+constexpr DU16 du16;
+constexpr DI16 di16;
+constexpr DU32 du32;
+constexpr DI32 di32;
+constexpr DF32 df32;
+constexpr Rebind<uint8_t, DI32> du8x32;
+
+/* Load a vector of T and widen to the lane type of d. The C paths do the
+ * arithmetic in the output type, so we must widen before we operate.
+ */
+template <class D, typename T,
+	hwy::EnableIf<!hwy::IsSame<T, TFromD<D>>()> * = nullptr>
+HWY_INLINE Vec<D>
+load_widen(D d, const T *HWY_RESTRICT p)
+{
+	return PromoteTo(d, LoadU(Rebind<T, D>(), p));
+}
+
+template <class D>
+HWY_INLINE Vec<D>
+load_widen(D d, const TFromD<D> *HWY_RESTRICT p)
+{
+	return LoadU(d, p);
+}
+
+/* Load a vector of pixels as float.
+ */
+template <typename T>
+HWY_INLINE Vec<DF32>
+load_float(const T *HWY_RESTRICT p)
+{
+	return ConvertTo(df32, PromoteTo(di32, LoadU(Rebind<T, DI32>(), p)));
+}
+
+HWY_INLINE Vec<DF32>
+load_float(const float *HWY_RESTRICT p)
+{
+	return LoadU(df32, p);
+}
+
+/* Write a mask out as uchar 255 or 0. One-byte masks are already in the
+ * right form, wider ones are narrowed with a saturating demote.
+ */
+template <class D>
+HWY_INLINE void
+store_mask(hwy::SizeTag<1>, D d, Mask<D> m, uint8_t *HWY_RESTRICT q)
+{
+	const RebindToUnsigned<D> du;
+
+	StoreU(BitCast(du, VecFromMask(d, m)), du, q);
+}
+
+template <class D, size_t S>
+HWY_INLINE void
+store_mask(hwy::SizeTag<S>, D d, Mask<D> m, uint8_t *HWY_RESTRICT q)
+{
+	const RebindToSigned<D> di;
+	const Rebind<uint8_t, decltype(di)> du;
+
+	StoreU(DemoteTo(du,
+			   IfThenElseZero(RebindMask(di, m), Set(di, 255))),
+		du, q);
+}
+
+template <class D>
+HWY_INLINE void
+store_mask(D d, Mask<D> m, uint8_t *HWY_RESTRICT q)
+{
+	store_mask(hwy::SizeTag<sizeof(TFromD<D>)>(), d, m, q);
+}
+
+/* The operations. Each has a vector form and a scalar form for the tail of
+ * the line, and the scalar form must match the C path exactly.
+ */
+struct AddOp {
+	template <class V>
+	static HWY_INLINE V vector(V a, V b) { return Add(a, b); }
+	template <typename T>
+	static HWY_INLINE T scalar(T a, T b) { return a + b; }
+};
+
+struct SubtractOp {
+	template <class V>
+	static HWY_INLINE V vector(V a, V b) { return Sub(a, b); }
+	template <typename T>
+	static HWY_INLINE T scalar(T a, T b) { return a - b; }
+};
+
+struct MultiplyOp {
+	template <class V>
+	static HWY_INLINE V vector(V a, V b) { return Mul(a, b); }
+	template <typename T>
+	static HWY_INLINE T scalar(T a, T b) { return a * b; }
+};
+
+struct AndOp {
+	template <class V>
+	static HWY_INLINE V vector(V a, V b) { return And(a, b); }
+	template <typename T>
+	static HWY_INLINE T scalar(T a, T b) { return a & b; }
+};
+
+struct OrOp {
+	template <class V>
+	static HWY_INLINE V vector(V a, V b) { return Or(a, b); }
+	template <typename T>
+	static HWY_INLINE T scalar(T a, T b) { return a | b; }
+};
+
+struct EorOp {
+	template <class V>
+	static HWY_INLINE V vector(V a, V b) { return Xor(a, b); }
+	template <typename T>
+	static HWY_INLINE T scalar(T a, T b) { return a ^ b; }
+};
+
+struct EqualOp {
+	template <class V>
+	static HWY_INLINE auto vector(V a, V b) -> decltype(Eq(a, b))
+	{
+		return Eq(a, b);
+	}
+	template <typename T>
+	static HWY_INLINE bool scalar(T a, T b) { return a == b; }
+};
+
+struct NoteqOp {
+	template <class V>
+	static HWY_INLINE auto vector(V a, V b) -> decltype(Ne(a, b))
+	{
+		return Ne(a, b);
+	}
+	template <typename T>
+	static HWY_INLINE bool scalar(T a, T b) { return a != b; }
+};
+
+struct LessOp {
+	template <class V>
+	static HWY_INLINE auto vector(V a, V b) -> decltype(Lt(a, b))
+	{
+		return Lt(a, b);
+	}
+	template <typename T>
+	static HWY_INLINE bool scalar(T a, T b) { return a < b; }
+};
+
+struct LesseqOp {
+	template <class V>
+	static HWY_INLINE auto vector(V a, V b) -> decltype(Le(a, b))
+	{
+		return Le(a, b);
+	}
+	template <typename T>
+	static HWY_INLINE bool scalar(T a, T b) { return a <= b; }
+};
+
+/* Two inputs of type T, output in the lane type of d.
+ */
+template <class Op, class D, typename T>
+HWY_INLINE void
+binary_line(D d, VipsPel *out, VipsPel **in, int32_t sz)
+{
+	using TO = TFromD<D>;
+
+	const T *HWY_RESTRICT left = (T *) in[0];
+	const T *HWY_RESTRICT right = (T *) in[1];
+	TO *HWY_RESTRICT q = (TO *) out;
+	const int32_t N = Lanes(d);
+
+	int32_t x = 0;
+	for (; x + 2 * N <= sz; x += 2 * N) {
+		const auto l0 = load_widen(d, left + x);
+		const auto r0 = load_widen(d, right + x);
+		const auto l1 = load_widen(d, left + x + N);
+		const auto r1 = load_widen(d, right + x + N);
+
+		StoreU(Op::vector(l0, r0), d, q + x);
+		StoreU(Op::vector(l1, r1), d, q + x + N);
+	}
+	for (; x + N <= sz; x += N)
+		StoreU(Op::vector(load_widen(d, left + x),
+				   load_widen(d, right + x)),
+			d, q + x);
+
+	for (; x < sz; ++x)
+		q[x] = Op::scalar((TO) left[x], (TO) right[x]);
+}
+
+template <typename T>
+HWY_INLINE void
+divide_line(VipsPel *out, VipsPel **in, int32_t sz)
+{
+	const T *HWY_RESTRICT left = (T *) in[0];
+	const T *HWY_RESTRICT right = (T *) in[1];
+	float *HWY_RESTRICT q = (float *) out;
+	const int32_t N = Lanes(df32);
+	const auto zero = Zero(df32);
+
+	int32_t x = 0;
+	for (; x + N <= sz; x += N) {
+		const auto l = load_float(left + x);
+		const auto r = load_float(right + x);
+
+		/* The lanes we zero can divide by zero, but we never trap on
+		 * fp exceptions.
+		 */
+		StoreU(IfThenZeroElse(Eq(r, zero), Div(l, r)), df32, q + x);
+	}
+
+	for (; x < sz; ++x)
+		q[x] = right[x] == 0 ? 0 : (float) left[x] / (float) right[x];
+}
+
+template <class Op, class D>
+HWY_INLINE void
+relational_line(D d, VipsPel *out, VipsPel *in0, VipsPel *in1, int32_t sz)
+{
+	using T = TFromD<D>;
+
+	const T *HWY_RESTRICT left = (T *) in0;
+	const T *HWY_RESTRICT right = (T *) in1;
+	uint8_t *HWY_RESTRICT q = (uint8_t *) out;
+	const int32_t N = Lanes(d);
+
+	int32_t x = 0;
+	for (; x + N <= sz; x += N)
+		store_mask(d, Op::vector(LoadU(d, left + x), LoadU(d, right + x)),
+			q + x);
+
+	for (; x < sz; ++x)
+		q[x] = Op::scalar(left[x], right[x]) ? 255 : 0;
+}
+
+/* n inputs of type T, output in the lane type of d. Sum in the same order
+ * as the C path, so float results match too.
+ */
+template <class D, typename T>
+HWY_INLINE void
+sum_line(D d, VipsPel *out, VipsPel **in, int32_t n, int32_t sz)
+{
+	using TO = TFromD<D>;
+
+	const T **HWY_RESTRICT p = (const T **) in;
+	TO *HWY_RESTRICT q = (TO *) out;
+	const int32_t N = Lanes(d);
+
+	int32_t x = 0;
+	for (; x + N <= sz; x += N) {
+		auto sum = load_widen(d, p[0] + x);
+
+		for (int32_t i = 1; i < n; ++i)
+			sum = Add(sum, load_widen(d, p[i] + x));
+
+		StoreU(sum, d, q + x);
+	}
+
+	for (; x < sz; ++x) {
+		TO sum = p[0][x];
+
+		for (int32_t i = 1; i < n; ++i)
+			sum += p[i][x];
+
+		q[x] = sum;
+	}
+}
+
+/* a * in + b, float output. Add(Mul()) rather than MulAdd(), so we round
+ * just like the C path.
+ */
+template <typename T>
+HWY_INLINE void
+linear_line(VipsPel *out, VipsPel *in, float a, float b, int32_t sz)
+{
+	const T *HWY_RESTRICT p = (T *) in;
+	float *HWY_RESTRICT q = (float *) out;
+	const int32_t N = Lanes(df32);
+	const auto va = Set(df32, a);
+	const auto vb = Set(df32, b);
+
+	int32_t x = 0;
+	for (; x + N <= sz; x += N)
+		StoreU(Add(Mul(va, load_float(p + x)), vb), df32, q + x);
+
+	for (; x < sz; ++x)
+		q[x] = a * (float) p[x] + b;
+}
+
+/* a * in + b, clipped and truncated to uchar. VIPS_FCLIP() sends NaN to
+ * 255, so we do too.
+ */
+template <typename T>
+HWY_INLINE void
+linear_uchar_line(VipsPel *out, VipsPel *in, float a, float b, int32_t sz)
+{
+	const T *HWY_RESTRICT p = (T *) in;
+	uint8_t *HWY_RESTRICT q = (uint8_t *) out;
+	const int32_t N = Lanes(df32);
+	const auto va = Set(df32, a);
+	const auto vb = Set(df32, b);
+	const auto zero = Zero(df32);
+	const auto max = Set(df32, 255.0f);
+
+	int32_t x = 0;
+	for (; x + N <= sz; x += N) {
+		auto t = Add(Mul(va, load_float(p + x)), vb);
+
+		t = IfThenElse(IsNaN(t), max, Max(Min(t, max), zero));
+		StoreU(DemoteTo(du8x32, ConvertTo(di32, t)), du8x32, q + x);
+	}
+
+	for (; x < sz; ++x) {
+		float t = a * p[x] + b;
+
+		q[x] = VIPS_FCLIP(0, t, 255);
+	}
+}
+
+HWY_ATTR int
+vips_add_hwy(VipsBandFormat format, VipsPel *out, VipsPel **in, int32_t sz)
+{
+	switch (format) {
+	case VIPS_FORMAT_UCHAR:
+		binary_line<AddOp, DU16, uint8_t>(du16, out, in, sz);
+		return TRUE;
+
+	case VIPS_FORMAT_CHAR:
+		binary_line<AddOp, DI16, int8_t>(di16, out, in, sz);
+		return TRUE;
+
+	case VIPS_FORMAT_USHORT:
+		binary_line<AddOp, DU32, uint16_t>(du32, out, in, sz);
+		return TRUE;
+
+	case VIPS_FORMAT_SHORT:
+		binary_line<AddOp, DI32, int16_t>(di32, out, in, sz);
+		return TRUE;
+
+	case VIPS_FORMAT_FLOAT:
+	case VIPS_FORMAT_COMPLEX:
+		binary_line<AddOp, DF32, float>(df32, out, in, sz);
+		return TRUE;
+
+	default:
+		return FALSE;
+	}
+}
+
+HWY_ATTR int
+vips_subtract_hwy(VipsBandFormat format,
+	VipsPel *out, VipsPel **in, int32_t sz)
+{
+	switch (format) {
+	case VIPS_FORMAT_UCHAR:
+		binary_line<SubtractOp, DI16, uint8_t>(di16, out, in, sz);
+		return TRUE;
+
+	case VIPS_FORMAT_CHAR:
+		binary_line<SubtractOp, DI16, int8_t>(di16, out, in, sz);
+		return TRUE;
+
+	case VIPS_FORMAT_USHORT:
+		binary_line<SubtractOp, DI32, uint16_t>(di32, out, in, sz);
+		return TRUE;
+
+	case VIPS_FORMAT_SHORT:
+		binary_line<SubtractOp, DI32, int16_t>(di32, out, in, sz);
+		return TRUE;
+
+	case VIPS_FORMAT_FLOAT:
+	case VIPS_FORMAT_COMPLEX:
+		binary_line<SubtractOp, DF32, float>(df32, out, in, sz);
+		return TRUE;
+
+	default:
+		return FALSE;
+	}
+}
+
+/* Complex multiply is not elementwise, so that stays in C.
+ */
+HWY_ATTR int
+vips_multiply_hwy(VipsBandFormat format,
+	VipsPel *out, VipsPel **in, int32_t sz)
+{
+	switch (format) {
+	case VIPS_FORMAT_UCHAR:
+		binary_line<MultiplyOp, DU16, uint8_t>(du16, out, in, sz);
+		return TRUE;
+
+	case VIPS_FORMAT_CHAR:
+		binary_line<MultiplyOp, DI16, int8_t>(di16, out, in, sz);
+		return TRUE;
+
+	case VIPS_FORMAT_USHORT:
+		binary_line<MultiplyOp, DU32, uint16_t>(du32, out, in, sz);
+		return TRUE;
+
+	case VIPS_FORMAT_SHORT:
+		binary_line<MultiplyOp, DI32, int16_t>(di32, out, in, sz);
+		return TRUE;
+
+	case VIPS_FORMAT_FLOAT:
+		binary_line<MultiplyOp, DF32, float>(df32, out, in, sz);
+		return TRUE;
+
+	default:
+		return FALSE;
+	}
+}
+
+HWY_ATTR int
+vips_divide_hwy(VipsBandFormat format,
+	VipsPel *out, VipsPel **in, int32_t sz)
+{
+	switch (format) {
+	case VIPS_FORMAT_UCHAR:
+		divide_line<uint8_t>(out, in, sz);
+		return TRUE;
+
+	case VIPS_FORMAT_CHAR:
+		divide_line<int8_t>(out, in, sz);
+		return TRUE;
+
+	case VIPS_FORMAT_USHORT:
+		divide_line<uint16_t>(out, in, sz);
+		return TRUE;
+
+	case VIPS_FORMAT_SHORT:
+		divide_line<int16_t>(out, in, sz);
+		return TRUE;
+
+	case VIPS_FORMAT_FLOAT:
+		divide_line<float>(out, in, sz);
+		return TRUE;
+
+	default:
+		return FALSE;
+	}
+}
+
+/* Bitwise ops don't care about sign, so we only need one type per size.
+ * Float goes via int in the C path, so that stays there.
+ */
+template <class Op>
+HWY_INLINE int
+boolean_hwy(VipsBandFormat format, VipsPel *out, VipsPel **in, int32_t sz)
+{
+	switch (format) {
+	case VIPS_FORMAT_UCHAR:
+	case VIPS_FORMAT_CHAR:
+		binary_line<Op, DU8, uint8_t>(du8, out, in, sz);
+		return TRUE;
+
+	case VIPS_FORMAT_USHORT:
+	case VIPS_FORMAT_SHORT:
+		binary_line<Op, DU16, uint16_t>(du16, out, in, sz);
+		return TRUE;
+
+	case VIPS_FORMAT_UINT:
+	case VIPS_FORMAT_INT:
+		binary_line<Op, DU32, uint32_t>(du32, out, in, sz);
+		return TRUE;
+
+	default:
+		return FALSE;
+	}
+}
+
+HWY_ATTR int
+vips_boolean_hwy(VipsOperationBoolean op, VipsBandFormat format,
+	VipsPel *out, VipsPel **in, int32_t sz)
+{
+	switch (op) {
+	case VIPS_OPERATION_BOOLEAN_AND:
+		return boolean_hwy<AndOp>(format, out, in, sz);
+
+	case VIPS_OPERATION_BOOLEAN_OR:
+		return boolean_hwy<OrOp>(format, out, in, sz);
+
+	case VIPS_OPERATION_BOOLEAN_EOR:
+		return boolean_hwy<EorOp>(format, out, in, sz);
+
+	default:
+		return FALSE;
+	}
+}
+
+template <class Op>
+HWY_INLINE int
+relational_hwy(VipsBandFormat format,
+	VipsPel *out, VipsPel *in0, VipsPel *in1, int32_t sz)
+{
+	switch (format) {
+	case VIPS_FORMAT_UCHAR:
+		relational_line<Op>(du8, out, in0, in1, sz);
+		return TRUE;
+
+	case VIPS_FORMAT_CHAR:
+		relational_line<Op>(di8, out, in0, in1, sz);
+		return TRUE;
+
+	case VIPS_FORMAT_USHORT:
+		relational_line<Op>(du16, out, in0, in1, sz);
+		return TRUE;
+
+	case VIPS_FORMAT_SHORT:
+		relational_line<Op>(di16, out, in0, in1, sz);
+		return TRUE;
+
+	case VIPS_FORMAT_FLOAT:
+		relational_line<Op>(df32, out, in0, in1, sz);
+		return TRUE;
+
+	default:
+		return FALSE;
+	}
+}
+
+/* MORE and MOREEQ have already been swapped to LESS and LESSEQ.
+ */
+HWY_ATTR int
+vips_relational_hwy(VipsOperationRelational op, VipsBandFormat format,
+	VipsPel *out, VipsPel *in0, VipsPel *in1, int32_t sz)
+{
+	switch (op) {
+	case VIPS_OPERATION_RELATIONAL_EQUAL:
+		return relational_hwy<EqualOp>(format, out, in0, in1, sz);
+
+	case VIPS_OPERATION_RELATIONAL_NOTEQ:
+		return relational_hwy<NoteqOp>(format, out, in0, in1, sz);
+
+	case VIPS_OPERATION_RELATIONAL_LESS:
+		return relational_hwy<LessOp>(format, out, in0, in1, sz);
+
+	case VIPS_OPERATION_RELATIONAL_LESSEQ:
+		return relational_hwy<LesseqOp>(format, out, in0, in1, sz);
+
+	default:
+		return FALSE;
+	}
+}
+
+HWY_ATTR int
+vips_sum_hwy(VipsBandFormat format,
+	VipsPel *out, VipsPel **in, int32_t n, int32_t sz)
+{
+	switch (format) {
+	case VIPS_FORMAT_UCHAR:
+		sum_line<DU32, uint8_t>(du32, out, in, n, sz);
+		return TRUE;
+
+	case VIPS_FORMAT_CHAR:
+		sum_line<DI32, int8_t>(di32, out, in, n, sz);
+		return TRUE;
+
+	case VIPS_FORMAT_USHORT:
+		sum_line<DU32, uint16_t>(du32, out, in, n, sz);
+		return TRUE;
+
+	case VIPS_FORMAT_SHORT:
+		sum_line<DI32, int16_t>(di32, out, in, n, sz);
+		return TRUE;
+
+	case VIPS_FORMAT_FLOAT:
+	case VIPS_FORMAT_COMPLEX:
+		sum_line<DF32, float>(df32, out, in, n, sz);
+		return TRUE;
+
+	default:
+		return FALSE;
+	}
+}
+
+HWY_ATTR int
+vips_linear_hwy(VipsBandFormat format, int uchar,
+	VipsPel *out, VipsPel *in, float a, float b, int32_t sz)
+{
+	switch (format) {
+	case VIPS_FORMAT_UCHAR:
+		if (uchar)
+			linear_uchar_line<uint8_t>(out, in, a, b, sz);
+		else
+			linear_line<uint8_t>(out, in, a, b, sz);
+		return TRUE;
+
+	case VIPS_FORMAT_CHAR:
+		if (uchar)
+			linear_uchar_line<int8_t>(out, in, a, b, sz);
+		else
+			linear_line<int8_t>(out, in, a, b, sz);
+		return TRUE;
+
+	case VIPS_FORMAT_USHORT:
+		if (uchar)
+			linear_uchar_line<uint16_t>(out, in, a, b, sz);
+		else
+			linear_line<uint16_t>(out, in, a, b, sz);
+		return TRUE;
+
+	case VIPS_FORMAT_SHORT:
+		if (uchar)
+			linear_uchar_line<int16_t>(out, in, a, b, sz);
+		else
+			linear_line<int16_t>(out, in, a, b, sz);
+		return TRUE;
+
+	case VIPS_FORMAT_FLOAT:
+		if (uchar)
+			linear_uchar_line<float>(out, in, a, b, sz);
+		else
+			linear_line<float>(out, in, a, b, sz);
+		return TRUE;
+
+	default:
+		return FALSE;
+	}
+}
+
+} /*namespace HWY_NAMESPACE*/
+
+#if HWY_ONCE
+HWY_EXPORT(vips_add_hwy);
+HWY_EXPORT(vips_subtract_hwy);
+HWY_EXPORT(vips_multiply_hwy);
+HWY_EXPORT(vips_divide_hwy);
+HWY_EXPORT(vips_boolean_hwy);
+HWY_EXPORT(vips_relational_hwy);
+HWY_EXPORT(vips_sum_hwy);
+HWY_EXPORT(vips_linear_hwy);
+
+/* Each of these returns FALSE if there's no vector path for this format, and
+ * the caller should run the C path instead.
+ */
+
+gboolean
+vips_add_hwy(VipsBandFormat format, VipsPel *out, VipsPel **in, int sz)
+{
+	/* clang-format off */
+	return HWY_DYNAMIC_DISPATCH(vips_add_hwy)(format, out, in, sz);
+	/* clang-format on */
+}
+
+gboolean
+vips_subtract_hwy(VipsBandFormat format, VipsPel *out, VipsPel **in, int sz)
+{
+	/* clang-format off */
+	return HWY_DYNAMIC_DISPATCH(vips_subtract_hwy)(format, out, in, sz);
+	/* clang-format on */
+}
+
+gboolean
+vips_multiply_hwy(VipsBandFormat format, VipsPel *out, VipsPel **in, int sz)
+{
+	/* clang-format off */
+	return HWY_DYNAMIC_DISPATCH(vips_multiply_hwy)(format, out, in, sz);
+	/* clang-format on */
+}
+
+gboolean
+vips_divide_hwy(VipsBandFormat format, VipsPel *out, VipsPel **in, int sz)
+{
+	/* clang-format off */
+	return HWY_DYNAMIC_DISPATCH(vips_divide_hwy)(format, out, in, sz);
+	/* clang-format on */
+}
+
+gboolean
+vips_boolean_hwy(VipsOperationBoolean op, VipsBandFormat format,
+	VipsPel *out, VipsPel **in, int sz)
+{
+	/* clang-format off */
+	return HWY_DYNAMIC_DISPATCH(vips_boolean_hwy)(op, format,
+		out, in, sz);
+	/* clang-format on */
+}
+
+gboolean
+vips_relational_hwy(VipsOperationRelational op, VipsBandFormat format,
+	VipsPel *out, VipsPel *in0, VipsPel *in1, int sz)
+{
+	/* clang-format off */
+	return HWY_DYNAMIC_DISPATCH(vips_relational_hwy)(op, format,
+		out, in0, in1, sz);
+	/* clang-format on */
+}
+
+gboolean
+vips_sum_hwy(VipsBandFormat format, VipsPel *out, VipsPel **in, int n, int sz)
+{
+	/* clang-format off */
+	return HWY_DYNAMIC_DISPATCH(vips_sum_hwy)(format, out, in, n, sz);
+	/* clang-format on */
+}
+
+gboolean
+vips_linear_hwy(VipsBandFormat format, gboolean uchar,
+	VipsPel *out, VipsPel *in, float a, float b, int sz)
+{
+	/* clang-format off */
+	return HWY_DYNAMIC_DISPATCH(vips_linear_hwy)(format, uchar,
+		out, in, a, b, sz);
+	/* clang-format on */
+}
+#endif /*HWY_ONCE*/
+
+#endif /*HAVE_HWY*/
@@ -31,6 +31,8 @@
  * 	  types
  * 12/11/11
  * 	- redo as a class
+ * 16/10/26
+ * 	- add Highway path for the common formats
  */
 
 /*
@@ -74,6 +76,7 @@
 
 #include <vips/vips.h>
 #include <vips/internal.h>
+#include <vips/vector.h>
 
 #include "binary.h"
 #include "unaryconst.h"
@@ -179,6 +182,13 @@ vips_boolean_buffer(VipsArithmetic *arithmetic,
 
 	int x;
 
+#ifdef HAVE_HWY
+	if (vips_vector_isenabled() &&
+		vips_boolean_hwy(boolean->operation,
+			vips_image_get_format(im), out, in, sz))
+		return;
+#endif /*HAVE_HWY*/
+
 	switch (boolean->operation) {
 	case VIPS_OPERATION_BOOLEAN_AND:
 		SWITCH(LOOP, FLOOP, &);
@@ -33,6 +33,8 @@
  * 6/4/12
  * 	- fixed switch cases
  *	- fixed int operands with <1 result
+ * 16/10/26
+ * 	- add Highway path for the common formats
  */
 
 /*
@@ -76,6 +78,7 @@
 #include <math.h>
 
 #include <vips/vips.h>
+#include <vips/vector.h>
 
 #include "binary.h"
 
@@ -177,6 +180,12 @@ vips_divide_buffer(VipsArithmetic *arithmetic,
 
 	int x;
 
+#ifdef HAVE_HWY
+	if (vips_vector_isenabled() &&
+		vips_divide_hwy(vips_image_get_format(im), out, in, sz))
+		return;
+#endif /*HAVE_HWY*/
+
 	/* Keep types here in sync with vips_divide_format_table[]
 	 * below.
 	 */
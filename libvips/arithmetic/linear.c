@@ -45,6 +45,9 @@
  * 30/9/17
  * 	- squash constants with all elements equal so we use 1ary path more
  * 	  often
+ * 16/10/26
+ * 	- a linear of a linear is a single linear
+ * 	- add Highway path for the common formats
  */
 
 /*
@@ -88,6 +91,7 @@
 #include <math.h>
 
 #include <vips/vips.h>
+#include <vips/vector.h>
 
 #include "unary.h"
 
@@ -109,6 +113,10 @@ typedef struct _VipsLinear {
 	double *a_ready;
 	double *b_ready;
 
+	/* All elements of a_ready are equal, and all of b_ready.
+	 */
+	gboolean scalar;
+
 } VipsLinear;
 
 typedef VipsUnaryClass VipsLinearClass;
@@ -123,6 +131,7 @@ vips_linear_build(VipsObject *object)
 	VipsUnary *unary = (VipsUnary *) object;
 	VipsLinear *linear = (VipsLinear *) object;
 
+	VipsArithmetic *upstream;
 	int i;
 
 	/* If we have a three-element vector, we need to bandup the image to
@@ -204,6 +213,39 @@ vips_linear_build(VipsObject *object)
 		}
 	}
 
+	/* A linear of a float linear can be done in one pass from the first
+	 * linear's input: a * (c * x + d) + b == a * c * x + (a * d + b).
+	 */
+	if (vips__simplify_enabled &&
+		unary->in &&
+		(upstream = vips__arithmetic_producer(unary->in)) &&
+		G_TYPE_CHECK_INSTANCE_TYPE(upstream, vips_linear_get_type()) &&
+		(unary->in->BandFmt == VIPS_FORMAT_FLOAT ||
+			unary->in->BandFmt == VIPS_FORMAT_DOUBLE)) {
+		VipsLinear *c = (VipsLinear *) upstream;
+
+		for (i = 0; i < linear->n; i++) {
+			int j = VIPS_MIN(i, c->n - 1);
+
+			linear->b_ready[i] += linear->a_ready[i] * c->b_ready[j];
+			linear->a_ready[i] *= c->a_ready[j];
+		}
+
+		arithmetic->n = 1;
+		arithmetic->in = (VipsImage **)
+			vips_object_local_array(object, 1);
+		arithmetic->in[0] = upstream->in[0];
+		g_object_ref(arithmetic->in[0]);
+	}
+
+	linear->scalar = TRUE;
+	for (i = 1; i < linear->n; i++)
+		if (linear->a_ready[i] != linear->a_ready[0] ||
+			linear->b_ready[i] != linear->b_ready[0]) {
+			linear->scalar = FALSE;
+			break;
+		}
+
 	if (linear->uchar)
 		arithmetic->format = VIPS_FORMAT_UCHAR;
 
@@ -241,7 +283,7 @@ vips_linear_build(VipsObject *object)
 
 #define LOOP(IN, OUT) \
 	{ \
-		if (linear->a->n == 1 && linear->b->n == 1) { \
+		if (linear->scalar) { \
 			LOOP1(IN, OUT); \
 		} \
 		else { \
@@ -300,7 +342,7 @@ vips_linear_build(VipsObject *object)
 
 #define LOOPuc(IN) \
 	{ \
-		if (linear->a->n == 1 && linear->b->n == 1) { \
+		if (linear->scalar) { \
 			LOOP1uc(IN); \
 		} \
 		else { \
@@ -338,6 +380,14 @@ vips_linear_buffer(VipsArithmetic *arithmetic,
 
 	int i, x, k;
 
+#ifdef HAVE_HWY
+	if (linear->scalar &&
+		vips_vector_isenabled() &&
+		vips_linear_hwy(vips_image_get_format(im), linear->uchar,
+			out, in[0], a[0], b[0], width * nb))
+		return;
+#endif /*HAVE_HWY*/
+
 	if (linear->uchar)
 		switch (vips_image_get_format(im)) {
 		case VIPS_FORMAT_UCHAR:
@@ -27,6 +27,8 @@
  * 	- remove liboil
  * 7/11/11
  * 	- redo as a class
+ * 16/10/26
+ * 	- add Highway path for the common formats
  */
 
 /*
@@ -70,6 +72,7 @@
 #include <math.h>
 
 #include <vips/vips.h>
+#include <vips/vector.h>
 
 #include "binary.h"
 
@@ -123,6 +126,12 @@ vips_multiply_buffer(VipsArithmetic *arithmetic,
 
 	int x;
 
+#ifdef HAVE_HWY
+	if (vips_vector_isenabled() &&
+		vips_multiply_hwy(vips_image_get_format(im), out, in, sz))
+		return;
+#endif /*HAVE_HWY*/
+
 	/* Keep types here in sync with vips_bandfmt_multiply[]
 	 * below.
 	 */
@@ -80,6 +80,11 @@ typedef struct _VipsArithmetic {
 	/* Set this to override class->format_table.
 	 */
 	VipsBandFormat format;
+
+	/* If we run some upstream arithmetic operations inline, the plan
+	 * for that. See vips_arithmetic_fuse().
+	 */
+	struct _VipsArithmeticFuse *fuse;
 } VipsArithmetic;
 
 typedef struct _VipsArithmeticClass {
@@ -100,6 +105,25 @@ GType vips_arithmetic_get_type(void);
 void vips_arithmetic_set_format_table(VipsArithmeticClass *klass,
 	const VipsBandFormat *format_table);
 
+VipsArithmetic *vips__arithmetic_producer(VipsImage *image);
+
+gboolean vips_add_hwy(VipsBandFormat format,
+	VipsPel *out, VipsPel **in, int sz);
+gboolean vips_subtract_hwy(VipsBandFormat format,
+	VipsPel *out, VipsPel **in, int sz);
+gboolean vips_multiply_hwy(VipsBandFormat format,
+	VipsPel *out, VipsPel **in, int sz);
+gboolean vips_divide_hwy(VipsBandFormat format,
+	VipsPel *out, VipsPel **in, int sz);
+gboolean vips_boolean_hwy(VipsOperationBoolean op, VipsBandFormat format,
+	VipsPel *out, VipsPel **in, int sz);
+gboolean vips_relational_hwy(VipsOperationRelational op,
+	VipsBandFormat format, VipsPel *out, VipsPel *in0, VipsPel *in1, int sz);
+gboolean vips_sum_hwy(VipsBandFormat format,
+	VipsPel *out, VipsPel **in, int n, int sz);
+gboolean vips_linear_hwy(VipsBandFormat format, gboolean uchar,
+	VipsPel *out, VipsPel *in, float a, float b, int sz);
+
 #ifdef __cplusplus
 }
 #endif /*__cplusplus*/
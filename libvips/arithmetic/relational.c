@@ -32,6 +32,8 @@
  * 	- im1 > im2, im1 >= im2 were broken
  * 17/9/14
  * 	- im1 > im2, im1 >= im2 were still broken, but in a more subtle way
+ * 16/10/26
+ * 	- add Highway path for the common formats
  */
 
 /*
@@ -74,6 +76,7 @@
 #include <stdlib.h>
 
 #include <vips/vips.h>
+#include <vips/vector.h>
 
 #include "binary.h"
 #include "unaryconst.h"
@@ -184,6 +187,13 @@ vips_relational_buffer(VipsArithmetic *arithmetic,
 		VIPS_SWAP(VipsPel *, in0, in1);
 	}
 
+#ifdef HAVE_HWY
+	if (vips_vector_isenabled() &&
+		vips_relational_hwy(op, vips_image_get_format(im),
+			out, in0, in1, sz))
+		return;
+#endif /*HAVE_HWY*/
+
 	switch (op) {
 	case VIPS_OPERATION_RELATIONAL_EQUAL:
 		SWITCH(RLOOP, CLOOP, ==, CEQUAL);
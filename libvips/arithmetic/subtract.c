@@ -31,6 +31,8 @@
  * 	- remove liboil
  * 23/8/11
  * 	- rewrite as a class from add.c
+ * 16/10/26
+ * 	- add Highway path for the common formats
  */
 
 /*
@@ -74,6 +76,7 @@
 #include <math.h>
 
 #include <vips/vips.h>
+#include <vips/vector.h>
 
 #include "binary.h"
 
@@ -105,6 +108,12 @@ vips_subtract_buffer(VipsArithmetic *arithmetic,
 
 	int x;
 
+#ifdef HAVE_HWY
+	if (vips_vector_isenabled() &&
+		vips_subtract_hwy(vips_image_get_format(im), out, in, sz))
+		return;
+#endif /*HAVE_HWY*/
+
 	/* Keep types here in sync with bandfmt_subtract[]
 	 * below.
 	 */
@@ -2,6 +2,8 @@
  *
  * 18/3/14
  * 	- from add.c
+ * 16/10/26
+ * 	- add Highway path for the common formats
  */
 
 /*
@@ -45,6 +47,7 @@
 #include <math.h>
 
 #include <vips/vips.h>
+#include <vips/vector.h>
 
 #include "nary.h"
 
@@ -82,6 +85,12 @@ sum_buffer(VipsArithmetic *arithmetic, VipsPel *out, VipsPel **in, int width)
 	int x;
 	int i;
 
+#ifdef HAVE_HWY
+	if (vips_vector_isenabled() &&
+		vips_sum_hwy(vips_image_get_format(im), out, in, n, sz))
+		return;
+#endif /*HAVE_HWY*/
+
 	/* Sum all input types. Keep types here in sync with
 	 * vips_sum_format_table[] below.
 	 */
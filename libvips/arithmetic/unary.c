@@ -56,11 +56,17 @@ vips_unary_build(VipsObject *object)
 	VipsArithmetic *arithmetic = VIPS_ARITHMETIC(object);
 	VipsUnary *unary = VIPS_UNARY(object);
 
-	arithmetic->n = 1;
-	arithmetic->in = (VipsImage **) vips_object_local_array(object, 1);
-	arithmetic->in[0] = unary->in;
-	if (arithmetic->in[0])
-		g_object_ref(arithmetic->in[0]);
+	/* Subclasses can set a different image to process, see
+	 * vips_linear_build().
+	 */
+	if (!arithmetic->in) {
+		arithmetic->n = 1;
+		arithmetic->in = (VipsImage **)
+			vips_object_local_array(object, 1);
+		arithmetic->in[0] = unary->in;
+		if (arithmetic->in[0])
+			g_object_ref(arithmetic->in[0]);
+	}
 
 	if (VIPS_OBJECT_CLASS(vips_unary_parent_class)->build(object))
 		return -1;
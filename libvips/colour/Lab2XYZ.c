@@ -15,6 +15,8 @@
  * 	- cleanups
  * 18/9/12
  * 	- redone as a class
+ * 16/10/26
+ * 	- add Highway path
  */
 
 /*
@@ -57,6 +59,7 @@
 #include <math.h>
 
 #include <vips/vips.h>
+#include <vips/vector.h>
 #include <vips/debug.h>
 
 #include "pcolour.h"
@@ -122,6 +125,14 @@ vips_Lab2XYZ_line(VipsColour *colour, VipsPel *out, VipsPel **in, int width)
 	VIPS_DEBUG_MSG("vips_Lab2XYZ_line: X0 = %g, Y0 = %g, Z0 = %g\n",
 		Lab2XYZ->X0, Lab2XYZ->Y0, Lab2XYZ->Z0);
 
+#ifdef HAVE_HWY
+	if (vips_vector_isenabled()) {
+		vips_Lab2XYZ_hwy(q, p, width,
+			Lab2XYZ->X0, Lab2XYZ->Y0, Lab2XYZ->Z0);
+		return;
+	}
+#endif /*HAVE_HWY*/
+
 	for (x = 0; x < width; x++) {
 		float L, a, b;
 		float X, Y, Z;
@@ -19,6 +19,8 @@
  * 	- fix a race in the table build
  * 19/9/12
  * 	- redone as a class
+ * 16/10/26
+ * 	- add Highway path
  */
 
 /*
@@ -57,6 +59,7 @@
 #include <math.h>
 
 #include <vips/vips.h>
+#include <vips/vector.h>
 #include <vips/internal.h>
 
 #include "pcolour.h"
@@ -153,6 +156,14 @@ vips_XYZ2Lab_line(VipsColour *colour, VipsPel *out, VipsPel **in, int width)
 
 	int x;
 
+#ifdef HAVE_HWY
+	if (vips_vector_isenabled()) {
+		vips_XYZ2Lab_hwy(q, p, width,
+			XYZ2Lab->X0, XYZ2Lab->Y0, XYZ2Lab->Z0);
+		return;
+	}
+#endif /*HAVE_HWY*/
+
 	VIPS_ONCE(&table_init_once, table_init, NULL);
 
 	for (x = 0; x < width; x++) {
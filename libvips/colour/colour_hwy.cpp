@@ -0,0 +1,461 @@
+/* Highway paths for the common colour transforms
+ *
+ * 16/10/26
+ * 	- initial implementation
+ * 	- scRGB2sRGB falls back to C on targets without double vectors
+ */
+
+/*
+
+	This file is part of VIPS.
+
+	VIPS is free software; you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+	02110-1301  USA
+
+ */
+
+/*
+
+	These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/* Accuracy, against the C paths:
+ *
+ * - cube roots are a seed from the float bits followed by two Halley
+ *   steps. The seed is within 3.2%, the first step takes that to about
+ *   3e-5 and the second to float precision, so the result is within a few
+ *   ulp of cbrt()
+ * - XYZ2Lab is within 1e-3 in L, a and b. The C path interpolates a
+ *   100,000 element table, and extrapolates that table above the white
+ *   point, so the vector path is the more accurate of the two for very
+ *   bright pixels
+ * - Lab2XYZ and scRGB2XYZ compute in float rather than double, so they are
+ *   within 1e-5 relative, or 1e-5 absolute for values below one
+ * - scRGB2sRGB interpolates the same tables as the C path, with the same
+ *   float arithmetic, so 8- and 16-bit results are identical
+ * - alpha is scaled exactly as in the C paths
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <glib/gi18n-lib.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <vips/vips.h>
+#include <vips/vector.h>
+#include <vips/debug.h>
+#include <vips/internal.h>
+
+#include "pcolour.h"
+
+#ifdef HAVE_HWY
+
+#undef HWY_TARGET_INCLUDE
+#define HWY_TARGET_INCLUDE "libvips/colour/colour_hwy.cpp"
+#include <hwy/foreach_target.h>
+#include <hwy/highway.h>
+
+namespace HWY_NAMESPACE {
+
+using namespace hwy::HWY_NAMESPACE;
+
+using DI32 = ScalableTag<int32_t>;
+using DF32 = ScalableTag<float>;
+using VF = Vec<DF32>;
+constexpr DI32 di32;
+constexpr DF32 df32;
+
+/* scRGB2sRGB needs some double arithmetic, so it runs at the width of a
+ * vector of doubles. Targets without double vectors use the C path.
+ */
+#if HWY_HAVE_FLOAT64
+using DF64 = ScalableTag<double>;
+using DF32D = Rebind<float, DF64>;
+using DI32D = Rebind<int32_t, DF64>;
+using VF32D = Vec<DF32D>;
+constexpr DF64 df64;
+constexpr DF32D df32d;
+constexpr DI32D di32d;
+#endif /*HWY_HAVE_FLOAT64*/
+
+/* The most bands we process in one pixel: three, plus alpha.
+ */
+#define MAX_BANDS (4)
+
+/* Run a kernel over a line of pixels, one vector of pixels at a time. The
+ * final partial vector goes through a zero-padded buffer, so every pixel
+ * sees the same arithmetic.
+ */
+template <class D, typename TO, typename K>
+HWY_INLINE void
+colour_line(D d, TO *HWY_RESTRICT q, const float *HWY_RESTRICT p,
+	int32_t bands, int32_t width, const K &kernel)
+{
+	const int32_t N = Lanes(d);
+
+	int32_t x = 0;
+	for (; x + N <= width; x += N)
+		kernel(q + x * bands, p + x * bands);
+
+	if (x < width) {
+		HWY_ALIGN float pbuf[MAX_BANDS * MaxLanes(d)] = { 0 };
+		HWY_ALIGN TO qbuf[MAX_BANDS * MaxLanes(d)];
+		const int32_t n = (width - x) * bands;
+
+		memcpy(pbuf, p + x * bands, n * sizeof(float));
+		kernel(qbuf, pbuf);
+		memcpy(q + x * bands, qbuf, n * sizeof(TO));
+	}
+}
+
+/* Cube root of positive t.
+ *
+ * Dividing the float bits by three and correcting the exponent bias gives a
+ * seed within 3.2% (see Hacker's Delight), and Halley's method triples the
+ * number of correct bits on each step. We divide in float since there's no
+ * vector integer divide: that loses a few low bits of the seed, which the
+ * refinement doesn't notice.
+ */
+HWY_INLINE VF
+cbrt_positive(VF t)
+{
+	const VF bits = ConvertTo(df32, BitCast(di32, t));
+	const auto third = ConvertTo(di32, Mul(bits, Set(df32, 1.0f / 3.0f)));
+	VF y = BitCast(df32, Add(third, Set(di32, 709958130)));
+
+	for (int i = 0; i < 2; i++) {
+		const VF y3 = Mul(Mul(y, y), y);
+
+		y = Mul(y, Div(Add(y3, Add(t, t)), Add(Add(y3, y3), t)));
+	}
+
+	return y;
+}
+
+/* The CIE f(t): linear below 0.008856, cube root above.
+ */
+HWY_INLINE VF
+lab_f(VF t)
+{
+	const VF threshold = Set(df32, 0.008856f);
+	const VF linear = Add(Mul(t, Set(df32, 7.787f)),
+		Set(df32, 16.0f / 116.0f));
+
+	return IfThenElse(Lt(t, threshold),
+		linear, cbrt_positive(Max(t, threshold)));
+}
+
+/* The inverse of lab_f(), scaled by the white point.
+ */
+HWY_INLINE VF
+lab_f_inverse(VF f, float white)
+{
+	const VF linear = Mul(Sub(f, Set(df32, 0.13793f)),
+		Set(df32, 1.0f / 7.787f));
+	const VF cube = Mul(Mul(f, f), f);
+
+	return Mul(IfThenElse(Lt(f, Set(df32, 0.2069f)), linear, cube),
+		Set(df32, white));
+}
+
+#if HWY_HAVE_FLOAT64
+/* scRGB to 8- or 16-bit sRGB with the C path's table and arithmetic: clip,
+ * interpolate between the two nearest table entries in float, then round to
+ * nearest, ties to even, like VIPS_RINT().
+ *
+ * The product of the table step and the fraction is exact in double, so
+ * demoting it gives the rounded float product of the C path, and the
+ * compiler can't fuse it with the add that follows.
+ */
+template <typename T>
+HWY_INLINE Vec<Rebind<T, DF64>>
+srgb_quantise(VF32D x, const int32_t *HWY_RESTRICT lut)
+{
+	const Rebind<T, DF64> dt;
+	const VF32D maxval = Set(df32d, hwy::HighestValue<T>());
+	const VF32D Yf = Min(Max(Mul(x, maxval), Zero(df32d)), maxval);
+	const auto Yi = ConvertTo(di32d, Yf);
+	const auto lo = GatherIndex(di32d, lut, Yi);
+	const auto hi = GatherIndex(di32d, lut, Add(Yi, Set(di32d, 1)));
+
+	const auto step = PromoteTo(df64, ConvertTo(df32d, Sub(hi, lo)));
+	const auto f = PromoteTo(df64, Sub(Yf, ConvertTo(df32d, Yi)));
+	const VF32D v = Add(ConvertTo(df32d, lo),
+		DemoteTo(df32d, Mul(step, f)));
+
+	return DemoteTo(dt, ConvertTo(di32d, Round(v)));
+}
+
+/* Alpha is scaled in double and truncated, then clipped.
+ */
+template <typename T>
+HWY_INLINE Vec<Rebind<T, DF64>>
+srgb_alpha(VF32D a)
+{
+	const Rebind<T, DF64> dt;
+	const auto maxval = Set(df64, hwy::HighestValue<T>());
+	const auto scaled = Mul(PromoteTo(df64, a), maxval);
+
+	return DemoteTo(dt,
+		DemoteTo(di32d, Min(Max(scaled, Zero(df64)), maxval)));
+}
+#endif /*HWY_HAVE_FLOAT64*/
+
+HWY_ATTR void
+vips_XYZ2Lab_hwy(float *out, float *in, int width,
+	float X0, float Y0, float Z0)
+{
+	const float rX0 = 1.0f / X0;
+	const float rY0 = 1.0f / Y0;
+	const float rZ0 = 1.0f / Z0;
+
+	colour_line(df32, out, in, 3, width,
+		[=](float *HWY_RESTRICT q, const float *HWY_RESTRICT p) HWY_ATTR {
+			VF X, Y, Z;
+			LoadInterleaved3(df32, p, X, Y, Z);
+
+			const VF cbx = lab_f(Mul(X, Set(df32, rX0)));
+			const VF cby = lab_f(Mul(Y, Set(df32, rY0)));
+			const VF cbz = lab_f(Mul(Z, Set(df32, rZ0)));
+
+			const VF L = Sub(Mul(cby, Set(df32, 116.0f)),
+				Set(df32, 16.0f));
+			const VF a = Mul(Sub(cbx, cby), Set(df32, 500.0f));
+			const VF b = Mul(Sub(cby, cbz), Set(df32, 200.0f));
+
+			StoreInterleaved3(L, a, b, df32, q);
+		});
+}
+
+HWY_ATTR void
+vips_Lab2XYZ_hwy(float *out, float *in, int width,
+	float X0, float Y0, float Z0)
+{
+	colour_line(df32, out, in, 3, width,
+		[=](float *HWY_RESTRICT q, const float *HWY_RESTRICT p) HWY_ATTR {
+			VF L, a, b;
+			LoadInterleaved3(df32, p, L, a, b);
+
+			/* Below L 8 we are on the linear part of the curve.
+			 */
+			const auto dark = Lt(L, Set(df32, 8.0f));
+			const VF ny = Mul(L, Set(df32, 1.0f / 903.3f));
+			const VF cby = IfThenElse(dark,
+				Add(Mul(ny, Set(df32, 7.787f)),
+					Set(df32, 16.0f / 116.0f)),
+				Mul(Add(L, Set(df32, 16.0f)),
+					Set(df32, 1.0f / 116.0f)));
+			const VF cube = Mul(Mul(cby, cby), cby);
+			const VF Y = Mul(IfThenElse(dark, ny, cube), Set(df32, Y0));
+
+			const VF X = lab_f_inverse(
+				Add(Mul(a, Set(df32, 1.0f / 500.0f)), cby), X0);
+			const VF Z = lab_f_inverse(
+				Sub(cby, Mul(b, Set(df32, 1.0f / 200.0f))), Z0);
+
+			StoreInterleaved3(X, Y, Z, df32, q);
+		});
+}
+
+/* The sRGB primaries, with the scale to Y0 folded in.
+ */
+#define M(V) ((float) ((V) * VIPS_D65_Y0))
+
+#define MATRIX(R, G, B, A, B1, C) \
+	Add(Add(Mul(R, Set(df32, M(A))), Mul(G, Set(df32, M(B1)))), \
+		Mul(B, Set(df32, M(C))))
+
+#define SCRGB2XYZ(R, G, B, X, Y, Z) \
+	const VF X = MATRIX(R, G, B, 0.4124, 0.3576, 0.1805); \
+	const VF Y = MATRIX(R, G, B, 0.2126, 0.7152, 0.0722); \
+	const VF Z = MATRIX(R, G, B, 0.0193, 0.1192, 0.9505);
+
+HWY_ATTR gboolean
+vips_scRGB2XYZ_hwy(float *out, float *in, int extra_bands, int width)
+{
+	switch (extra_bands) {
+	case 0:
+		colour_line(df32, out, in, 3, width,
+			[](float *HWY_RESTRICT q, const float *HWY_RESTRICT p) HWY_ATTR {
+				VF R, G, B;
+				LoadInterleaved3(df32, p, R, G, B);
+
+				SCRGB2XYZ(R, G, B, X, Y, Z);
+
+				StoreInterleaved3(X, Y, Z, df32, q);
+			});
+		return TRUE;
+
+	case 1:
+		colour_line(df32, out, in, 4, width,
+			[](float *HWY_RESTRICT q, const float *HWY_RESTRICT p) HWY_ATTR {
+				VF R, G, B, A;
+				LoadInterleaved4(df32, p, R, G, B, A);
+
+				SCRGB2XYZ(R, G, B, X, Y, Z);
+
+				/* A * 255 is exact in double, so this is the C
+				 * path's result.
+				 */
+				A = Min(Max(Mul(A, Set(df32, 255.0f)), Zero(df32)),
+					Set(df32, 255.0f));
+
+				StoreInterleaved4(X, Y, Z, A, df32, q);
+			});
+		return TRUE;
+
+	default:
+		return FALSE;
+	}
+}
+
+/* NaN in any channel makes the whole pixel black, as in the C path.
+ */
+#define SRGB_NAN(R, G, B) \
+	const auto nan = Or(Or(IsNaN(R), IsNaN(G)), IsNaN(B)); \
+	R = IfThenZeroElse(nan, R); \
+	G = IfThenZeroElse(nan, G); \
+	B = IfThenZeroElse(nan, B);
+
+#if HWY_HAVE_FLOAT64
+template <typename T>
+HWY_INLINE gboolean
+scRGB2sRGB_line(T *out, float *in, const int *table,
+	int extra_bands, int width)
+{
+	const int32_t *lut = (const int32_t *) table;
+
+	switch (extra_bands) {
+	case 0:
+		colour_line(df32d, out, in, 3, width,
+			[=](T *HWY_RESTRICT q, const float *HWY_RESTRICT p) HWY_ATTR {
+				const Rebind<T, DF64> dt;
+
+				VF32D R, G, B;
+				LoadInterleaved3(df32d, p, R, G, B);
+
+				SRGB_NAN(R, G, B);
+
+				StoreInterleaved3(srgb_quantise<T>(R, lut),
+					srgb_quantise<T>(G, lut),
+					srgb_quantise<T>(B, lut),
+					dt, q);
+			});
+		return TRUE;
+
+	case 1:
+		colour_line(df32d, out, in, 4, width,
+			[=](T *HWY_RESTRICT q, const float *HWY_RESTRICT p) HWY_ATTR {
+				const Rebind<T, DF64> dt;
+
+				VF32D R, G, B, A;
+				LoadInterleaved4(df32d, p, R, G, B, A);
+
+				SRGB_NAN(R, G, B);
+
+				StoreInterleaved4(srgb_quantise<T>(R, lut),
+					srgb_quantise<T>(G, lut),
+					srgb_quantise<T>(B, lut),
+					srgb_alpha<T>(A),
+					dt, q);
+			});
+		return TRUE;
+
+	default:
+		return FALSE;
+	}
+}
+#endif /*HWY_HAVE_FLOAT64*/
+
+HWY_ATTR gboolean
+vips_scRGB2sRGB_hwy(int depth, VipsPel *out, float *in,
+	int extra_bands, int width)
+{
+#if HWY_HAVE_FLOAT64
+	if (depth == 16)
+		return scRGB2sRGB_line((uint16_t *) out, in, vips_Y2v_16,
+			extra_bands, width);
+	else
+		return scRGB2sRGB_line((uint8_t *) out, in, vips_Y2v_8,
+			extra_bands, width);
+#else
+	return FALSE;
+#endif
+}
+
+} /*namespace HWY_NAMESPACE*/
+
+#if HWY_ONCE
+HWY_EXPORT(vips_XYZ2Lab_hwy);
+HWY_EXPORT(vips_Lab2XYZ_hwy);
+HWY_EXPORT(vips_scRGB2XYZ_hwy);
+HWY_EXPORT(vips_scRGB2sRGB_hwy);
+
+void
+vips_XYZ2Lab_hwy(float *out, float *in, int width,
+	float X0, float Y0, float Z0)
+{
+	/* clang-format off */
+	HWY_DYNAMIC_DISPATCH(vips_XYZ2Lab_hwy)(out, in, width, X0, Y0, Z0);
+	/* clang-format on */
+}
+
+void
+vips_Lab2XYZ_hwy(float *out, float *in, int width,
+	float X0, float Y0, float Z0)
+{
+	/* clang-format off */
+	HWY_DYNAMIC_DISPATCH(vips_Lab2XYZ_hwy)(out, in, width, X0, Y0, Z0);
+	/* clang-format on */
+}
+
+/* Returns FALSE for more than one extra band, and the caller should run the
+ * C path instead.
+ */
+gboolean
+vips_scRGB2XYZ_hwy(float *out, float *in, int extra_bands, int width)
+{
+	/* clang-format off */
+	return HWY_DYNAMIC_DISPATCH(vips_scRGB2XYZ_hwy)(out, in,
+		extra_bands, width);
+	/* clang-format on */
+}
+
+/* Returns FALSE for more than one extra band, or on targets without double
+ * vectors, and the caller should run the C path instead.
+ */
+gboolean
+vips_scRGB2sRGB_hwy(int depth, VipsPel *out, float *in,
+	int extra_bands, int width)
+{
+	if (depth == 16)
+		vips_col_make_tables_RGB_16();
+	else
+		vips_col_make_tables_RGB_8();
+
+	/* clang-format off */
+	return HWY_DYNAMIC_DISPATCH(vips_scRGB2sRGB_hwy)(depth, out, in,
+		extra_bands, width);
+	/* clang-format on */
+}
+#endif /*HWY_ONCE*/
+
+#endif /*HAVE_HWY*/
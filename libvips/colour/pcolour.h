@@ -210,6 +210,8 @@ void vips__pythagoras_line(VipsColour *colour,
  */
 extern float vips_v2Y_8[256];
 extern float vips_v2Y_16[65536];
+extern int vips_Y2v_8[256 + 1];
+extern int vips_Y2v_16[65536 + 1];
 
 void vips_col_make_tables_RGB_8(void);
 void vips_col_make_tables_RGB_16(void);
@@ -221,6 +223,14 @@ typedef int (*VipsColourTransformFn)(VipsImage *in, VipsImage **out, ...);
 int vips__colourspace_process_n(const char *domain,
 	VipsImage *in, VipsImage **out, int n, VipsColourTransformFn fn);
 
+void vips_XYZ2Lab_hwy(float *out, float *in, int width,
+	float X0, float Y0, float Z0);
+void vips_Lab2XYZ_hwy(float *out, float *in, int width,
+	float X0, float Y0, float Z0);
+gboolean vips_scRGB2XYZ_hwy(float *out, float *in, int extra_bands, int width);
+gboolean vips_scRGB2sRGB_hwy(int depth, VipsPel *out, float *in,
+	int extra_bands, int width);
+
 #ifdef __cplusplus
 }
 #endif /*__cplusplus*/
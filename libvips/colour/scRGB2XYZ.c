@@ -8,6 +8,8 @@
  * 	- cleanups
  * 20/9/12
  * 	redo as a class
+ * 16/10/26
+ * 	- add Highway path for RGB and RGBA
  */
 
 /*
@@ -46,6 +48,7 @@
 #include <math.h>
 
 #include <vips/vips.h>
+#include <vips/vector.h>
 
 #include "pcolour.h"
 
@@ -70,6 +73,12 @@ vips_scRGB2XYZ_line(float *restrict q, float *restrict p,
 {
 	int i, j;
 
+#ifdef HAVE_HWY
+	if (vips_vector_isenabled() &&
+		vips_scRGB2XYZ_hwy(q, p, extra_bands, width))
+		return;
+#endif /*HAVE_HWY*/
+
 	for (i = 0; i < width; i++) {
 		const float R = p[0] * VIPS_D65_Y0;
 		const float G = p[1] * VIPS_D65_Y0;
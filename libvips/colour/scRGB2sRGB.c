@@ -27,6 +27,8 @@
  * 	- cut about to make scRGB2sRGB.c
  * 12/2/15
  * 	- add 16-bit alpha handling
+ * 16/10/26
+ * 	- add Highway path for RGB and RGBA
  */
 
 /*
@@ -65,6 +67,7 @@
 #include <math.h>
 
 #include <vips/vips.h>
+#include <vips/vector.h>
 
 #include "pcolour.h"
 
@@ -168,6 +171,13 @@ vips_scRGB2sRGB_gen(VipsRegion *out_region,
 		VipsPel *q = (VipsPel *)
 			VIPS_REGION_ADDR(out_region, r->left, r->top + y);
 
+#ifdef HAVE_HWY
+		if (vips_vector_isenabled() &&
+			vips_scRGB2sRGB_hwy(scRGB2sRGB->depth, q, p,
+				in->Bands - 3, r->width))
+			continue;
+#endif /*HAVE_HWY*/
+
 		if (scRGB2sRGB->depth == 16)
 			vips_scRGB2sRGB_line_16((unsigned short *) q, p,
 				in->Bands - 3, r->width);
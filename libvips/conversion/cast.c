@@ -56,6 +56,10 @@
  * 	- remove old overflow/underflow detect
  * 8/12/20
  * 	- fix range clip in int32 -> unsigned casts [ewelot]
+ * 16/10/26
+ * 	- skip over casts that lose nothing
+ * 	- add @round option
+ * 	- add Highway path for the common casts
  */
 
 /*
@@ -102,6 +106,7 @@
 #include <vips/vips.h>
 #include <vips/internal.h>
 #include <vips/debug.h>
+#include <vips/vector.h>
 
 #include "pconversion.h"
 
@@ -111,6 +116,7 @@ typedef struct _VipsCast {
 	VipsImage *in;
 	VipsBandFormat format;
 	gboolean shift;
+	gboolean round;
 
 } VipsCast;
 
@@ -233,8 +239,12 @@ G_DEFINE_TYPE(VipsCast, vips_cast, VIPS_TYPE_CONVERSION);
 		ITYPE *restrict p = (ITYPE *) in; \
 		OTYPE *restrict q = (OTYPE *) out; \
 \
-		for (x = 0; x < sz; x++) \
-			q[x] = CAST((double) p[x]); \
+		if (cast->round) \
+			for (x = 0; x < sz; x++) \
+				q[x] = CAST(VIPS_RINT((double) p[x])); \
+		else \
+			for (x = 0; x < sz; x++) \
+				q[x] = CAST((double) p[x]); \
 	}
 
 /* Cast complex types to an int type. Just take the real part.
@@ -248,7 +258,11 @@ G_DEFINE_TYPE(VipsCast, vips_cast, VIPS_TYPE_CONVERSION);
 		OTYPE *restrict q = (OTYPE *) out; \
 \
 		for (x = 0; x < sz; x++) { \
-			q[x] = CAST((double) p[0]); \
+			double t = cast->round \
+				? VIPS_RINT((double) p[0]) \
+				: (double) p[0]; \
+\
+			q[x] = CAST(t); \
 			p += 2; \
 		} \
 	}
@@ -375,6 +389,13 @@ vips_cast_gen(VipsRegion *out_region,
 		VipsPel *in = VIPS_REGION_ADDR(ir, r->left, r->top + y);
 		VipsPel *out = VIPS_REGION_ADDR(out_region, r->left, r->top + y);
 
+#ifdef HAVE_HWY
+		if (vips_vector_isenabled() &&
+			vips_cast_hwy(ir->im->BandFmt, conversion->out->BandFmt,
+				cast->shift, cast->round, out, in, sz))
+			continue;
+#endif /*HAVE_HWY*/
+
 		switch (ir->im->BandFmt) {
 		case VIPS_FORMAT_UCHAR:
 			BAND_SWITCH_INNER(unsigned char,
@@ -456,6 +477,40 @@ vips_cast_gen(VipsRegion *out_region,
 	return 0;
 }
 
+/* Can @to represent every value of @from exactly?
+ */
+static gboolean
+vips_cast_is_lossless(VipsBandFormat from, VipsBandFormat to)
+{
+	/* Min and max for each non-complex format, with ints exactly
+	 * representable in float and double.
+	 */
+	static const double range[][2] = {
+		/* UCHAR */ { 0, UCHAR_MAX },
+		/* CHAR */ { SCHAR_MIN, SCHAR_MAX },
+		/* USHORT */ { 0, USHRT_MAX },
+		/* SHORT */ { SHRT_MIN, SHRT_MAX },
+		/* UINT */ { 0, UINT_MAX },
+		/* INT */ { INT_MIN, INT_MAX },
+		/* FLOAT */ { -(1 << 24), 1 << 24 },
+		/* COMPLEX */ { 0, 0 },
+		/* DOUBLE */ { -9007199254740992.0, 9007199254740992.0 }
+	};
+
+	if (from == to)
+		return TRUE;
+	if (vips_band_format_iscomplex(from) ||
+		vips_band_format_iscomplex(to))
+		return FALSE;
+	if (to == VIPS_FORMAT_DOUBLE)
+		return TRUE;
+	if (!vips_band_format_isint(from))
+		return FALSE;
+
+	return range[to][0] <= range[from][0] &&
+		range[to][1] >= range[from][1];
+}
+
 static int
 vips_cast_build(VipsObject *object)
 {
@@ -471,6 +526,18 @@ vips_cast_build(VipsObject *object)
 
 	in = cast->in;
 
+	/* If @in was made by a cast that lost nothing, for example uchar to
+	 * float, we can cast straight from that cast's input. This may leave
+	 * us with nothing to do.
+	 */
+	while (vips__simplify_enabled &&
+		!cast->shift &&
+		in->generate_fn == vips_cast_gen &&
+		!((VipsCast *) in->client2)->shift &&
+		vips_cast_is_lossless(((VipsImage *) in->client1)->BandFmt,
+			in->BandFmt))
+		in = (VipsImage *) in->client1;
+
 	/* Trivial case: fall back to copy().
 	 */
 	if (in->BandFmt == cast->format)
@@ -488,8 +555,9 @@ vips_cast_build(VipsObject *object)
 	if (cast->shift &&
 		!vips_band_format_isint(in->BandFmt) &&
 		vips_band_format_isint(cast->format)) {
-		if (vips_cast(in, &t[1],
-				vips_image_guess_format(in), NULL))
+		if (vips_cast(in, &t[1], vips_image_guess_format(in),
+				"round", cast->round,
+				NULL))
 			return -1;
 		in = t[1];
 	}
@@ -545,6 +613,13 @@ vips_cast_class_init(VipsCastClass *class)
 		VIPS_ARGUMENT_OPTIONAL_INPUT,
 		G_STRUCT_OFFSET(VipsCast, shift),
 		FALSE);
+
+	VIPS_ARG_BOOL(class, "round", 8,
+		_("Round"),
+		_("Round float values to the nearest integer"),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET(VipsCast, round),
+		FALSE);
 }
 
 static void
@@ -568,9 +643,11 @@ vips_castv(VipsImage *in, VipsImage **out, VipsBandFormat format, va_list ap)
  * Optional arguments:
  *
  * * @shift: %gboolean, integer values are shifted
+ * * @round: %gboolean, float values are rounded
  *
  * Convert @in to @format. You can convert between any pair of formats.
- * Floats are truncated (not rounded). Out of range values are clipped.
+ * Floats are truncated, or rounded to the nearest integer, with ties to
+ * even, if @round is %TRUE. Out of range values are clipped.
  *
  * Casting from complex to real returns the real part.
  *
@@ -0,0 +1,406 @@
+/* Highway paths for the common casts
+ *
+ * 16/10/26
+ * 	- initial implementation
+ */
+
+/*
+
+	This file is part of VIPS.
+
+	VIPS is free software; you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+	02110-1301  USA
+
+ */
+
+/*
+
+	These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <glib/gi18n-lib.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <math.h>
+
+#include <vips/vips.h>
+#include <vips/vector.h>
+#include <vips/debug.h>
+#include <vips/internal.h>
+
+#include "pconversion.h"
+
+#ifdef HAVE_HWY
+
+#undef HWY_TARGET_INCLUDE
+#define HWY_TARGET_INCLUDE "libvips/conversion/cast_hwy.cpp"
+#include <hwy/foreach_target.h>
+#include <hwy/highway.h>
+
+namespace HWY_NAMESPACE {
+
+using namespace hwy::HWY_NAMESPACE;
+
+using DU16 = ScalableTag<uint16_t>;
+using DI16 = ScalableTag<int16_t>;
+using DI32 = ScalableTag<int32_t>;
+using DF32 = ScalableTag<float>;
+constexpr DU16 du16;
+constexpr DI16 di16;
+constexpr DI32 di32;
+constexpr DF32 df32;
+constexpr Rebind<uint8_t, DU16> du8x16;
+
+/* Any 8- or 16-bit int to float.
+ */
+template <typename T>
+HWY_INLINE void
+cast_int_float(VipsPel *out, VipsPel *in, int32_t sz)
+{
+	const T *HWY_RESTRICT p = (T *) in;
+	float *HWY_RESTRICT q = (float *) out;
+	const Rebind<T, DI32> dt;
+	const int32_t N = Lanes(df32);
+
+	int32_t x = 0;
+	for (; x + N <= sz; x += N)
+		StoreU(ConvertTo(df32, PromoteTo(di32, LoadU(dt, p + x))),
+			df32, q + x);
+
+	for (; x < sz; ++x)
+		q[x] = p[x];
+}
+
+/* Float to an 8- or 16-bit int. Clip, then truncate towards zero, or round
+ * to nearest first. Round() and VIPS_RINT() both send ties to even.
+ *
+ * Every value of T is exact in float, so clipping in float gives the same
+ * result as the C path's clip in double.
+ */
+template <typename T>
+HWY_INLINE void
+cast_float_int(VipsPel *out, VipsPel *in, int32_t sz, bool round)
+{
+	const float *HWY_RESTRICT p = (float *) in;
+	T *HWY_RESTRICT q = (T *) out;
+	const Rebind<T, DI32> dt;
+	const int32_t N = Lanes(df32);
+	const T lo = hwy::LowestValue<T>();
+	const T hi = hwy::HighestValue<T>();
+	const auto vlo = Set(df32, lo);
+	const auto vhi = Set(df32, hi);
+
+	int32_t x = 0;
+	for (; x + N <= sz; x += N) {
+		auto v = LoadU(df32, p + x);
+
+		if (round)
+			v = Round(v);
+		v = Min(Max(v, vlo), vhi);
+
+		/* Values are in range now, so the demote can't saturate.
+		 */
+		StoreU(DemoteTo(dt, ConvertTo(di32, v)), dt, q + x);
+	}
+
+	for (; x < sz; ++x) {
+		double t = round ? VIPS_RINT((double) p[x]) : (double) p[x];
+
+		q[x] = VIPS_CLIP(lo, t, hi);
+	}
+}
+
+/* Widen with no change in value, eg. uchar to ushort.
+ */
+template <typename TI, typename TO>
+HWY_INLINE void
+cast_widen(VipsPel *out, VipsPel *in, int32_t sz)
+{
+	const TI *HWY_RESTRICT p = (TI *) in;
+	TO *HWY_RESTRICT q = (TO *) out;
+	const ScalableTag<TO> d;
+	const Rebind<TI, decltype(d)> di;
+	const int32_t N = Lanes(d);
+
+	int32_t x = 0;
+	for (; x + N <= sz; x += N)
+		StoreU(PromoteTo(d, LoadU(di, p + x)), d, q + x);
+
+	for (; x < sz; ++x)
+		q[x] = p[x];
+}
+
+/* ushort to uchar, saturating.
+ */
+HWY_INLINE void
+cast_ushort_uchar(VipsPel *out, VipsPel *in, int32_t sz)
+{
+	const uint16_t *HWY_RESTRICT p = (uint16_t *) in;
+	uint8_t *HWY_RESTRICT q = (uint8_t *) out;
+	const int32_t N = Lanes(du16);
+	const auto max = Set(du16, UCHAR_MAX);
+
+	int32_t x = 0;
+	for (; x + N <= sz; x += N) {
+		const auto v = Min(LoadU(du16, p + x), max);
+
+		StoreU(DemoteTo(du8x16, BitCast(di16, v)), du8x16, q + x);
+	}
+
+	for (; x < sz; ++x)
+		q[x] = VIPS_MIN(p[x], UCHAR_MAX);
+}
+
+/* short to uchar, saturating.
+ */
+HWY_INLINE void
+cast_short_uchar(VipsPel *out, VipsPel *in, int32_t sz)
+{
+	const int16_t *HWY_RESTRICT p = (int16_t *) in;
+	uint8_t *HWY_RESTRICT q = (uint8_t *) out;
+	const int32_t N = Lanes(di16);
+
+	int32_t x = 0;
+	for (; x + N <= sz; x += N)
+		StoreU(DemoteTo(du8x16, LoadU(di16, p + x)), du8x16, q + x);
+
+	for (; x < sz; ++x)
+		q[x] = VIPS_CLIP(0, p[x], UCHAR_MAX);
+}
+
+/* ushort to short, saturating.
+ */
+HWY_INLINE void
+cast_ushort_short(VipsPel *out, VipsPel *in, int32_t sz)
+{
+	const uint16_t *HWY_RESTRICT p = (uint16_t *) in;
+	int16_t *HWY_RESTRICT q = (int16_t *) out;
+	const int32_t N = Lanes(du16);
+	const auto max = Set(du16, SHRT_MAX);
+
+	int32_t x = 0;
+	for (; x + N <= sz; x += N)
+		StoreU(BitCast(di16, Min(LoadU(du16, p + x), max)), di16, q + x);
+
+	for (; x < sz; ++x)
+		q[x] = VIPS_MIN(p[x], SHRT_MAX);
+}
+
+/* short to ushort, saturating.
+ */
+HWY_INLINE void
+cast_short_ushort(VipsPel *out, VipsPel *in, int32_t sz)
+{
+	const int16_t *HWY_RESTRICT p = (int16_t *) in;
+	uint16_t *HWY_RESTRICT q = (uint16_t *) out;
+	const int32_t N = Lanes(di16);
+	const auto zero = Zero(di16);
+
+	int32_t x = 0;
+	for (; x + N <= sz; x += N)
+		StoreU(BitCast(du16, Max(LoadU(di16, p + x), zero)), du16, q + x);
+
+	for (; x < sz; ++x)
+		q[x] = VIPS_MAX(p[x], 0);
+}
+
+/* uchar to ushort with @shift: move up 8 bits and copy the bottom bit into
+ * the new bits, so 255 becomes 65535.
+ */
+HWY_INLINE void
+cast_uchar_ushort_shift(VipsPel *out, VipsPel *in, int32_t sz)
+{
+	const uint8_t *HWY_RESTRICT p = (uint8_t *) in;
+	uint16_t *HWY_RESTRICT q = (uint16_t *) out;
+	const int32_t N = Lanes(du16);
+	const auto one = Set(du16, 1);
+
+	int32_t x = 0;
+	for (; x + N <= sz; x += N) {
+		const auto v = PromoteTo(du16, LoadU(du8x16, p + x));
+		const auto bit = And(v, one);
+
+		StoreU(Or(ShiftLeft<8>(v), Sub(ShiftLeft<8>(bit), bit)),
+			du16, q + x);
+	}
+
+	for (; x < sz; ++x)
+		q[x] = (p[x] << 8) | (((p[x] & 1) << 8) - (p[x] & 1));
+}
+
+/* ushort to uchar with @shift: keep the top 8 bits.
+ */
+HWY_INLINE void
+cast_ushort_uchar_shift(VipsPel *out, VipsPel *in, int32_t sz)
+{
+	const uint16_t *HWY_RESTRICT p = (uint16_t *) in;
+	uint8_t *HWY_RESTRICT q = (uint8_t *) out;
+	const int32_t N = Lanes(du16);
+
+	int32_t x = 0;
+	for (; x + N <= sz; x += N) {
+		const auto v = ShiftRight<8>(LoadU(du16, p + x));
+
+		StoreU(DemoteTo(du8x16, BitCast(di16, v)), du8x16, q + x);
+	}
+
+	for (; x < sz; ++x)
+		q[x] = p[x] >> 8;
+}
+
+HWY_ATTR int
+vips_cast_hwy(VipsBandFormat in_format, VipsBandFormat out_format,
+	int shift, int round, VipsPel *out, VipsPel *in, int32_t sz)
+{
+	switch (in_format) {
+	case VIPS_FORMAT_UCHAR:
+		switch (out_format) {
+		case VIPS_FORMAT_USHORT:
+			if (shift)
+				cast_uchar_ushort_shift(out, in, sz);
+			else
+				cast_widen<uint8_t, uint16_t>(out, in, sz);
+			return TRUE;
+
+		case VIPS_FORMAT_SHORT:
+			if (shift)
+				return FALSE;
+			cast_widen<uint8_t, int16_t>(out, in, sz);
+			return TRUE;
+
+		case VIPS_FORMAT_FLOAT:
+			cast_int_float<uint8_t>(out, in, sz);
+			return TRUE;
+
+		default:
+			return FALSE;
+		}
+
+	case VIPS_FORMAT_CHAR:
+		switch (out_format) {
+		case VIPS_FORMAT_SHORT:
+			if (shift)
+				return FALSE;
+			cast_widen<int8_t, int16_t>(out, in, sz);
+			return TRUE;
+
+		case VIPS_FORMAT_FLOAT:
+			cast_int_float<int8_t>(out, in, sz);
+			return TRUE;
+
+		default:
+			return FALSE;
+		}
+
+	case VIPS_FORMAT_USHORT:
+		switch (out_format) {
+		case VIPS_FORMAT_UCHAR:
+			if (shift)
+				cast_ushort_uchar_shift(out, in, sz);
+			else
+				cast_ushort_uchar(out, in, sz);
+			return TRUE;
+
+		case VIPS_FORMAT_SHORT:
+			if (shift)
+				return FALSE;
+			cast_ushort_short(out, in, sz);
+			return TRUE;
+
+		case VIPS_FORMAT_FLOAT:
+			cast_int_float<uint16_t>(out, in, sz);
+			return TRUE;
+
+		default:
+			return FALSE;
+		}
+
+	case VIPS_FORMAT_SHORT:
+		switch (out_format) {
+		case VIPS_FORMAT_UCHAR:
+			if (shift)
+				return FALSE;
+			cast_short_uchar(out, in, sz);
+			return TRUE;
+
+		case VIPS_FORMAT_USHORT:
+			if (shift)
+				return FALSE;
+			cast_short_ushort(out, in, sz);
+			return TRUE;
+
+		case VIPS_FORMAT_FLOAT:
+			cast_int_float<int16_t>(out, in, sz);
+			return TRUE;
+
+		default:
+			return FALSE;
+		}
+
+	/* @shift has no effect for float input.
+	 */
+	case VIPS_FORMAT_FLOAT:
+		switch (out_format) {
+		case VIPS_FORMAT_UCHAR:
+			cast_float_int<uint8_t>(out, in, sz, round);
+			return TRUE;
+
+		case VIPS_FORMAT_CHAR:
+			cast_float_int<int8_t>(out, in, sz, round);
+			return TRUE;
+
+		case VIPS_FORMAT_USHORT:
+			cast_float_int<uint16_t>(out, in, sz, round);
+			return TRUE;
+
+		case VIPS_FORMAT_SHORT:
+			cast_float_int<int16_t>(out, in, sz, round);
+			return TRUE;
+
+		default:
+			return FALSE;
+		}
+
+	default:
+		return FALSE;
+	}
+}
+
+} /*namespace HWY_NAMESPACE*/
+
+#if HWY_ONCE
+HWY_EXPORT(vips_cast_hwy);
+
+/* Returns FALSE if there's no vector path for this pair of formats, and the
+ * caller should run the C path instead.
+ */
+gboolean
+vips_cast_hwy(VipsBandFormat in_format, VipsBandFormat out_format,
+	gboolean shift, gboolean round, VipsPel *out, VipsPel *in, int sz)
+{
+	/* clang-format off */
+	return HWY_DYNAMIC_DISPATCH(vips_cast_hwy)(in_format, out_format,
+		shift, round, out, in, sz);
+	/* clang-format on */
+}
+#endif /*HWY_ONCE*/
+
+#endif /*HAVE_HWY*/
@@ -37,6 +37,8 @@
  * 	- gtkdoc
  * 26/10/11
  * 	- redone as a class
+ * 16/10/26
+ * 	- extract of extract reads straight from the first image
  */
 
 /*
@@ -99,6 +101,13 @@ typedef struct _VipsExtractArea {
 	int width;
 	int height;
 
+	/* The image we read from, and where our area is in it. This can be
+	 * further up the pipeline than @in, see vips_extract_area_build().
+	 */
+	VipsImage *source;
+	int source_left;
+	int source_top;
+
 } VipsExtractArea;
 
 typedef VipsConversionClass VipsExtractAreaClass;
@@ -119,8 +128,8 @@ vips_extract_area_gen(VipsRegion *out_region,
 	 * demand in ir's space.
 	 */
 	iarea = out_region->valid;
-	iarea.left += extract->left;
-	iarea.top += extract->top;
+	iarea.left += extract->source_left;
+	iarea.top += extract->source_top;
 	if (vips_region_prepare(ir, &iarea))
 		return -1;
 
@@ -155,8 +164,24 @@ vips_extract_area_build(VipsObject *object)
 		vips_check_coding_known(class->nickname, extract->in))
 		return -1;
 
+	/* An extract of an extract can read straight from the first
+	 * extract's input.
+	 */
+	extract->source = extract->in;
+	extract->source_left = extract->left;
+	extract->source_top = extract->top;
+	if (vips__simplify_enabled &&
+		extract->in->generate_fn == vips_extract_area_gen) {
+		VipsExtractArea *upstream =
+			(VipsExtractArea *) extract->in->client2;
+
+		extract->source = upstream->source;
+		extract->source_left += upstream->source_left;
+		extract->source_top += upstream->source_top;
+	}
+
 	if (vips_image_pipelinev(conversion->out,
-			VIPS_DEMAND_STYLE_THINSTRIP, extract->in, NULL))
+			VIPS_DEMAND_STYLE_THINSTRIP, extract->source, NULL))
 		return -1;
 
 	conversion->out->Xsize = extract->width;
@@ -166,7 +191,7 @@ vips_extract_area_build(VipsObject *object)
 
 	if (vips_image_generate(conversion->out,
 			vips_start_one, vips_extract_area_gen, vips_stop_one,
-			extract->in, extract))
+			extract->source, extract))
 		return -1;
 
 	return 0;
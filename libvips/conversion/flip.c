@@ -17,6 +17,8 @@
  * 	- gtkdoc
  * 17/10/11
  * 	- redone as a class
+ * 16/10/26
+ * 	- a flip of a flip in the same direction is a copy
  */
 
 /*
@@ -198,6 +200,17 @@ vips_flip_build(VipsObject *object)
 	if (vips_image_pio_input(flip->in))
 		return -1;
 
+	/* Two flips in the same direction cancel.
+	 */
+	if (vips__simplify_enabled &&
+		(flip->in->generate_fn == vips_flip_horizontal_gen ||
+			flip->in->generate_fn == vips_flip_vertical_gen)) {
+		VipsFlip *upstream = (VipsFlip *) flip->in->client2;
+
+		if (upstream->direction == flip->direction)
+			return vips_image_write(upstream->in, conversion->out);
+	}
+
 	if (vips_image_pipelinev(conversion->out,
 			VIPS_DEMAND_STYLE_THINSTRIP, flip->in, NULL))
 		return -1;
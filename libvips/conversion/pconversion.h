@@ -66,6 +66,9 @@ typedef struct _VipsConversionClass {
 
 GType vips_conversion_get_type(void);
 
+gboolean vips_cast_hwy(VipsBandFormat in_format, VipsBandFormat out_format,
+	gboolean shift, gboolean round, VipsPel *out, VipsPel *in, int sz);
+
 #ifdef __cplusplus
 }
 #endif /*__cplusplus*/
@@ -25,6 +25,8 @@
  * 	- deprecate @trace, @access now seq is much simpler
  * 6/9/21
  * 	- don't set "persistent", it can cause huge memory use
+ * 16/10/26
+ * 	- add @readahead
  */
 
 /*
@@ -74,6 +76,46 @@
 
 #include "pconversion.h"
 
+/* Readahead: a background thread decodes strips from our source into a ring
+ * while workers consume earlier strips.
+ */
+typedef struct _VipsSequentialRing {
+	VipsImage *in;
+
+	/* The number of strips in the ring, and the height of each one.
+	 */
+	int n_strips;
+	int strip_height;
+
+	/* Protects everything below.
+	 */
+	GMutex *lock;
+	GCond *cond;
+
+	/* One region per strip, owned by the readahead thread, plus the
+	 * top of the strip each holds, or -1 while it's being filled.
+	 */
+	VipsRegion **strip;
+	int *strip_top;
+
+	/* The next strip the readahead thread will decode.
+	 */
+	int next_top;
+
+	/* The furthest line any consumer has asked for. The readahead thread
+	 * never overwrites the strip holding it, and runs at most
+	 * n_strips - 1 strips beyond that. Earlier strips can be reused: the
+	 * linecache in front of the ring keeps lines for threads which are a
+	 * little behind, so the ring sees requests in order.
+	 */
+	int consumer_top;
+
+	gboolean started;
+	gboolean running;
+	gboolean kill;
+	int error;
+} VipsSequentialRing;
+
 typedef struct _VipsSequential {
 	VipsConversion parent_instance;
 
@@ -81,6 +123,11 @@ typedef struct _VipsSequential {
 	int tile_height;
 	VipsAccess access;
 	gboolean trace;
+	int readahead;
+
+	/* Set if readahead is on.
+	 */
+	VipsSequentialRing *ring;
 
 	/* Lock access to y_pos with this.
 	 */
@@ -101,11 +148,221 @@ typedef VipsConversionClass VipsSequentialClass;
 
 G_DEFINE_TYPE(VipsSequential, vips_sequential, VIPS_TYPE_CONVERSION);
 
+/* The default for @readahead, from the environment.
+ */
+static int vips_sequential_readahead_default = 0;
+
+static VipsSequentialRing *
+vips_sequential_ring_new(VipsImage *in, int n_strips, int strip_height)
+{
+	VipsSequentialRing *ring = g_new0(VipsSequentialRing, 1);
+	int i;
+
+	ring->in = in;
+	ring->n_strips = n_strips;
+	ring->strip_height = strip_height;
+	ring->lock = vips_g_mutex_new();
+	ring->cond = vips_g_cond_new();
+	ring->strip = g_new0(VipsRegion *, n_strips);
+	ring->strip_top = g_new(int, n_strips);
+	for (i = 0; i < n_strips; i++)
+		ring->strip_top[i] = -1;
+
+	return ring;
+}
+
+static void
+vips_sequential_ring_free(VipsSequentialRing *ring)
+{
+	/* Stop the readahead thread, and wait for it to free its regions.
+	 */
+	g_mutex_lock(ring->lock);
+
+	ring->kill = TRUE;
+	g_cond_broadcast(ring->cond);
+	while (ring->running)
+		g_cond_wait(ring->cond, ring->lock);
+
+	g_mutex_unlock(ring->lock);
+
+	VIPS_FREEF(vips_g_mutex_free, ring->lock);
+	VIPS_FREEF(vips_g_cond_free, ring->cond);
+	VIPS_FREE(ring->strip);
+	VIPS_FREE(ring->strip_top);
+	g_free(ring);
+}
+
+/* The readahead thread. Decode strips into the ring in order, waiting for
+ * consumers to move past a strip before we overwrite it.
+ */
+static void
+vips_sequential_ring_run(void *data, void *user_data)
+{
+	VipsSequentialRing *ring = (VipsSequentialRing *) data;
+	VipsImage *in = ring->in;
+
+	VipsRegion *ir;
+	int i;
+
+	ir = vips_region_new(in);
+	for (i = 0; i < ring->n_strips; i++)
+		ring->strip[i] = vips_region_new(in);
+
+	g_mutex_lock(ring->lock);
+
+	while (!ring->kill &&
+		!ring->error &&
+		ring->next_top < in->Ysize) {
+		int index = (ring->next_top / ring->strip_height) %
+			ring->n_strips;
+
+		VipsRect area;
+		int result;
+
+		/* Wait for the strip we'd overwrite to be consumed.
+		 */
+		if (ring->consumer_top < ring->next_top -
+				(ring->n_strips - 1) * ring->strip_height) {
+			VIPS_GATE_START("vips_sequential_ring_run: wait");
+
+			g_cond_wait(ring->cond, ring->lock);
+
+			VIPS_GATE_STOP("vips_sequential_ring_run: wait");
+
+			continue;
+		}
+
+		ring->strip_top[index] = -1;
+		area.left = 0;
+		area.top = ring->next_top;
+		area.width = in->Xsize;
+		area.height = VIPS_MIN(ring->strip_height,
+			in->Ysize - ring->next_top);
+
+		g_mutex_unlock(ring->lock);
+
+		result = vips_region_buffer(ring->strip[index], &area) ||
+			vips_region_prepare_to(ir, ring->strip[index], &area,
+				area.left, area.top);
+
+		g_mutex_lock(ring->lock);
+
+		if (result)
+			ring->error = -1;
+		else {
+			ring->strip_top[index] = area.top;
+			ring->next_top = VIPS_RECT_BOTTOM(&area);
+		}
+
+		g_cond_broadcast(ring->cond);
+	}
+
+	g_mutex_unlock(ring->lock);
+
+	for (i = 0; i < ring->n_strips; i++)
+		VIPS_UNREF(ring->strip[i]);
+	VIPS_UNREF(ir);
+
+	g_mutex_lock(ring->lock);
+
+	ring->running = FALSE;
+	g_cond_broadcast(ring->cond);
+
+	g_mutex_unlock(ring->lock);
+}
+
+/* Is line y in the ring? Return the strip index, or -1.
+ */
+static int
+vips_sequential_ring_find(VipsSequentialRing *ring, int y)
+{
+	int index = (y / ring->strip_height) % ring->n_strips;
+	int top = y - y % ring->strip_height;
+
+	return ring->strip_top[index] == top ? index : -1;
+}
+
+/* Consumers read from the ring.
+ */
+static int
+vips_sequential_ring_generate(VipsRegion *out_region,
+	void *seq, void *a, void *b, gboolean *stop)
+{
+	VipsSequentialRing *ring = (VipsSequentialRing *) a;
+	VipsRect *r = &out_region->valid;
+
+	int y;
+
+	VIPS_GATE_START("vips_sequential_ring_generate: wait1");
+
+	vips__worker_lock(ring->lock);
+
+	VIPS_GATE_STOP("vips_sequential_ring_generate: wait1");
+
+	if (!ring->started) {
+		ring->started = TRUE;
+		ring->running = TRUE;
+		if (vips_thread_execute("readahead",
+				vips_sequential_ring_run, ring)) {
+			ring->running = FALSE;
+			ring->error = -1;
+		}
+	}
+
+	/* Let the readahead thread move on once this is the furthest
+	 * request.
+	 */
+	if (r->top > ring->consumer_top) {
+		ring->consumer_top = r->top;
+		g_cond_broadcast(ring->cond);
+	}
+
+	for (y = r->top; y < VIPS_RECT_BOTTOM(r);) {
+		int index;
+
+		if (ring->error) {
+			g_mutex_unlock(ring->lock);
+			return -1;
+		}
+
+		if ((index = vips_sequential_ring_find(ring, y)) >= 0) {
+			VipsRegion *strip = ring->strip[index];
+			VipsRect hit;
+
+			vips_rect_intersectrect(r, &strip->valid, &hit);
+			vips_region_copy(strip, out_region,
+				&hit, hit.left, hit.top);
+			y = VIPS_RECT_BOTTOM(&hit);
+		}
+		else if (y < ring->next_top) {
+			/* We've already read past this line and dropped
+			 * it.
+			 */
+			vips_error("sequential",
+				_("out of order read at line %d"), y);
+			g_mutex_unlock(ring->lock);
+			return -1;
+		}
+		else {
+			VIPS_GATE_START("vips_sequential_ring_generate: wait2");
+
+			vips__worker_cond_wait(ring->cond, ring->lock);
+
+			VIPS_GATE_STOP("vips_sequential_ring_generate: wait2");
+		}
+	}
+
+	g_mutex_unlock(ring->lock);
+
+	return 0;
+}
+
 static void
 vips_sequential_dispose(GObject *gobject)
 {
 	VipsSequential *sequential = (VipsSequential *) gobject;
 
+	VIPS_FREEF(vips_sequential_ring_free, sequential->ring);
 	VIPS_FREEF(vips_g_mutex_free, sequential->lock);
 
 	G_OBJECT_CLASS(vips_sequential_parent_class)->dispose(gobject);
@@ -188,6 +445,7 @@ vips_sequential_build(VipsObject *object)
 	VipsConversion *conversion = VIPS_CONVERSION(object);
 	VipsSequential *sequential = (VipsSequential *) object;
 
+	VipsImage *source;
 	VipsImage *t;
 
 	VIPS_DEBUG_MSG("vips_sequential_build\n");
@@ -195,6 +453,35 @@ vips_sequential_build(VipsObject *object)
 	if (VIPS_OBJECT_CLASS(vips_sequential_parent_class)->build(object))
 		return -1;
 
+	source = sequential->in;
+
+	/* With readahead, the linecache reads from a ring of strips being
+	 * filled by a background thread.
+	 */
+	if (sequential->readahead > 0) {
+		int tile_width;
+		int tile_height;
+		int n_lines;
+		int strip_height;
+
+		vips_get_tile_size(sequential->in,
+			&tile_width, &tile_height, &n_lines);
+		strip_height = VIPS_ROUND_UP(n_lines, sequential->tile_height);
+
+		sequential->ring = vips_sequential_ring_new(sequential->in,
+			sequential->readahead, strip_height);
+
+		source = vips_image_new();
+		vips_object_local(object, source);
+
+		if (vips_image_pipelinev(source,
+				VIPS_DEMAND_STYLE_THINSTRIP, sequential->in, NULL) ||
+			vips_image_generate(source,
+				NULL, vips_sequential_ring_generate, NULL,
+				sequential->ring, NULL))
+			return -1;
+	}
+
 	/* We've gone forwards and backwards on sequential caches being
 	 * persistent. Persistent caches can be useful if you want to eg.
 	 * make several crop() operations on a seq image source, but they use
@@ -203,7 +490,7 @@ vips_sequential_build(VipsObject *object)
 	 * On balance, if you want to make many crops from one source, use a
 	 * RANDOM image.
 	 */
-	if (vips_linecache(sequential->in, &t,
+	if (vips_linecache(source, &t,
 			"tile_height", sequential->tile_height,
 			"access", VIPS_ACCESS_SEQUENTIAL,
 			NULL))
@@ -264,6 +551,17 @@ vips_sequential_class_init(VipsSequentialClass *class)
 		VIPS_ARGUMENT_OPTIONAL_INPUT | VIPS_ARGUMENT_DEPRECATED,
 		G_STRUCT_OFFSET(VipsSequential, trace),
 		TRUE);
+
+	if (g_getenv("VIPS_READAHEAD"))
+		vips_sequential_readahead_default = VIPS_CLIP(0,
+			atoi(g_getenv("VIPS_READAHEAD")), 1000);
+
+	VIPS_ARG_INT(class, "readahead", 4,
+		_("Readahead"),
+		_("Decode this many strips ahead in the background"),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET(VipsSequential, readahead),
+		0, 1000, vips_sequential_readahead_default);
 }
 
 static void
@@ -273,6 +571,7 @@ vips_sequential_init(VipsSequential *sequential)
 	sequential->tile_height = 1;
 	sequential->error = 0;
 	sequential->trace = FALSE;
+	sequential->readahead = vips_sequential_readahead_default;
 }
 
 /**
@@ -284,6 +583,7 @@ vips_sequential_init(VipsSequential *sequential)
  * Optional arguments:
  *
  * * @tile_height: height of cache strips
+ * * @readahead: %gint, decode this many strips ahead in the background
  *
  * This operation behaves rather like vips_copy() between images
  * @in and @out, except that it checks that pixels on @in are only requested
@@ -293,6 +593,14 @@ vips_sequential_init(VipsSequential *sequential)
  * @tile_height can be used to set the size of the tiles that
  * vips_sequential() uses. The default value is 1.
  *
+ * Set @readahead to decode that many strips ahead of the workers on a
+ * background thread, so that decode overlaps with downstream processing.
+ * Each strip is a few scanlines high, see vips_get_tile_size(). The default
+ * is 0, meaning no readahead, or the value of the environment variable
+ * `VIPS_READAHEAD`, if it's set. Since loaders use vips_sequential()
+ * internally, setting `VIPS_READAHEAD` enables readahead for all
+ * sequential loads.
+ *
  * See also: vips_cache(), vips_linecache(), vips_tilecache().
  *
  * Returns: 0 on success, -1 on error.
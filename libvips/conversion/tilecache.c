@@ -35,6 +35,12 @@
  * 	- terminate on tile calc error
  * 7/3/17
  * 	- remove "access" on linecache, use the base class instead
+ * 16/10/26
+ * 	- add "cache_dir", a persistent on-disc tier keyed by image digest
+ * 	- share tiles through the process-wide tile store
+ * 	- create disc cache files with a rename
+ * 	- write tiles to disc as they leave memory, checksum them rather than
+ * 	  waiting for them to reach disc
  */
 
 /*
@@ -77,6 +83,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
 
 #include <vips/vips.h>
 #include <vips/internal.h>
@@ -96,6 +107,30 @@ typedef enum VipsTileState {
 	VIPS_TILE_STATE_PEND
 } VipsTileState;
 
+/* The header of an on-disc tile cache file. It's followed by a checksum
+ * for each tile, zero for tiles not yet written, then by the tiles
+ * themselves, each a full tile_width by tile_height pixels, even at the right
+ * and bottom edges. Files are sparse, so we only use disc space for tiles
+ * we've written.
+ */
+typedef struct _VipsDiscTileHeader {
+	char magic[8];
+	gint32 width;
+	gint32 height;
+	gint32 bands;
+	gint32 format;
+	gint32 coding;
+	gint32 tile_width;
+	gint32 tile_height;
+	gint32 pad;
+} VipsDiscTileHeader;
+
+#define VIPS_DISC_TILE_MAGIC "VIPSTC02"
+
+/* Tile data starts on a page boundary.
+ */
+#define VIPS_DISC_TILE_ALIGN (4096)
+
 /* A tile in our cache.
  */
 typedef struct _VipsTile {
@@ -115,6 +150,10 @@ typedef struct _VipsTile {
 	 * pointer is NULL.
 	 */
 	VipsRect pos;
+
+	/* Calculated, but not yet written to the disc tier.
+	 */
+	gboolean dirty;
 } VipsTile;
 
 typedef struct _VipsBlockCache {
@@ -128,6 +167,17 @@ typedef struct _VipsBlockCache {
 	VipsAccess access;
 	gboolean threaded;
 	gboolean persistent;
+	char *cache_dir;
+
+	/* The disc tier, if cache_dir is set. The whole file is mapped.
+	 */
+	int disc_fd;
+	char *disc_base;
+	size_t disc_length;
+	size_t disc_tile_size;
+	int disc_tiles_across;
+	gint *disc_checksum;
+	char *disc_data;
 
 	int ntiles;		   /* Current cache size */
 	GMutex *lock;	   /* Lock everything here */
@@ -167,9 +217,379 @@ vips_block_cache_dispose(GObject *gobject)
 	VIPS_FREEF(g_hash_table_destroy, cache->tiles);
 	VIPS_FREEF(g_queue_free, cache->recycle);
 
+	if (cache->disc_base) {
+		vips__munmap(cache->disc_base, cache->disc_length);
+		cache->disc_base = NULL;
+	}
+	if (cache->disc_fd != -1) {
+		vips_tracked_close(cache->disc_fd);
+		cache->disc_fd = -1;
+	}
+
 	G_OBJECT_CLASS(vips_block_cache_parent_class)->dispose(gobject);
 }
 
+typedef struct _VipsDiscFile {
+	char *filename;
+	guint64 size;
+	gint64 mtime;
+} VipsDiscFile;
+
+static void
+vips_disc_file_free(VipsDiscFile *file)
+{
+	g_free(file->filename);
+	g_free(file);
+}
+
+static gint
+vips_disc_file_compare(gconstpointer a, gconstpointer b)
+{
+	const VipsDiscFile *fa = (const VipsDiscFile *) a;
+	const VipsDiscFile *fb = (const VipsDiscFile *) b;
+
+	return fa->mtime < fb->mtime ? -1 : fa->mtime > fb->mtime ? 1 : 0;
+}
+
+/* Make room for a cache file of @length bytes in @dir by removing the
+ * least-recently-used cache files, other than @keep, until we're within
+ * vips_cache_get_max_tile_disc(). We touch files as we open them, so mtime
+ * is last use. Sizes are file lengths, so this overestimates for sparse
+ * files.
+ *
+ * Other processes may still have removed files mapped, that's OK on POSIX.
+ * Where it's not, the unlink fails and we leave the file.
+ */
+static void
+vips_block_cache_disc_trim(const char *dir, const char *keep, guint64 length)
+{
+	const guint64 max_disc = vips_cache_get_max_tile_disc();
+
+	GDir *gdir;
+	const char *name;
+	GSList *files;
+	GSList *p;
+	guint64 total;
+
+	if (!(gdir = g_dir_open(dir, 0, NULL)))
+		return;
+
+	files = NULL;
+	total = length;
+	while ((name = g_dir_read_name(gdir))) {
+		char *filename;
+		GStatBuf st;
+		VipsDiscFile *file;
+
+		if (!g_str_has_suffix(name, ".vtc") ||
+			strcmp(name, keep) == 0)
+			continue;
+
+		filename = g_build_filename(dir, name, NULL);
+		if (g_stat(filename, &st)) {
+			g_free(filename);
+			continue;
+		}
+
+		file = g_new(VipsDiscFile, 1);
+		file->filename = filename;
+		file->size = st.st_size;
+		file->mtime = st.st_mtime;
+		files = g_slist_prepend(files, file);
+		total += file->size;
+	}
+	g_dir_close(gdir);
+
+	files = g_slist_sort(files, vips_disc_file_compare);
+	for (p = files; p && total > max_disc; p = p->next) {
+		VipsDiscFile *file = (VipsDiscFile *) p->data;
+
+		if (!g_unlink(file->filename))
+			total -= file->size;
+	}
+
+	g_slist_free_full(files, (GDestroyNotify) vips_disc_file_free);
+}
+
+/* Make the cache file @filename of @length bytes, starting with @header, if
+ * it doesn't exist yet. We write a temp file and rename it into place, so
+ * other processes only ever see a complete, initialised file. If two
+ * processes race, the second rename replaces the first file. Anything
+ * written to that in the meantime is lost, but never mixed up.
+ */
+static int
+vips_block_cache_disc_create(const char *filename,
+	VipsDiscTileHeader *header, guint64 length)
+{
+	char *temp;
+	int fd;
+
+	if (g_file_test(filename, G_FILE_TEST_EXISTS))
+		return 0;
+
+	temp = g_strdup_printf("%s.XXXXXX", filename);
+	if ((fd = g_mkstemp_full(temp, BINARYIZE(O_RDWR), 0666)) == -1) {
+		vips_error_system(errno, "tilecache",
+			_("unable to create \"%s\""), temp);
+		g_free(temp);
+		return -1;
+	}
+
+	if (vips__ftruncate(fd, length) ||
+		vips__write(fd, header, sizeof(VipsDiscTileHeader))) {
+		g_close(fd, NULL);
+		g_unlink(temp);
+		g_free(temp);
+		return -1;
+	}
+	g_close(fd, NULL);
+
+	if (vips_rename(temp, filename)) {
+		g_unlink(temp);
+		g_free(temp);
+		return -1;
+	}
+	g_free(temp);
+
+	return 0;
+}
+
+/* Open the disc tier. We key the cache file on the digest of the input image,
+ * so any process that makes the same pixels can share it. Failing to open
+ * the disc tier is not an error, we just run without it.
+ */
+static void
+vips_block_cache_disc_open(VipsBlockCache *cache)
+{
+	VipsImage *in = cache->in;
+	const int tw = cache->tile_width;
+	const int th = cache->tile_height;
+	const int tiles_across = VIPS_ROUND_UP(in->Xsize, tw) / tw;
+	const int tiles_down = VIPS_ROUND_UP(in->Ysize, th) / th;
+	const guint64 n_tiles = (guint64) tiles_across * tiles_down;
+	const guint64 tile_size =
+		(guint64) tw * th * VIPS_IMAGE_SIZEOF_PEL(in);
+	const guint64 header_size = VIPS_ROUND_UP(
+		sizeof(VipsDiscTileHeader) + n_tiles * sizeof(gint),
+		VIPS_DISC_TILE_ALIGN);
+	const guint64 length = header_size + n_tiles * tile_size;
+
+	const char *digest;
+	char name[256];
+	char *filename;
+	struct stat st;
+	VipsDiscTileHeader header;
+	VipsDiscTileHeader *disc_header;
+
+	if (!(digest = vips__image_get_digest(in))) {
+		g_info("tilecache: input has no stable digest, "
+			   "disc cache disabled");
+		return;
+	}
+
+	if (length > G_MAXSIZE ||
+		length > vips_cache_get_max_tile_disc()) {
+		g_info("tilecache: image too large for disc cache, "
+			   "disc cache disabled");
+		return;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, VIPS_DISC_TILE_MAGIC, sizeof(header.magic));
+	header.width = in->Xsize;
+	header.height = in->Ysize;
+	header.bands = in->Bands;
+	header.format = in->BandFmt;
+	header.coding = in->Coding;
+	header.tile_width = tw;
+	header.tile_height = th;
+
+	g_snprintf(name, 256, "%s-%dx%d.vtc", digest, tw, th);
+	vips_block_cache_disc_trim(cache->cache_dir, name, length);
+
+	filename = g_build_filename(cache->cache_dir, name, NULL);
+	if (vips_block_cache_disc_create(filename, &header, length)) {
+		g_free(filename);
+		g_warning("%s", vips_error_buffer());
+		vips_error_clear();
+		return;
+	}
+	cache->disc_fd = vips_tracked_open(filename, O_RDWR, 0666);
+
+	/* Mark as recently used for trim.
+	 */
+	if (cache->disc_fd != -1)
+		(void) g_utime(filename, NULL);
+	g_free(filename);
+	if (cache->disc_fd == -1 ||
+		fstat(cache->disc_fd, &st)) {
+		g_warning("%s", vips_error_buffer());
+		vips_error_clear();
+		return;
+	}
+
+	if ((guint64) st.st_size != length) {
+		g_warning("tilecache: bad length for disc cache, "
+				  "disc cache disabled");
+		return;
+	}
+
+	if (!(cache->disc_base =
+				vips__mmap(cache->disc_fd, 1, length, 0))) {
+		vips_error_clear();
+		return;
+	}
+	cache->disc_length = length;
+
+	disc_header = (VipsDiscTileHeader *) cache->disc_base;
+	if (memcmp(disc_header, &header, sizeof(header)) != 0) {
+		g_warning("tilecache: bad header in disc cache, "
+				  "disc cache disabled");
+		vips__munmap(cache->disc_base, cache->disc_length);
+		cache->disc_base = NULL;
+		return;
+	}
+
+	cache->disc_tile_size = tile_size;
+	cache->disc_tiles_across = tiles_across;
+	cache->disc_checksum = (gint *) (cache->disc_base + sizeof(header));
+	cache->disc_data = cache->disc_base + header_size;
+}
+
+static char *
+vips_block_cache_disc_tile(VipsBlockCache *cache, VipsTile *tile)
+{
+	int index = (tile->pos.top / cache->tile_height) *
+			cache->disc_tiles_across +
+		tile->pos.left / cache->tile_width;
+
+	return cache->disc_data + index * cache->disc_tile_size;
+}
+
+static gint *
+vips_block_cache_disc_checksum(VipsBlockCache *cache, VipsTile *tile)
+{
+	int index = (tile->pos.top / cache->tile_height) *
+			cache->disc_tiles_across +
+		tile->pos.left / cache->tile_width;
+
+	return &cache->disc_checksum[index];
+}
+
+/* FNV-1a, but a word at a time.
+ */
+#define VIPS_DISC_FNV_BASIS G_GUINT64_CONSTANT(14695981039346656037)
+#define VIPS_DISC_FNV_PRIME G_GUINT64_CONSTANT(1099511628211)
+
+/* Checksum the pixels of a tile on disc. We never flush the mapping, so
+ * after a crash a tile's checksum can reach disc before its pixels. A
+ * mismatch on read means we just calculate the tile again. Zero means no
+ * tile, so it's never a checksum.
+ */
+static guint32
+vips_block_cache_disc_sum(VipsBlockCache *cache, VipsTile *tile)
+{
+	VipsRect *valid = &tile->region->valid;
+	size_t line_size = VIPS_IMAGE_SIZEOF_PEL(cache->in) * valid->width;
+	size_t disc_line_size =
+		VIPS_IMAGE_SIZEOF_PEL(cache->in) * cache->tile_width;
+	const char *p = vips_block_cache_disc_tile(cache, tile);
+
+	guint64 hash;
+	guint32 sum;
+	size_t i;
+	int y;
+
+	hash = VIPS_DISC_FNV_BASIS;
+	for (y = 0; y < valid->height; y++) {
+		for (i = 0; i + sizeof(guint64) <= line_size;
+			 i += sizeof(guint64)) {
+			guint64 word;
+
+			memcpy(&word, p + i, sizeof(guint64));
+			hash = (hash ^ word) * VIPS_DISC_FNV_PRIME;
+		}
+		for (; i < line_size; i++)
+			hash = (hash ^ (guchar) p[i]) * VIPS_DISC_FNV_PRIME;
+
+		p += disc_line_size;
+	}
+
+	sum = (guint32) (hash ^ (hash >> 32));
+
+	return sum ? sum : 1;
+}
+
+/* Try to fill a tile from the disc tier. TRUE for success.
+ */
+static gboolean
+vips_block_cache_disc_read(VipsBlockCache *cache, VipsTile *tile)
+{
+	VipsRect *valid = &tile->region->valid;
+	guint32 checksum;
+	size_t line_size;
+	size_t disc_line_size;
+	char *p;
+	int y;
+
+	if (!cache->disc_base)
+		return FALSE;
+
+	checksum = (guint32) g_atomic_int_get(
+		vips_block_cache_disc_checksum(cache, tile));
+	if (!checksum ||
+		checksum != vips_block_cache_disc_sum(cache, tile))
+		return FALSE;
+
+	line_size = VIPS_IMAGE_SIZEOF_PEL(cache->in) * valid->width;
+	disc_line_size = VIPS_IMAGE_SIZEOF_PEL(cache->in) * cache->tile_width;
+	p = vips_block_cache_disc_tile(cache, tile);
+	for (y = 0; y < valid->height; y++) {
+		memcpy(VIPS_REGION_ADDR(tile->region,
+				   valid->left, valid->top + y),
+			p, line_size);
+		p += disc_line_size;
+	}
+
+	return TRUE;
+}
+
+/* Write a calculated tile to the disc tier as it leaves memory, so we only
+ * copy tiles once, and not while workers are waiting for them. Other threads
+ * and processes only see the tile once its checksum is set.
+ */
+static void
+vips_block_cache_disc_write(VipsBlockCache *cache, VipsTile *tile)
+{
+	VipsRect *valid;
+	size_t line_size;
+	size_t disc_line_size;
+	char *q;
+	int y;
+
+	if (!tile->dirty)
+		return;
+	tile->dirty = FALSE;
+
+	if (!cache->disc_base)
+		return;
+
+	valid = &tile->region->valid;
+	line_size = VIPS_IMAGE_SIZEOF_PEL(cache->in) * valid->width;
+	disc_line_size = VIPS_IMAGE_SIZEOF_PEL(cache->in) * cache->tile_width;
+	q = vips_block_cache_disc_tile(cache, tile);
+	for (y = 0; y < valid->height; y++) {
+		memcpy(q,
+			VIPS_REGION_ADDR(tile->region,
+				valid->left, valid->top + y),
+			line_size);
+		q += disc_line_size;
+	}
+
+	g_atomic_int_set(vips_block_cache_disc_checksum(cache, tile),
+		(gint) vips_block_cache_disc_sum(cache, tile));
+}
+
 static int
 vips_tile_move(VipsTile *tile, int x, int y)
 {
@@ -207,6 +627,7 @@ vips_tile_new(VipsBlockCache *cache, int x, int y)
 	tile->state = VIPS_TILE_STATE_PEND;
 	tile->ref_count = 0;
 	tile->region = NULL;
+	tile->dirty = FALSE;
 	tile->pos.left = x;
 	tile->pos.top = y;
 	tile->pos.width = cache->tile_width;
@@ -326,6 +747,8 @@ vips_tile_find(VipsBlockCache *cache, int x, int y)
 	VIPS_DEBUG_MSG_RED("vips_tile_find: reusing tile %d x %d\n",
 		tile->pos.left, tile->pos.top);
 
+	vips_block_cache_disc_write(cache, tile);
+
 	if (vips_tile_move(tile, x, y))
 		return NULL;
 
@@ -467,6 +890,8 @@ vips_tile_destroy(VipsTile *tile)
 	g_assert(g_queue_find(tile->cache->recycle, tile));
 	g_queue_remove(cache->recycle, tile);
 
+	vips_block_cache_disc_write(cache, tile);
+
 	cache->ntiles -= 1;
 	g_assert(cache->ntiles >= 0);
 	tile->cache = NULL;
@@ -485,6 +910,7 @@ vips_block_cache_init(VipsBlockCache *cache)
 	cache->access = VIPS_ACCESS_RANDOM;
 	cache->threaded = FALSE;
 	cache->persistent = FALSE;
+	cache->disc_fd = -1;
 
 	cache->ntiles = 0;
 	cache->lock = vips_g_mutex_new();
@@ -683,13 +1109,29 @@ vips_tile_cache_gen(VipsRegion *out_region,
 					g_mutex_unlock(cache->lock);
 
 				/* Don't compute if we've seen an error
-				 * previously.
+				 * previously. Try the shared tile store, then
+				 * the disc tier, and put anything we
+				 * calculate back in the store. It goes to
+				 * disc when it leaves memory.
 				 */
-				if (!result)
-					result = vips_region_prepare_to(in,
-						tile->region,
-						&tile->pos,
-						tile->pos.left, tile->pos.top);
+				if (!result &&
+					!vips__tile_store_get(cache->in,
+						tile->region)) {
+					if (!vips_block_cache_disc_read(cache,
+							tile)) {
+						result = vips_region_prepare_to(in,
+							tile->region,
+							&tile->pos,
+							tile->pos.left, tile->pos.top);
+
+						if (!result)
+							tile->dirty = TRUE;
+					}
+
+					if (!result)
+						vips__tile_store_put(cache->in,
+							tile->region);
+				}
 
 				if (cache->threaded) {
 					VIPS_GATE_START("vips_tile_cache_gen: wait2");
@@ -775,6 +1217,9 @@ vips_tile_cache_build(VipsObject *object)
 	if (vips_image_pio_input(block_cache->in))
 		return -1;
 
+	if (block_cache->cache_dir)
+		vips_block_cache_disc_open(block_cache);
+
 	if (vips_image_pipelinev(conversion->out,
 			VIPS_DEMAND_STYLE_SMALLTILE, block_cache->in, NULL))
 		return -1;
@@ -815,6 +1260,13 @@ vips_tile_cache_class_init(VipsTileCacheClass *class)
 		VIPS_ARGUMENT_OPTIONAL_INPUT,
 		G_STRUCT_OFFSET(VipsBlockCache, max_tiles),
 		-1, 1000000, 1000);
+
+	VIPS_ARG_STRING(class, "cache_dir", 9,
+		_("Cache directory"),
+		_("Directory for a persistent on-disc tile cache"),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET(VipsBlockCache, cache_dir),
+		NULL);
 }
 
 static void
@@ -836,6 +1288,7 @@ vips_tile_cache_init(VipsTileCache *cache)
  * * @access: hint expected access pattern #VipsAccess
  * * @threaded: allow many threads
  * * @persistent: don't drop cache at end of computation
+ * * @cache_dir: %gchararray, directory for a persistent on-disc cache
  *
  * This operation behaves rather like vips_copy() between images
  * @in and @out, except that it keeps a cache of computed pixels.
@@ -861,6 +1314,21 @@ vips_tile_cache_init(VipsTileCache *cache)
  * Normally the cache is dropped when computation finishes. Set @persistent to
  * %TRUE to keep the cache between computations.
  *
+ * If vips_cache_set_max_tile_mem() has been called, tiles are also shared
+ * with any other tile or line cache over the same image.
+ *
+ * Set @cache_dir to add a second tier on disc. Every tile that is
+ * calculated is also written to a memory-mapped file in that directory as it
+ * leaves memory, and tiles are read back from it rather than recalculated.
+ * Tiles are checksummed, so a tile damaged by a crash is just calculated
+ * again. The file is named
+ * from a digest of the operations and files that made @in, so other
+ * processes making the same image will share it. Images from memory, blobs
+ * or sources have no digest and are not cached on disc.
+ *
+ * When a new file would take @cache_dir over vips_cache_get_max_tile_disc(),
+ * the least-recently-used files in it are removed first.
+ *
  * See also: vips_cache(), vips_linecache().
  *
  * Returns: 0 on success, -1 on error.
@@ -1028,6 +1496,9 @@ vips_line_cache_init(VipsLineCache *cache)
  * you set @threaded to %TRUE, vips_linecache() will allow many threads to
  * calculate tiles at once and share the cache between them.
  *
+ * If vips_cache_set_max_tile_mem() has been called, lines are also shared
+ * with any other tile or line cache over the same image.
+ *
  * See also: vips_cache(), vips_tilecache().
  *
  * Returns: 0 on success, -1 on error.
@@ -9,6 +9,8 @@
  *      - from im_conv()
  * 5/7/16
  * 	- redone as a class
+ * 16/10/26
+ * 	- add a vector path for the vertical pass
  */
 
 /*
@@ -83,6 +85,7 @@
 #include <math.h>
 
 #include <vips/vips.h>
+#include <vips/vector.h>
 #include <vips/debug.h>
 #include <vips/internal.h>
 
@@ -350,6 +353,15 @@ typedef struct {
 	double *dsum;
 
 	int last_stride; /* Avoid recalcing offsets, if we can */
+
+#ifdef HAVE_HWY
+	/* The vector path keeps a running total for each line at each point
+	 * on the scanline, plus a scanline of weighted sums.
+	 */
+	int *line;
+	int *total;
+	int sz;
+#endif /*HAVE_HWY*/
 } VipsConvasepSeq;
 
 /* Free a sequence value.
@@ -364,6 +376,10 @@ vips_convasep_stop(void *vseq, void *a, void *b)
 	VIPS_FREE(seq->end);
 	VIPS_FREE(seq->isum);
 	VIPS_FREE(seq->dsum);
+#ifdef HAVE_HWY
+	VIPS_FREE(seq->line);
+	VIPS_FREE(seq->total);
+#endif /*HAVE_HWY*/
 
 	return 0;
 }
@@ -394,6 +410,11 @@ vips_convasep_start(VipsImage *out, void *a, void *b)
 	else
 		seq->dsum = VIPS_ARRAY(NULL, convasep->n_lines, double);
 	seq->last_stride = -1;
+#ifdef HAVE_HWY
+	seq->line = NULL;
+	seq->total = NULL;
+	seq->sz = 0;
+#endif /*HAVE_HWY*/
 
 	if (!seq->ir ||
 		!seq->start ||
@@ -812,6 +833,74 @@ vips_convasep_generate_vertical(VipsRegion *out_region,
 	return 0;
 }
 
+#ifdef HAVE_HWY
+/* The vertical pass for 8- and 16-bit images. We move the running totals
+ * down a whole scanline at once, see convasep_hwy.cpp.
+ */
+static int
+vips_convasep_generate_vertical_vector(VipsRegion *out_region,
+	void *vseq, void *a, void *b, gboolean *stop)
+{
+	VipsConvasepSeq *seq = (VipsConvasepSeq *) vseq;
+	VipsImage *in = (VipsImage *) a;
+	VipsConvasep *convasep = (VipsConvasep *) b;
+
+	VipsRegion *ir = seq->ir;
+	const int n_lines = convasep->n_lines;
+	VipsRect *r = &out_region->valid;
+	int sz = VIPS_REGION_N_ELEMENTS(out_region);
+
+	VipsRect s;
+	int z;
+	int istride;
+
+	s = *r;
+	s.height += convasep->width - 1;
+	if (vips_region_prepare(ir, &s))
+		return -1;
+
+	istride = VIPS_REGION_LSKIP(ir) / VIPS_IMAGE_SIZEOF_ELEMENT(in);
+
+	if (seq->last_stride != istride) {
+		seq->last_stride = istride;
+
+		for (z = 0; z < n_lines; z++) {
+			seq->start[z] = convasep->start[z] * istride;
+			seq->end[z] = convasep->end[z] * istride;
+		}
+	}
+
+	/* Regions are usually the same size, so we only need to realloc at
+	 * the start.
+	 */
+	if (seq->sz < sz) {
+		VIPS_FREE(seq->line);
+		VIPS_FREE(seq->total);
+		seq->line = VIPS_ARRAY(NULL, n_lines * sz, int);
+		seq->total = VIPS_ARRAY(NULL, sz, int);
+		if (!seq->line ||
+			!seq->total) {
+			seq->sz = 0;
+			return -1;
+		}
+		seq->sz = sz;
+	}
+
+	VIPS_GATE_START("vips_convasep_generate_vertical_vector: work");
+
+	vips_convasep_vertical_hwy(out_region, ir, r,
+		sz, n_lines, seq->start, seq->end, convasep->factor,
+		convasep->rounding, convasep->divisor, convasep->offset,
+		seq->line, seq->total);
+
+	VIPS_GATE_STOP("vips_convasep_generate_vertical_vector: work");
+
+	VIPS_COUNT_PIXELS(out_region, "vips_convasep_generate_vertical_vector");
+
+	return 0;
+}
+#endif /*HAVE_HWY*/
+
 static int
 vips_convasep_pass(VipsConvasep *convasep,
 	VipsImage *in, VipsImage **out, VipsDirection direction)
@@ -832,6 +921,21 @@ vips_convasep_pass(VipsConvasep *convasep,
 	else {
 		(*out)->Ysize -= convasep->width - 1;
 		gen = vips_convasep_generate_vertical;
+
+		/* Running sums are independent across the scanline, so the
+		 * vertical pass vectorises well. The horizontal pass carries
+		 * each sum along the scanline and stays in C.
+		 */
+#ifdef HAVE_HWY
+		if ((in->BandFmt == VIPS_FORMAT_UCHAR ||
+				in->BandFmt == VIPS_FORMAT_CHAR ||
+				in->BandFmt == VIPS_FORMAT_USHORT ||
+				in->BandFmt == VIPS_FORMAT_SHORT) &&
+			vips_vector_isenabled()) {
+			gen = vips_convasep_generate_vertical_vector;
+			g_info("convasep: using vector path");
+		}
+#endif /*HAVE_HWY*/
 	}
 
 	if ((*out)->Xsize <= 0 ||
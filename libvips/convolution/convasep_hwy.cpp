@@ -0,0 +1,279 @@
+/* 16/10/26
+ * 	- from convf_hwy.cpp
+ */
+
+/*
+
+	This file is part of VIPS.
+
+	VIPS is free software; you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+	02110-1301  USA
+
+ */
+
+/*
+
+	These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <glib/gi18n-lib.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#include <vips/vips.h>
+#include <vips/vector.h>
+#include <vips/debug.h>
+#include <vips/internal.h>
+
+#include "pconvolution.h"
+
+#ifdef HAVE_HWY
+
+#undef HWY_TARGET_INCLUDE
+#define HWY_TARGET_INCLUDE "libvips/convolution/convasep_hwy.cpp"
+#include <hwy/foreach_target.h>
+#include <hwy/highway.h>
+
+namespace HWY_NAMESPACE {
+
+using namespace hwy::HWY_NAMESPACE;
+
+using DI32 = ScalableTag<int32_t>;
+constexpr DI32 di32;
+
+template <typename T>
+HWY_INLINE Vec<DI32>
+load_promote(const T *HWY_RESTRICT p)
+{
+	return PromoteTo(di32, LoadU(Rebind<T, DI32>(), p));
+}
+
+HWY_INLINE void
+clip_store(uint8_t *HWY_RESTRICT q, int32_t v)
+{
+	*q = VIPS_CLIP(0, v, UCHAR_MAX);
+}
+
+HWY_INLINE void
+clip_store(int8_t *HWY_RESTRICT q, int32_t v)
+{
+	*q = VIPS_CLIP(SCHAR_MIN, v, SCHAR_MAX);
+}
+
+HWY_INLINE void
+clip_store(uint16_t *HWY_RESTRICT q, int32_t v)
+{
+	*q = VIPS_CLIP(0, v, USHRT_MAX);
+}
+
+HWY_INLINE void
+clip_store(int16_t *HWY_RESTRICT q, int32_t v)
+{
+	*q = VIPS_CLIP(SHRT_MIN, v, SHRT_MAX);
+}
+
+/* The vertical pass, a whole scanline at a time. @line holds the running
+ * total for each line of the mask at each point on the scanline, @total is
+ * the weighted sum of the lines for the current output scanline.
+ */
+template <typename T>
+HWY_INLINE void
+convasep_vertical_hwy(VipsRegion *out_region, VipsRegion *ir, VipsRect *r,
+	int32_t sz, int32_t n_lines,
+	const int32_t *HWY_RESTRICT start, const int32_t *HWY_RESTRICT end,
+	const int32_t *HWY_RESTRICT factor,
+	int32_t rounding, int32_t divisor, int32_t offset,
+	int32_t *HWY_RESTRICT line, int32_t *HWY_RESTRICT total)
+{
+	const int32_t N = Lanes(di32);
+	const int32_t istride = VIPS_REGION_LSKIP(ir) / sizeof(T);
+	const T *HWY_RESTRICT p0 = (T *) VIPS_REGION_ADDR(ir, r->left, r->top);
+
+	for (int32_t y = 0; y < r->height; ++y) {
+		T *HWY_RESTRICT q =
+			(T *) VIPS_REGION_ADDR(out_region, r->left, r->top + y);
+
+		int32_t x = 0;
+		for (; x + N <= sz; x += N) {
+			auto sum = Zero(di32);
+
+			for (int32_t z = 0; z < n_lines; ++z) {
+				int32_t *HWY_RESTRICT l = line + z * sz + x;
+				Vec<DI32> v;
+
+				if (y == 0) {
+					/* Sum the first window.
+					 */
+					v = Zero(di32);
+					for (int32_t k = start[z]; k < end[z]; k += istride)
+						v = Add(v, load_promote(p0 + x + k));
+				}
+				else {
+					/* Slide the window down a line.
+					 */
+					const T *HWY_RESTRICT p = p0 + (y - 1) * istride + x;
+
+					v = LoadU(di32, l);
+					v = Add(v, load_promote(p + end[z]));
+					v = Sub(v, load_promote(p + start[z]));
+				}
+
+				StoreU(v, di32, l);
+				sum = Add(sum, Mul(v, Set(di32, factor[z])));
+			}
+
+			StoreU(sum, di32, total + x);
+		}
+
+		/* `sz` was not a multiple of the vector length `N`;
+		 * proceed one by one.
+		 */
+		for (; x < sz; ++x) {
+			int32_t sum = 0;
+
+			for (int32_t z = 0; z < n_lines; ++z) {
+				int32_t *HWY_RESTRICT l = line + z * sz + x;
+
+				if (y == 0) {
+					*l = 0;
+					for (int32_t k = start[z]; k < end[z]; k += istride)
+						*l += p0[x + k];
+				}
+				else {
+					const T *HWY_RESTRICT p = p0 + (y - 1) * istride + x;
+
+					*l += p[end[z]];
+					*l -= p[start[z]];
+				}
+
+				sum += factor[z] * *l;
+			}
+
+			total[x] = sum;
+		}
+
+		/* There's no vector integer divide, so finish one by one.
+		 */
+		for (x = 0; x < sz; ++x)
+			clip_store(q + x,
+				(total[x] + rounding) / divisor + offset);
+	}
+}
+
+HWY_ATTR void
+vips_convasep_vertical_uchar_hwy(VipsRegion *out_region, VipsRegion *ir,
+	VipsRect *r, int32_t sz, int32_t n_lines,
+	const int32_t *HWY_RESTRICT start, const int32_t *HWY_RESTRICT end,
+	const int32_t *HWY_RESTRICT factor,
+	int32_t rounding, int32_t divisor, int32_t offset,
+	int32_t *HWY_RESTRICT line, int32_t *HWY_RESTRICT total)
+{
+	convasep_vertical_hwy<uint8_t>(out_region, ir, r, sz, n_lines,
+		start, end, factor, rounding, divisor, offset, line, total);
+}
+
+HWY_ATTR void
+vips_convasep_vertical_char_hwy(VipsRegion *out_region, VipsRegion *ir,
+	VipsRect *r, int32_t sz, int32_t n_lines,
+	const int32_t *HWY_RESTRICT start, const int32_t *HWY_RESTRICT end,
+	const int32_t *HWY_RESTRICT factor,
+	int32_t rounding, int32_t divisor, int32_t offset,
+	int32_t *HWY_RESTRICT line, int32_t *HWY_RESTRICT total)
+{
+	convasep_vertical_hwy<int8_t>(out_region, ir, r, sz, n_lines,
+		start, end, factor, rounding, divisor, offset, line, total);
+}
+
+HWY_ATTR void
+vips_convasep_vertical_ushort_hwy(VipsRegion *out_region, VipsRegion *ir,
+	VipsRect *r, int32_t sz, int32_t n_lines,
+	const int32_t *HWY_RESTRICT start, const int32_t *HWY_RESTRICT end,
+	const int32_t *HWY_RESTRICT factor,
+	int32_t rounding, int32_t divisor, int32_t offset,
+	int32_t *HWY_RESTRICT line, int32_t *HWY_RESTRICT total)
+{
+	convasep_vertical_hwy<uint16_t>(out_region, ir, r, sz, n_lines,
+		start, end, factor, rounding, divisor, offset, line, total);
+}
+
+HWY_ATTR void
+vips_convasep_vertical_short_hwy(VipsRegion *out_region, VipsRegion *ir,
+	VipsRect *r, int32_t sz, int32_t n_lines,
+	const int32_t *HWY_RESTRICT start, const int32_t *HWY_RESTRICT end,
+	const int32_t *HWY_RESTRICT factor,
+	int32_t rounding, int32_t divisor, int32_t offset,
+	int32_t *HWY_RESTRICT line, int32_t *HWY_RESTRICT total)
+{
+	convasep_vertical_hwy<int16_t>(out_region, ir, r, sz, n_lines,
+		start, end, factor, rounding, divisor, offset, line, total);
+}
+
+} /*namespace HWY_NAMESPACE*/
+
+#if HWY_ONCE
+HWY_EXPORT(vips_convasep_vertical_uchar_hwy);
+HWY_EXPORT(vips_convasep_vertical_char_hwy);
+HWY_EXPORT(vips_convasep_vertical_ushort_hwy);
+HWY_EXPORT(vips_convasep_vertical_short_hwy);
+
+void
+vips_convasep_vertical_hwy(VipsRegion *out_region, VipsRegion *ir,
+	VipsRect *r, int sz, int n_lines,
+	const int *restrict start, const int *restrict end,
+	const int *restrict factor,
+	int rounding, int divisor, int offset,
+	int *restrict line, int *restrict total)
+{
+	/* clang-format off */
+	switch (ir->im->BandFmt) {
+	case VIPS_FORMAT_UCHAR:
+		HWY_DYNAMIC_DISPATCH(vips_convasep_vertical_uchar_hwy)(out_region,
+			ir, r, sz, n_lines, start, end, factor,
+			rounding, divisor, offset, line, total);
+		break;
+
+	case VIPS_FORMAT_CHAR:
+		HWY_DYNAMIC_DISPATCH(vips_convasep_vertical_char_hwy)(out_region,
+			ir, r, sz, n_lines, start, end, factor,
+			rounding, divisor, offset, line, total);
+		break;
+
+	case VIPS_FORMAT_USHORT:
+		HWY_DYNAMIC_DISPATCH(vips_convasep_vertical_ushort_hwy)(out_region,
+			ir, r, sz, n_lines, start, end, factor,
+			rounding, divisor, offset, line, total);
+		break;
+
+	case VIPS_FORMAT_SHORT:
+		HWY_DYNAMIC_DISPATCH(vips_convasep_vertical_short_hwy)(out_region,
+			ir, r, sz, n_lines, start, end, factor,
+			rounding, divisor, offset, line, total);
+		break;
+
+	default:
+		g_assert_not_reached();
+		break;
+	}
+	/* clang-format on */
+}
+#endif /*HWY_ONCE*/
+
+#endif /*HAVE_HWY*/
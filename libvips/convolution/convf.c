@@ -51,6 +51,8 @@
  * 	- remove pts for a small speedup
  * 2/8/22 kleisauke
  * 	- bake the scale into the mask
+ * 16/10/26
+ * 	- add a vector path
  */
 
 /*
@@ -94,6 +96,7 @@
 #include <limits.h>
 
 #include <vips/vips.h>
+#include <vips/vector.h>
 
 #include "pconvolution.h"
 
@@ -280,6 +283,66 @@ vips_convf_gen(VipsRegion *out_region,
 	return 0;
 }
 
+#ifdef HAVE_HWY
+static int
+vips_convf_vector_gen(VipsRegion *out_region,
+	void *vseq, void *a, void *b, gboolean *stop)
+{
+	VipsConvfSequence *seq = (VipsConvfSequence *) vseq;
+	VipsConvf *convf = (VipsConvf *) b;
+	VipsConvolution *convolution = (VipsConvolution *) convf;
+	VipsImage *M = convolution->M;
+	double offset = vips_image_get_offset(M);
+	VipsImage *in = (VipsImage *) a;
+	VipsRegion *ir = seq->ir;
+	const int nnz = convf->nnz;
+	VipsRect *r = &out_region->valid;
+	int ne = VIPS_REGION_N_ELEMENTS(out_region) *
+		(vips_band_format_iscomplex(in->BandFmt) ? 2 : 1);
+
+	VipsRect s;
+	int x, y, z, i;
+
+	/* Prepare the section of the input image we need. A little larger
+	 * than the section of the output image we are producing.
+	 */
+	s = *r;
+	s.width += M->Xsize - 1;
+	s.height += M->Ysize - 1;
+	if (vips_region_prepare(ir, &s))
+		return -1;
+
+	/* Fill offset array. Only do this if the bpl has changed since the
+	 * previous vips_region_prepare().
+	 */
+	if (seq->last_bpl != VIPS_REGION_LSKIP(ir)) {
+		seq->last_bpl = VIPS_REGION_LSKIP(ir);
+
+		for (i = 0; i < nnz; i++) {
+			z = convf->coeff_pos[i];
+			x = z % M->Xsize;
+			y = z / M->Xsize;
+
+			seq->offsets[i] =
+				(VIPS_REGION_ADDR(ir, x + r->left, y + r->top) -
+					VIPS_REGION_ADDR(ir, r->left, r->top)) /
+				VIPS_IMAGE_SIZEOF_ELEMENT(ir->im);
+		}
+	}
+
+	VIPS_GATE_START("vips_convf_vector_gen: work");
+
+	vips_convf_hwy(out_region, ir, r,
+		ne, nnz, offset, seq->offsets, convf->coeff);
+
+	VIPS_GATE_STOP("vips_convf_vector_gen: work");
+
+	VIPS_COUNT_PIXELS(out_region, "vips_convf_vector_gen");
+
+	return 0;
+}
+#endif /*HAVE_HWY*/
+
 static int
 vips_convf_build(VipsObject *object)
 {
@@ -289,6 +352,7 @@ vips_convf_build(VipsObject *object)
 
 	VipsImage *in;
 	VipsImage *M;
+	VipsGenerateFn generate;
 	double *coeff;
 	int ne;
 	int i;
@@ -339,6 +403,26 @@ vips_convf_build(VipsObject *object)
 		return -1;
 	in = t[0];
 
+	/* 8- and 16-bit and float input can use a vector path. It accumulates
+	 * in double, like the C path.
+	 */
+#ifdef HAVE_HWY
+	if ((in->BandFmt == VIPS_FORMAT_UCHAR ||
+			in->BandFmt == VIPS_FORMAT_CHAR ||
+			in->BandFmt == VIPS_FORMAT_USHORT ||
+			in->BandFmt == VIPS_FORMAT_SHORT ||
+			in->BandFmt == VIPS_FORMAT_FLOAT ||
+			in->BandFmt == VIPS_FORMAT_COMPLEX) &&
+		vips_vector_isenabled()) {
+		generate = vips_convf_vector_gen;
+		g_info("convf: using vector path");
+	}
+	else
+#endif /*HAVE_HWY*/
+		/* Default to the C path.
+		 */
+		generate = vips_convf_gen;
+
 	g_object_set(convf, "out", vips_image_new(), NULL);
 	if (vips_image_pipelinev(convolution->out,
 			VIPS_DEMAND_STYLE_SMALLTILE, in, NULL))
@@ -356,7 +440,7 @@ vips_convf_build(VipsObject *object)
 	convolution->out->Ysize -= M->Ysize - 1;
 
 	if (vips_image_generate(convolution->out,
-			vips_convf_start, vips_convf_gen, vips_convf_stop, in, convf))
+			vips_convf_start, generate, vips_convf_stop, in, convf))
 		return -1;
 
 	convolution->out->Xoffset = -M->Xsize / 2;
@@ -0,0 +1,246 @@
+/* 16/10/26
+ * 	- from convi_hwy.cpp
+ * 	- accumulate in double, like the C path
+ * 	- plain C on targets without double vectors
+ */
+
+/*
+
+	This file is part of VIPS.
+
+	VIPS is free software; you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+	02110-1301  USA
+
+ */
+
+/*
+
+	These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <glib/gi18n-lib.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <vips/vips.h>
+#include <vips/vector.h>
+#include <vips/debug.h>
+#include <vips/internal.h>
+
+#include "pconvolution.h"
+
+#ifdef HAVE_HWY
+
+#undef HWY_TARGET_INCLUDE
+#define HWY_TARGET_INCLUDE "libvips/convolution/convf_hwy.cpp"
+#include <hwy/foreach_target.h>
+#include <hwy/highway.h>
+
+namespace HWY_NAMESPACE {
+
+using namespace hwy::HWY_NAMESPACE;
+
+/* Not all targets have double vectors, those run the plain C loop below.
+ */
+#if HWY_HAVE_FLOAT64
+using DF64 = ScalableTag<double>;
+using DF32 = Rebind<float, DF64>;
+using DI32 = Rebind<int32_t, DF64>;
+constexpr DF64 df64;
+constexpr DF32 df32;
+constexpr DI32 di32;
+
+/* Load a vector of pixels as double.
+ */
+template <typename T>
+HWY_INLINE Vec<DF64>
+load_double(const T *HWY_RESTRICT p)
+{
+	return PromoteTo(df64, PromoteTo(di32, LoadU(Rebind<T, DF64>(), p)));
+}
+
+HWY_INLINE Vec<DF64>
+load_double(const float *HWY_RESTRICT p)
+{
+	return PromoteTo(df64, LoadU(df32, p));
+}
+#endif /*HWY_HAVE_FLOAT64*/
+
+/* Accumulate in double, like the C path. We run across the scanline, so
+ * band count and mask shape don't matter.
+ */
+template <typename T>
+HWY_INLINE void
+convf_hwy(VipsRegion *out_region, VipsRegion *ir, VipsRect *r,
+	int32_t ne, int32_t nnz, double offset,
+	const int32_t *HWY_RESTRICT offsets, const double *HWY_RESTRICT coeff)
+{
+	const int32_t bo = VIPS_RECT_BOTTOM(r);
+#if HWY_HAVE_FLOAT64
+	const int32_t N = Lanes(df64);
+	const auto v_offset = Set(df64, offset);
+#endif
+
+	for (int32_t y = r->top; y < bo; ++y) {
+		const T *HWY_RESTRICT p =
+			(T *) VIPS_REGION_ADDR(ir, r->left, y);
+		float *HWY_RESTRICT q =
+			(float *) VIPS_REGION_ADDR(out_region, r->left, y);
+
+		int32_t x = 0;
+
+#if HWY_HAVE_FLOAT64
+		/* Main loop: two vectors at once.
+		 */
+		for (; x + 2 * N <= ne; x += 2 * N) {
+			auto sum0 = v_offset;
+			auto sum1 = v_offset;
+
+			for (int32_t i = 0; i < nnz; ++i) {
+				const auto mmk = Set(df64, coeff[i]);
+
+				/* Load with an offset.
+				 */
+				sum0 = MulAdd(mmk,
+					load_double(p + x + offsets[i]), sum0);
+				sum1 = MulAdd(mmk,
+					load_double(p + x + N + offsets[i]), sum1);
+			}
+
+			StoreU(DemoteTo(df32, sum0), df32, q + x);
+			StoreU(DemoteTo(df32, sum1), df32, q + x + N);
+		}
+		for (; x + N <= ne; x += N) {
+			auto sum0 = v_offset;
+
+			for (int32_t i = 0; i < nnz; ++i)
+				sum0 = MulAdd(Set(df64, coeff[i]),
+					load_double(p + x + offsets[i]), sum0);
+
+			StoreU(DemoteTo(df32, sum0), df32, q + x);
+		}
+#endif /*HWY_HAVE_FLOAT64*/
+
+		/* `ne` was not a multiple of the vector length `N`, or
+		 * there are no double vectors; proceed one by one.
+		 */
+		for (; x < ne; ++x) {
+			double sum = offset;
+
+			for (int32_t i = 0; i < nnz; ++i)
+				sum += coeff[i] * p[x + offsets[i]];
+
+			q[x] = sum;
+		}
+	}
+}
+
+HWY_ATTR void
+vips_convf_uchar_hwy(VipsRegion *out_region, VipsRegion *ir, VipsRect *r,
+	int32_t ne, int32_t nnz, double offset,
+	const int32_t *HWY_RESTRICT offsets, const double *HWY_RESTRICT coeff)
+{
+	convf_hwy<uint8_t>(out_region, ir, r, ne, nnz, offset, offsets, coeff);
+}
+
+HWY_ATTR void
+vips_convf_char_hwy(VipsRegion *out_region, VipsRegion *ir, VipsRect *r,
+	int32_t ne, int32_t nnz, double offset,
+	const int32_t *HWY_RESTRICT offsets, const double *HWY_RESTRICT coeff)
+{
+	convf_hwy<int8_t>(out_region, ir, r, ne, nnz, offset, offsets, coeff);
+}
+
+HWY_ATTR void
+vips_convf_ushort_hwy(VipsRegion *out_region, VipsRegion *ir, VipsRect *r,
+	int32_t ne, int32_t nnz, double offset,
+	const int32_t *HWY_RESTRICT offsets, const double *HWY_RESTRICT coeff)
+{
+	convf_hwy<uint16_t>(out_region, ir, r, ne, nnz, offset, offsets, coeff);
+}
+
+HWY_ATTR void
+vips_convf_short_hwy(VipsRegion *out_region, VipsRegion *ir, VipsRect *r,
+	int32_t ne, int32_t nnz, double offset,
+	const int32_t *HWY_RESTRICT offsets, const double *HWY_RESTRICT coeff)
+{
+	convf_hwy<int16_t>(out_region, ir, r, ne, nnz, offset, offsets, coeff);
+}
+
+HWY_ATTR void
+vips_convf_float_hwy(VipsRegion *out_region, VipsRegion *ir, VipsRect *r,
+	int32_t ne, int32_t nnz, double offset,
+	const int32_t *HWY_RESTRICT offsets, const double *HWY_RESTRICT coeff)
+{
+	convf_hwy<float>(out_region, ir, r, ne, nnz, offset, offsets, coeff);
+}
+
+} /*namespace HWY_NAMESPACE*/
+
+#if HWY_ONCE
+HWY_EXPORT(vips_convf_uchar_hwy);
+HWY_EXPORT(vips_convf_char_hwy);
+HWY_EXPORT(vips_convf_ushort_hwy);
+HWY_EXPORT(vips_convf_short_hwy);
+HWY_EXPORT(vips_convf_float_hwy);
+
+void
+vips_convf_hwy(VipsRegion *out_region, VipsRegion *ir, VipsRect *r,
+	int ne, int nnz, double offset,
+	const int *restrict offsets, const double *restrict coeff)
+{
+	/* clang-format off */
+	switch (ir->im->BandFmt) {
+	case VIPS_FORMAT_UCHAR:
+		HWY_DYNAMIC_DISPATCH(vips_convf_uchar_hwy)(out_region, ir, r,
+			ne, nnz, offset, offsets, coeff);
+		break;
+
+	case VIPS_FORMAT_CHAR:
+		HWY_DYNAMIC_DISPATCH(vips_convf_char_hwy)(out_region, ir, r,
+			ne, nnz, offset, offsets, coeff);
+		break;
+
+	case VIPS_FORMAT_USHORT:
+		HWY_DYNAMIC_DISPATCH(vips_convf_ushort_hwy)(out_region, ir, r,
+			ne, nnz, offset, offsets, coeff);
+		break;
+
+	case VIPS_FORMAT_SHORT:
+		HWY_DYNAMIC_DISPATCH(vips_convf_short_hwy)(out_region, ir, r,
+			ne, nnz, offset, offsets, coeff);
+		break;
+
+	case VIPS_FORMAT_FLOAT:
+	case VIPS_FORMAT_COMPLEX:
+		HWY_DYNAMIC_DISPATCH(vips_convf_float_hwy)(out_region, ir, r,
+			ne, nnz, offset, offsets, coeff);
+		break;
+
+	default:
+		g_assert_not_reached();
+		break;
+	}
+	/* clang-format on */
+}
+#endif /*HWY_ONCE*/
+
+#endif /*HAVE_HWY*/
@@ -74,6 +74,15 @@ GType vips_convolution_get_type(void);
 void vips_convi_uchar_hwy(VipsRegion *out_region, VipsRegion *ir, VipsRect *r,
 	int ne, int nnz, int offset, const int *restrict offsets,
 	const short *restrict mant, int exp);
+void vips_convf_hwy(VipsRegion *out_region, VipsRegion *ir, VipsRect *r,
+	int ne, int nnz, double offset,
+	const int *restrict offsets, const double *restrict coeff);
+void vips_convasep_vertical_hwy(VipsRegion *out_region, VipsRegion *ir,
+	VipsRect *r, int sz, int n_lines,
+	const int *restrict start, const int *restrict end,
+	const int *restrict factor,
+	int rounding, int divisor, int offset,
+	int *restrict line, int *restrict total);
 
 #ifdef __cplusplus
 }
@@ -939,14 +939,21 @@ vips_foreign_load_temp(VipsForeignLoad *load)
 	}
 
 	/* We open via disc if the uncompressed image will be larger than
-	 * vips_get_disc_threshold()
+	 * vips_get_disc_threshold(). If vips_get_temp_memory() is set, the
+	 * temp file keeps compressed tiles in memory until that is used up,
+	 * then spills to disc.
 	 */
 	if (image_size > disc_threshold) {
+		VipsImage *image;
+
 #ifdef DEBUG
 		printf("vips_foreign_load_temp: disc temp\n");
 #endif /*DEBUG*/
 
-		return vips_image_new_temp_file("%s.v");
+		if ((image = vips_image_new_temp_file("%s.v")))
+			vips__vips_tiled_memory(image);
+
+		return image;
 	}
 
 #ifdef DEBUG
@@ -1054,11 +1061,25 @@ vips_foreign_load_generate(VipsRegion *out_region,
 
 	VipsRect *r = &out_region->valid;
 
+	VipsRect next;
+
 	/* Ask for input we need.
 	 */
 	if (vips_region_prepare(ir, r))
 		return -1;
 
+	/* We'll probably need the next tile to the right soon, or the start
+	 * of the next row of tiles. This does nothing unless the loader has
+	 * set vips_reorder_prefetch_hint().
+	 */
+	next = *r;
+	next.left += r->width;
+	if (next.left >= ir->im->Xsize) {
+		next.left = 0;
+		next.top += r->height;
+	}
+	vips_reorder_prefetch(ir, &next);
+
 	/* Attach output region to that.
 	 */
 	if (vips_region_region(out_region, ir, r, r->left, r->top))
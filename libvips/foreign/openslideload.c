@@ -816,6 +816,11 @@ vips__openslide_read(const char *filename, VipsImage *out,
 	}
 	g_object_unref(t);
 
+	/* Tiles are slow to read, and they are cached, so it's worth reading
+	 * ahead.
+	 */
+	vips_reorder_prefetch_hint(out);
+
 	return 0;
 }
 
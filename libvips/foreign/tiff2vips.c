@@ -2640,6 +2640,11 @@ rtiff_read_tilewise(Rtiff *rtiff, VipsImage *out)
 	if (vips_image_write(in, out))
 		return -1;
 
+	/* Decoding tiles is slow, and they are cached, so it's worth
+	 * decoding ahead.
+	 */
+	vips_reorder_prefetch_hint(out);
+
 	return 0;
 }
 
@@ -78,7 +78,8 @@ vips_foreign_load_vips_get_flags_source(VipsSource *source)
 	flags = VIPS_FOREIGN_PARTIAL;
 
 	if (vips_source_sniff_at_most(source, &data, 4) == 4 &&
-		*((guint32 *) data) == VIPS_MAGIC_SPARC)
+		(*((guint32 *) data) == VIPS_MAGIC_SPARC ||
+			*((guint32 *) data) == VIPS__MAGIC_TILED_SPARC))
 		flags |= VIPS_FOREIGN_BIGENDIAN;
 
 	return flags;
@@ -1,6 +1,8 @@
 /* save to vips
  *
  * 24/11/11
+ * 16/10/26
+ * 	- add "compression" and "tile_size"
  */
 
 /*
@@ -53,6 +55,11 @@ typedef struct _VipsForeignSaveVips {
 
 	VipsTarget *target;
 
+	/* Compress tiles with this.
+	 */
+	VipsForeignVipsCompression compression;
+	int tile_size;
+
 } VipsForeignSaveVips;
 
 typedef VipsForeignSaveClass VipsForeignSaveVipsClass;
@@ -90,8 +97,27 @@ vips_foreign_save_vips_build(VipsObject *object)
 		 * preventing recursion and sending this directly to the
 		 * saver built into iofuncs.
 		 */
+		if (vips->compression != VIPS_FOREIGN_VIPS_COMPRESSION_NONE &&
+			!vips__vips_tiled_supported(vips->compression)) {
+			VipsObjectClass *class = VIPS_OBJECT_GET_CLASS(object);
+
+			vips_error(class->nickname,
+				_("support for %s compression not built in"),
+				vips_enum_nick(VIPS_TYPE_FOREIGN_VIPS_COMPRESSION,
+					vips->compression));
+			return -1;
+		}
+
 		if (!(x = vips_image_new_mode(filename, "w")))
 			return -1;
+
+		/* Must be set before the header is written.
+		 */
+		if (vips->compression != VIPS_FOREIGN_VIPS_COMPRESSION_NONE) {
+			x->Compression = VIPS__COMPRESSION_TILED + vips->compression;
+			x->Level = vips->tile_size;
+		}
+
 		if (vips_image_write(save->ready, x)) {
 			g_object_unref(x);
 			return -1;
@@ -143,11 +169,28 @@ vips_foreign_save_vips_class_init(VipsForeignSaveVipsClass *class)
 	save_class->saveable = VIPS_SAVEABLE_ANY;
 	for (i = 0; i < VIPS_CODING_LAST; i++)
 		save_class->coding[i] = TRUE;
+
+	VIPS_ARG_ENUM(class, "compression", 10,
+		_("Compression"),
+		_("Compress tiles with this codec"),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET(VipsForeignSaveVips, compression),
+		VIPS_TYPE_FOREIGN_VIPS_COMPRESSION,
+		VIPS_FOREIGN_VIPS_COMPRESSION_NONE);
+
+	VIPS_ARG_INT(class, "tile_size", 11,
+		_("Tile size"),
+		_("Tile size in pixels for compressed images"),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET(VipsForeignSaveVips, tile_size),
+		16, 8192, VIPS__TILED_TILE_SIZE);
 }
 
 static void
 vips_foreign_save_vips_init(VipsForeignSaveVips *vips)
 {
+	vips->compression = VIPS_FOREIGN_VIPS_COMPRESSION_NONE;
+	vips->tile_size = VIPS__TILED_TILE_SIZE;
 }
 
 typedef struct _VipsForeignSaveVipsFile {
@@ -265,8 +308,19 @@ vips_foreign_save_vips_target_init(VipsForeignSaveVipsTarget *target)
  * @filename: file to write to
  * @...: %NULL-terminated list of optional named arguments
  *
+ * Optional arguments:
+ *
+ * * @compression: #VipsForeignVipsCompression, compress tiles with this
+ * * @tile_size: %gint, tile size for compressed images
+ *
  * Write @in to @filename in VIPS format.
  *
+ * Set @compression to store pixels as a grid of independently compressed
+ * tiles, each @tile_size pixels across. Readers decompress just the tiles
+ * they need. Compressed files are often much smaller, but can't be mapped
+ * directly, so random access is slower. The codecs available depend on
+ * how libvips was built.
+ *
  * See also: vips_vipsload().
  *
  * Returns: 0 on success, -1 on error.
@@ -445,6 +445,23 @@ int vips_vipsload(const char *filename, VipsImage **out, ...)
 VIPS_API
 int vips_vipsload_source(VipsSource *source, VipsImage **out, ...)
 	G_GNUC_NULL_TERMINATED;
+/**
+ * VipsForeignVipsCompression:
+ * @VIPS_FOREIGN_VIPS_COMPRESSION_NONE: plain scanlines
+ * @VIPS_FOREIGN_VIPS_COMPRESSION_DEFLATE: tiles compressed with zlib deflate
+ * @VIPS_FOREIGN_VIPS_COMPRESSION_ZSTD: tiles compressed with zstd
+ * @VIPS_FOREIGN_VIPS_COMPRESSION_LZ4: tiles compressed with lz4
+ *
+ * How to store pixels in a vips file, see vips_vipssave().
+ */
+typedef enum {
+	VIPS_FOREIGN_VIPS_COMPRESSION_NONE,
+	VIPS_FOREIGN_VIPS_COMPRESSION_DEFLATE,
+	VIPS_FOREIGN_VIPS_COMPRESSION_ZSTD,
+	VIPS_FOREIGN_VIPS_COMPRESSION_LZ4,
+	VIPS_FOREIGN_VIPS_COMPRESSION_LAST
+} VipsForeignVipsCompression;
+
 VIPS_API
 int vips_vipssave(VipsImage *in, const char *filename, ...)
 	G_GNUC_NULL_TERMINATED;
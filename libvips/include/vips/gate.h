@@ -73,6 +73,8 @@ extern gboolean vips__thread_profile;
 
 VIPS_API
 void vips_profile_set(gboolean profile);
+VIPS_API
+void vips_profile_set_trace(const char *filename);
 
 void vips__thread_profile_attach(const char *thread_name);
 void vips__thread_profile_detach(void);
@@ -500,6 +500,8 @@ void vips_image_set_delete_on_close(VipsImage *image,
 VIPS_API
 guint64 vips_get_disc_threshold(void);
 VIPS_API
+guint64 vips_get_temp_memory(void);
+VIPS_API
 VipsImage *vips_image_new_temp_file(const char *format);
 
 VIPS_API
@@ -594,6 +596,10 @@ int vips_reorder_prepare_many(VipsImage *image,
 	VipsRegion **regions, VipsRect *r);
 VIPS_API
 void vips_reorder_margin_hint(VipsImage *image, int margin);
+VIPS_API
+void vips_reorder_prefetch_hint(VipsImage *image);
+VIPS_API
+void vips_reorder_prefetch(VipsRegion *region, VipsRect *r);
 
 VIPS_API
 void vips_image_free_buffer(VipsImage *image, void *buffer);
@@ -145,17 +145,63 @@ extern int vips__info;
  */
 extern char *vips__disc_threshold;
 
+/* A string giving the memory budget for compressed temp images.
+ */
+extern char *vips__temp_memory;
+
 extern gboolean vips__cache_dump;
 extern gboolean vips__cache_trace;
 
 void vips__thread_init(void);
+int vips__numa_get_n_nodes(void);
+int vips__numa_bind(int node);
+int vips__numa_node(void);
 void vips__threadpool_init(void);
 void vips__threadpool_shutdown(void);
 int vips__thread_execute(const char *name, GFunc func, gpointer data);
 VIPS_API void vips__worker_lock(GMutex *mutex);
 VIPS_API void vips__worker_cond_wait(GCond *cond, GMutex *mutex);
+int vips__worker_execute(const char *domain, GFunc func, gpointer data);
+int vips__threadpool_run_tiles(VipsImage *im,
+	int tile_width, int tile_height,
+	VipsThreadStartFn start,
+	VipsThreadpoolAllocateFn allocate,
+	VipsThreadpoolWorkFn work,
+	VipsThreadpoolProgressFn progress,
+	void *a);
+int vips__sink_disc_unordered(VipsImage *im, int depth,
+	VipsRegionWrite write_fn, void *a);
+
+/* Compression values from this up mark tiled vips files. Smaller values
+ * are left over from vips7 and are ignored.
+ */
+#define VIPS__COMPRESSION_TILED (0x100)
+
+/* Tiled vips files have their own magic numbers, so older readers reject
+ * them rather than reading compressed tiles as pixels.
+ */
+#define VIPS__MAGIC_TILED_INTEL (0xb6a6f2a8U)
+#define VIPS__MAGIC_TILED_SPARC (0xa8f2a6b6U)
+
+/* The default tile size for compressed vips files.
+ */
+#define VIPS__TILED_TILE_SIZE (256)
+
+gboolean vips__vips_tiled_supported(VipsForeignVipsCompression compression);
+gboolean vips__vips_tiled(VipsImage *image);
+gint64 vips__vips_tiled_pixel_length(VipsImage *image);
+int vips__vips_tiled_open(VipsImage *image);
+int vips__vips_tiled_attach(VipsImage *image);
+int vips__vips_tiled_sink(VipsImage *image);
+void vips__vips_tiled_temp(VipsImage *image);
+int vips__vips_tiled_write_line(VipsImage *image,
+	int ypos, VipsPel *linebuffer);
+gboolean vips__vips_tiled_memory(VipsImage *image);
 
 void vips__cache_init(void);
+const char *vips__image_get_digest(VipsImage *image);
+gboolean vips__tile_store_get(VipsImage *image, VipsRegion *region);
+void vips__tile_store_put(VipsImage *image, VipsRegion *region);
 
 int vips__print_renders(void);
 int vips__type_leak(void);
@@ -211,11 +257,14 @@ int vips_remapfilerw(VipsImage *image);
 
 void vips__buffer_init(void);
 void vips__buffer_shutdown(void);
+void vips__tracked_idle(void *s, gboolean idle);
+void vips__tracked_idle_free(void *s);
 
 void vips__copy_4byte(int swap, unsigned char *to, unsigned char *from);
 void vips__copy_2byte(gboolean swap, unsigned char *to, unsigned char *from);
 
 guint32 vips__file_magic(const char *filename);
+int vips__pread(int fd, void *buf, size_t count, gint64 offset);
 /* TODO(kleisauke): VIPS_API is required by vipsheader.
  */
 VIPS_API
@@ -371,6 +420,32 @@ void vips__reorder_clear(VipsImage *image);
  */
 VipsWindow *vips_window_take(VipsWindow *window,
 	VipsImage *im, int top, int height);
+void vips__window_table_clear(VipsImage *image);
+
+extern gboolean vips__window_whole;
+
+/* Per-operation counters, see metrics.c.
+ */
+typedef struct _VipsMetricsFrame {
+	struct _VipsMetricsFrame *parent;
+	gint64 start;
+	gint64 children;
+} VipsMetricsFrame;
+
+extern gboolean vips__metrics_enabled;
+
+void vips__metrics_build(VipsOperation *operation, gboolean hit);
+struct _VipsMetricsEntry *vips__metrics_begin(VipsImage *image,
+	VipsMetricsFrame *frame);
+void vips__metrics_end(struct _VipsMetricsEntry *entry,
+	VipsMetricsFrame *frame, guint64 pixels);
+void vips__metrics_memory(VipsImage *image, size_t bytes);
+const char *vips__metrics_nickname(VipsImage *image);
+
+extern gboolean vips__fuse_enabled;
+extern gboolean vips__simplify_enabled;
+extern gboolean vips__prefetch_enabled;
+extern int vips__render_threads;
 
 int vips__profile_set(VipsImage *image, const char *name);
 
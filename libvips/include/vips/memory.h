@@ -87,6 +87,8 @@ void *vips_tracked_aligned_alloc(size_t size, size_t align);
 VIPS_API
 size_t vips_tracked_get_mem(void);
 VIPS_API
+size_t vips_tracked_get_idle(void);
+VIPS_API
 size_t vips_tracked_get_mem_highwater(void);
 VIPS_API
 int vips_tracked_get_allocs(void);
@@ -155,16 +155,57 @@ int vips_cache_get_max(void);
 VIPS_API
 int vips_cache_get_size(void);
 VIPS_API
+guint64 vips_cache_get_hits(void);
+VIPS_API
+guint64 vips_cache_get_misses(void);
+VIPS_API
+guint64 vips_cache_get_evictions(void);
+VIPS_API
 size_t vips_cache_get_max_mem(void);
 VIPS_API
 int vips_cache_get_max_files(void);
 VIPS_API
 void vips_cache_set_max_files(int max_files);
 VIPS_API
+void vips_cache_set_max_tile_mem(size_t max_mem);
+VIPS_API
+size_t vips_cache_get_max_tile_mem(void);
+VIPS_API
+size_t vips_cache_get_tile_mem(void);
+VIPS_API
+guint64 vips_cache_get_tile_hits(void);
+VIPS_API
+guint64 vips_cache_get_tile_misses(void);
+VIPS_API
+void vips_cache_set_max_tile_disc(size_t max_disc);
+VIPS_API
+size_t vips_cache_get_max_tile_disc(void);
+VIPS_API
 void vips_cache_set_dump(gboolean dump);
 VIPS_API
 void vips_cache_set_trace(gboolean trace);
 
+typedef struct _VipsMetrics {
+	const char *nickname;
+
+	guint64 hits;
+	guint64 misses;
+	guint64 pixels;
+	guint64 time;
+	guint64 memory;
+} VipsMetrics;
+
+typedef void *(*VipsMetricsMapFn)(VipsMetrics *metrics, void *a, void *b);
+
+VIPS_API
+void vips_metrics_set(gboolean enabled);
+VIPS_API
+gboolean vips_metrics_get(const char *nickname, VipsMetrics *metrics);
+VIPS_API
+void *vips_metrics_map(VipsMetricsMapFn fn, void *a, void *b);
+VIPS_API
+void vips_metrics_reset(void);
+
 /* Part of threadpool, really, but we want these in a header that gets scanned
  * for our typelib.
  */
@@ -172,6 +213,18 @@ VIPS_API
 void vips_concurrency_set(int concurrency);
 VIPS_API
 int vips_concurrency_get(void);
+VIPS_API
+void vips_threadpool_steal_set(gboolean steal);
+VIPS_API
+gboolean vips_threadpool_steal_get(void);
+VIPS_API
+void vips_numa_set(gboolean numa);
+VIPS_API
+gboolean vips_numa_get(void);
+VIPS_API
+void vips_tile_autotune_set(gboolean autotune);
+VIPS_API
+void vips_tile_autotune_set_cache(const char *filename);
 
 VIPS_API
 void vips_operation_block_set(const char *name, gboolean state);
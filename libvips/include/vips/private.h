@@ -114,6 +114,7 @@ typedef struct _VipsBuffer {
 	VipsBufferCache *cache; /* The cache this buffer is published on */
 	VipsPel *buf;			/* Private malloc() area */
 	size_t bsize;			/* Size of private malloc() */
+	int node;				/* NUMA node buf was allocated on, or -1 */
 } VipsBuffer;
 
 VIPS_API
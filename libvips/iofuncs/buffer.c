@@ -25,6 +25,11 @@
  * 	  buffers don't clog up the system
  * 13/10/16
  * 	- better solution: don't keep a buffercache for non-workers
+ * 16/10/26
+ * 	- only keep node-local buffers in reserve in NUMA mode
+ * 	- add a per-thread, size-classed arena of pixel memory, so steady
+ * 	  state processing doesn't need to malloc
+ * 	- bound idle arena memory process-wide, scaled by concurrency
  */
 
 /*
@@ -91,6 +96,46 @@ static const int buffer_cache_max_reserve = 2;
  */
 static GPrivate *buffer_thread_key = NULL;
 
+/* Pixel memory is allocated in size classes, four per power of two, from
+ * 4kb up to 16mb. Larger buffers are not recycled.
+ */
+#define ARENA_MIN_LOG2 (12)
+#define ARENA_MAX_LOG2 (24)
+#define ARENA_N_CLASSES (4 * (ARENA_MAX_LOG2 - ARENA_MIN_LOG2) + 1)
+
+/* Arena blocks are always aligned for the highway paths.
+ */
+#define ARENA_ALIGN (64)
+
+/* The free pixel memory we keep, per thread of vips_concurrency_get(). It's
+ * not counted by vips_tracked_get_mem(), so it doesn't count against the
+ * operation cache, but vips_tracked_get_idle() reports it. The bound is
+ * process-wide, so a large threadset can't keep a full arena per thread.
+ */
+static const size_t buffer_arena_per_thread = 8 * 1024 * 1024;
+
+/* Free pixel memory in all arenas. Atomic.
+ */
+static gssize buffer_arena_total = 0;
+
+/* A free block of pixel memory. We link free blocks through their first few
+ * bytes, so recycling never needs to allocate.
+ */
+typedef struct _VipsArenaBlock {
+	struct _VipsArenaBlock *next;
+} VipsArenaBlock;
+
+/* Workers also have a VipsBufferArena of free pixel memory. Unlike the
+ * BufferThread, this holds no image references, so it lives until thread
+ * exit and lets threadset members recycle memory across pipelines.
+ */
+typedef struct _VipsBufferArena {
+	VipsArenaBlock *free[ARENA_N_CLASSES];
+	size_t bytes;
+} VipsBufferArena;
+
+static GPrivate *buffer_arena_key = NULL;
+
 void
 vips_buffer_print(VipsBuffer *buffer)
 {
@@ -196,10 +241,154 @@ vips_buffer_dump_all(void)
 #endif /*DEBUG*/
 }
 
+/* Find the size class for a block of pixel memory, or -1 for blocks too
+ * large to recycle.
+ */
+static int
+buffer_arena_class(size_t size, size_t *class_size)
+{
+	size_t base;
+	size_t quarter;
+	int log2;
+	int n;
+
+	size = VIPS_MAX(size, (size_t) 1 << ARENA_MIN_LOG2);
+	if (size > (size_t) 1 << ARENA_MAX_LOG2)
+		return -1;
+
+	/* The power of two at or below size.
+	 */
+	for (log2 = ARENA_MIN_LOG2; ((size_t) 1 << (log2 + 1)) <= size; log2++)
+		;
+	base = (size_t) 1 << log2;
+	quarter = base / 4;
+	n = (size - base + quarter - 1) / quarter;
+
+	*class_size = base + n * quarter;
+
+	return 4 * (log2 - ARENA_MIN_LOG2) + n;
+}
+
+static void
+buffer_arena_free(VipsBufferArena *arena)
+{
+	int i;
+
+	g_atomic_pointer_add(&buffer_arena_total, -(gssize) arena->bytes);
+
+	for (i = 0; i < ARENA_N_CLASSES; i++)
+		while (arena->free[i]) {
+			VipsArenaBlock *block = arena->free[i];
+
+			arena->free[i] = block->next;
+			vips__tracked_idle_free(block);
+		}
+
+	g_free(arena);
+}
+
+/* Our private VipsBufferArena. NULL for non-worker threads.
+ */
+static VipsBufferArena *
+buffer_arena_get(void)
+{
+	VipsBufferArena *arena;
+
+	if (!vips_thread_isvips())
+		return NULL;
+
+	if (!(arena = g_private_get(buffer_arena_key))) {
+		arena = g_new0(VipsBufferArena, 1);
+		g_private_set(buffer_arena_key, arena);
+	}
+
+	return arena;
+}
+
+/* Get a block of pixel memory of at least size bytes, reusing a free block
+ * if we can. The size we actually allocated is returned in bsize.
+ */
+static VipsPel *
+buffer_arena_alloc(size_t size, size_t *bsize)
+{
+	VipsBufferArena *arena;
+	size_t class_size;
+	int class;
+
+	if ((class = buffer_arena_class(size, &class_size)) < 0) {
+		*bsize = size;
+		return vips_tracked_aligned_alloc(size, ARENA_ALIGN);
+	}
+
+	if ((arena = buffer_arena_get()) &&
+		arena->free[class]) {
+		VipsArenaBlock *block = arena->free[class];
+
+		arena->free[class] = block->next;
+		arena->bytes -= class_size;
+		vips__tracked_idle(block, FALSE);
+		g_atomic_pointer_add(&buffer_arena_total, -(gssize) class_size);
+		*bsize = class_size;
+
+		return (VipsPel *) block;
+	}
+
+	*bsize = class_size;
+
+	return vips_tracked_aligned_alloc(class_size, ARENA_ALIGN);
+}
+
+/* Reserve room for @bsize more bytes of free pixel memory. FALSE if the
+ * arenas are full.
+ */
+static gboolean
+buffer_arena_reserve(size_t bsize)
+{
+	const gssize max = (gssize) buffer_arena_per_thread *
+		VIPS_MAX(1, vips_concurrency_get());
+
+	if ((gssize) g_atomic_pointer_add(&buffer_arena_total,
+			(gssize) bsize) + (gssize) bsize > max) {
+		g_atomic_pointer_add(&buffer_arena_total, -(gssize) bsize);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Return a block from buffer_arena_alloc() to our free list, or free it if
+ * the arenas are full. In NUMA mode, we only keep memory from our own node.
+ */
+static void
+buffer_arena_release(VipsPel *buf, size_t bsize, int node)
+{
+	VipsBufferArena *arena;
+	size_t class_size;
+	int class;
+
+	if ((class = buffer_arena_class(bsize, &class_size)) >= 0 &&
+		class_size == bsize &&
+		node == vips__numa_node() &&
+		(arena = buffer_arena_get()) &&
+		buffer_arena_reserve(bsize)) {
+		VipsArenaBlock *block = (VipsArenaBlock *) buf;
+
+		block->next = arena->free[class];
+		arena->free[class] = block;
+		arena->bytes += bsize;
+		vips__tracked_idle(block, TRUE);
+	}
+	else
+		vips_tracked_aligned_free(buf);
+}
+
 static void
 vips_buffer_free(VipsBuffer *buffer)
 {
-	VIPS_FREEF(vips_tracked_aligned_free, buffer->buf);
+	if (buffer->buf) {
+		buffer_arena_release(buffer->buf, buffer->bsize, buffer->node);
+		buffer->buf = NULL;
+	}
 	buffer->bsize = 0;
 	g_free(buffer);
 
@@ -444,10 +633,12 @@ vips_buffer_unref(VipsBuffer *buffer)
 
 		vips_buffer_undone(buffer);
 
-		/* Place on this thread's reserve list for reuse.
+		/* Place on this thread's reserve list for reuse. In NUMA
+		 * mode, only keep buffers that are local to this thread.
 		 */
 		if ((cache = buffer_cache_get(buffer->im)) &&
-			cache->n_reserve < buffer_cache_max_reserve) {
+			cache->n_reserve < buffer_cache_max_reserve &&
+			buffer->node == vips__numa_node()) {
 			g_assert(!buffer->cache);
 
 			cache->reserve =
@@ -468,7 +659,6 @@ buffer_move(VipsBuffer *buffer, VipsRect *area)
 {
 	VipsImage *im = buffer->im;
 	size_t new_bsize;
-	size_t align;
 
 	g_assert(buffer->ref_count == 1);
 
@@ -481,23 +671,30 @@ buffer_move(VipsBuffer *buffer, VipsRect *area)
 		area->width * area->height;
 
 	/* Need to pad buffer size to be aligned-up to
-	 * 64 bytes for the vips_reduce{h,v} highway path.
+	 * 64 bytes for the vips_reduce{h,v} highway path. Arena memory is
+	 * always 64-byte aligned.
 	 */
 #ifdef HAVE_HWY
-	if (im->BandFmt == VIPS_FORMAT_UCHAR) {
+	if (im->BandFmt == VIPS_FORMAT_UCHAR)
 		new_bsize += /*HWY_ALIGNMENT*/ 64 - 1;
-		align = /*HWY_ALIGNMENT*/ 64;
-	}
-	else
 #endif /*HAVE_HWY*/
-		align = 16;
 
 	if (buffer->bsize < new_bsize ||
 		!buffer->buf) {
-		buffer->bsize = new_bsize;
-		VIPS_FREEF(vips_tracked_aligned_free, buffer->buf);
-		if (!(buffer->buf = vips_tracked_aligned_alloc(buffer->bsize, align)))
+		if (buffer->buf) {
+			buffer_arena_release(buffer->buf, buffer->bsize, buffer->node);
+			buffer->buf = NULL;
+		}
+		buffer->bsize = 0;
+		if (!(buffer->buf = buffer_arena_alloc(new_bsize, &buffer->bsize)))
 			return -1;
+		if (vips__metrics_enabled)
+			vips__metrics_memory(im, buffer->bsize);
+
+		/* We'll be the first thread to write to this memory, so it
+		 * will be placed on our node.
+		 */
+		buffer->node = vips__numa_node();
 	}
 
 	return 0;
@@ -533,6 +730,7 @@ vips_buffer_new(VipsImage *im, VipsRect *area)
 		buffer->cache = NULL;
 		buffer->buf = NULL;
 		buffer->bsize = 0;
+		buffer->node = -1;
 
 #ifdef DEBUG
 		g_mutex_lock(vips__global_lock);
@@ -656,6 +854,15 @@ vips_buffer_unref_ref(VipsBuffer *old_buffer, VipsImage *im, VipsRect *area)
 	return buffer;
 }
 
+static void
+buffer_arena_destroy_notify(VipsBufferArena *arena)
+{
+	/* Run on thread exit. Arenas hold no image refs, so it's safe to
+	 * keep them across vips_thread_shutdown().
+	 */
+	buffer_arena_free(arena);
+}
+
 static void
 buffer_thread_destroy_notify(VipsBufferThread *buffer_thread)
 {
@@ -675,8 +882,11 @@ vips__buffer_init(void)
 {
 	static GPrivate private =
 		G_PRIVATE_INIT((GDestroyNotify) buffer_thread_destroy_notify);
+	static GPrivate arena_private =
+		G_PRIVATE_INIT((GDestroyNotify) buffer_arena_destroy_notify);
 
 	buffer_thread_key = &private;
+	buffer_arena_key = &arena_private;
 
 	if (buffer_cache_max_reserve < 1)
 		printf("vips__buffer_init: buffer reserve disabled\n");
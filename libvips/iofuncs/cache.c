@@ -6,6 +6,12 @@
  * 	- add a lock so we can run operations from many threads
  * 28/11/19 [MaxKellermann]
  * 	- make invalidate advisory rather than immediate
+ * 16/10/26
+ * 	- shard the cache by operation hash, approximate LRU with CLOCK
+ * 	- weight eviction by build cost and footprint, count hits and misses
+ * 	- tag output images with a digest that's stable between processes
+ * 	- compute digests on demand, from the operation that made the image
+ * 	- add a process-wide tile store
  */
 
 /*
@@ -63,6 +69,7 @@
 #include <unistd.h>
 #endif /*HAVE_UNISTD_H*/
 #include <ctype.h>
+#include <math.h>
 
 #include <vips/vips.h>
 #include <vips/internal.h>
@@ -93,27 +100,45 @@ static int vips_cache_max_files = 100;
  */
 static size_t vips_cache_max_mem = 100 * 1024 * 1024;
 
-/* Hold a ref to all "recent" operations.
+/* The cache is split into a set of shards by operation hash, each with its
+ * own lock and table, so threads building unrelated operations don't contend.
+ * Must be a power of two.
  */
-static GHashTable *vips_cache_table = NULL;
+#define VIPS_CACHE_N_SHARDS (16)
 
-/* A 'time' counter: increment on all cache ops. Use this to detect LRU.
+/* The most credit an entry can have, ie. the most sweeps of the clock hand
+ * it can survive without a hit.
  */
-static int vips_cache_time = 0;
+#define VIPS_CACHE_MAX_CREDIT (16)
 
-/* Protect cache access with this.
+/* An output image backed by a file costs the same as this much memory when
+ * we score entries.
  */
-static GMutex *vips_cache_lock = NULL;
+#define VIPS_CACHE_FILE_COST (64 * 1024)
 
 /* A cache entry.
  */
 typedef struct _VipsOperationCacheEntry {
 	VipsOperation *operation;
 
-	/* When we added this operation to cache .. used to find LRU for
-	 * flush.
+	/* Our link in the shard's clock, so we can remove in O(1).
 	 */
-	int time;
+	GList *link;
+
+	/* What this entry cost to make, as build time in seconds, and the
+	 * bytes its output images hold on to.
+	 */
+	double build_time;
+	size_t size;
+
+	/* The credit we reset to on every hit, from the scores above.
+	 */
+	int value;
+
+	/* Decremented as the clock hand passes. Entries the hand finds with
+	 * no credit left are evicted.
+	 */
+	int credit;
 
 	/* We listen for "invalidate" from the operation. Track the id here so
 	 * we can disconnect when we drop an operation.
@@ -126,6 +151,42 @@ typedef struct _VipsOperationCacheEntry {
 
 } VipsOperationCacheEntry;
 
+typedef struct _VipsCacheShard {
+	/* Protect shard access with this.
+	 */
+	GMutex *lock;
+
+	/* Hold a ref to all "recent" operations in this shard.
+	 */
+	GHashTable *table;
+
+	/* All entries in order of insertion, plus the clock hand. We
+	 * approximate GreedyDual-Size with a counting CLOCK: trim sweeps the
+	 * hand forward, taking one credit from each entry, and drops the
+	 * first entry that has run out. Expensive, small entries get more
+	 * credit, so they survive more sweeps.
+	 */
+	GQueue clock;
+	GList *hand;
+
+	/* Counters for vips_cache_get_hits() and friends. 64-bit on all
+	 * platforms, so they are protected by the shard lock.
+	 */
+	guint64 hits;
+	guint64 misses;
+	guint64 evictions;
+} VipsCacheShard;
+
+static VipsCacheShard vips_cache_shards[VIPS_CACHE_N_SHARDS];
+
+/* Number of operations in cache, summed over all shards.
+ */
+static int vips_cache_size = 0;
+
+/* Trim visits shards round-robin from here.
+ */
+static int vips_cache_next_trim = 0;
+
 /* Pass in the pspec so we can get the generic type. For example, a
  * held in a GParamSpec allowing OBJECT, but the value could be of type
  * VipsImage. generics are much faster to compare.
@@ -425,14 +486,607 @@ vips_operation_equal(VipsOperation *a, VipsOperation *b)
 	return FALSE;
 }
 
+/* Images made by operations are tagged with a digest of the operation that
+ * made them and all of its inputs. Unlike vips_operation_hash(), this
+ * doesn't depend on object addresses, so it's stable between processes and
+ * can be used to key persistent caches.
+ */
+static GQuark vips_cache_digest_quark = 0;
+
+/* Digests cost a SHA-256 and a look at every argument, so we only make them
+ * when something asks for one. Until then, output images just keep a weak
+ * ref to the operation that made them.
+ */
+static GQuark vips_cache_producer_quark = 0;
+
+/* Making a digest walks back up the pipeline, so the lock is recursive.
+ */
+static GRecMutex vips_cache_digest_lock;
+
+/* The most disc space each disc tile cache directory can use.
+ */
+static size_t vips_cache_max_tile_disc = 1024 * 1024 * 1024;
+
+/* Digests are shared by the image they tag and every stored tile made from
+ * it, so they are refcounted. The refcount sits just before the string, so a
+ * digest can be passed around as a plain char *.
+ */
+typedef struct _VipsDigest {
+	gint ref_count;
+	char str[1];
+} VipsDigest;
+
+#define VIPS_DIGEST(S) \
+	((VipsDigest *) ((S) - G_STRUCT_OFFSET(VipsDigest, str)))
+
+static char *
+vips_digest_new(const char *str)
+{
+	size_t length = strlen(str);
+	VipsDigest *digest;
+
+	digest = g_malloc(sizeof(VipsDigest) + length);
+	digest->ref_count = 1;
+	memcpy(digest->str, str, length + 1);
+
+	return digest->str;
+}
+
+static char *
+vips_digest_ref(char *str)
+{
+	g_atomic_int_inc(&VIPS_DIGEST(str)->ref_count);
+
+	return str;
+}
+
+static void
+vips_digest_unref(char *str)
+{
+	if (g_atomic_int_dec_and_test(&VIPS_DIGEST(str)->ref_count))
+		g_free(VIPS_DIGEST(str));
+}
+
+/* Add a value to a digest. Return FALSE if it has no stable digest.
+ */
+static gboolean
+vips_cache_digest_value(GChecksum *checksum,
+	GParamSpec *pspec, GValue *value)
+{
+	GType generic = G_PARAM_SPEC_TYPE(pspec);
+	GType type = G_VALUE_TYPE(value);
+
+	if (generic == G_TYPE_PARAM_FLOAT) {
+		float f = g_value_get_float(value);
+
+		g_checksum_update(checksum, (guchar *) &f, sizeof(f));
+	}
+	else if (generic == G_TYPE_PARAM_DOUBLE) {
+		double d = g_value_get_double(value);
+
+		g_checksum_update(checksum, (guchar *) &d, sizeof(d));
+	}
+	else if (generic == G_TYPE_PARAM_STRING) {
+		const char *s = g_value_get_string(value);
+		GStatBuf st;
+
+		if (!s)
+			return TRUE;
+
+		g_checksum_update(checksum, (guchar *) s, strlen(s) + 1);
+
+		/* Loaders are keyed by filename, so we must notice if the
+		 * file changes under us.
+		 */
+		if (strcmp(g_param_spec_get_name(pspec), "filename") == 0 &&
+			!g_stat(s, &st)) {
+			gint64 stamp[2] = { st.st_size, st.st_mtime };
+
+			g_checksum_update(checksum,
+				(guchar *) stamp, sizeof(stamp));
+		}
+	}
+	else if (generic == G_TYPE_PARAM_OBJECT) {
+		GObject *object = g_value_get_object(value);
+		const char *digest;
+
+		if (!object ||
+			!VIPS_IS_IMAGE(object) ||
+			!(digest = vips__image_get_digest(VIPS_IMAGE(object))))
+			return FALSE;
+
+		g_checksum_update(checksum, (guchar *) digest, -1);
+	}
+	else if (generic == G_TYPE_PARAM_BOXED) {
+		VipsArea *area;
+
+		if (!(area = g_value_get_boxed(value)))
+			return TRUE;
+
+		if (type == VIPS_TYPE_ARRAY_DOUBLE ||
+			type == VIPS_TYPE_ARRAY_INT)
+			g_checksum_update(checksum, (guchar *) area->data,
+				(gssize) area->n * area->sizeof_type);
+		else if (type == VIPS_TYPE_ARRAY_IMAGE) {
+			VipsImage **images = (VipsImage **) area->data;
+			int i;
+
+			for (i = 0; i < area->n; i++) {
+				const char *digest;
+
+				if (!(digest = vips__image_get_digest(images[i])))
+					return FALSE;
+
+				g_checksum_update(checksum, (guchar *) digest, -1);
+			}
+		}
+		else
+			/* Blobs, sources and so on have no stable digest.
+			 */
+			return FALSE;
+	}
+	else if (generic == G_TYPE_PARAM_POINTER)
+		return FALSE;
+	else {
+		/* Ints, enums, flags and bools print stably.
+		 */
+		char *s = g_strdup_value_contents(value);
+
+		g_checksum_update(checksum, (guchar *) s, -1);
+		g_free(s);
+	}
+
+	return TRUE;
+}
+
+static void *
+vips_object_digest_arg(VipsObject *object,
+	GParamSpec *pspec,
+	VipsArgumentClass *argument_class,
+	VipsArgumentInstance *argument_instance,
+	void *a, void *b)
+{
+	GChecksum *checksum = (GChecksum *) a;
+
+	if ((argument_class->flags & VIPS_ARGUMENT_CONSTRUCT) &&
+		(argument_class->flags & VIPS_ARGUMENT_INPUT) &&
+		!(argument_class->flags & VIPS_ARGUMENT_NON_HASHABLE) &&
+		argument_instance->assigned) {
+		const char *name = g_param_spec_get_name(pspec);
+		GType type = G_PARAM_SPEC_VALUE_TYPE(pspec);
+		GValue value = G_VALUE_INIT;
+		gboolean stable;
+
+		g_checksum_update(checksum, (guchar *) name, strlen(name) + 1);
+
+		g_value_init(&value, type);
+		g_object_get_property(G_OBJECT(object), name, &value);
+		stable = vips_cache_digest_value(checksum, pspec, &value);
+		g_value_unset(&value);
+
+		/* Stop on the first unstable arg.
+		 */
+		if (!stable)
+			return object;
+	}
+
+	return NULL;
+}
+
+static void *
+vips_object_tag_arg(VipsObject *object,
+	GParamSpec *pspec,
+	VipsArgumentClass *argument_class,
+	VipsArgumentInstance *argument_instance,
+	void *a, void *b)
+{
+	GChecksum *checksum = (GChecksum *) a;
+
+	if ((argument_class->flags & VIPS_ARGUMENT_CONSTRUCT) &&
+		(argument_class->flags & VIPS_ARGUMENT_OUTPUT) &&
+		argument_instance->assigned &&
+		G_IS_PARAM_SPEC_OBJECT(pspec)) {
+		const char *name = g_param_spec_get_name(pspec);
+		GObject *value;
+
+		g_object_get(G_OBJECT(object), name, &value, NULL);
+
+		/* Another operation may have tagged it already, and that
+		 * digest could be in use.
+		 */
+		if (VIPS_IS_IMAGE(value) &&
+			!g_object_get_qdata(value, vips_cache_digest_quark)) {
+			GChecksum *output = g_checksum_copy(checksum);
+
+			g_checksum_update(output,
+				(guchar *) name, strlen(name) + 1);
+			g_object_set_qdata_full(value, vips_cache_digest_quark,
+				vips_digest_new(g_checksum_get_string(output)),
+				(GDestroyNotify) vips_digest_unref);
+			g_checksum_free(output);
+		}
+
+		g_object_unref(value);
+	}
+
+	return NULL;
+}
+
+/* Tag the output images of a built operation with a digest, if it has a
+ * stable one. Called with the digest lock held.
+ */
+static void
+vips_operation_digest(VipsOperation *operation)
+{
+	GChecksum *checksum;
+	const char *name;
+
+	checksum = g_checksum_new(G_CHECKSUM_SHA256);
+
+	/* Include the version, since pixels can change between releases.
+	 */
+	g_checksum_update(checksum, (guchar *) VIPS_VERSION, -1);
+	name = G_OBJECT_TYPE_NAME(operation);
+	g_checksum_update(checksum, (guchar *) name, strlen(name) + 1);
+
+	if (!vips_argument_map(VIPS_OBJECT(operation),
+			vips_object_digest_arg, checksum, NULL))
+		(void) vips_argument_map(VIPS_OBJECT(operation),
+			vips_object_tag_arg, checksum, NULL);
+
+	g_checksum_free(checksum);
+}
+
+static void
+vips_producer_free(GWeakRef *producer)
+{
+	g_weak_ref_clear(producer);
+	g_free(producer);
+}
+
+static void *
+vips_object_producer_arg(VipsObject *object,
+	GParamSpec *pspec,
+	VipsArgumentClass *argument_class,
+	VipsArgumentInstance *argument_instance,
+	void *a, void *b)
+{
+	if ((argument_class->flags & VIPS_ARGUMENT_CONSTRUCT) &&
+		(argument_class->flags & VIPS_ARGUMENT_OUTPUT) &&
+		argument_instance->assigned &&
+		G_IS_PARAM_SPEC_OBJECT(pspec)) {
+		GObject *value = G_STRUCT_MEMBER(GObject *,
+			object, argument_class->offset);
+
+		/* The first operation to make an image owns it.
+		 */
+		if (value &&
+			VIPS_IS_IMAGE(value) &&
+			!g_object_get_qdata(value, vips_cache_producer_quark)) {
+			GWeakRef *producer = g_new(GWeakRef, 1);
+
+			g_weak_ref_init(producer, object);
+			g_object_set_qdata_full(value, vips_cache_producer_quark,
+				producer, (GDestroyNotify) vips_producer_free);
+		}
+	}
+
+	return NULL;
+}
+
+/* Remember which operation made each output image, so we can compute a
+ * digest later.
+ */
+static void
+vips_operation_tag_producer(VipsOperation *operation)
+{
+	VipsOperationFlags flags = vips_operation_get_flags(operation);
+
+	/* Sources, targets and operations with side effects don't give
+	 * repeatable results.
+	 */
+	if (flags & (VIPS_OPERATION_NOCACHE | VIPS_OPERATION_REVALIDATE))
+		return;
+
+	(void) vips_argument_map(VIPS_OBJECT(operation),
+		vips_object_producer_arg, NULL, NULL);
+}
+
+/**
+ * vips__image_get_digest: (skip)
+ * @image: image to get the digest of
+ *
+ * The first call walks back up the pipeline from @image and digests the
+ * operations that made it. Images with no stable digest, or whose operation
+ * has gone, give %NULL.
+ *
+ * Returns: the digest, or %NULL if @image has no stable digest
+ */
+const char *
+vips__image_get_digest(VipsImage *image)
+{
+	const char *digest;
+	GWeakRef *producer;
+
+	if (!vips_cache_digest_quark)
+		return NULL;
+
+	if ((digest = g_object_get_qdata(G_OBJECT(image),
+			 vips_cache_digest_quark)) ||
+		!g_object_get_qdata(G_OBJECT(image), vips_cache_producer_quark))
+		return digest;
+
+	g_rec_mutex_lock(&vips_cache_digest_lock);
+
+	/* Another thread could have got here first.
+	 */
+	if ((producer = g_object_get_qdata(G_OBJECT(image),
+			 vips_cache_producer_quark))) {
+		VipsOperation *operation;
+
+		if ((operation = g_weak_ref_get(producer))) {
+			vips_operation_digest(operation);
+			g_object_unref(operation);
+		}
+
+		/* If that didn't work, it never will.
+		 */
+		g_object_set_qdata(G_OBJECT(image),
+			vips_cache_producer_quark, NULL);
+	}
+
+	digest = g_object_get_qdata(G_OBJECT(image), vips_cache_digest_quark);
+
+	g_rec_mutex_unlock(&vips_cache_digest_lock);
+
+	return digest;
+}
+
+/* The tile store: a process-wide cache of calculated tiles, shared by all
+ * vips_tilecache() and vips_linecache() instances. Tiles are keyed on the
+ * digest of the image they came from, so separate pipelines over the same
+ * source share decode work. Off unless vips_cache_set_max_tile_mem() has been
+ * called.
+ */
+typedef struct _VipsStoredTile {
+	/* A ref to the digest of the image this tile came from.
+	 */
+	char *digest;
+	VipsRect rect;
+
+	size_t size;
+	VipsPel *data;
+
+	/* Our link in the LRU queue.
+	 */
+	GList *link;
+} VipsStoredTile;
+
+static GMutex *vips_tile_store_lock = NULL;
+static GHashTable *vips_tile_store = NULL;
+static GQueue vips_tile_store_lru = G_QUEUE_INIT;
+static size_t vips_tile_store_mem = 0;
+static size_t vips_tile_store_max_mem = 0;
+
+/* Counters for vips_cache_get_tile_hits() and friends. Protected by
+ * vips_tile_store_lock.
+ */
+static guint64 vips_tile_store_hits = 0;
+static guint64 vips_tile_store_misses = 0;
+
+static guint
+vips_stored_tile_hash(VipsStoredTile *tile)
+{
+	return g_str_hash(tile->digest) ^
+		(guint) tile->rect.left ^
+		((guint) tile->rect.top << 16) ^
+		((guint) tile->rect.width << 8) ^
+		((guint) tile->rect.height << 24);
+}
+
+static gboolean
+vips_stored_tile_equal(VipsStoredTile *a, VipsStoredTile *b)
+{
+	return vips_rect_equalsrect(&a->rect, &b->rect) &&
+		(a->digest == b->digest ||
+			g_str_equal(a->digest, b->digest));
+}
+
+/* Tile data is not tracked memory, so the store doesn't push the operation
+ * cache into trimming. It has its own budget.
+ */
+static void
+vips_stored_tile_free(VipsStoredTile *tile)
+{
+	VIPS_FREE(tile->data);
+	VIPS_FREEF(vips_digest_unref, tile->digest);
+	g_free(tile);
+}
+
+/* Drop tiles until we're within budget. Return a list of dropped tiles for
+ * the caller to free once the lock is released.
+ */
+static GSList *
+vips_tile_store_trim(void)
+{
+	GSList *dropped;
+
+	dropped = NULL;
+	while (vips_tile_store_mem > vips_tile_store_max_mem &&
+		vips_tile_store_lru.head) {
+		VipsStoredTile *tile = vips_tile_store_lru.head->data;
+
+		g_queue_delete_link(&vips_tile_store_lru, tile->link);
+		g_hash_table_remove(vips_tile_store, tile);
+		vips_tile_store_mem -= tile->size;
+		dropped = g_slist_prepend(dropped, tile);
+	}
+
+	return dropped;
+}
+
+static void
+vips_tile_store_drop_all(void)
+{
+	GSList *dropped;
+
+	g_mutex_lock(vips_tile_store_lock);
+
+	dropped = NULL;
+	while (vips_tile_store_lru.head) {
+		VipsStoredTile *tile = vips_tile_store_lru.head->data;
+
+		g_queue_delete_link(&vips_tile_store_lru, tile->link);
+		g_hash_table_remove(vips_tile_store, tile);
+		vips_tile_store_mem -= tile->size;
+		dropped = g_slist_prepend(dropped, tile);
+	}
+
+	g_mutex_unlock(vips_tile_store_lock);
+
+	g_slist_free_full(dropped, (GDestroyNotify) vips_stored_tile_free);
+}
+
+/**
+ * vips__tile_store_get: (skip)
+ * @image: image the tile comes from
+ * @region: region to fill
+ *
+ * Fill @region->valid from the tile store, if we have that tile.
+ *
+ * Returns: %TRUE on a hit
+ */
+gboolean
+vips__tile_store_get(VipsImage *image, VipsRegion *region)
+{
+	VipsStoredTile key;
+	VipsStoredTile *tile;
+	const char *digest;
+
+	if (!vips_tile_store_max_mem ||
+		!(digest = vips__image_get_digest(image)))
+		return FALSE;
+
+	key.digest = (char *) digest;
+	key.rect = region->valid;
+
+	g_mutex_lock(vips_tile_store_lock);
+
+	if ((tile = g_hash_table_lookup(vips_tile_store, &key))) {
+		size_t line_size = VIPS_REGION_SIZEOF_LINE(region);
+		VipsPel *p = tile->data;
+		int y;
+
+		for (y = 0; y < tile->rect.height; y++) {
+			memcpy(VIPS_REGION_ADDR(region,
+					   tile->rect.left, tile->rect.top + y),
+				p, line_size);
+			p += line_size;
+		}
+
+		/* Move to the most-recently-used end.
+		 */
+		g_queue_unlink(&vips_tile_store_lru, tile->link);
+		g_queue_push_tail_link(&vips_tile_store_lru, tile->link);
+
+		vips_tile_store_hits += 1;
+	}
+	else
+		vips_tile_store_misses += 1;
+
+	g_mutex_unlock(vips_tile_store_lock);
+
+	return tile != NULL;
+}
+
+/**
+ * vips__tile_store_put: (skip)
+ * @image: image the tile comes from
+ * @region: calculated pixels
+ *
+ * Add @region->valid to the tile store, evicting old tiles to stay within
+ * budget.
+ */
+void
+vips__tile_store_put(VipsImage *image, VipsRegion *region)
+{
+	size_t line_size = VIPS_REGION_SIZEOF_LINE(region);
+	size_t size = line_size * region->valid.height;
+
+	const char *digest;
+	VipsStoredTile *tile;
+	VipsPel *q;
+	GSList *dropped;
+	int y;
+
+	if (size > vips_tile_store_max_mem ||
+		!(digest = vips__image_get_digest(image)))
+		return;
+
+	/* Copy outside the lock.
+	 */
+	if (!(q = g_try_malloc(size)))
+		return;
+
+	tile = g_new(VipsStoredTile, 1);
+	tile->digest = vips_digest_ref((char *) digest);
+	tile->rect = region->valid;
+	tile->size = size;
+	tile->data = q;
+	tile->link = NULL;
+
+	for (y = 0; y < tile->rect.height; y++) {
+		memcpy(q, VIPS_REGION_ADDR(region,
+					  tile->rect.left, tile->rect.top + y),
+			line_size);
+		q += line_size;
+	}
+
+	g_mutex_lock(vips_tile_store_lock);
+
+	/* Another thread may have got there first.
+	 */
+	if (g_hash_table_lookup(vips_tile_store, tile))
+		dropped = g_slist_prepend(NULL, tile);
+	else {
+		g_hash_table_insert(vips_tile_store, tile, tile);
+		g_queue_push_tail(&vips_tile_store_lru, tile);
+		tile->link = vips_tile_store_lru.tail;
+		vips_tile_store_mem += size;
+
+		dropped = vips_tile_store_trim();
+	}
+
+	g_mutex_unlock(vips_tile_store_lock);
+
+	g_slist_free_full(dropped, (GDestroyNotify) vips_stored_tile_free);
+}
+
 void *
 vips__cache_once_init(void *data)
 {
-	vips_cache_lock = vips_g_mutex_new();
-
-	vips_cache_table = g_hash_table_new(
-		(GHashFunc) vips_operation_hash,
-		(GEqualFunc) vips_operation_equal);
+	int i;
+
+	vips_cache_digest_quark =
+		g_quark_from_static_string("vips-cache-digest");
+	vips_cache_producer_quark =
+		g_quark_from_static_string("vips-cache-producer");
+
+	vips_tile_store_lock = vips_g_mutex_new();
+	vips_tile_store = g_hash_table_new(
+		(GHashFunc) vips_stored_tile_hash,
+		(GEqualFunc) vips_stored_tile_equal);
+
+	for (i = 0; i < VIPS_CACHE_N_SHARDS; i++) {
+		VipsCacheShard *shard = &vips_cache_shards[i];
+
+		shard->lock = vips_g_mutex_new();
+		shard->table = g_hash_table_new(
+			(GHashFunc) vips_operation_hash,
+			(GEqualFunc) vips_operation_equal);
+		g_queue_init(&shard->clock);
+		shard->hand = NULL;
+	}
 
 	return NULL;
 }
@@ -445,6 +1099,17 @@ vips__cache_init(void)
 	VIPS_ONCE(&once, vips__cache_once_init, NULL);
 }
 
+/* The shard an operation lives in. The bottom bit of the hash is always set,
+ * so skip it.
+ */
+static VipsCacheShard *
+vips_cache_shard(VipsOperation *operation)
+{
+	guint hash = vips_operation_hash(operation);
+
+	return &vips_cache_shards[(hash >> 1) & (VIPS_CACHE_N_SHARDS - 1)];
+}
+
 static void *
 vips_cache_print_fn(void *value, void *a, void *b)
 {
@@ -461,13 +1126,11 @@ vips_cache_print_fn(void *value, void *a, void *b)
 }
 
 static void
-vips_cache_print_nolock(void)
+vips_cache_print_nolock(VipsCacheShard *shard)
 {
-	if (vips_cache_table) {
-		printf("Operation cache:\n");
-		vips_hash_table_map(vips_cache_table,
+	if (shard->table)
+		vips_hash_table_map(shard->table,
 			vips_cache_print_fn, NULL, NULL);
-	}
 }
 
 /**
@@ -478,11 +1141,19 @@ vips_cache_print_nolock(void)
 void
 vips_cache_print(void)
 {
-	g_mutex_lock(vips_cache_lock);
+	int i;
+
+	printf("Operation cache:\n");
+
+	for (i = 0; i < VIPS_CACHE_N_SHARDS; i++) {
+		VipsCacheShard *shard = &vips_cache_shards[i];
 
-	vips_cache_print_nolock();
+		g_mutex_lock(shard->lock);
 
-	g_mutex_unlock(vips_cache_lock);
+		vips_cache_print_nolock(shard);
+
+		g_mutex_unlock(shard->lock);
+	}
 }
 
 static void *
@@ -527,17 +1198,21 @@ vips_cache_unref(VipsOperation *operation)
 }
 
 static VipsOperationCacheEntry *
-vips_cache_operation_get(VipsOperation *operation)
+vips_cache_operation_get(VipsCacheShard *shard, VipsOperation *operation)
 {
-	return g_hash_table_lookup(vips_cache_table, operation);
+	if (!shard->table)
+		return NULL;
+
+	return g_hash_table_lookup(shard->table, operation);
 }
 
-/* Remove an operation from the cache.
+/* Remove an operation from the cache. The shard must be locked.
  */
 static void
-vips_cache_remove(VipsOperation *operation)
+vips_cache_remove(VipsCacheShard *shard, VipsOperation *operation)
 {
-	VipsOperationCacheEntry *entry = vips_cache_operation_get(operation);
+	VipsOperationCacheEntry *entry =
+		vips_cache_operation_get(shard, operation);
 
 #ifdef DEBUG
 	printf("vips_cache_remove: ");
@@ -551,7 +1226,14 @@ vips_cache_remove(VipsOperation *operation)
 		entry->invalidate_id = 0;
 	}
 
-	g_hash_table_remove(vips_cache_table, operation);
+	/* Don't leave the hand pointing at a dead link.
+	 */
+	if (shard->hand == entry->link)
+		shard->hand = entry->link->next;
+	g_queue_delete_link(&shard->clock, entry->link);
+
+	g_hash_table_remove(shard->table, operation);
+	g_atomic_int_add(&vips_cache_size, -1);
 	vips_cache_unref(operation);
 
 	g_free(entry);
@@ -580,25 +1262,23 @@ vips_object_ref_arg(VipsObject *object,
 }
 
 static void
-vips_operation_touch(VipsOperation *operation)
+vips_operation_touch(VipsOperationCacheEntry *entry)
 {
-	VipsOperationCacheEntry *entry = vips_cache_operation_get(operation);
-
-	vips_cache_time += 1;
-
-	/* Don't up the time for invalid items -- we want them to fall out of
-	 * cache.
+	/* Don't restore credit to invalid items -- we want them to fall out
+	 * of cache.
 	 */
 	if (!entry->invalid)
-		entry->time = vips_cache_time;
+		entry->credit = entry->value;
 }
 
 /* Ref an operation for the cache. The operation itself, plus all the output
  * objects it makes.
  */
 static void
-vips_cache_ref(VipsOperation *operation)
+vips_cache_ref(VipsOperationCacheEntry *entry)
 {
+	VipsOperation *operation = entry->operation;
+
 #ifdef DEBUG
 	printf("vips_cache_ref: ");
 	vips_object_print_summary(VIPS_OBJECT(operation));
@@ -607,7 +1287,7 @@ vips_cache_ref(VipsOperation *operation)
 	g_object_ref(operation);
 	(void) vips_argument_map(VIPS_OBJECT(operation),
 		vips_object_ref_arg, NULL, NULL);
-	vips_operation_touch(operation);
+	vips_operation_touch(entry);
 }
 
 static void
@@ -620,10 +1300,88 @@ vips_cache_invalidate_cb(VipsOperation *operation,
 #endif /*DEBUG*/
 
 	entry->invalid = TRUE;
+	entry->credit = 0;
 }
 
+static void *
+vips_object_size_arg(VipsObject *object,
+	GParamSpec *pspec,
+	VipsArgumentClass *argument_class,
+	VipsArgumentInstance *argument_instance,
+	void *a, void *b)
+{
+	size_t *size = (size_t *) a;
+
+	if ((argument_class->flags & VIPS_ARGUMENT_OUTPUT) &&
+		argument_instance->assigned &&
+		G_IS_PARAM_SPEC_OBJECT(pspec)) {
+		GObject *value;
+
+		g_object_get(G_OBJECT(object),
+			g_param_spec_get_name(pspec), &value, NULL);
+
+		if (VIPS_IS_IMAGE(value)) {
+			VipsImage *image = VIPS_IMAGE(value);
+
+			switch (image->dtype) {
+			case VIPS_IMAGE_SETBUF:
+			case VIPS_IMAGE_SETBUF_FOREIGN:
+				*size += VIPS_IMAGE_SIZEOF_IMAGE(image);
+				break;
+
+			case VIPS_IMAGE_OPENIN:
+			case VIPS_IMAGE_MMAPIN:
+			case VIPS_IMAGE_MMAPINRW:
+				*size += VIPS_CACHE_FILE_COST;
+				break;
+
+			default:
+				break;
+			}
+		}
+
+		VIPS_UNREF(value);
+	}
+
+	return NULL;
+}
+
+/* The memory and files held by the output images of a built operation. Most
+ * outputs are partial images, which hold nothing until they are computed.
+ * We look at the outputs rather than the change in tracked memory, since
+ * that's a process-wide count which other threads change too.
+ */
+static size_t
+vips_operation_output_size(VipsOperation *operation)
+{
+	size_t size = 0;
+
+	(void) vips_argument_map(VIPS_OBJECT(operation),
+		vips_object_size_arg, &size, NULL);
+
+	return size;
+}
+
+/* Score an entry GreedyDual-Size style: cost to rebuild divided by the space
+ * it takes up, mapped logarithmically to a number of clock sweeps. Cheap
+ * arithmetic nodes get a few sweeps, slow loaders like pdfload get many.
+ */
+static int
+vips_cache_entry_value(VipsOperationCacheEntry *entry)
+{
+	double cost = 1.0 + entry->build_time * 1000000.0;
+	double size = 1.0 + entry->size / 1024.0;
+	int value = 1 + (int) log2(1.0 + cost / size);
+
+	return VIPS_CLIP(1, value, VIPS_CACHE_MAX_CREDIT);
+}
+
+/* Add an operation to the cache, with what it cost to build. The shard must
+ * be locked.
+ */
 static void
-vips_cache_insert(VipsOperation *operation)
+vips_cache_insert(VipsCacheShard *shard, VipsOperation *operation,
+	double build_time, size_t size)
 {
 	VipsOperationCacheEntry *entry = g_new(VipsOperationCacheEntry, 1);
 
@@ -633,12 +1391,19 @@ vips_cache_insert(VipsOperation *operation)
 #endif /*VIPS_DEBUG*/
 
 	entry->operation = operation;
-	entry->time = 0;
+	entry->link = NULL;
+	entry->build_time = build_time;
+	entry->size = size;
+	entry->value = vips_cache_entry_value(entry);
+	entry->credit = 0;
 	entry->invalidate_id = 0;
 	entry->invalid = FALSE;
 
-	g_hash_table_insert(vips_cache_table, operation, entry);
-	vips_cache_ref(operation);
+	g_hash_table_insert(shard->table, operation, entry);
+	g_queue_push_tail(&shard->clock, entry);
+	entry->link = shard->clock.tail;
+	g_atomic_int_inc(&vips_cache_size);
+	vips_cache_ref(entry);
 
 	/* If the operation signals "invalidate", we must tag this cache entry
 	 * for removal.
@@ -647,27 +1412,6 @@ vips_cache_insert(VipsOperation *operation)
 		G_CALLBACK(vips_cache_invalidate_cb), entry);
 }
 
-static void *
-vips_cache_get_first_fn(void *value, void *a, void *b)
-{
-	return value;
-}
-
-/* Return the first item.
- */
-static VipsOperation *
-vips_cache_get_first(void)
-{
-	VipsOperationCacheEntry *entry;
-
-	if (vips_cache_table &&
-		(entry = vips_hash_table_map(vips_cache_table,
-			 vips_cache_get_first_fn, NULL, NULL)))
-		return VIPS_OPERATION(entry->operation);
-
-	return NULL;
-}
-
 /**
  * vips_cache_drop_all:
  *
@@ -677,82 +1421,117 @@ vips_cache_get_first(void)
 void
 vips_cache_drop_all(void)
 {
+	int i;
+
 #ifdef VIPS_DEBUG
 	printf("vips_cache_drop_all:\n");
 #endif /*VIPS_DEBUG*/
 
-	g_mutex_lock(vips_cache_lock);
+	if (vips__cache_dump)
+		printf("Operation cache:\n");
 
-	if (vips_cache_table) {
-		VipsOperation *operation;
+	for (i = 0; i < VIPS_CACHE_N_SHARDS; i++) {
+		VipsCacheShard *shard = &vips_cache_shards[i];
 
-		if (vips__cache_dump)
-			vips_cache_print_nolock();
+		if (!shard->lock)
+			continue;
 
-		/* We can't modify the hash in the callback from
-		 * g_hash_table_foreach() and friends. Repeatedly drop the
-		 * first item instead.
-		 */
-		while ((operation = vips_cache_get_first()))
-			vips_cache_remove(operation);
+		g_mutex_lock(shard->lock);
 
-		VIPS_FREEF(g_hash_table_unref, vips_cache_table);
-	}
+		if (shard->table) {
+			if (vips__cache_dump)
+				vips_cache_print_nolock(shard);
 
-	g_mutex_unlock(vips_cache_lock);
-}
+			/* The clock holds every entry, so we can just drop
+			 * from the head until it's empty.
+			 */
+			while (shard->clock.head) {
+				VipsOperationCacheEntry *entry =
+					shard->clock.head->data;
 
-static void
-vips_cache_get_lru_cb(VipsOperation *key, VipsOperationCacheEntry *value,
-	VipsOperationCacheEntry **best)
-{
-	if (!*best ||
-		(*best)->time > value->time)
-		*best = value;
+				vips_cache_remove(shard, entry->operation);
+			}
+
+			VIPS_FREEF(g_hash_table_unref, shard->table);
+		}
+
+		g_mutex_unlock(shard->lock);
+	}
+
+	if (vips_tile_store_lock)
+		vips_tile_store_drop_all();
 }
 
-/* Get the least-recently-used cache item.
- *
- * TODO ... will this be too expensive? probably not
+/* Sweep the clock hand to find an entry to drop. We take credit as we go,
+ * so this will always find something within VIPS_CACHE_MAX_CREDIT + 1 turns
+ * of a non-empty clock. The shard must be locked.
  */
 static VipsOperation *
-vips_cache_get_lru(void)
+vips_cache_get_lru(VipsCacheShard *shard)
 {
-	VipsOperationCacheEntry *entry;
+	while (shard->clock.head) {
+		VipsOperationCacheEntry *entry;
 
-	entry = NULL;
-	g_hash_table_foreach(vips_cache_table,
-		(GHFunc) vips_cache_get_lru_cb, &entry);
+		if (!shard->hand)
+			shard->hand = shard->clock.head;
 
-	if (entry)
-		return entry->operation;
+		entry = (VipsOperationCacheEntry *) shard->hand->data;
+		shard->hand = shard->hand->next;
+
+		if (entry->credit <= 0)
+			return entry->operation;
+
+		entry->credit -= 1;
+	}
 
 	return NULL;
 }
 
+static gboolean
+vips_cache_full(void)
+{
+	return g_atomic_int_get(&vips_cache_size) > vips_cache_max ||
+		vips_tracked_get_files() > vips_cache_max_files ||
+		vips_tracked_get_mem() > vips_cache_max_mem;
+}
+
 /* Is the cache full? Drop until it's not.
+ *
+ * We take shards round-robin and drop one entry from each, so the shards
+ * shrink evenly. Give up when we've seen every shard empty in a row.
  */
 static void
 vips_cache_trim(void)
 {
-	VipsOperation *operation;
+	int n_empty;
+
+	n_empty = 0;
+	while (n_empty < VIPS_CACHE_N_SHARDS &&
+		vips_cache_full()) {
+		int i = (guint) g_atomic_int_add(&vips_cache_next_trim, 1) &
+			(VIPS_CACHE_N_SHARDS - 1);
+		VipsCacheShard *shard = &vips_cache_shards[i];
+
+		VipsOperation *operation;
 
-	g_mutex_lock(vips_cache_lock);
+		g_mutex_lock(shard->lock);
 
-	while (vips_cache_table &&
-		(g_hash_table_size(vips_cache_table) > vips_cache_max ||
-			vips_tracked_get_files() > vips_cache_max_files ||
-			vips_tracked_get_mem() > vips_cache_max_mem) &&
-		(operation = vips_cache_get_lru())) {
+		if (shard->table &&
+			(operation = vips_cache_get_lru(shard))) {
 #ifdef DEBUG
-		printf("vips_cache_trim: trimming ");
-		vips_object_print_summary(VIPS_OBJECT(operation));
+			printf("vips_cache_trim: trimming ");
+			vips_object_print_summary(VIPS_OBJECT(operation));
 #endif /*DEBUG*/
 
-		vips_cache_remove(operation);
-	}
+			vips_cache_remove(shard, operation);
+			shard->evictions += 1;
+			n_empty = 0;
+		}
+		else
+			n_empty += 1;
 
-	g_mutex_unlock(vips_cache_lock);
+		g_mutex_unlock(shard->lock);
+	}
 }
 
 /**
@@ -774,6 +1553,9 @@ vips_cache_trim(void)
  *
  * Operators with the #VIPS_OPERATION_NOCACHE flag are never cached.
  *
+ * When the cache is full, operations which were slow to build and which hold
+ * little memory and few files are kept in preference to cheap or large ones.
+ *
  * Returns: 0 on success, or -1 on error.
  */
 int
@@ -783,6 +1565,7 @@ vips_cache_operation_buildp(VipsOperation **operation)
 	 */
 	VipsOperationFlags flags = vips_operation_get_flags(*operation);
 
+	VipsCacheShard *shard;
 	VipsOperationCacheEntry *hit;
 
 	g_assert(VIPS_IS_OPERATION(*operation));
@@ -794,9 +1577,14 @@ vips_cache_operation_buildp(VipsOperation **operation)
 	vips_object_print_dump(VIPS_OBJECT(*operation));
 #endif /*VIPS_DEBUG*/
 
-	g_mutex_lock(vips_cache_lock);
+	/* The hash only depends on the input args, so this is stable across
+	 * build.
+	 */
+	shard = vips_cache_shard(*operation);
+
+	g_mutex_lock(shard->lock);
 
-	hit = vips_cache_operation_get(*operation);
+	hit = vips_cache_operation_get(shard, *operation);
 
 	/* We need to remove the existing cache entry if it's been tagged
 	 * as invalid, if it's been blocked, or someone has requested
@@ -806,7 +1594,7 @@ vips_cache_operation_buildp(VipsOperation **operation)
 		if (hit->invalid ||
 			(flags & VIPS_OPERATION_BLOCKED) ||
 			(flags & VIPS_OPERATION_REVALIDATE)) {
-			vips_cache_remove(hit->operation);
+			vips_cache_remove(shard, hit->operation);
 			hit = NULL;
 		}
 	}
@@ -815,9 +1603,11 @@ vips_cache_operation_buildp(VipsOperation **operation)
 	 * passed.
 	 */
 	if (hit) {
-		vips_cache_ref(hit->operation);
+		shard->hits += 1;
+		vips_cache_ref(hit);
 		g_object_unref(*operation);
 		*operation = hit->operation;
+		vips__metrics_build(*operation, TRUE);
 
 		if (vips__cache_trace) {
 			printf("vips cache*: ");
@@ -825,27 +1615,42 @@ vips_cache_operation_buildp(VipsOperation **operation)
 		}
 	}
 
-	g_mutex_unlock(vips_cache_lock);
+	g_mutex_unlock(shard->lock);
 
 	/* If there was a miss, we need to build this operation and add
 	 * it to the cache if appropriate.
 	 */
 	if (!hit) {
+		gint64 start = g_get_monotonic_time();
+
+		double build_time;
+
 		if (vips_object_build(VIPS_OBJECT(*operation)))
 			return -1;
 
+		vips_operation_tag_producer(*operation);
+		vips__metrics_build(*operation, FALSE);
+
+		build_time = (g_get_monotonic_time() - start) / 1000000.0;
+
 		/* Retrieve the flags again, as vips_foreign_load_build() may
 		 * set load->nocache.
 		 */
 		flags = vips_operation_get_flags(*operation);
 
-		g_mutex_lock(vips_cache_lock);
+		g_mutex_lock(shard->lock);
+
+		/* Operations we never cache don't count as misses.
+		 */
+		if (!(flags & VIPS_OPERATION_NOCACHE))
+			shard->misses += 1;
 
 		/* If two threads build the same operation at the same time,
 		 * we can get multiple adds. Let the first one win. See
 		 * https://github.com/libvips/libvips/pull/181
 		 */
-		if (!vips_cache_operation_get(*operation)) {
+		if (shard->table &&
+			!vips_cache_operation_get(shard, *operation)) {
 			/* Has to be after _build() so we can see output args.
 			 */
 			if (vips__cache_trace) {
@@ -858,10 +1663,12 @@ vips_cache_operation_buildp(VipsOperation **operation)
 			}
 
 			if (!(flags & VIPS_OPERATION_NOCACHE))
-				vips_cache_insert(*operation);
+				vips_cache_insert(shard, *operation,
+					build_time,
+					vips_operation_output_size(*operation));
 		}
 
-		g_mutex_unlock(vips_cache_lock);
+		g_mutex_unlock(shard->lock);
 	}
 
 	vips_cache_trim();
@@ -955,17 +1762,78 @@ vips_cache_get_max(void)
 int
 vips_cache_get_size(void)
 {
-	guint size;
+	return g_atomic_int_get(&vips_cache_size);
+}
+
+/* Sum a counter over the shards.
+ */
+static guint64
+vips_cache_count(glong offset)
+{
+	guint64 n;
+	int i;
 
-	g_mutex_lock(vips_cache_lock);
+	vips__cache_init();
 
-	size = 0;
-	if (vips_cache_table)
-		size = g_hash_table_size(vips_cache_table);
+	n = 0;
+	for (i = 0; i < VIPS_CACHE_N_SHARDS; i++) {
+		VipsCacheShard *shard = &vips_cache_shards[i];
 
-	g_mutex_unlock(vips_cache_lock);
+		g_mutex_lock(shard->lock);
+		n += G_STRUCT_MEMBER(guint64, shard, offset);
+		g_mutex_unlock(shard->lock);
+	}
 
-	return size;
+	return n;
+}
+
+/**
+ * vips_cache_get_hits:
+ *
+ * Get the number of times vips_cache_operation_buildp() has found an
+ * operation in cache.
+ *
+ * See also: vips_cache_get_misses(), vips_cache_get_evictions().
+ *
+ * Returns: the number of cache hits so far
+ */
+guint64
+vips_cache_get_hits(void)
+{
+	return vips_cache_count(G_STRUCT_OFFSET(VipsCacheShard, hits));
+}
+
+/**
+ * vips_cache_get_misses:
+ *
+ * Get the number of times vips_cache_operation_buildp() has had to build an
+ * operation.
+ *
+ * See also: vips_cache_get_hits(), vips_cache_get_evictions().
+ *
+ * Returns: the number of cache misses so far
+ */
+guint64
+vips_cache_get_misses(void)
+{
+	return vips_cache_count(G_STRUCT_OFFSET(VipsCacheShard, misses));
+}
+
+/**
+ * vips_cache_get_evictions:
+ *
+ * Get the number of operations that have been dropped to keep the cache
+ * within its limits. Operations dropped because they were invalidated or
+ * revalidated are not counted.
+ *
+ * See also: vips_cache_get_hits(), vips_cache_set_max().
+ *
+ * Returns: the number of cache evictions so far
+ */
+guint64
+vips_cache_get_evictions(void)
+{
+	return vips_cache_count(G_STRUCT_OFFSET(VipsCacheShard, evictions));
 }
 
 /**
@@ -1020,6 +1888,168 @@ vips_cache_set_max_files(int max_files)
 	vips_cache_trim();
 }
 
+/**
+ * vips_cache_set_max_tile_mem:
+ * @max_mem: maximum memory the shared tile store can use
+ *
+ * Set the maximum amount of memory the shared tile store can use.
+ *
+ * When this is non-zero, every vips_tilecache() and vips_linecache() also
+ * keeps the tiles it calculates in a single process-wide store. Caches over
+ * the same image, even in unrelated pipelines, then share tiles rather than
+ * calculating them again. Images are matched by the operations and files
+ * that made them, so two loads of the same file with the same options will
+ * share. The least-recently-used tiles are dropped when the store is full.
+ *
+ * The store is separate from tracked memory, so it does not count towards
+ * vips_cache_set_max_mem().
+ *
+ * The default is 0, meaning no shared store.
+ *
+ * See also: vips_cache_get_tile_mem(), vips_tilecache().
+ */
+void
+vips_cache_set_max_tile_mem(size_t max_mem)
+{
+	GSList *dropped;
+
+	vips__cache_init();
+
+	g_mutex_lock(vips_tile_store_lock);
+
+	vips_tile_store_max_mem = max_mem;
+	dropped = vips_tile_store_trim();
+
+	g_mutex_unlock(vips_tile_store_lock);
+
+	g_slist_free_full(dropped, (GDestroyNotify) vips_stored_tile_free);
+}
+
+/**
+ * vips_cache_get_max_tile_mem:
+ *
+ * Get the maximum amount of memory the shared tile store can use.
+ *
+ * See also: vips_cache_set_max_tile_mem().
+ *
+ * Returns: the maximum tile store size in bytes
+ */
+size_t
+vips_cache_get_max_tile_mem(void)
+{
+	return vips_tile_store_max_mem;
+}
+
+/**
+ * vips_cache_get_tile_mem:
+ *
+ * Get the amount of memory the shared tile store is using now.
+ *
+ * See also: vips_cache_set_max_tile_mem().
+ *
+ * Returns: the current tile store size in bytes
+ */
+size_t
+vips_cache_get_tile_mem(void)
+{
+	size_t mem;
+
+	vips__cache_init();
+
+	g_mutex_lock(vips_tile_store_lock);
+
+	mem = vips_tile_store_mem;
+
+	g_mutex_unlock(vips_tile_store_lock);
+
+	return mem;
+}
+
+/**
+ * vips_cache_get_tile_hits:
+ *
+ * Get the number of tiles the shared tile store has supplied.
+ *
+ * See also: vips_cache_get_tile_misses(), vips_cache_set_max_tile_mem().
+ *
+ * Returns: the number of tile store hits so far
+ */
+guint64
+vips_cache_get_tile_hits(void)
+{
+	guint64 hits;
+
+	vips__cache_init();
+
+	g_mutex_lock(vips_tile_store_lock);
+
+	hits = vips_tile_store_hits;
+
+	g_mutex_unlock(vips_tile_store_lock);
+
+	return hits;
+}
+
+/**
+ * vips_cache_get_tile_misses:
+ *
+ * Get the number of tiles the shared tile store has been asked for but did
+ * not have.
+ *
+ * See also: vips_cache_get_tile_hits(), vips_cache_set_max_tile_mem().
+ *
+ * Returns: the number of tile store misses so far
+ */
+guint64
+vips_cache_get_tile_misses(void)
+{
+	guint64 misses;
+
+	vips__cache_init();
+
+	g_mutex_lock(vips_tile_store_lock);
+
+	misses = vips_tile_store_misses;
+
+	g_mutex_unlock(vips_tile_store_lock);
+
+	return misses;
+}
+
+/**
+ * vips_cache_set_max_tile_disc:
+ * @max_disc: maximum disc space for each disc tile cache directory
+ *
+ * Set the maximum amount of disc space the files in each vips_tilecache()
+ * @cache_dir can use. When a new cache file would go over this, the
+ * least-recently-used files in that directory are removed first. Images too
+ * large to fit are not cached on disc.
+ *
+ * The default is 1GB.
+ *
+ * See also: vips_cache_get_max_tile_disc(), vips_tilecache().
+ */
+void
+vips_cache_set_max_tile_disc(size_t max_disc)
+{
+	vips_cache_max_tile_disc = max_disc;
+}
+
+/**
+ * vips_cache_get_max_tile_disc:
+ *
+ * Get the maximum amount of disc space for each disc tile cache directory.
+ *
+ * See also: vips_cache_set_max_tile_disc().
+ *
+ * Returns: the maximum disc space in bytes
+ */
+size_t
+vips_cache_get_max_tile_disc(void)
+{
+	return vips_cache_max_tile_disc;
+}
+
 /**
  * vips_cache_set_dump:
  * @dump: if %TRUE, dump the operation cache on exit
@@ -1,6 +1,8 @@
 /* gate.c --- thread profiling
  *
  * Written on: 18 nov 13
+ * 16/10/26
+ * 	- add vips_profile_set_trace() to write Chrome trace event JSON
  */
 
 /*
@@ -80,16 +82,28 @@ typedef struct _VipsThreadProfile {
 
 gboolean vips__thread_profile = FALSE;
 
+/* Write a Chrome trace to this file, rather than vips-profile.txt.
+ */
+static char *vips__thread_trace = NULL;
+
 static GPrivate *vips_thread_profile_key = NULL;
 
 static FILE *vips__thread_fp = NULL;
 
+/* The next thread id we give out in the trace, and whether we've written
+ * any events yet (JSON arrays need commas between elements).
+ */
+static int vips__thread_trace_tid = 0;
+static gboolean vips__thread_trace_first = TRUE;
+
 /**
  * vips_profile_set:
  * @profile: %TRUE to enable profile recording
  *
  * If set, vips will record profiling information, and dump it on program
  * exit. These profiles can be analysed with the `vipsprofile` program.
+ *
+ * See also: vips_profile_set_trace().
  */
 void
 vips_profile_set(gboolean profile)
@@ -97,6 +111,38 @@ vips_profile_set(gboolean profile)
 	vips__thread_profile = profile;
 }
 
+/**
+ * vips_profile_set_trace:
+ * @filename: (nullable): write the trace here
+ *
+ * Enable profile recording, and write the profile to @filename in Chrome
+ * trace event format rather than the `vipsprofile` text format. The trace
+ * can be loaded into `chrome://tracing` or https://ui.perfetto.dev.
+ *
+ * Each thread appears as a track. Time spent computing tiles, waiting for
+ * the threadpool allocate lock and writing in the background appear as
+ * spans on those tracks, and each thread's memory use is shown as a
+ * counter.
+ *
+ * Threads are written as they exit, and the file is closed by
+ * vips_shutdown().
+ *
+ * You can also set this with the `--vips-profile-trace` command-line
+ * option, or with the `VIPS_PROFILE_TRACE` environment variable.
+ *
+ * Pass %NULL to go back to the text format. This must be set before any
+ * thread has exited.
+ *
+ * See also: vips_profile_set().
+ */
+void
+vips_profile_set_trace(const char *filename)
+{
+	VIPS_SETSTR(vips__thread_trace, filename);
+	if (filename)
+		vips_profile_set(TRUE);
+}
+
 static void
 vips_thread_gate_block_save(VipsThreadGateBlock *block, FILE *fp)
 {
@@ -131,11 +177,168 @@ vips_thread_profile_save_cb(gpointer key, gpointer value, gpointer data)
 	vips_thread_profile_save_gate(gate, fp);
 }
 
+/* Write a JSON string. Gate and thread names are usually C literals, but
+ * be careful anyway.
+ */
+static void
+vips_thread_trace_string(FILE *fp, const char *str)
+{
+	const char *p;
+
+	fputc('"', fp);
+	for (p = str; *p; p++)
+		if (*p == '"' ||
+			*p == '\\')
+			fprintf(fp, "\\%c", *p);
+		else if ((unsigned char) *p < 32)
+			fprintf(fp, "\\u%04x", (unsigned char) *p);
+		else
+			fputc(*p, fp);
+	fputc('"', fp);
+}
+
+/* Start a new event object.
+ */
+static void
+vips_thread_trace_event(FILE *fp, const char *ph, int tid)
+{
+	if (!vips__thread_trace_first)
+		fprintf(fp, ",\n");
+	vips__thread_trace_first = FALSE;
+
+	fprintf(fp, "{\"ph\":\"%s\",\"pid\":1,\"tid\":%d,", ph, tid);
+}
+
+/* Blocks are chained newest first. Flatten to an array of times, oldest
+ * first.
+ */
+static void
+vips_thread_gate_block_flatten(VipsThreadGateBlock *block, GArray *array)
+{
+	if (block->prev)
+		vips_thread_gate_block_flatten(block->prev, array);
+	g_array_append_vals(array, block->time, block->i);
+}
+
+static GArray *
+vips_thread_gate_times(VipsThreadGateBlock *block)
+{
+	GArray *array;
+
+	array = g_array_new(FALSE, FALSE, sizeof(gint64));
+	vips_thread_gate_block_flatten(block, array);
+
+	return array;
+}
+
+/* Gates become complete ("X") events. Starts and stops pair up in order,
+ * and a gate still open when the thread exits is dropped.
+ */
+static void
+vips_thread_trace_save_gate(VipsThreadGate *gate, FILE *fp, int tid)
+{
+	GArray *start = vips_thread_gate_times(gate->start);
+	GArray *stop = vips_thread_gate_times(gate->stop);
+	guint n = VIPS_MIN(start->len, stop->len);
+
+	guint i;
+
+	for (i = 0; i < n; i++) {
+		gint64 t0 = g_array_index(start, gint64, i);
+		gint64 t1 = g_array_index(stop, gint64, i);
+
+		vips_thread_trace_event(fp, "X", tid);
+		fprintf(fp, "\"name\":");
+		vips_thread_trace_string(fp, gate->name);
+		fprintf(fp, ",\"cat\":\"vips\",\"ts\":%" G_GINT64_FORMAT
+					",\"dur\":%" G_GINT64_FORMAT "}",
+			t0, VIPS_MAX(0, t1 - t0));
+	}
+
+	g_array_free(start, TRUE);
+	g_array_free(stop, TRUE);
+}
+
+/* The memory gate has times in start and malloc/free sizes in stop. Write a
+ * counter track with the running total for this thread.
+ */
+static void
+vips_thread_trace_save_memory(VipsThreadGate *gate, FILE *fp, int tid)
+{
+	GArray *time = vips_thread_gate_times(gate->start);
+	GArray *size = vips_thread_gate_times(gate->stop);
+	gint64 total = 0;
+
+	guint i;
+
+	for (i = 0; i < time->len; i++) {
+		total += g_array_index(size, gint64, i);
+
+		vips_thread_trace_event(fp, "C", tid);
+		fprintf(fp, "\"name\":\"memory\",\"id\":%d,"
+					"\"ts\":%" G_GINT64_FORMAT ","
+					"\"args\":{\"bytes\":%" G_GINT64_FORMAT "}}",
+			tid, g_array_index(time, gint64, i), total);
+	}
+
+	g_array_free(time, TRUE);
+	g_array_free(size, TRUE);
+}
+
+static void
+vips_thread_trace_save_cb(gpointer key, gpointer value, gpointer data)
+{
+	VipsThreadGate *gate = (VipsThreadGate *) value;
+	FILE *fp = (FILE *) data;
+
+	/* We hold the global lock, so this is the tid we just gave out.
+	 */
+	vips_thread_trace_save_gate(gate, fp, vips__thread_trace_tid);
+}
+
+/* Must be called with vips__global_lock held.
+ */
+static void
+vips_thread_trace_save(VipsThreadProfile *profile)
+{
+	int tid;
+
+	if (!vips__thread_fp) {
+		vips__thread_fp =
+			vips__file_open_write(vips__thread_trace, TRUE);
+		if (!vips__thread_fp) {
+			g_warning("unable to create profile trace");
+			return;
+		}
+
+		fprintf(vips__thread_fp, "[\n");
+		vips__thread_trace_first = TRUE;
+	}
+
+	tid = ++vips__thread_trace_tid;
+
+	vips_thread_trace_event(vips__thread_fp, "M", tid);
+	fprintf(vips__thread_fp, "\"name\":\"thread_name\",\"args\":{\"name\":");
+	vips_thread_trace_string(vips__thread_fp, profile->name);
+	fprintf(vips__thread_fp, "}}");
+
+	g_hash_table_foreach(profile->gates,
+		vips_thread_trace_save_cb, vips__thread_fp);
+	vips_thread_trace_save_memory(profile->memory,
+		vips__thread_fp, tid);
+}
+
 static void
 vips_thread_profile_save(VipsThreadProfile *profile)
 {
 	g_mutex_lock(vips__global_lock);
 
+	if (vips__thread_trace) {
+		vips_thread_trace_save(profile);
+		g_mutex_unlock(vips__global_lock);
+		return;
+	}
+
 	VIPS_DEBUG_MSG("vips_thread_profile_save: %s\n", profile->name);
 
 	if (!vips__thread_fp) {
@@ -186,8 +389,13 @@ vips_thread_profile_free(VipsThreadProfile *profile)
 void
 vips__thread_profile_stop(void)
 {
-	if (vips__thread_profile)
+	if (vips__thread_profile) {
+		if (vips__thread_trace &&
+			vips__thread_fp)
+			fprintf(vips__thread_fp, "\n]\n");
+
 		VIPS_FREEF(fclose, vips__thread_fp);
+	}
 }
 
 static void
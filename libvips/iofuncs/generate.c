@@ -53,6 +53,8 @@
  * 7/7/12
  * 	- lock around link make/break so we can process an image from many
  * 	  threads
+ * 16/10/26
+ * 	- write .v files with pwrite(), several strips at once
  */
 
 /*
@@ -623,6 +625,46 @@ vips_allocate_input_array(VipsImage *out, ...)
  * Returns: 0 on success, -1 on error.
  */
 
+#ifdef HAVE_PWRITE
+/* The number of strips we keep in flight when writing .v files.
+ */
+#define VIPS_WRITE_DEPTH (4)
+
+/* Write the pixel data at its position in the file, so strips can be
+ * written in any order, and several at once.
+ */
+static int
+write_vips_at(VipsRegion *region, VipsRect *area, void *a)
+{
+	VipsImage *image = region->im;
+
+	size_t count;
+	gint64 offset;
+	ssize_t nwritten;
+	char *buf;
+
+	count = (size_t) region->bpl * area->height;
+	offset = image->sizeof_header +
+		(gint64) VIPS_IMAGE_SIZEOF_LINE(image) * area->top;
+	buf = (char *) VIPS_REGION_ADDR(region, 0, area->top);
+
+	do {
+		nwritten = pwrite(image->fd, buf, count, (off_t) offset);
+		if (nwritten == -1) {
+			if (errno == EINTR)
+				continue;
+
+			return errno;
+		}
+
+		buf += nwritten;
+		offset += nwritten;
+		count -= nwritten;
+	} while (count > 0);
+
+	return 0;
+}
+#else  /*!HAVE_PWRITE*/
 /* A write function for VIPS images. Just write() the pixel data.
  */
 static int
@@ -645,6 +687,7 @@ write_vips(VipsRegion *region, VipsRect *area, void *a)
 
 	return 0;
 }
+#endif /*HAVE_PWRITE*/
 
 /**
  * vips_image_generate:
@@ -748,8 +791,16 @@ vips_image_generate(VipsImage *image,
 		if (vips_image_write_prepare(image))
 			return -1;
 
-		if (image->dtype == VIPS_IMAGE_OPENOUT)
+		if (image->dtype == VIPS_IMAGE_OPENOUT &&
+			vips__vips_tiled(image))
+			res = vips__vips_tiled_sink(image);
+		else if (image->dtype == VIPS_IMAGE_OPENOUT)
+#ifdef HAVE_PWRITE
+			res = vips__sink_disc_unordered(image,
+				VIPS_WRITE_DEPTH, write_vips_at, NULL);
+#else  /*!HAVE_PWRITE*/
 			res = vips_sink_disc(image, write_vips, NULL);
+#endif /*HAVE_PWRITE*/
 		else
 			res = vips_sink_memory(image);
 
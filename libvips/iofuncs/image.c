@@ -385,6 +385,11 @@ int vips__progress = 0;
  */
 char *vips__disc_threshold = NULL;
 
+/* A string giving the number of bytes of compressed temp images we keep in
+ * memory before spilling to disc.
+ */
+char *vips__temp_memory = NULL;
+
 /* Minimise needs a lock.
  */
 static GMutex *vips__minimise_lock = NULL;
@@ -506,6 +511,10 @@ vips_image_dispose(GObject *gobject)
 
 	vips_object_preclose(VIPS_OBJECT(gobject));
 
+	/* No regions, so no refs to our windows.
+	 */
+	vips__window_table_clear(image);
+
 	/* We have to junk the fd in dispose, since we run this for rewind and
 	 * we must close and reopen the file when we switch from write to
 	 * read.
@@ -1886,6 +1895,13 @@ vips_filename_get_options(const char *vips_filename)
  * "m" or "g" to indicate kilobytes, megabytes or gigabytes.
  * The default threshold is 100 MB.
  *
+ * If libvips was built with lz4, zstd or zlib, these temporary files can
+ * hold compressed tiles, and keep them in memory until a process-wide budget
+ * is used up. Only then are tiles written to disc. The budget can be set
+ * with the "--vips-temp-memory" command-line argument, or the
+ * `VIPS_TEMP_MEMORY` environment variable. It defaults to zero, meaning
+ * plain uncompressed temporary files. See vips_get_temp_memory().
+ *
  * For example:
  *
  * |[
@@ -2541,6 +2557,47 @@ vips_get_disc_threshold(void)
 	return threshold;
 }
 
+/**
+ * vips_get_temp_memory:
+ *
+ * Return the number of bytes of compressed pixels that temporary images made
+ * by vips_image_new_from_file() can hold in memory, summed over the whole
+ * process. Once this is used up, tiles are written to the temporary file
+ * instead. This defaults to zero, meaning no memory tier, but can be set
+ * with the VIPS_TEMP_MEMORY environment variable or the --vips-temp-memory
+ * command-line flag. See vips_image_new_from_file().
+ *
+ * Returns: temp memory budget in bytes.
+ */
+guint64
+vips_get_temp_memory(void)
+{
+	static gboolean done = FALSE;
+	static guint64 budget;
+
+	if (!done) {
+		const char *env;
+
+		done = TRUE;
+
+		/* Off by default.
+		 */
+		budget = 0;
+
+		if ((env = g_getenv("VIPS_TEMP_MEMORY")))
+			budget = vips__parse_size(env);
+
+		if (vips__temp_memory)
+			budget = vips__parse_size(vips__temp_memory);
+
+#ifdef DEBUG
+		printf("vips_get_temp_memory: %zd bytes\n", budget);
+#endif /*DEBUG*/
+	}
+
+	return budget;
+}
+
 /**
  * vips_image_new_temp_file: (constructor)
  * @format: format of file
@@ -2554,6 +2611,10 @@ vips_get_disc_threshold(void)
  * will default to /tmp. On Windows, vips uses GetTempPath() to find the
  * temporary directory.
  *
+ * Set the environment variable VIPS_TEMP_COMPRESSION to the name of a
+ * #VipsForeignVipsCompression, for example "lz4", to compress the pixels
+ * of vips temp files. See vips_vipssave().
+ *
  * See also: vips_image_new().
  *
  * Returns: the new #VipsImage, or %NULL on error.
@@ -2578,6 +2639,10 @@ vips_image_new_temp_file(const char *format)
 
 	vips_image_set_delete_on_close(image, TRUE);
 
+	/* Maybe compress the pixels, see VIPS_TEMP_COMPRESSION.
+	 */
+	vips__vips_tiled_temp(image);
+
 	return image;
 }
 
@@ -3222,9 +3287,15 @@ vips_image_write_line(VipsImage *image, int ypos, VipsPel *linebuffer)
 		break;
 
 	case VIPS_IMAGE_OPENOUT:
+		/* Tiled files are written a row of tiles at a time.
+		 */
+		if (vips__vips_tiled(image)) {
+			if (vips__vips_tiled_write_line(image, ypos, linebuffer))
+				return -1;
+		}
 		/* Don't use ypos for this.
 		 */
-		if (vips__write(image->fd, linebuffer, linesize))
+		else if (vips__write(image->fd, linebuffer, linesize))
 			return -1;
 		break;
 
@@ -464,10 +464,26 @@ vips_init(const char *argv0)
 		vips_verbose();
 	if (g_getenv("VIPS_PROFILE"))
 		vips_profile_set(TRUE);
+	if (g_getenv("VIPS_PROFILE_TRACE"))
+		vips_profile_set_trace(g_getenv("VIPS_PROFILE_TRACE"));
 	if (g_getenv("VIPS_LEAK"))
 		vips_leak_set(TRUE);
 	if (g_getenv("VIPS_TRACE"))
 		vips_cache_set_trace(TRUE);
+	if (g_getenv("VIPS_WINDOW_STRIPS"))
+		vips__window_whole = FALSE;
+	if (g_getenv("VIPS_NOFUSE"))
+		vips__fuse_enabled = FALSE;
+	if (g_getenv("VIPS_NOSIMPLIFY"))
+		vips__simplify_enabled = FALSE;
+	if (g_getenv("VIPS_NOPREFETCH"))
+		vips__prefetch_enabled = FALSE;
+	if (g_getenv("VIPS_RENDER_THREADS"))
+		vips__render_threads = atoi(g_getenv("VIPS_RENDER_THREADS"));
+	if (g_getenv("VIPS_AUTOTUNE"))
+		vips_tile_autotune_set(TRUE);
+	if (g_getenv("VIPS_AUTOTUNE_CACHE"))
+		vips_tile_autotune_set_cache(g_getenv("VIPS_AUTOTUNE_CACHE"));
 	if (g_getenv("VIPS_PIPE_READ_LIMIT"))
 		vips_pipe_read_limit =
 			g_ascii_strtoll(g_getenv("VIPS_PIPE_READ_LIMIT"),
@@ -796,6 +812,33 @@ vips_lib_config_cb(const gchar *option_name, const gchar *value,
 	exit(0);
 }
 
+static gboolean
+vips_profile_trace_cb(const gchar *option_name, const gchar *value,
+	gpointer data, GError **error)
+{
+	vips_profile_set_trace(value);
+
+	return TRUE;
+}
+
+static gboolean
+vips_autotune_cb(const gchar *option_name, const gchar *value,
+	gpointer data, GError **error)
+{
+	vips_tile_autotune_set(TRUE);
+
+	return TRUE;
+}
+
+static gboolean
+vips_autotune_cache_cb(const gchar *option_name, const gchar *value,
+	gpointer data, GError **error)
+{
+	vips_tile_autotune_set_cache(value);
+
+	return TRUE;
+}
+
 static gboolean
 vips_cache_max_cb(const gchar *option_name, const gchar *value,
 	gpointer data, GError **error)
@@ -814,6 +857,24 @@ vips_cache_max_memory_cb(const gchar *option_name, const gchar *value,
 	return TRUE;
 }
 
+static gboolean
+vips_cache_max_tile_memory_cb(const gchar *option_name, const gchar *value,
+	gpointer data, GError **error)
+{
+	vips_cache_set_max_tile_mem(vips__parse_size(value));
+
+	return TRUE;
+}
+
+static gboolean
+vips_cache_max_tile_disc_cb(const gchar *option_name, const gchar *value,
+	gpointer data, GError **error)
+{
+	vips_cache_set_max_tile_disc(vips__parse_size(value));
+
+	return TRUE;
+}
+
 static gboolean
 vips_cache_max_files_cb(const gchar *option_name, const gchar *value,
 	gpointer data, GError **error)
@@ -854,18 +915,49 @@ static GOptionEntry option_entries[] = {
 	{ "vips-profile", 0, 0,
 		G_OPTION_ARG_NONE, &vips__thread_profile,
 		N_("profile and dump timing on exit"), NULL },
+	{ "vips-profile-trace", 0, 0,
+		G_OPTION_ARG_CALLBACK, (gpointer) &vips_profile_trace_cb,
+		N_("profile and write a Chrome trace to FILE on exit"), "FILE" },
 	{ "vips-disc-threshold", 0, 0,
 		G_OPTION_ARG_STRING, &vips__disc_threshold,
 		N_("images larger than N are decompressed to disc"), "N" },
+	{ "vips-temp-memory", 0, 0,
+		G_OPTION_ARG_STRING, &vips__temp_memory,
+		N_("keep up to N bytes of compressed temp images in memory"), "N" },
+	{ "vips-autotune", 0, G_OPTION_FLAG_NO_ARG,
+		G_OPTION_ARG_CALLBACK, (gpointer) &vips_autotune_cb,
+		N_("time several tile sizes and use the fastest"), NULL },
+	{ "vips-autotune-cache", 0, 0,
+		G_OPTION_ARG_CALLBACK, (gpointer) &vips_autotune_cache_cb,
+		N_("autotune, and keep results in FILE"), "FILE" },
 	{ "vips-novector", 0, G_OPTION_FLAG_REVERSE,
 		G_OPTION_ARG_NONE, &vips__vector_enabled,
 		N_("disable vectorised versions of operations"), NULL },
+	{ "vips-nofuse", 0, G_OPTION_FLAG_REVERSE,
+		G_OPTION_ARG_NONE, &vips__fuse_enabled,
+		N_("disable fusing of arithmetic operations"), NULL },
+	{ "vips-nosimplify", 0, G_OPTION_FLAG_REVERSE,
+		G_OPTION_ARG_NONE, &vips__simplify_enabled,
+		N_("disable pipeline simplification"), NULL },
+	{ "vips-noprefetch", 0, G_OPTION_FLAG_REVERSE,
+		G_OPTION_ARG_NONE, &vips__prefetch_enabled,
+		N_("disable background prefetch from slow loaders"), NULL },
+	{ "vips-render-threads", 0, 0,
+		G_OPTION_ARG_INT, &vips__render_threads,
+		N_("render screen images with N background threads"), "N" },
 	{ "vips-cache-max", 0, 0,
 		G_OPTION_ARG_CALLBACK, (gpointer) &vips_cache_max_cb,
 		N_("cache at most N operations"), "N" },
 	{ "vips-cache-max-memory", 0, 0,
 		G_OPTION_ARG_CALLBACK, (gpointer) &vips_cache_max_memory_cb,
 		N_("cache at most N bytes in memory"), "N" },
+	{ "vips-cache-max-tile-memory", 0, 0,
+		G_OPTION_ARG_CALLBACK, (gpointer) &vips_cache_max_tile_memory_cb,
+		N_("share at most N bytes of tiles between caches"), "N" },
+	{ "vips-cache-max-tile-disc", 0, 0,
+		G_OPTION_ARG_CALLBACK, (gpointer) &vips_cache_max_tile_disc_cb,
+		N_("use at most N bytes of disc in each tile cache directory"),
+		"N" },
 	{ "vips-cache-max-files", 0, 0,
 		G_OPTION_ARG_CALLBACK, (gpointer) &vips_cache_max_files_cb,
 		N_("allow at most N open files"), "N" },
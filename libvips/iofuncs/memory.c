@@ -22,6 +22,13 @@
  * 21/9/11
  * 	- rename as vips_tracked_malloc() to emphasise difference from
  * 	  g_malloc()/g_free()
+ * 16/10/26
+ * 	- track memory with sharded atomic counters, not a global lock
+ * 	- don't count idle buffer arena memory or blocks as in use, add
+ * 	  vips_tracked_get_idle()
+ * 	- keep a highwater mark per shard, charge frees to the allocating
+ * 	  shard
+ * 	- vips_tracked_aligned_alloc() memory is now aligned
  */
 
 /*
@@ -75,6 +82,7 @@
 
 #include <vips/vips.h>
 #include <vips/thread.h>
+#include <vips/internal.h>
 
 /**
  * SECTION: memory
@@ -111,10 +119,74 @@
 #warning DEBUG on in libsrc/iofuncs/memory.c
 #endif /*DEBUG*/
 
-static int vips_tracked_allocs = 0;
-static size_t vips_tracked_mem = 0;
+/* Memory use is tracked in a set of shards. Threads are given a shard
+ * round-robin, and update it with atomic ops, so threads allocating at the
+ * same time don't contend on one lock or cache line. We fold the shards on
+ * read.
+ *
+ * Each block records the shard that allocated it, and frees and idle changes
+ * are charged back to that shard, so every shard's in-use count is a true
+ * subtotal.
+ */
+#define VIPS_TRACKED_N_SHARDS (64)
+
+/* Each shard keeps its own highwater mark, updated as its in-use memory
+ * rises, so allocations never touch a shared cache line. The total highwater
+ * mark is the sum of the shard marks. Shards can peak at different times, so
+ * this is an upper bound, but it can't miss a peak made by several threads
+ * together.
+ */
+typedef union _VipsTrackedShard {
+	struct {
+		gssize mem;
+		gssize idle;
+		gssize highwater;
+		int allocs;
+		int idle_allocs;
+	} count;
+
+	/* Pad to a cache line to stop false sharing.
+	 */
+	char padding[64];
+} VipsTrackedShard;
+
+/* The padding only helps if the shards start on a cache line too.
+ */
+#ifdef _MSC_VER
+#define VIPS_TRACKED_ALIGNED __declspec(align(64))
+#elif defined(__GNUC__)
+#define VIPS_TRACKED_ALIGNED __attribute__((aligned(64)))
+#else
+#define VIPS_TRACKED_ALIGNED
+#endif
+
+static VIPS_TRACKED_ALIGNED VipsTrackedShard
+	vips_tracked_shards[VIPS_TRACKED_N_SHARDS];
+
+/* Kept in the 16 bytes before each tracked block. @offset is the distance
+ * from the start of the real allocation to the block.
+ */
+typedef struct _VipsTrackedHeader {
+	size_t size;
+	int shard;
+	int offset;
+} VipsTrackedHeader;
+
+#define VIPS_TRACKED_HEADER(S) \
+	((VipsTrackedHeader *) ((char *) (S) - 16))
+
+/* Hand out shards to threads round-robin.
+ */
+static int vips_tracked_next_shard = 0;
+
+/* The shard index plus one for this thread, so NULL means unset.
+ */
+static GPrivate vips_tracked_shard_key = G_PRIVATE_INIT(NULL);
+
 static int vips_tracked_files = 0;
-static size_t vips_tracked_mem_highwater = 0;
+
+/* Protects files.
+ */
 static GMutex *vips_tracked_mutex = NULL;
 
 /**
@@ -219,6 +291,150 @@ vips_strdup(VipsObject *object, const char *str)
 	return str_dup;
 }
 
+static void *
+vips_tracked_init_mutex(void *data)
+{
+	vips_tracked_mutex = vips_g_mutex_new();
+
+	return NULL;
+}
+
+static void
+vips_tracked_init(void)
+{
+	static GOnce vips_tracked_once = G_ONCE_INIT;
+
+	VIPS_ONCE(&vips_tracked_once,
+		vips_tracked_init_mutex, NULL);
+}
+
+/* Get the shard index for this thread.
+ */
+static int
+vips_tracked_shard_get(void)
+{
+	int index;
+
+	if (!(index = GPOINTER_TO_INT(g_private_get(&vips_tracked_shard_key)))) {
+		index = 1 + (guint) g_atomic_int_add(&vips_tracked_next_shard, 1) %
+			VIPS_TRACKED_N_SHARDS;
+		g_private_set(&vips_tracked_shard_key, GINT_TO_POINTER(index));
+	}
+
+	return index - 1;
+}
+
+static size_t
+vips_tracked_sum_mem(void)
+{
+	gssize mem;
+	int i;
+
+	mem = 0;
+	for (i = 0; i < VIPS_TRACKED_N_SHARDS; i++)
+		mem += (gssize) g_atomic_pointer_get(
+				   &vips_tracked_shards[i].count.mem) -
+			(gssize) g_atomic_pointer_get(
+				&vips_tracked_shards[i].count.idle);
+
+	/* We can see a free before the matching alloc if they race with
+	 * this read.
+	 */
+	return VIPS_MAX(0, mem);
+}
+
+/* In-use memory on @shard has gone up. Update the shard highwater mark.
+ */
+static void
+vips_tracked_rise(VipsTrackedShard *shard)
+{
+	gssize mem = (gssize) g_atomic_pointer_get(&shard->count.mem) -
+		(gssize) g_atomic_pointer_get(&shard->count.idle);
+	gssize highwater;
+
+	do {
+		highwater = (gssize) g_atomic_pointer_get(&shard->count.highwater);
+		if (mem <= highwater)
+			break;
+	} while (!g_atomic_pointer_compare_and_exchange(
+		&shard->count.highwater, highwater, mem));
+}
+
+/* Charge a new block of @size bytes to this thread's shard. Fill out the
+ * header and return the block.
+ */
+static void *
+vips_tracked_add(void *start, size_t size, int offset)
+{
+	void *s = (char *) start + offset;
+	VipsTrackedHeader *header = VIPS_TRACKED_HEADER(s);
+	int index = vips_tracked_shard_get();
+	VipsTrackedShard *shard = &vips_tracked_shards[index];
+
+	header->size = size;
+	header->shard = index;
+	header->offset = offset;
+
+	g_atomic_pointer_add(&shard->count.mem, (gssize) size);
+	g_atomic_int_inc(&shard->count.allocs);
+	vips_tracked_rise(shard);
+
+	return s;
+}
+
+/* Uncharge a block from the shard that allocated it. Return the start of
+ * the real allocation.
+ */
+static void *
+vips_tracked_sub(void *s, size_t *size)
+{
+	VipsTrackedHeader *header = VIPS_TRACKED_HEADER(s);
+	VipsTrackedShard *shard = &vips_tracked_shards[header->shard];
+
+	*size = header->size;
+
+	g_atomic_pointer_add(&shard->count.mem, -(gssize) header->size);
+	g_atomic_int_add(&shard->count.allocs, -1);
+
+#ifdef DEBUG
+	if (vips_tracked_get_allocs() < 0)
+		g_warning("%s", _("vips_free: too many frees"));
+#endif /*DEBUG*/
+
+	return (char *) s - header->offset;
+}
+
+/**
+ * vips__tracked_idle: (skip)
+ * @s: memory from vips_tracked_aligned_alloc()
+ * @idle: %TRUE if the memory is now idle
+ *
+ * Buffer arenas keep tracked memory for reuse. It's still allocated, but it
+ * doesn't count as in use, so it can't make the operation cache trim. Mark
+ * @s idle as it goes into an arena, and not idle as it comes out again.
+ *
+ * See also: vips__tracked_idle_free(), vips_tracked_get_idle().
+ */
+void
+vips__tracked_idle(void *s, gboolean idle)
+{
+	VipsTrackedHeader *header = VIPS_TRACKED_HEADER(s);
+	VipsTrackedShard *shard = &vips_tracked_shards[header->shard];
+
+	if (idle) {
+		g_atomic_pointer_add(&shard->count.idle, (gssize) header->size);
+		g_atomic_int_inc(&shard->count.idle_allocs);
+	}
+	else {
+		g_atomic_pointer_add(&shard->count.idle, -(gssize) header->size);
+		g_atomic_int_add(&shard->count.idle_allocs, -1);
+
+		/* Memory coming out of an arena is back in use.
+		 */
+		vips_tracked_rise(shard);
+	}
+}
+
 /**
  * vips_tracked_free:
  * @s: (transfer full): memory to free
@@ -232,29 +448,26 @@ vips_strdup(VipsObject *object, const char *str)
 void
 vips_tracked_free(void *s)
 {
-	/* Keep the size of the alloc in the previous 16 bytes. Ensures
-	 * alignment rules are kept.
-	 */
-	void *start = (void *) ((char *) s - 16);
-	size_t size = *((size_t *) start);
-
-	g_mutex_lock(vips_tracked_mutex);
+	size_t size;
+	void *start = vips_tracked_sub(s, &size);
 
 #ifdef DEBUG_VERBOSE_MEM
 	printf("vips_tracked_free: %p, %zd bytes\n", s, size);
 #endif /*DEBUG_VERBOSE_MEM*/
 
-	if (vips_tracked_allocs <= 0)
-		g_warning("%s", _("vips_free: too many frees"));
-	if (vips_tracked_mem < size)
-		g_warning("%s", _("vips_free: too much free"));
-
-	vips_tracked_mem -= size;
-	vips_tracked_allocs -= 1;
+	g_free(start);
 
-	g_mutex_unlock(vips_tracked_mutex);
+	VIPS_GATE_FREE(size);
+}
 
-	g_free(start);
+static void
+vips_tracked_aligned_release(void *start, size_t size)
+{
+#ifdef HAVE__ALIGNED_MALLOC
+	_aligned_free(start);
+#else /*defined(HAVE_POSIX_MEMALIGN) || defined(HAVE_MEMALIGN)*/
+	free(start);
+#endif
 
 	VIPS_GATE_FREE(size);
 }
@@ -272,49 +485,38 @@ vips_tracked_free(void *s)
 void
 vips_tracked_aligned_free(void *s)
 {
-	void *start = (size_t *) s - 1;
-	size_t size = *((size_t *) start);
-
-	g_mutex_lock(vips_tracked_mutex);
+	size_t size;
+	void *start = vips_tracked_sub(s, &size);
 
 #ifdef DEBUG_VERBOSE
 	printf("vips_tracked_aligned_free: %p, %zd bytes\n", s, size);
 #endif /*DEBUG_VERBOSE*/
 
-	if (vips_tracked_allocs <= 0)
-		g_warning("%s", _("vips_free: too many frees"));
-	if (vips_tracked_mem < size)
-		g_warning("%s", _("vips_free: too much free"));
-
-	vips_tracked_mem -= size;
-	vips_tracked_allocs -= 1;
-
-	g_mutex_unlock(vips_tracked_mutex);
-
-#ifdef HAVE__ALIGNED_MALLOC
-	_aligned_free(start);
-#else /*defined(HAVE_POSIX_MEMALIGN) || defined(HAVE_MEMALIGN)*/
-	free(start);
-#endif
-
-	VIPS_GATE_FREE(size);
+	vips_tracked_aligned_release(start, size);
 }
 
-static void *
-vips_tracked_init_mutex(void *data)
+/**
+ * vips__tracked_idle_free: (skip)
+ * @s: (transfer full): idle memory to free
+ *
+ * Free memory marked idle with vips__tracked_idle() without it counting as
+ * back in use on the way out.
+ *
+ * See also: vips__tracked_idle().
+ */
+void
+vips__tracked_idle_free(void *s)
 {
-	vips_tracked_mutex = vips_g_mutex_new();
-
-	return NULL;
-}
+	VipsTrackedHeader *header = VIPS_TRACKED_HEADER(s);
+	VipsTrackedShard *shard = &vips_tracked_shards[header->shard];
+	size_t size = header->size;
 
-static void
-vips_tracked_init(void)
-{
-	static GOnce vips_tracked_once = G_ONCE_INIT;
+	g_atomic_pointer_add(&shard->count.mem, -(gssize) size);
+	g_atomic_int_add(&shard->count.allocs, -1);
+	g_atomic_pointer_add(&shard->count.idle, -(gssize) size);
+	g_atomic_int_add(&shard->count.idle_allocs, -1);
 
-	VIPS_ONCE(&vips_tracked_once,
-		vips_tracked_init_mutex, NULL);
+	vips_tracked_aligned_release((char *) s - header->offset, size);
 }
 
 /**
@@ -340,9 +542,8 @@ vips_tracked_malloc(size_t size)
 
 	vips_tracked_init();
 
-	/* Need an extra sizeof(size_t) bytes to track
-	 * size of this block. Ask for an extra 16 to make sure we don't break
-	 * alignment rules.
+	/* Need an extra 16 bytes for the header. Ask for all 16 to make sure
+	 * we don't break alignment rules.
 	 */
 	size += 16;
 
@@ -360,22 +561,12 @@ vips_tracked_malloc(size_t size)
 		return NULL;
 	}
 
-	g_mutex_lock(vips_tracked_mutex);
-
-	*((size_t *) buf) = size;
-	buf = (void *) ((char *) buf + 16);
-
-	vips_tracked_mem += size;
-	if (vips_tracked_mem > vips_tracked_mem_highwater)
-		vips_tracked_mem_highwater = vips_tracked_mem;
-	vips_tracked_allocs += 1;
+	buf = vips_tracked_add(buf, size, 16);
 
 #ifdef DEBUG_VERBOSE_MEM
 	printf("vips_tracked_malloc: %p, %zd bytes\n", buf, size);
 #endif /*DEBUG_VERBOSE_MEM*/
 
-	g_mutex_unlock(vips_tracked_mutex);
-
 	VIPS_GATE_MALLOC(size);
 
 	return buf;
@@ -403,15 +594,17 @@ void *
 vips_tracked_aligned_alloc(size_t size, size_t align)
 {
 	void *buf;
+	int offset;
 
 	vips_tracked_init();
 
 	g_assert(!(align & (align - 1)));
 
-	/* Need an extra sizeof(size_t) bytes to track
-	 * size of this block.
+	/* Need an extra 16 bytes for the header. Pad that out to a whole
+	 * alignment unit so the memory we return is aligned too.
 	 */
-	size += sizeof(size_t);
+	offset = VIPS_MAX(align, 16);
+	size += offset;
 
 #ifdef HAVE__ALIGNED_MALLOC
 	if (!(buf = _aligned_malloc(size, align))) {
@@ -437,24 +630,15 @@ vips_tracked_aligned_alloc(size_t size, size_t align)
 
 	memset(buf, 0, size);
 
-	g_mutex_lock(vips_tracked_mutex);
-
-	*((size_t *) buf) = size;
-
-	vips_tracked_mem += size;
-	if (vips_tracked_mem > vips_tracked_mem_highwater)
-		vips_tracked_mem_highwater = vips_tracked_mem;
-	vips_tracked_allocs += 1;
+	buf = vips_tracked_add(buf, size, offset);
 
 #ifdef DEBUG_VERBOSE
 	printf("vips_tracked_aligned_alloc: %p, %zd bytes\n", buf, size);
 #endif /*DEBUG_VERBOSE*/
 
-	g_mutex_unlock(vips_tracked_mutex);
-
 	VIPS_GATE_MALLOC(size);
 
-	return (void *) ((size_t *) buf + 1);
+	return buf;
 }
 
 /**
@@ -546,22 +730,39 @@ vips_tracked_close(int fd)
  * friends. vips uses this figure to decide when to start dropping cache, see
  * #VipsOperation.
  *
+ * Pixel memory that worker threads keep for reuse is not counted, see
+ * vips_tracked_get_idle().
+ *
  * Returns: the number of currently allocated bytes
  */
 size_t
 vips_tracked_get_mem(void)
 {
-	size_t mem;
-
-	vips_tracked_init();
-
-	g_mutex_lock(vips_tracked_mutex);
+	return vips_tracked_sum_mem();
+}
 
-	mem = vips_tracked_mem;
+/**
+ * vips_tracked_get_idle:
+ *
+ * Returns the number of bytes allocated via vips_malloc() and friends which
+ * worker threads are keeping for reuse. This memory is not counted by
+ * vips_tracked_get_mem() or vips_tracked_get_allocs(). The total is bounded
+ * by the number of worker threads, see vips_concurrency_set().
+ *
+ * Returns: the number of idle bytes
+ */
+size_t
+vips_tracked_get_idle(void)
+{
+	gssize idle;
+	int i;
 
-	g_mutex_unlock(vips_tracked_mutex);
+	idle = 0;
+	for (i = 0; i < VIPS_TRACKED_N_SHARDS; i++)
+		idle += (gssize) g_atomic_pointer_get(
+			&vips_tracked_shards[i].count.idle);
 
-	return mem;
+	return VIPS_MAX(0, idle);
 }
 
 /**
@@ -571,28 +772,32 @@ vips_tracked_get_mem(void)
  * vips_tracked_malloc(). Handy for estimating max memory requirements for a
  * program.
  *
+ * This is the sum of the peaks seen by each thread's share of memory, so it
+ * can be a little over the true peak, but it will never be under it.
+ *
  * Returns: the largest number of currently allocated bytes
  */
 size_t
 vips_tracked_get_mem_highwater(void)
 {
-	size_t mx;
+	gssize highwater;
+	int i;
 
 	vips_tracked_init();
 
-	g_mutex_lock(vips_tracked_mutex);
-
-	mx = vips_tracked_mem_highwater;
+	highwater = 0;
+	for (i = 0; i < VIPS_TRACKED_N_SHARDS; i++)
+		highwater += (gssize) g_atomic_pointer_get(
+			&vips_tracked_shards[i].count.highwater);
 
-	g_mutex_unlock(vips_tracked_mutex);
-
-	return mx;
+	return highwater;
 }
 
 /**
  * vips_tracked_get_allocs:
  *
- * Returns the number of active allocations.
+ * Returns the number of active allocations. Blocks that worker threads are
+ * keeping for reuse are not counted, as in vips_tracked_get_mem().
  *
  * Returns: the number of active allocations
  */
@@ -600,14 +805,12 @@ int
 vips_tracked_get_allocs(void)
 {
 	int n;
+	int i;
 
-	vips_tracked_init();
-
-	g_mutex_lock(vips_tracked_mutex);
-
-	n = vips_tracked_allocs;
-
-	g_mutex_unlock(vips_tracked_mutex);
+	n = 0;
+	for (i = 0; i < VIPS_TRACKED_N_SHARDS; i++)
+		n += g_atomic_int_get(&vips_tracked_shards[i].count.allocs) -
+			g_atomic_int_get(&vips_tracked_shards[i].count.idle_allocs);
 
 	return n;
 }
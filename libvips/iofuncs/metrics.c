@@ -0,0 +1,576 @@
+/* metrics.c --- per-operation counters
+ *
+ * 16/10/26
+ * 	- from vips__region_count_pixels() and the cache counters
+ * 	- shard the counters, so threads don't contend on one lock per tile
+ * 	- allocate entries on a cache line, so the shard padding works
+ */
+
+/*
+
+	This file is part of VIPS.
+
+	VIPS is free software; you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+	02110-1301  USA
+
+ */
+
+/*
+
+	These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/*
+#define DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <glib/gi18n-lib.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(HAVE__ALIGNED_MALLOC) || defined(HAVE_MEMALIGN)
+#include <malloc.h>
+#endif
+
+#include <vips/vips.h>
+#include <vips/internal.h>
+
+/* Counters are kept in a set of shards per nickname. Threads are given a
+ * shard round-robin, so threads computing tiles for the same operation at
+ * the same time don't contend on one lock or cache line. We sum the shards
+ * on read.
+ *
+ * Counters are 64-bit on all platforms, so each shard needs a lock rather
+ * than pointer-sized atomics, but it's almost never contended.
+ */
+#define VIPS_METRICS_N_SHARDS (16)
+
+typedef struct _VipsMetricsCounts {
+	guint64 hits;
+	guint64 misses;
+	guint64 pixels;
+	guint64 time;
+	guint64 memory;
+} VipsMetricsCounts;
+
+typedef union _VipsMetricsShard {
+	struct {
+		GMutex lock;
+		VipsMetricsCounts counts;
+	} s;
+
+	/* Pad to a cache line to stop false sharing.
+	 */
+	char padding[64];
+} VipsMetricsShard;
+
+/* The counters for one operation nickname. Entries are made on first use
+ * and live until shutdown, so output images can keep a pointer to theirs.
+ *
+ * Entries are allocated on a cache line, and the shards come first, so each
+ * shard has a cache line to itself.
+ */
+typedef struct _VipsMetricsEntry {
+	VipsMetricsShard shards[VIPS_METRICS_N_SHARDS];
+
+	const char *nickname;
+} VipsMetricsEntry;
+
+/* Turn counting on and off. This is the only test on the generate and
+ * buffer paths when counting is off, see vips_region_generate().
+ */
+gboolean vips__metrics_enabled = TRUE;
+
+/* nickname -> VipsMetricsEntry.
+ */
+static GHashTable *vips_metrics_table = NULL;
+static GMutex vips_metrics_lock;
+
+/* The innermost generate we are timing on this thread.
+ */
+static GPrivate vips_metrics_frame_key;
+
+/* Hand out shards to threads round-robin.
+ */
+static int vips_metrics_next_shard = 0;
+
+/* The shard index plus one for this thread, so NULL means unset.
+ */
+static GPrivate vips_metrics_shard_key = G_PRIVATE_INIT(NULL);
+
+static GQuark
+vips_metrics_quark(void)
+{
+	return g_quark_from_static_string("vips-metrics");
+}
+
+/* Images also carry the nickname of the operation that made them. This is
+ * set even when counting is off, and needs no lock.
+ */
+static GQuark
+vips_metrics_nickname_quark(void)
+{
+	return g_quark_from_static_string("vips-metrics-nickname");
+}
+
+/* Entries are not tracked memory, since they live until shutdown and would
+ * show up as leaks.
+ */
+static VipsMetricsEntry *
+vips_metrics_entry_new(void)
+{
+	VipsMetricsEntry *entry;
+
+#ifdef HAVE__ALIGNED_MALLOC
+	entry = _aligned_malloc(sizeof(VipsMetricsEntry), 64);
+#elif defined(HAVE_POSIX_MEMALIGN)
+	if (posix_memalign((void **) &entry, 64, sizeof(VipsMetricsEntry)))
+		entry = NULL;
+#elif defined(HAVE_MEMALIGN)
+	entry = memalign(64, sizeof(VipsMetricsEntry));
+#else
+#error Missing aligned alloc implementation
+#endif
+
+	if (!entry)
+		g_error("%s", _("out of memory"));
+
+	memset(entry, 0, sizeof(VipsMetricsEntry));
+
+	return entry;
+}
+
+static void
+vips_metrics_entry_free(void *data)
+{
+	VipsMetricsEntry *entry = (VipsMetricsEntry *) data;
+
+	int i;
+
+	for (i = 0; i < VIPS_METRICS_N_SHARDS; i++)
+		g_mutex_clear(&entry->shards[i].s.lock);
+
+#ifdef HAVE__ALIGNED_MALLOC
+	_aligned_free(entry);
+#else /*defined(HAVE_POSIX_MEMALIGN) || defined(HAVE_MEMALIGN)*/
+	free(entry);
+#endif
+}
+
+/* Get this thread's shard of @entry and lock it.
+ */
+static VipsMetricsShard *
+vips_metrics_shard_lock(VipsMetricsEntry *entry)
+{
+	VipsMetricsShard *shard;
+	int index;
+
+	if (!(index = GPOINTER_TO_INT(g_private_get(&vips_metrics_shard_key)))) {
+		index = 1 + (guint) g_atomic_int_add(&vips_metrics_next_shard, 1) %
+			VIPS_METRICS_N_SHARDS;
+		g_private_set(&vips_metrics_shard_key, GINT_TO_POINTER(index));
+	}
+
+	shard = &entry->shards[index - 1];
+	g_mutex_lock(&shard->s.lock);
+
+	return shard;
+}
+
+static VipsMetricsEntry *
+vips_metrics_entry(const char *nickname)
+{
+	VipsMetricsEntry *entry;
+
+	g_mutex_lock(&vips_metrics_lock);
+
+	if (!vips_metrics_table)
+		vips_metrics_table = g_hash_table_new_full(g_str_hash,
+			g_str_equal, NULL, vips_metrics_entry_free);
+
+	if (!(entry = g_hash_table_lookup(vips_metrics_table, nickname))) {
+		int i;
+
+		entry = vips_metrics_entry_new();
+		entry->nickname = nickname;
+		for (i = 0; i < VIPS_METRICS_N_SHARDS; i++)
+			g_mutex_init(&entry->shards[i].s.lock);
+		g_hash_table_insert(vips_metrics_table,
+			(char *) nickname, entry);
+	}
+
+	g_mutex_unlock(&vips_metrics_lock);
+
+	return entry;
+}
+
+static void *
+vips_metrics_tag(VipsObject *object, GParamSpec *pspec,
+	VipsArgumentClass *argument_class,
+	VipsArgumentInstance *argument_instance,
+	void *a, void *b)
+{
+	const char *nickname = (const char *) a;
+	VipsMetricsEntry *entry = (VipsMetricsEntry *) b;
+
+	if ((argument_class->flags & VIPS_ARGUMENT_OUTPUT) &&
+		argument_instance->assigned &&
+		g_type_is_a(G_PARAM_SPEC_VALUE_TYPE(pspec), VIPS_TYPE_IMAGE)) {
+		VipsImage *image = G_STRUCT_MEMBER(VipsImage *,
+			object, argument_class->offset);
+
+		/* The first operation to make an image owns it.
+		 */
+		if (image &&
+			!g_object_get_qdata(G_OBJECT(image),
+				vips_metrics_nickname_quark())) {
+			g_object_set_qdata(G_OBJECT(image),
+				vips_metrics_nickname_quark(), (char *) nickname);
+			if (entry)
+				g_object_set_qdata(G_OBJECT(image),
+					vips_metrics_quark(), entry);
+		}
+	}
+
+	return NULL;
+}
+
+/* Called from vips_cache_operation_buildp() for every operation. On a
+ * miss, @operation has just been built and we tag its output images so
+ * generate and buffer counts go to this nickname.
+ *
+ * When counting is off we don't touch the table or its lock, we only tag
+ * outputs with the nickname, since sinks use that to make pipeline
+ * signatures, see vips__metrics_nickname(). Images made while counting is
+ * off are never counted.
+ *
+ * Operations which are never cached don't count as misses, just as in
+ * vips_cache_get_misses().
+ */
+void
+vips__metrics_build(VipsOperation *operation, gboolean hit)
+{
+	const char *nickname = VIPS_OBJECT_GET_CLASS(operation)->nickname;
+
+	VipsMetricsEntry *entry;
+	VipsMetricsShard *shard;
+
+	entry = vips__metrics_enabled
+		? vips_metrics_entry(nickname)
+		: NULL;
+
+	if (hit) {
+		if (entry) {
+			shard = vips_metrics_shard_lock(entry);
+			shard->s.counts.hits += 1;
+			g_mutex_unlock(&shard->s.lock);
+		}
+	}
+	else {
+		if (entry &&
+			!(vips_operation_get_flags(operation) &
+				VIPS_OPERATION_NOCACHE)) {
+			shard = vips_metrics_shard_lock(entry);
+			shard->s.counts.misses += 1;
+			g_mutex_unlock(&shard->s.lock);
+		}
+		(void) vips_argument_map(VIPS_OBJECT(operation),
+			vips_metrics_tag, (void *) nickname, entry);
+	}
+}
+
+/* The nickname of the operation that made @image, or NULL if it wasn't
+ * made by an operation.
+ */
+const char *
+vips__metrics_nickname(VipsImage *image)
+{
+	return (const char *) g_object_get_qdata(G_OBJECT(image),
+		vips_metrics_nickname_quark());
+}
+
+/* Start timing a generate on @image. Returns NULL if we're not counting
+ * this image. Callers test vips__metrics_enabled first, so there's no
+ * qdata lookup or clock read when counting is off.
+ */
+VipsMetricsEntry *
+vips__metrics_begin(VipsImage *image, VipsMetricsFrame *frame)
+{
+	VipsMetricsEntry *entry;
+
+	if (!(entry = g_object_get_qdata(G_OBJECT(image),
+			  vips_metrics_quark())))
+		return NULL;
+
+	frame->parent = g_private_get(&vips_metrics_frame_key);
+	frame->children = 0;
+	frame->start = g_get_monotonic_time();
+	g_private_set(&vips_metrics_frame_key, frame);
+
+	return entry;
+}
+
+/* Stop timing. Time spent in generates further up the pipeline is
+ * subtracted, so each operation is only charged for its own work.
+ */
+void
+vips__metrics_end(VipsMetricsEntry *entry,
+	VipsMetricsFrame *frame, guint64 pixels)
+{
+	gint64 elapsed = g_get_monotonic_time() - frame->start;
+
+	VipsMetricsShard *shard;
+
+	if (frame->parent)
+		frame->parent->children += elapsed;
+	g_private_set(&vips_metrics_frame_key, frame->parent);
+
+	shard = vips_metrics_shard_lock(entry);
+	shard->s.counts.time += VIPS_MAX(0, elapsed - frame->children);
+	shard->s.counts.pixels += pixels;
+	g_mutex_unlock(&shard->s.lock);
+}
+
+/* Count pixel buffer memory allocated for @image. Callers test
+ * vips__metrics_enabled first.
+ */
+void
+vips__metrics_memory(VipsImage *image, size_t bytes)
+{
+	VipsMetricsEntry *entry;
+
+	if ((entry = g_object_get_qdata(G_OBJECT(image),
+			 vips_metrics_quark()))) {
+		VipsMetricsShard *shard = vips_metrics_shard_lock(entry);
+
+		shard->s.counts.memory += bytes;
+		g_mutex_unlock(&shard->s.lock);
+	}
+}
+
+/* Sum the shards. Each shard is read under its lock, so the counts are
+ * never torn, though the total can be a moment out of date.
+ */
+static void
+vips_metrics_snapshot(VipsMetricsEntry *entry, VipsMetrics *metrics)
+{
+	int i;
+
+	metrics->nickname = entry->nickname;
+	metrics->hits = 0;
+	metrics->misses = 0;
+	metrics->pixels = 0;
+	metrics->time = 0;
+	metrics->memory = 0;
+
+	for (i = 0; i < VIPS_METRICS_N_SHARDS; i++) {
+		VipsMetricsShard *shard = &entry->shards[i];
+
+		g_mutex_lock(&shard->s.lock);
+		metrics->hits += shard->s.counts.hits;
+		metrics->misses += shard->s.counts.misses;
+		metrics->pixels += shard->s.counts.pixels;
+		metrics->time += shard->s.counts.time;
+		metrics->memory += shard->s.counts.memory;
+		g_mutex_unlock(&shard->s.lock);
+	}
+}
+
+/**
+ * VipsMetrics:
+ * @nickname: operation nickname
+ * @hits: number of times the operation cache returned an existing operation
+ * @misses: number of times the operation was built
+ * @pixels: number of pixels computed by the operation's generate function
+ * @time: microseconds spent in the operation's generate function, not
+ * counting time spent computing its inputs
+ * @memory: bytes of pixel buffer allocated for the operation's outputs
+ *
+ * Counts for one operation, see vips_metrics_map().
+ *
+ * Counts are for all instances of the operation in this process. Pixels,
+ * time and memory are only counted for images made by operations built with
+ * vips_cache_operation_buildp(), which includes all calls made through
+ * vips_call() and the C, C++ and language bindings.
+ */
+
+/**
+ * vips_metrics_set:
+ * @enabled: count operations
+ *
+ * Turn per-operation counting on and off. Counting is on by default. Each
+ * tile computed costs two clock reads and an update to one of a set of
+ * sharded counters, so threads computing at the same time rarely wait for
+ * each other. Counts are kept when counting is turned off. Images made
+ * while counting is off are not counted, even if counting is turned on
+ * again later.
+ *
+ * See also: vips_metrics_map().
+ */
+void
+vips_metrics_set(gboolean enabled)
+{
+	vips__metrics_enabled = enabled;
+}
+
+/**
+ * vips_metrics_get:
+ * @nickname: operation nickname, for example "resize"
+ * @metrics: (out): fill this with counts
+ *
+ * Fill @metrics with the counts for the operation @nickname. See
+ * #VipsMetrics for the meaning of each field.
+ *
+ * See also: vips_metrics_map().
+ *
+ * Returns: %TRUE if @nickname has been seen.
+ */
+gboolean
+vips_metrics_get(const char *nickname, VipsMetrics *metrics)
+{
+	VipsMetricsEntry *entry;
+
+	g_mutex_lock(&vips_metrics_lock);
+	entry = vips_metrics_table
+		? g_hash_table_lookup(vips_metrics_table, nickname)
+		: NULL;
+	g_mutex_unlock(&vips_metrics_lock);
+
+	if (!entry)
+		return FALSE;
+
+	vips_metrics_snapshot(entry, metrics);
+
+	return TRUE;
+}
+
+static int
+vips_metrics_compare(const void *a, const void *b)
+{
+	VipsMetricsEntry *e1 = *((VipsMetricsEntry **) a);
+	VipsMetricsEntry *e2 = *((VipsMetricsEntry **) b);
+
+	return strcmp(e1->nickname, e2->nickname);
+}
+
+/**
+ * vips_metrics_map: (skip)
+ * @fn: function to call for each operation
+ * @a: client data
+ * @b: client data
+ *
+ * Call @fn with the counts for each operation that has been seen, in
+ * nickname order. @fn gets a copy of the counters, taken just before the
+ * call. If @fn returns non-%NULL, iteration stops and that value is
+ * returned.
+ *
+ * For example, this will print the operations which have taken the most
+ * time:
+ *
+ * |[
+ * static void *
+ * print_metrics(VipsMetrics *metrics, void *a, void *b)
+ * {
+ *     if (metrics->time > 1000000)
+ *         printf("%s: %g s, %" G_GUINT64_FORMAT " pixels\n",
+ *             metrics->nickname, metrics->time / 1000000.0,
+ *             metrics->pixels);
+ *
+ *     return NULL;
+ * }
+ *
+ * vips_metrics_map(print_metrics, NULL, NULL);
+ * ]|
+ *
+ * See also: vips_metrics_get(), vips_metrics_reset().
+ *
+ * Returns: the first non-%NULL value from @fn, or %NULL.
+ */
+void *
+vips_metrics_map(VipsMetricsMapFn fn, void *a, void *b)
+{
+	VipsMetricsEntry **entries;
+	GHashTableIter iter;
+	gpointer value;
+	guint n;
+	guint i;
+	void *result;
+
+	g_mutex_lock(&vips_metrics_lock);
+	if (!vips_metrics_table) {
+		g_mutex_unlock(&vips_metrics_lock);
+		return NULL;
+	}
+	n = g_hash_table_size(vips_metrics_table);
+	entries = g_new(VipsMetricsEntry *, n);
+	i = 0;
+	g_hash_table_iter_init(&iter, vips_metrics_table);
+	while (g_hash_table_iter_next(&iter, NULL, &value))
+		entries[i++] = (VipsMetricsEntry *) value;
+	g_mutex_unlock(&vips_metrics_lock);
+
+	qsort(entries, n, sizeof(VipsMetricsEntry *), vips_metrics_compare);
+
+	result = NULL;
+	for (i = 0; i < n; i++) {
+		VipsMetrics metrics;
+
+		vips_metrics_snapshot(entries[i], &metrics);
+		if ((result = fn(&metrics, a, b)))
+			break;
+	}
+
+	g_free(entries);
+
+	return result;
+}
+
+static void
+vips_metrics_reset_entry(void *key, void *value, void *data)
+{
+	VipsMetricsEntry *entry = (VipsMetricsEntry *) value;
+
+	int i;
+
+	for (i = 0; i < VIPS_METRICS_N_SHARDS; i++) {
+		VipsMetricsShard *shard = &entry->shards[i];
+
+		g_mutex_lock(&shard->s.lock);
+		memset(&shard->s.counts, 0, sizeof(VipsMetricsCounts));
+		g_mutex_unlock(&shard->s.lock);
+	}
+}
+
+/**
+ * vips_metrics_reset:
+ *
+ * Set all per-operation counters back to zero.
+ *
+ * See also: vips_metrics_map().
+ */
+void
+vips_metrics_reset(void)
+{
+	g_mutex_lock(&vips_metrics_lock);
+	if (vips_metrics_table)
+		g_hash_table_foreach(vips_metrics_table,
+			vips_metrics_reset_entry, NULL);
+	g_mutex_unlock(&vips_metrics_lock);
+}
@@ -2,6 +2,8 @@
  *
  * 30/12/14
  * 	- display default/min/max for pspec in usage
+ * 16/10/26
+ * 	- add vips__simplify_enabled
  */
 
 /*
@@ -163,7 +165,23 @@
  * operation reffed, and the old operation returned in place of the new one.
  *
  * The cache size is controlled with vips_cache_set_max() and friends.
+ *
+ * ## Simplification
+ *
+ * Some operations look at how their input was made and simplify the
+ * pipeline as they build. An extract of an extract reads directly from the
+ * first image, a flip of a flip in the same direction and rotations that
+ * add up to zero become copies, a vips_linear() of a vips_linear() becomes a
+ * single vips_linear(), and a vips_cast() skips over earlier casts that
+ * lost no information. Less work is done per pixel. The pixels are the
+ * same, except that a merged vips_linear() rounds once rather than twice,
+ * so float results can differ in the last few bits. Set `VIPS_NOSIMPLIFY`
+ * or use `--vips-nosimplify` to turn this off.
+ */
+
+/* Set FALSE to stop operations simplifying the pipeline as they build.
  */
+gboolean vips__simplify_enabled = TRUE;
 
 /**
  * VipsOperationFlags:
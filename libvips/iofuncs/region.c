@@ -1612,6 +1612,9 @@ vips_region_generate(VipsRegion *reg, void *a)
 	VipsImage *im = reg->im;
 
 	gboolean stop;
+	VipsMetricsFrame frame;
+	struct _VipsMetricsEntry *metrics;
+	int result;
 
 	/* Start new sequence, if necessary.
 	 */
@@ -1621,7 +1624,15 @@ vips_region_generate(VipsRegion *reg, void *a)
 	/* Ask for evaluation.
 	 */
 	stop = FALSE;
-	if (im->generate_fn(reg, reg->seq, im->client1, im->client2, &stop))
+	metrics = vips__metrics_enabled
+		? vips__metrics_begin(im, &frame)
+		: NULL;
+	result = im->generate_fn(reg, reg->seq,
+		im->client1, im->client2, &stop);
+	if (metrics)
+		vips__metrics_end(metrics, &frame,
+			(guint64) reg->valid.width * reg->valid.height);
+	if (result)
 		return -1;
 	if (stop) {
 		vips_error("vips_region_generate",
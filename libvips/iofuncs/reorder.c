@@ -2,6 +2,8 @@
  *
  * 11/1/17
  * 	- first version
+ * 16/10/26
+ * 	- add vips_reorder_prefetch_hint() and vips_reorder_prefetch()
  */
 
 /*
@@ -42,6 +44,7 @@
 
 #include <vips/vips.h>
 #include <vips/internal.h>
+#include <vips/thread.h>
 #include <vips/debug.h>
 
 /* Have one of these on every image, identified by a quark.
@@ -76,10 +79,31 @@ typedef struct _VipsReorder {
 	VipsImage **source;
 	int *cumulative_margin;
 
+	/* Set if this image is slow to compute but cached, so it's worth
+	 * computing pixels before they are needed.
+	 */
+	gboolean prefetch;
+
 } VipsReorder;
 
+/* A prefetch we've set going in the background.
+ */
+typedef struct _VipsReorderPrefetch {
+	VipsImage *image;
+	VipsRect rect;
+} VipsReorderPrefetch;
+
 GQuark vips__image_reorder_quark = 0;
 
+/* Set by --vips-noprefetch and VIPS_NOPREFETCH.
+ */
+gboolean vips__prefetch_enabled = TRUE;
+
+/* The number of prefetches running. We don't start more than the number of
+ * worker threads.
+ */
+static int vips_reorder_n_prefetch = 0;
+
 #ifdef DEBUG
 static void
 vips_reorder_print(VipsReorder *reorder)
@@ -149,6 +173,7 @@ vips_reorder_get(VipsImage *image)
 	reorder->n_sources = 0;
 	reorder->source = NULL;
 	reorder->cumulative_margin = NULL;
+	reorder->prefetch = FALSE;
 
 	g_object_set_qdata_full(G_OBJECT(image), vips__image_reorder_quark,
 		reorder, (GDestroyNotify) vips_reorder_destroy);
@@ -369,6 +394,119 @@ vips_reorder_margin_hint(VipsImage *image, int margin)
 		reorder->cumulative_margin[i] += margin;
 }
 
+/**
+ * vips_reorder_prefetch_hint: (method)
+ * @image: the image to hint on
+ *
+ * vips_reorder_prefetch_hint() sets a hint that @image is slow to compute,
+ * but keeps the pixels it computes in a vips_tilecache() with @threaded set.
+ * Loaders for formats like tiled TIFF and slide images use this on their
+ * output.
+ *
+ * The cache must be threaded, since prefetches run alongside the requests
+ * that will use them. With a non-threaded cache, a request would queue
+ * behind the prefetch and gain nothing.
+ *
+ * Operations can then use vips_reorder_prefetch() to ask for pixels they
+ * will need soon to be computed in the background.
+ *
+ * See also: vips_reorder_prefetch(), vips_reorder_margin_hint().
+ */
+void
+vips_reorder_prefetch_hint(VipsImage *image)
+{
+	vips_reorder_get(image)->prefetch = TRUE;
+}
+
+static void
+vips_reorder_prefetch_run(void *data, void *user_data)
+{
+	VipsReorderPrefetch *prefetch = (VipsReorderPrefetch *) data;
+	gboolean cancelled = user_data != NULL;
+
+	VipsRegion *region;
+
+	VIPS_GATE_START("vips_reorder_prefetch_run: work");
+
+	/* Failures will show up again when the pixels are needed for real,
+	 * so we can ignore them here. If the sink has finished, the pixels
+	 * will never be needed.
+	 */
+	if (!cancelled &&
+		(region = vips_region_new(prefetch->image))) {
+		(void) vips_region_prepare(region, &prefetch->rect);
+		g_object_unref(region);
+	}
+
+	VIPS_GATE_STOP("vips_reorder_prefetch_run: work");
+
+	g_object_unref(prefetch->image);
+	g_free(prefetch);
+
+	g_atomic_int_add(&vips_reorder_n_prefetch, -1);
+}
+
+/**
+ * vips_reorder_prefetch: (method)
+ * @region: the region that will be prepared
+ * @r: the area that will be needed
+ *
+ * vips_reorder_prefetch() tells vips that @r will be prepared on @region
+ * soon, for example the next tile to the right of the one being computed.
+ *
+ * If the image @region is on has had vips_reorder_prefetch_hint() set, @r
+ * is computed by an idle thread, so it will be ready when needed. Otherwise,
+ * or if enough prefetches are already running, this does nothing.
+ *
+ * Prefetches belong to the sink whose worker asked for them. The sink waits
+ * for them to finish before it returns, and prefetches which have not
+ * started by then are dropped. Calls from outside a sink do nothing.
+ *
+ * See also: vips_reorder_prefetch_hint(), vips_region_prepare().
+ */
+void
+vips_reorder_prefetch(VipsRegion *region, VipsRect *r)
+{
+	VipsImage *image = region->im;
+
+	VipsReorder *reorder;
+	VipsRect all;
+	VipsRect need;
+	VipsReorderPrefetch *prefetch;
+
+	if (!vips__prefetch_enabled ||
+		!(reorder = g_object_get_qdata(G_OBJECT(image),
+			  vips__image_reorder_quark)) ||
+		!reorder->prefetch)
+		return;
+
+	all.left = 0;
+	all.top = 0;
+	all.width = image->Xsize;
+	all.height = image->Ysize;
+	vips_rect_intersectrect(r, &all, &need);
+	if (vips_rect_isempty(&need))
+		return;
+
+	if (g_atomic_int_add(&vips_reorder_n_prefetch, 1) >=
+		vips_concurrency_get()) {
+		g_atomic_int_add(&vips_reorder_n_prefetch, -1);
+		return;
+	}
+
+	prefetch = g_new(VipsReorderPrefetch, 1);
+	prefetch->image = image;
+	prefetch->rect = need;
+	g_object_ref(image);
+
+	if (vips__worker_execute("prefetch",
+			vips_reorder_prefetch_run, prefetch)) {
+		g_object_unref(image);
+		g_free(prefetch);
+		g_atomic_int_add(&vips_reorder_n_prefetch, -1);
+	}
+}
+
 void
 vips__reorder_clear(VipsImage *image)
 {
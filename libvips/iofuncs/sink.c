@@ -2,6 +2,9 @@
  *
  * 28/3/10
  * 	- from im_iterate(), reworked for threadpool
+ * 16/10/26
+ * 	- use the work-stealing scheduler for non-sequential images
+ * 	- add tile geometry autotuning
  */
 
 /*
@@ -42,6 +45,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <vips/vips.h>
 #include <vips/thread.h>
@@ -202,6 +206,8 @@ sink_area_allocate_fn(VipsThreadState *state, void *a, gboolean *stop)
 			VIPS_SWAP(SinkArea *,
 				sink->area, sink->old_area);
 
+			vips_sink_base_tune_next(sink_base);
+
 			/* Position buf at the new y.
 			 */
 			sink_area_position(sink->area,
@@ -371,6 +377,417 @@ vips_sink_base_init(SinkBase *sink_base, VipsImage *image)
 		&sink_base->n_lines);
 
 	sink_base->processed = 0;
+	sink_base->steal = FALSE;
+	sink_base->n_tiles = 0;
+	sink_base->tune_n = 0;
+}
+
+/* Decide if we can use the work-stealing scheduler for this sink. Tiles are
+ * then computed in no particular order, so we can't use it for sequential
+ * images.
+ */
+gboolean
+vips_sink_base_steal(SinkBase *sink_base)
+{
+	sink_base->steal = vips_threadpool_steal_get() &&
+		!vips_image_is_sequential(sink_base->im);
+
+	return sink_base->steal;
+}
+
+/* The allocate for work-stealing sinks. The pool has already set state->pos,
+ * and many threads run this at once.
+ */
+int
+vips_sink_base_steal_allocate(VipsThreadState *state, void *a, gboolean *stop)
+{
+	SinkBase *sink_base = (SinkBase *) a;
+
+	g_atomic_int_inc(&sink_base->n_tiles);
+
+	return 0;
+}
+
+/* Set to time a range of tile geometries on the first few areas of each
+ * sink.
+ */
+static gboolean vips__tile_autotune = FALSE;
+
+/* Load and save tuned geometries here.
+ */
+static char *vips__tile_autotune_cache = NULL;
+
+/* Pipeline signature -> the best geometry we've measured.
+ */
+typedef struct _SinkTuned {
+	int tile_width;
+	int tile_height;
+} SinkTuned;
+
+static GHashTable *vips_sink_tuned = NULL;
+static GMutex vips_sink_tuned_lock;
+
+/* Candidate geometries, as shifts of the default tile width and height.
+ * The first must be the default.
+ */
+static const int vips_sink_tune_shift[SINK_TUNE_MAX][2] = {
+	{ 0, 0 },
+	{ 1, 0 },
+	{ 2, 0 },
+	{ -1, 0 },
+	{ 1, -1 },
+	{ 2, -1 },
+	{ 0, 1 },
+	{ -1, 1 },
+};
+
+/**
+ * vips_tile_autotune_set:
+ * @autotune: %TRUE to enable tile autotuning
+ *
+ * Normally, vips_sink(), vips_sink_memory() and vips_sink_disc() pick a tile
+ * size from the image demand hint, see vips_get_tile_size(). With
+ * autotuning enabled, the first few areas of each image are computed with a
+ * range of tile sizes, and the sink keeps the fastest for the rest of the
+ * image.
+ *
+ * Results are remembered for each pipeline signature (the operations in the
+ * pipeline, their band formats, the output width and the number of threads),
+ * so later runs of the same pipeline start at the best size immediately.
+ * Use vips_tile_autotune_set_cache() to keep results between runs.
+ *
+ * Images need to be at least a few buffers high to be tuned. Sinks using the
+ * work-stealing scheduler will use known results, but can't tune.
+ *
+ * You can also enable autotuning with the `VIPS_AUTOTUNE` environment
+ * variable, or with the `--vips-autotune` command-line option.
+ *
+ * See also: vips_tile_autotune_set_cache(), vips_get_tile_size().
+ */
+void
+vips_tile_autotune_set(gboolean autotune)
+{
+	vips__tile_autotune = autotune;
+}
+
+/**
+ * vips_tile_autotune_set_cache:
+ * @filename: (nullable): keep results in this file
+ *
+ * Enable tile autotuning, and load and save results in @filename. Results
+ * are loaded the first time a sink runs, and each new result is appended to
+ * the file.
+ *
+ * You can also set this with the `VIPS_AUTOTUNE_CACHE` environment
+ * variable, or with the `--vips-autotune-cache` command-line option.
+ *
+ * See also: vips_tile_autotune_set().
+ */
+void
+vips_tile_autotune_set_cache(const char *filename)
+{
+	VIPS_SETSTR(vips__tile_autotune_cache, filename);
+	if (filename)
+		vips_tile_autotune_set(TRUE);
+}
+
+static void
+vips_sink_tuned_add(const char *signature, int tile_width, int tile_height)
+{
+	SinkTuned *tuned;
+
+	tuned = g_new(SinkTuned, 1);
+	tuned->tile_width = tile_width;
+	tuned->tile_height = tile_height;
+	g_hash_table_replace(vips_sink_tuned, g_strdup(signature), tuned);
+}
+
+/* Must be called with vips_sink_tuned_lock held.
+ */
+static void
+vips_sink_tuned_init(void)
+{
+	FILE *fp;
+
+	if (vips_sink_tuned)
+		return;
+
+	vips_sink_tuned = g_hash_table_new_full(g_str_hash, g_str_equal,
+		g_free, g_free);
+
+	/* The file doesn't need to exist yet.
+	 */
+	if (vips__tile_autotune_cache &&
+		(fp = vips__fopen(vips__tile_autotune_cache, "r"))) {
+		char line[256];
+
+		while (fgets(line, sizeof(line), fp)) {
+			char signature[SINK_TUNE_SIGNATURE];
+			int tile_width;
+			int tile_height;
+
+			if (sscanf(line, "%40s %d %d",
+					signature, &tile_width, &tile_height) == 3 &&
+				tile_width > 0 &&
+				tile_height > 0)
+				vips_sink_tuned_add(signature,
+					tile_width, tile_height);
+		}
+
+		fclose(fp);
+	}
+}
+
+static gboolean
+vips_sink_tuned_get(const char *signature, int *tile_width, int *tile_height)
+{
+	SinkTuned *tuned;
+
+	g_mutex_lock(&vips_sink_tuned_lock);
+
+	vips_sink_tuned_init();
+	if ((tuned = g_hash_table_lookup(vips_sink_tuned, signature))) {
+		*tile_width = tuned->tile_width;
+		*tile_height = tuned->tile_height;
+	}
+
+	g_mutex_unlock(&vips_sink_tuned_lock);
+
+	return tuned != NULL;
+}
+
+static void
+vips_sink_tuned_set(const char *signature, int tile_width, int tile_height)
+{
+	FILE *fp;
+
+	g_mutex_lock(&vips_sink_tuned_lock);
+
+	vips_sink_tuned_init();
+	vips_sink_tuned_add(signature, tile_width, tile_height);
+
+	if (vips__tile_autotune_cache) {
+		if ((fp = vips__fopen(vips__tile_autotune_cache, "a"))) {
+			fprintf(fp, "%s %d %d\n",
+				signature, tile_width, tile_height);
+			fclose(fp);
+		}
+		else
+			g_warning("unable to append to \"%s\"",
+				vips__tile_autotune_cache);
+	}
+
+	g_mutex_unlock(&vips_sink_tuned_lock);
+}
+
+/* Add an image and everything upstream of it to a signature. We use the
+ * operation that made each image, not the pixels, so signatures match
+ * between runs on different files.
+ */
+static void
+vips_sink_tune_signature_image(GChecksum *checksum, GHashTable *seen,
+	VipsImage *image)
+{
+	const char *nickname;
+	char buf[256];
+	GSList *p;
+
+	/* Don't let huge graphs take forever.
+	 */
+	if (g_hash_table_contains(seen, image) ||
+		g_hash_table_size(seen) > 1000)
+		return;
+	g_hash_table_add(seen, image);
+
+	nickname = vips__metrics_nickname(image);
+	g_snprintf(buf, sizeof(buf), "%s %d %d %d;",
+		nickname ? nickname : "-",
+		image->Bands, image->BandFmt, image->dhint);
+	g_checksum_update(checksum, (guchar *) buf, -1);
+
+	for (p = image->upstream; p; p = p->next)
+		vips_sink_tune_signature_image(checksum, seen,
+			VIPS_IMAGE(p->data));
+}
+
+static void
+vips_sink_tune_signature(VipsImage *image, char *signature)
+{
+	GChecksum *checksum;
+	GHashTable *seen;
+	char buf[256];
+
+	checksum = g_checksum_new(G_CHECKSUM_SHA1);
+	seen = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	g_mutex_lock(vips__global_lock);
+	vips_sink_tune_signature_image(checksum, seen, image);
+	g_mutex_unlock(vips__global_lock);
+
+	/* Only the output width affects geometry, and only roughly.
+	 */
+	g_snprintf(buf, sizeof(buf), "%d %d",
+		vips_concurrency_get(), g_bit_storage(image->Xsize));
+	g_checksum_update(checksum, (guchar *) buf, -1);
+
+	g_strlcpy(signature, g_checksum_get_string(checksum),
+		SINK_TUNE_SIGNATURE);
+
+	g_hash_table_destroy(seen);
+	g_checksum_free(checksum);
+}
+
+/* Set up autotuning, if it's enabled. Call after vips_sink_base_steal() and
+ * before any tiles are allocated.
+ *
+ * If we've seen this pipeline before, we just use the best geometry we
+ * found. Otherwise we make a list of candidates and time each on one area
+ * of the image, see vips_sink_base_tune_next().
+ */
+void
+vips_sink_base_tune(SinkBase *sink_base)
+{
+	VipsImage *im = sink_base->im;
+
+	int tile_width;
+	int tile_height;
+	int max;
+	int i;
+
+	sink_base->tune_n = 0;
+
+	if (!vips__tile_autotune)
+		return;
+
+	vips_sink_tune_signature(im, sink_base->tune_signature);
+
+	/* Heights must divide n_lines, since sinks assume tiles never
+	 * straddle areas.
+	 */
+	if (vips_sink_tuned_get(sink_base->tune_signature,
+			&tile_width, &tile_height)) {
+		if (sink_base->n_lines % tile_height == 0) {
+			sink_base->tile_width = tile_width;
+			sink_base->tile_height = tile_height;
+		}
+
+		return;
+	}
+
+	/* We can only change geometry at area boundaries, and concurrent
+	 * allocate has no areas.
+	 */
+	if (sink_base->steal)
+		return;
+
+	/* One warm-up area, then one area per candidate, and we want to
+	 * leave a bit at the end to use the result.
+	 */
+	max = VIPS_MIN(SINK_TUNE_MAX, im->Ysize / sink_base->n_lines - 2);
+
+	for (i = 0; i < SINK_TUNE_MAX && sink_base->tune_n < max; i++) {
+		int ws = vips_sink_tune_shift[i][0];
+		int hs = vips_sink_tune_shift[i][1];
+
+		int j;
+
+		tile_width = ws >= 0
+			? sink_base->tile_width << ws
+			: sink_base->tile_width >> -ws;
+		tile_height = hs >= 0
+			? sink_base->tile_height << hs
+			: sink_base->tile_height >> -hs;
+		tile_width = VIPS_MIN(tile_width, im->Xsize);
+
+		if (tile_width < 16 &&
+			tile_width != im->Xsize)
+			continue;
+		if (tile_height < 1 ||
+			sink_base->n_lines % tile_height != 0)
+			continue;
+
+		for (j = 0; j < sink_base->tune_n; j++)
+			if (sink_base->tune_width[j] == tile_width &&
+				sink_base->tune_height[j] == tile_height)
+				break;
+		if (j < sink_base->tune_n)
+			continue;
+
+		sink_base->tune_width[sink_base->tune_n] = tile_width;
+		sink_base->tune_height[sink_base->tune_n] = tile_height;
+		sink_base->tune_rate[sink_base->tune_n] = 0.0;
+		sink_base->tune_n += 1;
+	}
+
+	/* Nothing to choose between.
+	 */
+	if (sink_base->tune_n < 2) {
+		sink_base->tune_n = 0;
+		return;
+	}
+
+	/* The first area warms up the pipeline with the default geometry.
+	 */
+	sink_base->tune_i = -1;
+	sink_base->tune_start = g_get_monotonic_time();
+	sink_base->tune_processed = 0;
+
+	VIPS_DEBUG_MSG("vips_sink_base_tune: %d candidates for %s\n",
+		sink_base->tune_n, sink_base->tune_signature);
+}
+
+/* Allocate calls this as it moves to a new area. Record the speed of the
+ * area we just did and move to the next candidate, or pick the fastest.
+ *
+ * Time between area starts is a fair measure: allocate blocks until the
+ * area before the previous one has been computed.
+ */
+void
+vips_sink_base_tune_next(SinkBase *sink_base)
+{
+	gint64 now;
+	int best;
+	int i;
+
+	if (!sink_base->tune_n)
+		return;
+
+	now = g_get_monotonic_time();
+
+	if (sink_base->tune_i >= 0)
+		sink_base->tune_rate[sink_base->tune_i] =
+			(double) (sink_base->processed -
+				sink_base->tune_processed) /
+			VIPS_MAX(1, now - sink_base->tune_start);
+
+	sink_base->tune_i += 1;
+	sink_base->tune_start = now;
+	sink_base->tune_processed = sink_base->processed;
+
+	if (sink_base->tune_i < sink_base->tune_n) {
+		sink_base->tile_width =
+			sink_base->tune_width[sink_base->tune_i];
+		sink_base->tile_height =
+			sink_base->tune_height[sink_base->tune_i];
+
+		return;
+	}
+
+	best = 0;
+	for (i = 1; i < sink_base->tune_n; i++)
+		if (sink_base->tune_rate[i] > sink_base->tune_rate[best])
+			best = i;
+
+	sink_base->tile_width = sink_base->tune_width[best];
+	sink_base->tile_height = sink_base->tune_height[best];
+	sink_base->tune_n = 0;
+
+	VIPS_DEBUG_MSG("vips_sink_base_tune_next: picked %d x %d for %s\n",
+		sink_base->tile_width, sink_base->tile_height,
+		sink_base->tune_signature);
+
+	vips_sink_tuned_set(sink_base->tune_signature,
+		sink_base->tile_width, sink_base->tile_height);
 }
 
 static int
@@ -418,9 +835,11 @@ sink_work(VipsThreadState *state, void *a)
 		result = sink->generate_fn(sstate->reg, sstate->seq,
 			sink->a, sink->b, &state->stop);
 
-	/* Tell the allocator we're done.
+	/* Tell the allocator we're done. There are no areas with the
+	 * work-stealing scheduler.
 	 */
-	vips_semaphore_upn(&area->n_thread, 1);
+	if (area)
+		vips_semaphore_upn(&area->n_thread, 1);
 
 	return result;
 }
@@ -432,6 +851,15 @@ vips_sink_base_progress(void *a)
 
 	VIPS_DEBUG_MSG("vips_sink_base_progress:\n");
 
+	/* Work-stealing allocate is concurrent and only counts tiles. Edge
+	 * tiles are smaller, so clip to the image size.
+	 */
+	if (sink_base->steal)
+		sink_base->processed = VIPS_MIN(
+			(guint64) sink_base->im->Xsize * sink_base->im->Ysize,
+			(guint64) g_atomic_int_get(&sink_base->n_tiles) *
+				sink_base->tile_width * sink_base->tile_height);
+
 	/* Trigger any eval callbacks on our source image and
 	 * check for errors.
 	 */
@@ -472,6 +900,7 @@ vips_sink_tile(VipsImage *im,
 	void *a, void *b)
 {
 	Sink sink;
+	gboolean steal;
 	int result;
 
 	g_assert(vips_object_sanity(VIPS_OBJECT(im)));
@@ -494,13 +923,30 @@ vips_sink_tile(VipsImage *im,
 	 */
 	vips_image_preeval(im);
 
-	sink_area_position(sink.area, 0, sink.sink_base.n_lines);
-	result = vips_threadpool_run(im,
-		vips_sink_thread_state_new,
-		sink_area_allocate_fn,
-		sink_work,
-		vips_sink_base_progress,
-		&sink);
+	steal = vips_sink_base_steal(&sink.sink_base);
+
+	/* Don't tune if the caller asked for a geometry.
+	 */
+	if (tile_width <= 0)
+		vips_sink_base_tune(&sink.sink_base);
+
+	if (steal)
+		result = vips__threadpool_run_tiles(im,
+			sink.sink_base.tile_width, sink.sink_base.tile_height,
+			vips_sink_thread_state_new,
+			vips_sink_base_steal_allocate,
+			sink_work,
+			vips_sink_base_progress,
+			&sink);
+	else {
+		sink_area_position(sink.area, 0, sink.sink_base.n_lines);
+		result = vips_threadpool_run(im,
+			vips_sink_thread_state_new,
+			sink_area_allocate_fn,
+			sink_work,
+			vips_sink_base_progress,
+			&sink);
+	}
 
 	vips_image_posteval(im);
 
@@ -41,6 +41,12 @@ extern "C" {
 #include <vips/vips.h>
 #include <vips/thread.h>
 
+/* The most tile geometries we try when autotuning, and the size of a
+ * pipeline signature (a SHA1 as hex, plus the terminator).
+ */
+#define SINK_TUNE_MAX (8)
+#define SINK_TUNE_SIGNATURE (41)
+
 /* Base for sink.c / sinkdisc.c / sinkmemory.c
  */
 typedef struct _SinkBase {
@@ -61,6 +67,25 @@ typedef struct _SinkBase {
 	 * feedback.
 	 */
 	guint64 processed;
+
+	/* Set if we're running with the work-stealing scheduler. Allocate
+	 * is then concurrent, so we just count tiles for progress.
+	 */
+	gboolean steal;
+	int n_tiles;
+
+	/* Autotuning state. tune_n is the number of candidate geometries
+	 * we are timing, or zero if we're not tuning. tune_i is the
+	 * candidate timing now, or -1 for the warm-up area.
+	 */
+	int tune_n;
+	int tune_i;
+	int tune_width[SINK_TUNE_MAX];
+	int tune_height[SINK_TUNE_MAX];
+	double tune_rate[SINK_TUNE_MAX];
+	gint64 tune_start;
+	guint64 tune_processed;
+	char tune_signature[SINK_TUNE_SIGNATURE];
 } SinkBase;
 
 /* Some function we can share.
@@ -69,6 +94,11 @@ void vips_sink_base_init(SinkBase *sink_base, VipsImage *image);
 VipsThreadState *vips_sink_thread_state_new(VipsImage *im, void *a);
 int vips_sink_base_allocate(VipsThreadState *state, void *a, gboolean *stop);
 int vips_sink_base_progress(void *a);
+gboolean vips_sink_base_steal(SinkBase *sink_base);
+int vips_sink_base_steal_allocate(VipsThreadState *state,
+	void *a, gboolean *stop);
+void vips_sink_base_tune(SinkBase *sink_base);
+void vips_sink_base_tune_next(SinkBase *sink_base);
 
 #ifdef __cplusplus
 }
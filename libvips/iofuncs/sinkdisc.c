@@ -9,6 +9,9 @@
  * 	- we could get stuck if allocate failed (thanks Tim)
  * 23/2/12
  * 	- we could deadlock if generate failed
+ * 16/10/26
+ * 	- generalise to a ring of buffers, add an unordered mode with several
+ * 	  writes in flight
  */
 
 /*
@@ -77,6 +80,7 @@ typedef struct _WriteBuffer {
 	VipsSemaphore done;	  /* Bg thread has done write */
 	VipsSemaphore finish; /* Bg thread has finished */
 	int write_errno;	  /* Save write errors here */
+	gboolean pending;	  /* Set writing, but we've not seen done */
 	gboolean running;	  /* Whether the bg writer thread is running */
 	gboolean kill;		  /* Set to ask thread to exit */
 } WriteBuffer;
@@ -86,11 +90,18 @@ typedef struct _WriteBuffer {
 typedef struct _Write {
 	SinkBase sink_base;
 
-	/* We are current writing tiles to buf, buf_back is in the hands of
-	 * the bg write thread.
+	/* A ring of buffers. We are currently writing tiles to buf, the
+	 * others are in the hands of their bg write threads.
 	 */
+	WriteBuffer **bufs;
+	int n_bufs;
+	int current;
 	WriteBuffer *buf;
-	WriteBuffer *buf_back;
+
+	/* Set if write_fn can be called for several areas at once, in any
+	 * order.
+	 */
+	gboolean unordered;
 
 	/* The file format write operation.
 	 */
@@ -222,6 +233,7 @@ wbuffer_new(Write *write)
 	vips_semaphore_init(&wbuffer->done, 0, "done");
 	vips_semaphore_init(&wbuffer->finish, 0, "finish");
 	wbuffer->write_errno = 0;
+	wbuffer->pending = FALSE;
 	wbuffer->running = FALSE;
 	wbuffer->kill = FALSE;
 
@@ -246,30 +258,51 @@ wbuffer_new(Write *write)
 	return wbuffer;
 }
 
-/* Block until the previous write completes, then write the front buffer.
+/* Block until any write of this buffer completes.
  */
 static int
-wbuffer_flush(Write *write)
+wbuffer_wait(WriteBuffer *wbuffer)
 {
-	VIPS_DEBUG_MSG("wbuffer_flush:\n");
+	if (wbuffer->pending) {
+		VIPS_GATE_START("wbuffer_wait: wait");
 
-	/* Block until the other buffer has been written. We have to do this
-	 * before we can set this buffer writing or we'll lose output ordering.
-	 */
-	if (write->buf->area.top > 0) {
-		vips_semaphore_down(&write->buf_back->done);
+		vips_semaphore_down(&wbuffer->done);
+
+		VIPS_GATE_STOP("wbuffer_wait: wait");
 
-		/* Previous write succeeded?
+		wbuffer->pending = FALSE;
+
+		/* Write succeeded?
 		 */
-		if (write->buf_back->write_errno) {
-			vips_error_system(write->buf_back->write_errno,
+		if (wbuffer->write_errno) {
+			vips_error_system(wbuffer->write_errno,
 				"wbuffer_write", "%s", _("write failed"));
 			return -1;
 		}
 	}
 
+	return 0;
+}
+
+/* Block until the previous write completes, then write the front buffer.
+ */
+static int
+wbuffer_flush(Write *write)
+{
+	VIPS_DEBUG_MSG("wbuffer_flush:\n");
+
+	/* Block until the previous buffer has been written. We have to do
+	 * this before we can set this buffer writing or we'll lose output
+	 * ordering. Unordered writes can all be in flight at once.
+	 */
+	if (!write->unordered &&
+		wbuffer_wait(write->bufs[(write->current + write->n_bufs - 1) %
+			write->n_bufs]))
+		return -1;
+
 	/* Set the background writer going for this buffer.
 	 */
+	write->buf->pending = TRUE;
 	vips_semaphore_up(&write->buf->go);
 
 	return 0;
@@ -359,9 +392,18 @@ wbuffer_allocate_fn(VipsThreadState *state, void *a, gboolean *stop)
 						   "starting top = %d, height = %d\n",
 				sink_base->y, sink_base->n_lines);
 
-			/* Swap buffers.
+			/* Move to the next buffer in the ring. We must
+			 * wait for its last write to finish before we can
+			 * reuse it.
 			 */
-			VIPS_SWAP(WriteBuffer *, write->buf, write->buf_back);
+			write->current = (write->current + 1) % write->n_bufs;
+			write->buf = write->bufs[write->current];
+			if (wbuffer_wait(write->buf)) {
+				*stop = TRUE;
+				return -1;
+			}
+
+			vips_sink_base_tune_next(sink_base);
 
 			/* Position buf at the new y.
 			 */
@@ -440,23 +482,86 @@ wbuffer_work_fn(VipsThreadState *state, void *a)
 	return result;
 }
 
-static void
-write_init(Write *write,
-	VipsImage *image, VipsRegionWrite write_fn, void *a)
+static int
+write_init(Write *write, VipsImage *image, int n_bufs, gboolean unordered,
+	VipsRegionWrite write_fn, void *a)
 {
+	int i;
+
 	vips_sink_base_init(&write->sink_base, image);
 
-	write->buf = wbuffer_new(write);
-	write->buf_back = wbuffer_new(write);
+	write->bufs = g_new0(WriteBuffer *, n_bufs);
+	write->n_bufs = n_bufs;
+	write->current = 0;
+	write->unordered = unordered;
 	write->write_fn = write_fn;
 	write->a = a;
+
+	for (i = 0; i < n_bufs; i++)
+		if (!(write->bufs[i] = wbuffer_new(write)))
+			return -1;
+	write->buf = write->bufs[0];
+
+	vips_sink_base_tune(&write->sink_base);
+
+	return 0;
 }
 
 static void
 write_free(Write *write)
 {
-	VIPS_FREEF(wbuffer_free, write->buf);
-	VIPS_FREEF(wbuffer_free, write->buf_back);
+	int i;
+
+	for (i = 0; i < write->n_bufs; i++)
+		VIPS_FREEF(wbuffer_free, write->bufs[i]);
+	VIPS_FREE(write->bufs);
+}
+
+static int
+sink_disc(VipsImage *im, int n_bufs, gboolean unordered,
+	VipsRegionWrite write_fn, void *a)
+{
+	Write write;
+	int result;
+	int i;
+
+	vips_image_preeval(im);
+
+	result = 0;
+	if (write_init(&write, im, n_bufs, unordered, write_fn, a) ||
+		wbuffer_position(write.buf, 0, write.sink_base.n_lines) ||
+		vips_threadpool_run(im,
+			write_thread_state_new,
+			wbuffer_allocate_fn,
+			wbuffer_work_fn,
+			vips_sink_base_progress,
+			&write))
+		result = -1;
+
+	/* Just before allocate signalled stop, it set write.buf writing. We
+	 * need to wait for this write, and any others still in flight, to
+	 * finish.
+	 *
+	 * We can't just free the buffers (which will wait for the bg threads
+	 * to finish), since the bg thread might see the kill before it gets a
+	 * chance to write.
+	 *
+	 * If the pool exited with an error, write.buf might not have been
+	 * started (if the allocate failed), and in any case, we don't care if
+	 * the final writes went through or not.
+	 */
+	if (!result)
+		for (i = 0; i < write.n_bufs; i++)
+			if (wbuffer_wait(write.bufs[i]))
+				result = -1;
+
+	vips_image_posteval(im);
+
+	write_free(&write);
+
+	vips_image_minimise_all(im);
+
+	return result;
 }
 
 /**
@@ -497,44 +602,20 @@ write_free(Write *write)
 int
 vips_sink_disc(VipsImage *im, VipsRegionWrite write_fn, void *a)
 {
-	Write write;
-	int result;
-
-	vips_image_preeval(im);
-
-	write_init(&write, im, write_fn, a);
-
-	result = 0;
-	if (!write.buf ||
-		!write.buf_back ||
-		wbuffer_position(write.buf, 0, write.sink_base.n_lines) ||
-		vips_threadpool_run(im,
-			write_thread_state_new,
-			wbuffer_allocate_fn,
-			wbuffer_work_fn,
-			vips_sink_base_progress,
-			&write))
-		result = -1;
-
-	/* Just before allocate signalled stop, it set write.buf writing. We
-	 * need to wait for this write to finish.
-	 *
-	 * We can't just free the buffers (which will wait for the bg threads
-	 * to finish), since the bg thread might see the kill before it gets a
-	 * chance to write.
-	 *
-	 * If the pool exited with an error, write.buf might not have been
-	 * started (if the allocate failed), and in any case, we don't care if
-	 * the final write went through or not.
+	/* Two buffers: one being filled, one being written.
 	 */
-	if (!result)
-		vips_semaphore_down(&write.buf->done);
-
-	vips_image_posteval(im);
-
-	write_free(&write);
-
-	vips_image_minimise_all(im);
+	return sink_disc(im, 2, FALSE, write_fn, a);
+}
 
-	return result;
+/* As vips_sink_disc(), but @write_fn may be called from several threads at
+ * once, with areas in any order. We keep up to @depth buffers, so
+ * @depth - 1 writes can be in flight while we fill the next buffer. Handy
+ * for positional writes to fast discs, which need several requests queued
+ * to reach full bandwidth.
+ */
+int
+vips__sink_disc_unordered(VipsImage *im, int depth,
+	VipsRegionWrite write_fn, void *a)
+{
+	return sink_disc(im, VIPS_MAX(2, depth), TRUE, write_fn, a);
 }
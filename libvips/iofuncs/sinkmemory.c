@@ -8,6 +8,8 @@
  * 	- from sinkdisc.c
  * 23/2/12
  * 	- we could deadlock if generate failed
+ * 16/10/26
+ * 	- use the work-stealing scheduler for non-sequential images
  */
 
 /*
@@ -208,6 +210,8 @@ sink_memory_area_allocate_fn(VipsThreadState *state, void *a, gboolean *stop)
 			VIPS_SWAP(SinkMemoryArea *,
 				memory->area, memory->old_area);
 
+			vips_sink_base_tune_next(sink_base);
+
 			/* Position buf at the new y.
 			 */
 			sink_memory_area_position(memory->area,
@@ -269,9 +273,11 @@ sink_memory_area_work_fn(VipsThreadState *state, void *a)
 	VIPS_DEBUG_MSG("sink_memory_area_work_fn: %p result = %d\n",
 		g_thread_self(), result);
 
-	/* Tell the allocator we're done.
+	/* Tell the allocator we're done. There are no areas with the
+	 * work-stealing scheduler.
 	 */
-	vips_semaphore_upn(&area->nwrite, 1);
+	if (area)
+		vips_semaphore_upn(&area->nwrite, 1);
 
 	return result;
 }
@@ -324,6 +330,7 @@ int
 vips_sink_memory(VipsImage *image)
 {
 	SinkMemory memory;
+	gboolean steal;
 	int result;
 
 	if (sink_memory_init(&memory, image))
@@ -331,15 +338,35 @@ vips_sink_memory(VipsImage *image)
 
 	vips_image_preeval(image);
 
+	steal = vips_sink_base_steal(&memory.sink_base);
+	vips_sink_base_tune(&memory.sink_base);
+
 	result = 0;
-	sink_memory_area_position(memory.area, 0, memory.sink_base.n_lines);
-	if (vips_threadpool_run(image,
-			sink_memory_thread_state_new,
-			sink_memory_area_allocate_fn,
-			sink_memory_area_work_fn,
-			vips_sink_base_progress,
-			&memory))
-		result = -1;
+	if (steal) {
+		/* We write to a region on the whole image, so tiles can be
+		 * computed in any order.
+		 */
+		if (vips__threadpool_run_tiles(image,
+				memory.sink_base.tile_width,
+				memory.sink_base.tile_height,
+				sink_memory_thread_state_new,
+				vips_sink_base_steal_allocate,
+				sink_memory_area_work_fn,
+				vips_sink_base_progress,
+				&memory))
+			result = -1;
+	}
+	else {
+		sink_memory_area_position(memory.area,
+			0, memory.sink_base.n_lines);
+		if (vips_threadpool_run(image,
+				sink_memory_thread_state_new,
+				sink_memory_area_allocate_fn,
+				sink_memory_area_work_fn,
+				vips_sink_base_progress,
+				&memory))
+			result = -1;
+	}
 
 	vips_image_posteval(image);
 
@@ -10,6 +10,12 @@
  * 1/12/15
  * 	- don't do anything to out or mask after they have closed
  * 	- only run the bg render thread when there's work to do
+ * 16/10/26
+ * 	- several bg render threads, scheduled by priority then deadline
+ * 	- time-slice renders so a busy render can't starve the others
+ * 	- add vips_sink_screen_set_deadline() and vips_sink_screen_cancel()
+ * 	- reuse cancelled tiles first when max_tiles is reached
+ * 	- vips_sink_screen_set_deadline() reschedules waiting renders
  */
 
 /*
@@ -95,6 +101,11 @@ typedef struct {
 	 */
 	gboolean dirty;
 
+	/* The tile was taken off the dirty list by vips_sink_screen_cancel()
+	 * before it was painted. We must queue it again on the next request.
+	 */
+	gboolean cancelled;
+
 	/* Time of last use, for LRU flush
 	 */
 	int ticks;
@@ -148,6 +159,26 @@ typedef struct _Render {
 	 * anything to them until we shut down too.
 	 */
 	gboolean shutdown;
+
+	/* Scheduling. We try to start work on a render within deadline ms
+	 * of it becoming dirty, and due is that time. slice_end is when the
+	 * bg thread working on us should move on to another render.
+	 *
+	 * Working is set while a bg thread runs us. We are never on the dirty
+	 * list then, so only one bg thread works on a render at once.
+	 *
+	 * Protected by render_dirty_lock.
+	 */
+	int deadline;
+	gint64 due;
+	gint64 slice_end;
+	gboolean working;
+
+	/* Set this to make the bg thread working on us stop and think
+	 * again. Only that thread clears it, so it's per-thread in effect.
+	 * Atomic.
+	 */
+	int reschedule;
 } Render;
 
 /* Our per-thread state.
@@ -167,10 +198,30 @@ typedef struct _RenderThreadStateClass {
 
 G_DEFINE_TYPE(RenderThreadState, render_thread_state, VIPS_TYPE_THREAD_STATE);
 
-/* The BG thread which sits waiting to do some calculations, and the semaphore
- * it waits on holding the number of renders with dirty tiles.
+/* The default number of bg render threads. Each runs a threadpool, so
+ * one slow render can't hold up all the others.
+ */
+#define RENDER_THREADS (2)
+
+/* Default deadline, in ms.
  */
-static GThread *render_thread = NULL;
+#define RENDER_DEADLINE (100)
+
+/* How long a bg thread works on one render, in ms, before it looks for more
+ * urgent work.
+ */
+#define RENDER_SLICE (50)
+
+/* The number of bg render threads to start, set by --vips-render-threads
+ * and VIPS_RENDER_THREADS. 0 means the default.
+ */
+int vips__render_threads = 0;
+
+/* The BG threads which sit waiting to do some calculations, and the
+ * semaphore they wait on holding the number of renders with dirty tiles.
+ */
+static GThread **render_thread = NULL;
+static int render_n_threads = 0;
 
 /* Set this to ask the render thread to quit.
  */
@@ -183,10 +234,6 @@ static GMutex *render_dirty_lock = NULL;
 static GSList *render_dirty_all = NULL;
 static VipsSemaphore n_render_dirty_sem;
 
-/* Set this to make the bg thread stop and reschedule.
- */
-static gboolean render_reschedule = FALSE;
-
 static void
 render_thread_state_class_init(RenderThreadStateClass *class)
 {
@@ -360,6 +407,7 @@ tile_dirty_set(Tile *tile)
 		render->dirty = g_slist_prepend(render->dirty, tile);
 		tile->dirty = TRUE;
 		tile->painted = FALSE;
+		tile->cancelled = FALSE;
 	}
 	else
 		g_assert(g_slist_find(render->dirty, tile));
@@ -382,6 +430,30 @@ tile_dirty_bump(Tile *tile)
 		g_assert(!g_slist_find(render->dirty, tile));
 }
 
+/* Has this render had its turn? Only if another render is waiting, and
+ * either our slice is up, or the most urgent waiting render has passed its
+ * deadline and is at least as important as us.
+ */
+static gboolean
+render_slice_over(Render *render)
+{
+	gboolean over;
+
+	g_mutex_lock(render_dirty_lock);
+	over = FALSE;
+	if (render_dirty_all) {
+		Render *next = (Render *) render_dirty_all->data;
+		gint64 now = g_get_monotonic_time();
+
+		over = now > render->slice_end ||
+			(now > next->due &&
+				next->priority >= render->priority);
+	}
+	g_mutex_unlock(render_dirty_lock);
+
+	return over;
+}
+
 static int
 render_allocate(VipsThreadState *state, void *a, gboolean *stop)
 {
@@ -391,7 +463,9 @@ render_allocate(VipsThreadState *state, void *a, gboolean *stop)
 
 	g_mutex_lock(render->lock);
 
-	if (render_reschedule ||
+	if (render_kill ||
+		g_atomic_int_get(&render->reschedule) ||
+		render_slice_over(render) ||
 		!(tile = render_tile_dirty_get(render))) {
 		VIPS_DEBUG_MSG_GREEN("render_allocate: stopping\n");
 		*stop = TRUE;
@@ -443,44 +517,61 @@ vips__render_shutdown(void)
 	/* We may come here without having inited.
 	 */
 	if (render_dirty_lock) {
-		g_mutex_lock(render_dirty_lock);
+		int i;
 
-		if (render_thread) {
-			GThread *thread;
-
-			thread = render_thread;
-			render_reschedule = TRUE;
-			render_kill = TRUE;
-
-			g_mutex_unlock(render_dirty_lock);
+		g_mutex_lock(render_dirty_lock);
+		render_kill = TRUE;
+		g_mutex_unlock(render_dirty_lock);
 
+		/* Wake every bg thread, then wait for them all to see the
+		 * kill.
+		 */
+		for (i = 0; i < render_n_threads; i++)
 			vips_semaphore_up(&n_render_dirty_sem);
-
-			(void) g_thread_join(thread);
-		}
-		else
-			g_mutex_unlock(render_dirty_lock);
+		for (i = 0; i < render_n_threads; i++)
+			(void) g_thread_join(render_thread[i]);
+		VIPS_FREE(render_thread);
+		render_n_threads = 0;
 
 		VIPS_FREEF(vips_g_mutex_free, render_dirty_lock);
 		vips_semaphore_destroy(&n_render_dirty_sem);
 	}
 }
 
+/* Highest priority first, then earliest deadline. A render goes to the back
+ * of its priority group each time it is put back, so renders with the same
+ * priority and deadline share the bg threads fairly.
+ */
 static int
 render_dirty_sort(Render *a, Render *b, void *user_data)
 {
-	return b->priority - a->priority;
+	if (a->priority != b->priority)
+		return b->priority - a->priority;
+
+	return a->due < b->due ? -1 : a->due > b->due ? 1 : 0;
 }
 
-/* Add to the jobs list, if it has work to be done.
+/* The deadline for a render in ms, with the default filled in.
+ */
+static int
+render_deadline(Render *render)
+{
+	return render->deadline > 0 ? render->deadline : RENDER_DEADLINE;
+}
+
+/* Add to the jobs list, if it has work to be done. If a bg thread is
+ * working on this render, it will put it back when it's done.
  */
 static void
 render_dirty_put(Render *render)
 {
 	g_mutex_lock(render_dirty_lock);
 
-	if (render->dirty) {
+	if (render->dirty &&
+		!render->working) {
 		if (!g_slist_find(render_dirty_all, render)) {
+			render->due = g_get_monotonic_time() +
+				(gint64) render_deadline(render) * 1000;
 			render_dirty_all = g_slist_prepend(render_dirty_all,
 				render);
 			render_dirty_all = g_slist_sort(render_dirty_all,
@@ -529,13 +620,14 @@ render_close_cb(VipsImage *image, Render *render)
 	 */
 	render->shutdown = TRUE;
 
-	render_unref(render);
-
 	/* If this render is being worked on, we want to jog the bg thread,
-	 * make it drop it's ref and think again.
+	 * make it drop it's ref and think again. Do this before we drop our
+	 * ref, since that can free the render if no thread has it.
 	 */
 	VIPS_DEBUG_MSG_GREEN("render_close_cb: reschedule\n");
-	render_reschedule = TRUE;
+	g_atomic_int_set(&render->reschedule, TRUE);
+
+	render_unref(render);
 }
 
 static Render *
@@ -586,6 +678,12 @@ render_new(VipsImage *in, VipsImage *out, VipsImage *mask,
 
 	render->shutdown = FALSE;
 
+	render->deadline = 0;
+	render->due = 0;
+	render->slice_end = 0;
+	render->working = FALSE;
+	render->reschedule = FALSE;
+
 	/* Both out and mask must close before we can free the render.
 	 */
 	g_signal_connect(out, "close",
@@ -629,6 +727,7 @@ tile_new(Render *render)
 	tile->region = NULL;
 	tile->painted = FALSE;
 	tile->dirty = FALSE;
+	tile->cancelled = FALSE;
 	tile->ticks = render->ticks;
 
 	if (!(tile->region = vips_region_new(render->in))) {
@@ -715,6 +814,7 @@ tile_queue(Tile *tile, VipsRegion *reg)
 		tile, tile->area.left, tile->area.top);
 
 	tile->painted = FALSE;
+	tile->cancelled = FALSE;
 	tile_touch(tile);
 
 	if (render->notify) {
@@ -752,12 +852,19 @@ tile_queue(Tile *tile, VipsRegion *reg)
 static void
 tile_test_clean_ticks(VipsRect *key, Tile *value, Tile **best)
 {
-	if (value->painted)
-		if (!*best || value->ticks < (*best)->ticks)
+	/* Cancelled tiles have no pixels worth keeping, so take them before
+	 * any painted tile.
+	 */
+	if (value->painted ||
+		value->cancelled)
+		if (!*best ||
+			(value->cancelled && !(*best)->cancelled) ||
+			(value->cancelled == (*best)->cancelled &&
+				value->ticks < (*best)->ticks))
 			*best = value;
 }
 
-/* Pick a painted tile to reuse. Search for LRU (slow!).
+/* Pick a cancelled or painted tile to reuse. Search for LRU (slow!).
  */
 static Tile *
 render_tile_get_painted(Render *render)
@@ -789,9 +896,11 @@ render_tile_request(Render *render, VipsRegion *reg, VipsRect *area)
 
 	if ((tile = render_tile_lookup(render, area))) {
 		/* We already have a tile at this position. If it's invalid,
-		 * ask for a repaint.
+		 * or it was cancelled before it was painted, ask for a
+		 * repaint.
 		 */
-		if (tile->region->invalid)
+		if (tile->region->invalid ||
+			tile->cancelled)
 			tile_queue(tile, reg);
 		else
 			tile_touch(tile);
@@ -809,8 +918,8 @@ render_tile_request(Render *render, VipsRegion *reg, VipsRect *area)
 		tile_queue(tile, reg);
 	}
 	else {
-		/* Need to reuse a tile. Try for an old painted tile first,
-		 * then if that fails, reuse a dirty tile.
+		/* Need to reuse a tile. Try for a cancelled or old painted
+		 * tile first, then if that fails, reuse a dirty tile.
 		 */
 		if (!(tile = render_tile_get_painted(render)) &&
 			!(tile = render_tile_dirty_reuse(render))) {
@@ -993,6 +1102,11 @@ render_dirty_get(void)
 		render_ref(render);
 
 		render_dirty_all = g_slist_remove(render_dirty_all, render);
+
+		render->working = TRUE;
+		render->slice_end = g_get_monotonic_time() +
+			RENDER_SLICE * 1000;
+		g_atomic_int_set(&render->reschedule, FALSE);
 	}
 
 	g_mutex_unlock(render_dirty_lock);
@@ -1010,8 +1124,6 @@ render_thread_main(void *client)
 	while (!render_kill) {
 		VIPS_DEBUG_MSG_GREEN("render_thread_main: threadpool start\n");
 
-		render_reschedule = FALSE;
-
 		if ((render = render_dirty_get())) {
 			if (vips_threadpool_run(render->in,
 					render_thread_state_new,
@@ -1024,7 +1136,13 @@ render_thread_main(void *client)
 
 			VIPS_DEBUG_MSG_GREEN("render_thread_main: threadpool return\n");
 
-			/* Add back to the jobs list, if we need to.
+			g_mutex_lock(render_dirty_lock);
+			render->working = FALSE;
+			g_mutex_unlock(render_dirty_lock);
+
+			/* Add back to the jobs list, if we need to. This
+			 * puts us behind any render with the same priority
+			 * that's been waiting.
 			 */
 			render_dirty_put(render);
 
@@ -1036,27 +1154,34 @@ render_thread_main(void *client)
 		}
 	}
 
-	/* We are exiting, so render_thread must now be NULL.
-	 */
-	render_thread = NULL;
-
 	return NULL;
 }
 
 static void *
 vips__sink_screen_once(void *data)
 {
+	int n_threads;
+	int i;
+
 	g_assert(!render_thread);
 	g_assert(!render_dirty_lock);
 
 	render_dirty_lock = vips_g_mutex_new();
 	vips_semaphore_init(&n_render_dirty_sem, 0, "n_render_dirty");
 
-	/* Don't use vips_thread_execute(), since this thread will only be
+	n_threads = vips__render_threads > 0
+		? VIPS_MIN(vips__render_threads, vips_concurrency_get())
+		: RENDER_THREADS;
+
+	/* Don't use vips_thread_execute(), since these threads will only be
 	 * ended by vips_shutdown, and that isn't always called.
 	 */
-	render_thread = vips_g_thread_new("sink_screen",
-		render_thread_main, NULL);
+	render_thread = g_new0(GThread *, n_threads);
+	for (i = 0; i < n_threads; i++)
+		if ((render_thread[render_n_threads] =
+					vips_g_thread_new("sink_screen",
+						render_thread_main, NULL)))
+			render_n_threads += 1;
 
 	return NULL;
 }
@@ -1083,11 +1208,20 @@ vips__sink_screen_once(void *data)
  * The @mask image is a one-band uchar image and has 255 for pixels which are
  * currently in cache and 0 for uncalculated pixels.
  *
- * Only a single sink is calculated at any one time, though many may be
- * alive. Use @priority to indicate which renders are more important:
+ * A small number of background threads calculate sinks, one sink
+ * per thread at a time, though many may be alive. Use @priority to indicate
+ * which renders are more important:
  * zero means normal
  * priority, negative numbers are low priority, positive numbers high
- * priority.
+ * priority. Renders with the same priority are worked on in order of
+ * deadline, see vips_sink_screen_set_deadline(). A thread will move on from
+ * a busy render after a short time if another render is waiting, or sooner
+ * if a render as important has passed its deadline, so a single large render
+ * can't starve the others.
+ *
+ * Set the number of background threads with the `VIPS_RENDER_THREADS`
+ * environment variable or the `--vips-render-threads` command-line option.
+ * The default is two.
  *
  * Calls to vips_region_prepare() on @out return immediately and hold
  * whatever is
@@ -1107,7 +1241,7 @@ vips__sink_screen_once(void *data)
  * calculated.
  *
  * See also: vips_tilecache(), vips_region_prepare(),
- * vips_sink_disc(), vips_sink().
+ * vips_sink_disc(), vips_sink(), vips_sink_screen_cancel().
  *
  * Returns: 0 on success, -1 on error.
  */
@@ -1163,6 +1297,105 @@ vips_sink_screen(VipsImage *in, VipsImage *out, VipsImage *mask,
 	return 0;
 }
 
+/* Find the render behind an output image made by vips_sink_screen().
+ */
+static Render *
+render_get(VipsImage *out)
+{
+	if (out->generate_fn != image_fill)
+		return NULL;
+
+	return (Render *) out->client2;
+}
+
+/**
+ * vips_sink_screen_set_deadline: (method)
+ * @out: output image from vips_sink_screen()
+ * @deadline: target latency in milliseconds
+ *
+ * Set the target latency for a render. When a render has tiles waiting, it
+ * is scheduled to start within @deadline ms, and renders with the same
+ * priority are worked on in order of deadline. If no thread is free when
+ * the deadline passes, a thread working on a render of the same or lower
+ * priority moves on after its current tiles. A @deadline of 0 means the
+ * default, 100 ms.
+ *
+ * If the render already has tiles waiting, their deadline moves by the
+ * change in @deadline and the render takes its new place in the queue.
+ *
+ * For example, a viewer might give the view the user is looking at a short
+ * deadline, and thumbnails a long one.
+ *
+ * See also: vips_sink_screen().
+ */
+void
+vips_sink_screen_set_deadline(VipsImage *out, int deadline)
+{
+	Render *render;
+
+	if ((render = render_get(out))) {
+		g_mutex_lock(render_dirty_lock);
+
+		if (g_slist_find(render_dirty_all, render)) {
+			int old_deadline = render_deadline(render);
+
+			render->deadline = VIPS_MAX(0, deadline);
+			render->due += (gint64)
+				(render_deadline(render) - old_deadline) * 1000;
+			render_dirty_all = g_slist_sort(render_dirty_all,
+				(GCompareFunc) render_dirty_sort);
+		}
+		else
+			render->deadline = VIPS_MAX(0, deadline);
+
+		g_mutex_unlock(render_dirty_lock);
+	}
+}
+
+/**
+ * vips_sink_screen_cancel: (method)
+ * @out: output image from vips_sink_screen()
+ * @keep: (nullable): keep tiles touching this area
+ *
+ * Cancel the calculation of any tiles waiting to be painted which don't
+ * touch @keep. Tiles already being calculated will complete. Pass %NULL to
+ * cancel all waiting tiles.
+ *
+ * Use this when the viewport moves, so the background threads don't spend
+ * time on tiles no one will look at. Cancelled tiles are queued again if
+ * they are requested, and are the first to be reused for new tiles when
+ * @max_tiles is reached.
+ *
+ * See also: vips_sink_screen().
+ */
+void
+vips_sink_screen_cancel(VipsImage *out, VipsRect *keep)
+{
+	Render *render;
+	GSList *p;
+	GSList *next;
+
+	if (!(render = render_get(out)))
+		return;
+
+	g_mutex_lock(render->lock);
+
+	for (p = render->dirty; p; p = next) {
+		Tile *tile = (Tile *) p->data;
+
+		next = p->next;
+
+		if (!keep ||
+			!vips_rect_overlapsrect(&tile->area, keep)) {
+			render->dirty = g_slist_delete_link(render->dirty, p);
+			tile->dirty = FALSE;
+			tile->cancelled = TRUE;
+		}
+	}
+
+	g_mutex_unlock(render->lock);
+}
+
 int
 vips__print_renders(void)
 {
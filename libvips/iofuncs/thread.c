@@ -2,6 +2,9 @@
  *
  * 29/9/22
  * 	- from threadpool.c
+ * 16/10/26
+ * 	- add NUMA node discovery and binding
+ * 	- only look for NUMA nodes when NUMA mode is used
  */
 
 /*
@@ -36,6 +39,10 @@
 #define VIPS_DEBUG_RED
  */
 
+/* sched_setaffinity() and cpu_set_t are non-portable GNU extensions.
+ */
+#define _GNU_SOURCE
+
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif /*HAVE_CONFIG_H*/
@@ -47,6 +54,9 @@
 #include <unistd.h>
 #endif /*HAVE_UNISTD_H*/
 #include <errno.h>
+#ifdef HAVE_SCHED_SETAFFINITY
+#include <sched.h>
+#endif /*HAVE_SCHED_SETAFFINITY*/
 
 #include <vips/vips.h>
 #include <vips/internal.h>
@@ -77,6 +87,23 @@ int vips__thinstrip_height = VIPS__THINSTRIP_HEIGHT;
  */
 static GPrivate *is_vips_thread_key = NULL;
 
+/* Set to pin workers to NUMA nodes.
+ */
+static gboolean vips__numa = FALSE;
+
+/* The NUMA nodes we found, and the CPUs in each one. We always have at
+ * least one node. We only look when NUMA mode is first used, see
+ * vips__numa_once().
+ */
+static int vips__numa_n_nodes = 1;
+#ifdef HAVE_SCHED_SETAFFINITY
+static cpu_set_t *vips__numa_cpus = NULL;
+#endif /*HAVE_SCHED_SETAFFINITY*/
+
+/* The node this thread is bound to, plus one, so that NULL means unbound.
+ */
+static GPrivate *numa_node_key = NULL;
+
 /* TRUE if we are a vips thread. We sometimes manage resource allocation
  * differently for vips threads since we can cheaply free stuff on thread
  * termination.
@@ -358,13 +385,203 @@ vips_get_tile_size(VipsImage *im,
 		*tile_width, *tile_height, *n_lines);
 }
 
+#ifdef HAVE_SCHED_SETAFFINITY
+/* Parse a sysfs cpulist, eg. "0-7,16-23".
+ */
+static void
+vips__numa_parse_cpulist(const char *str, cpu_set_t *set)
+{
+	const char *p;
+
+	CPU_ZERO(set);
+
+	for (p = str; *p;) {
+		char *end;
+		long first;
+		long last;
+		long i;
+
+		first = strtol(p, &end, 10);
+		if (end == p)
+			break;
+		last = first;
+		p = end;
+
+		if (*p == '-') {
+			last = strtol(p + 1, &end, 10);
+			p = end;
+		}
+
+		for (i = first; i <= last && i < CPU_SETSIZE; i++)
+			CPU_SET(i, set);
+
+		while (*p == ',' ||
+			g_ascii_isspace(*p))
+			p++;
+	}
+}
+#endif /*HAVE_SCHED_SETAFFINITY*/
+
+/* Find the NUMA nodes on this host. Nodes are numbered contiguously from
+ * zero in sysfs.
+ */
+static void *
+vips__numa_init(void *data)
+{
+#ifdef HAVE_SCHED_SETAFFINITY
+	GArray *cpus;
+	int node;
+
+	cpus = g_array_new(FALSE, TRUE, sizeof(cpu_set_t));
+
+	for (node = 0;; node++) {
+		char *filename;
+		char *contents;
+		cpu_set_t set;
+
+		filename = g_strdup_printf(
+			"/sys/devices/system/node/node%d/cpulist", node);
+		if (!g_file_get_contents(filename, &contents, NULL, NULL)) {
+			g_free(filename);
+			break;
+		}
+		g_free(filename);
+
+		vips__numa_parse_cpulist(contents, &set);
+		g_free(contents);
+
+		g_array_append_val(cpus, set);
+	}
+
+	if (cpus->len > 1) {
+		vips__numa_n_nodes = cpus->len;
+		vips__numa_cpus = (cpu_set_t *) g_array_free(cpus, FALSE);
+	}
+	else
+		g_array_free(cpus, TRUE);
+
+	g_info("found %d NUMA nodes", vips__numa_n_nodes);
+#endif /*HAVE_SCHED_SETAFFINITY*/
+
+	return NULL;
+}
+
+/* Scan for nodes on first use, so hosts which never turn NUMA mode on don't
+ * read sysfs.
+ */
+static void
+vips__numa_once(void)
+{
+	static GOnce once = G_ONCE_INIT;
+
+	VIPS_ONCE(&once, vips__numa_init, NULL);
+}
+
+/**
+ * vips_numa_set:
+ * @numa: %TRUE to enable NUMA mode
+ *
+ * In NUMA mode, libvips pins each worker thread to one NUMA node, spreading
+ * threads evenly over the nodes on the host. Since pixel buffers are
+ * allocated and first written by the worker that uses them, they end up in
+ * memory local to that worker. The work-stealing scheduler (see
+ * vips_threadpool_steal_set()) also gives each node a contiguous band of
+ * the image and prefers to steal tiles from workers on the same node.
+ *
+ * vips_sink_disc() and vips_sink_screen() hand out tiles in image order to
+ * all workers, so with these sinks only pixel buffers are node-local.
+ *
+ * This only affects threads created after the call, so it's best to call it
+ * before vips_init(), or set the `VIPS_NUMA` environment variable.
+ *
+ * NUMA mode does nothing on hosts with a single node, or on platforms
+ * which do not support thread affinity.
+ *
+ * See also: vips_numa_get(), vips_concurrency_set().
+ */
+void
+vips_numa_set(gboolean numa)
+{
+	vips__numa = numa;
+}
+
+/**
+ * vips_numa_get:
+ *
+ * See also: vips_numa_set().
+ *
+ * Returns: %TRUE if NUMA mode is enabled and the host has more than one
+ * node.
+ */
+gboolean
+vips_numa_get(void)
+{
+	if (!vips__numa)
+		return FALSE;
+
+	vips__numa_once();
+
+	return vips__numa_n_nodes > 1;
+}
+
+/* The number of NUMA nodes we found. Always at least 1.
+ */
+int
+vips__numa_get_n_nodes(void)
+{
+	vips__numa_once();
+
+	return vips__numa_n_nodes;
+}
+
+/* Bind the calling thread to a NUMA node.
+ */
+int
+vips__numa_bind(int node)
+{
+#ifdef HAVE_SCHED_SETAFFINITY
+	vips__numa_once();
+
+	if (!vips__numa_cpus ||
+		node < 0 ||
+		node >= vips__numa_n_nodes)
+		return 0;
+
+	if (sched_setaffinity(0, sizeof(cpu_set_t), &vips__numa_cpus[node])) {
+		vips_error_system(errno, "vips__numa_bind",
+			_("unable to bind thread to node %d"), node);
+		return -1;
+	}
+
+	g_private_set(numa_node_key, GINT_TO_POINTER(node + 1));
+
+	VIPS_DEBUG_MSG("vips__numa_bind: thread %p on node %d\n",
+		g_thread_self(), node);
+#endif /*HAVE_SCHED_SETAFFINITY*/
+
+	return 0;
+}
+
+/* The node the calling thread is bound to, or -1 for unbound threads.
+ */
+int
+vips__numa_node(void)
+{
+	return GPOINTER_TO_INT(g_private_get(numa_node_key)) - 1;
+}
+
 void
 vips__thread_init(void)
 {
 	static GPrivate private = G_PRIVATE_INIT(NULL);
+	static GPrivate numa_private = G_PRIVATE_INIT(NULL);
 
 	is_vips_thread_key = &private;
+	numa_node_key = &numa_private;
 
 	if (vips__concurrency == 0)
 		vips__concurrency = vips__concurrency_get_default();
+
+	if (g_getenv("VIPS_NUMA"))
+		vips__numa = TRUE;
 }
@@ -23,6 +23,9 @@
  * 	- don't depend on image width when setting n_lines
  * 27/2/19 jtorresfabra
  * 	- free threadpool earlier
+ * 16/10/26
+ * 	- add vips__threadpool_run_tiles(), a work-stealing scheduler
+ * 	- add vips__worker_execute(), pools wait for the tasks it starts
  */
 
 /*
@@ -64,6 +67,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif /*HAVE_UNISTD_H*/
@@ -96,6 +100,10 @@
  */
 static gboolean vips__stall = FALSE;
 
+/* Set to let sinks use the work-stealing scheduler.
+ */
+static gboolean vips__steal = FALSE;
+
 /* The global threadset we run workers in.
  */
 static VipsThreadset *vips__threadset = NULL;
@@ -128,6 +136,9 @@ vips__threadpool_init(void)
 	if (g_getenv("VIPS_STALL"))
 		vips__stall = TRUE;
 
+	if (g_getenv("VIPS_STEAL"))
+		vips__steal = TRUE;
+
 	/* max_threads > 0 will create a set of threads on startup. This is
 	 * necessary for wasm, but may break on systems that try to fork()
 	 * after init.
@@ -230,6 +241,25 @@ vips_thread_state_new(VipsImage *im, void *a)
 		VIPS_TYPE_THREAD_STATE, vips_thread_state_set, im, a));
 }
 
+/* A range of tiles for the work-stealing scheduler. Tiles are numbered in
+ * raster order. The owner takes tiles from the front, thieves take from the
+ * back, so the owner keeps walking down its own part of the image.
+ */
+typedef struct _VipsTileDeque {
+	GMutex lock;
+
+	int front;
+	int back; /* One past the last tile */
+
+	/* The NUMA node this range should be computed on, or -1.
+	 */
+	int node;
+
+	/* Set when a worker takes ownership.
+	 */
+	gboolean claimed;
+} VipsTileDeque;
+
 /* What we track for each thread in the pool.
  */
 typedef struct _VipsWorker {
@@ -238,6 +268,10 @@ typedef struct _VipsWorker {
 
 	VipsThreadState *state;
 
+	/* The deque we own, if this is a work-stealing pool.
+	 */
+	VipsTileDeque *deque;
+
 	gboolean stop;
 
 } VipsWorker;
@@ -286,8 +320,36 @@ typedef struct _VipsThreadpool {
 	 * (used to downsize the threadpool).
 	 */
 	int exit;
+
+	/* For work-stealing pools, the tile geometry and one deque per
+	 * worker. deques is NULL for normal pools.
+	 */
+	int tile_width;
+	int tile_height;
+	int tiles_across;
+	int n_tiles;
+	VipsTileDeque *deques;
+	int n_deques;
+
+	/* The number of tiles that have been processed.
+	 */
+	int n_done;
+
+	/* The number of background tasks our workers have started (as a
+	 * negative number), see vips__worker_execute(). We wait for these
+	 * on free.
+	 */
+	VipsSemaphore n_tasks;
 } VipsThreadpool;
 
+/* A background task started by a worker.
+ */
+typedef struct _VipsWorkerTask {
+	VipsThreadpool *pool;
+	GFunc func;
+	gpointer data;
+} VipsWorkerTask;
+
 static int
 vips_worker_allocate(VipsWorker *worker)
 {
@@ -425,6 +487,245 @@ vips_thread_main_loop(void *a, void *b)
 	vips_semaphore_upn(&pool->n_workers, 1);
 }
 
+/* Find the fullest deque to steal from, preferring deques on our own NUMA
+ * node. The sizes we read here without the lock are only a hint.
+ */
+static VipsTileDeque *
+vips_worker_find_victim(VipsWorker *worker)
+{
+	VipsThreadpool *pool = worker->pool;
+
+	VipsTileDeque *victim;
+	gboolean victim_local;
+	int size;
+	int i;
+
+	victim = NULL;
+	victim_local = FALSE;
+	size = 0;
+	for (i = 0; i < pool->n_deques; i++) {
+		VipsTileDeque *other = &pool->deques[i];
+		gboolean local = other->node == worker->deque->node;
+		int other_size = g_atomic_int_get(&other->back) -
+			g_atomic_int_get(&other->front);
+
+		if (other == worker->deque ||
+			other_size <= 0)
+			continue;
+
+		/* A local deque always beats a remote one.
+		 */
+		if (!victim ||
+			(local && !victim_local) ||
+			(local == victim_local && other_size > size)) {
+			victim = other;
+			victim_local = local;
+			size = other_size;
+		}
+	}
+
+	return victim;
+}
+
+/* Take ownership of a deque, preferably one for our NUMA node. Called
+ * single-threaded from start.
+ */
+static VipsTileDeque *
+vips_worker_claim_deque(VipsWorker *worker)
+{
+	VipsThreadpool *pool = worker->pool;
+	int node = vips__numa_node();
+
+	VipsTileDeque *deque;
+	int i;
+
+	deque = NULL;
+	for (i = 0; i < pool->n_deques; i++)
+		if (!pool->deques[i].claimed &&
+			(!deque ||
+				pool->deques[i].node == node)) {
+			deque = &pool->deques[i];
+			if (deque->node == node)
+				break;
+		}
+
+	g_assert(deque);
+
+	deque->claimed = TRUE;
+
+	return deque;
+}
+
+/* Take the next tile from our own deque, or steal the back half of the
+ * fullest deque in the pool. FALSE if there's no work left anywhere.
+ */
+static gboolean
+vips_worker_next_tile(VipsWorker *worker, int *tile)
+{
+	VipsTileDeque *deque = worker->deque;
+
+	for (;;) {
+		VipsTileDeque *victim;
+		int size;
+		int mid;
+
+		g_mutex_lock(&deque->lock);
+		if (deque->front < deque->back) {
+			*tile = deque->front;
+			g_atomic_int_set(&deque->front, deque->front + 1);
+			g_mutex_unlock(&deque->lock);
+
+			return TRUE;
+		}
+		g_mutex_unlock(&deque->lock);
+
+		if (!(victim = vips_worker_find_victim(worker)))
+			return FALSE;
+
+		/* We never hold two deque locks at once, so thieves can't
+		 * deadlock.
+		 */
+		g_mutex_lock(&victim->lock);
+		size = victim->back - victim->front;
+		if (size <= 0) {
+			/* Someone beat us to it, look again.
+			 */
+			g_mutex_unlock(&victim->lock);
+			continue;
+		}
+		mid = victim->back - (size + 1) / 2;
+		g_atomic_int_set(&victim->back, mid);
+		g_mutex_unlock(&victim->lock);
+
+		VIPS_DEBUG_MSG("vips_worker_next_tile: stole %d tiles\n",
+			(size + 1) / 2);
+
+		/* Keep the first stolen tile, queue the rest in our deque.
+		 */
+		*tile = mid;
+
+		g_mutex_lock(&deque->lock);
+		g_atomic_int_set(&deque->front, mid + 1);
+		g_atomic_int_set(&deque->back, mid + (size + 1) / 2);
+		g_mutex_unlock(&deque->lock);
+
+		return TRUE;
+	}
+}
+
+/* Run this once per main loop for work-stealing pools. There's no pool-wide
+ * lock: the tile comes from our deque and allocate only needs to set up
+ * per-thread state.
+ */
+static void
+vips_worker_steal_unit(VipsWorker *worker)
+{
+	VipsThreadpool *pool = worker->pool;
+
+	VipsRect image;
+	VipsRect tile;
+	int n;
+
+	/* Start functions are always single-threaded.
+	 */
+	if (!worker->state) {
+		VIPS_GATE_START("vips_worker_steal_unit: wait");
+
+		g_mutex_lock(pool->allocate_lock);
+
+		VIPS_GATE_STOP("vips_worker_steal_unit: wait");
+
+		worker->deque = vips_worker_claim_deque(worker);
+		worker->state = pool->start(pool->im, pool->a);
+		g_mutex_unlock(pool->allocate_lock);
+
+		if (!worker->state) {
+			pool->error = TRUE;
+			worker->stop = TRUE;
+			return;
+		}
+	}
+
+	if (!vips_worker_next_tile(worker, &n)) {
+		worker->stop = TRUE;
+		return;
+	}
+
+	image.left = 0;
+	image.top = 0;
+	image.width = pool->im->Xsize;
+	image.height = pool->im->Ysize;
+	tile.left = (n % pool->tiles_across) * pool->tile_width;
+	tile.top = (n / pool->tiles_across) * pool->tile_height;
+	tile.width = pool->tile_width;
+	tile.height = pool->tile_height;
+	vips_rect_intersectrect(&image, &tile, &worker->state->pos);
+	worker->state->x = worker->state->pos.left;
+	worker->state->y = worker->state->pos.top;
+
+	if (pool->allocate &&
+		pool->allocate(worker->state, pool->a, &pool->stop)) {
+		pool->error = TRUE;
+		worker->stop = TRUE;
+		return;
+	}
+
+	if (pool->work(worker->state, pool->a)) {
+		worker->stop = TRUE;
+		pool->error = TRUE;
+	}
+
+	/* Work can ask for the whole computation to end early.
+	 */
+	if (worker->state->stop)
+		pool->stop = TRUE;
+
+	g_atomic_int_inc(&pool->n_done);
+}
+
+/* What runs as a thread ... loop, waiting to be told to do stuff.
+ */
+static void
+vips_thread_steal_loop(void *a, void *b)
+{
+	VipsWorker *worker = (VipsWorker *) a;
+	VipsThreadpool *pool = worker->pool;
+
+	VIPS_GATE_START("vips_thread_steal_loop: thread");
+
+	g_private_set(worker_key, worker);
+
+	/* Always tick, even if we are stopping, so the main thread will wake
+	 * up for exit.
+	 */
+	while (!pool->stop &&
+		!worker->stop &&
+		!pool->error) {
+		VIPS_GATE_START("vips_worker_steal_unit: u");
+		vips_worker_steal_unit(worker);
+		VIPS_GATE_STOP("vips_worker_steal_unit: u");
+		vips_semaphore_up(&pool->tick);
+	}
+
+	VIPS_GATE_STOP("vips_thread_steal_loop: thread");
+
+	/* unreffing the worker state will trigger stop in the threadstate, so
+	 * we need to single-thread.
+	 */
+	g_mutex_lock(pool->allocate_lock);
+
+	VIPS_FREEF(g_object_unref, worker->state);
+
+	g_mutex_unlock(pool->allocate_lock);
+
+	VIPS_FREE(worker);
+	g_private_set(worker_key, NULL);
+
+	/* We are done: tell the main thread.
+	 */
+	vips_semaphore_upn(&pool->n_workers, 1);
+}
+
 /* Attach another thread to a threadpool.
  */
 static int
@@ -436,13 +737,17 @@ vips_worker_new(VipsThreadpool *pool)
 		return -1;
 	worker->pool = pool;
 	worker->state = NULL;
+	worker->deque = NULL;
+	worker->stop = FALSE;
 
 	/* We can't build the state here, it has to be done by the worker
 	 * itself the first time that allocate runs so that any regions are
 	 * owned by the correct thread.
 	 */
 
-	if (vips_thread_execute("worker", vips_thread_main_loop, worker)) {
+	if (vips_thread_execute("worker",
+			pool->deques ? vips_thread_steal_loop : vips_thread_main_loop,
+			worker)) {
 		g_free(worker);
 		return -1;
 	}
@@ -478,6 +783,54 @@ vips__worker_cond_wait(GCond *cond, GMutex *mutex)
 		g_atomic_int_add(&worker->pool->n_waiting, -1);
 }
 
+static void
+vips_worker_task_run(void *data, void *user_data)
+{
+	VipsWorkerTask *task = (VipsWorkerTask *) data;
+	VipsThreadpool *pool = task->pool;
+
+	/* Tell the task if the pool has finished, so it can skip its work.
+	 */
+	task->func(task->data, GINT_TO_POINTER(pool->stop || pool->error));
+	g_free(task);
+
+	/* The pool can be freed as soon as we're done.
+	 */
+	vips_semaphore_up(&pool->n_tasks);
+}
+
+/* Run @func in the threadset on behalf of the pool the calling worker belongs
+ * to. The pool won't be freed until @func has returned, and @func's
+ * user_data is non-NULL if the pool finished before the task started, in
+ * which case @func should just free @data.
+ *
+ * Returns -1, and does not run @func, if this is not a worker thread.
+ */
+int
+vips__worker_execute(const char *domain, GFunc func, gpointer data)
+{
+	VipsWorker *worker = (VipsWorker *) g_private_get(worker_key);
+
+	VipsWorkerTask *task;
+
+	if (!worker)
+		return -1;
+
+	task = g_new(VipsWorkerTask, 1);
+	task->pool = worker->pool;
+	task->func = func;
+	task->data = data;
+
+	vips_semaphore_upn(&task->pool->n_tasks, -1);
+	if (vips_thread_execute(domain, vips_worker_task_run, task)) {
+		vips_semaphore_up(&task->pool->n_tasks);
+		g_free(task);
+		return -1;
+	}
+
+	return 0;
+}
+
 static void
 vips_threadpool_free(VipsThreadpool *pool)
 {
@@ -489,9 +842,22 @@ vips_threadpool_free(VipsThreadpool *pool)
 	pool->stop = TRUE;
 	vips_semaphore_downn(&pool->n_workers, 0);
 
+	/* And for any background tasks they started.
+	 */
+	vips_semaphore_downn(&pool->n_tasks, 0);
+
+	if (pool->deques) {
+		int i;
+
+		for (i = 0; i < pool->n_deques; i++)
+			g_mutex_clear(&pool->deques[i].lock);
+		VIPS_FREE(pool->deques);
+	}
+
 	VIPS_FREEF(vips_g_mutex_free, pool->allocate_lock);
 	vips_semaphore_destroy(&pool->n_workers);
 	vips_semaphore_destroy(&pool->tick);
+	vips_semaphore_destroy(&pool->n_tasks);
 	VIPS_FREE(pool);
 }
 
@@ -515,9 +881,17 @@ vips_threadpool_new(VipsImage *im)
 	pool->max_workers = vips_concurrency_get();
 	vips_semaphore_init(&pool->n_workers, 0, "n_workers");
 	vips_semaphore_init(&pool->tick, 0, "tick");
+	vips_semaphore_init(&pool->n_tasks, 0, "n_tasks");
 	pool->error = FALSE;
 	pool->stop = FALSE;
 	pool->exit = 0;
+	pool->tile_width = 0;
+	pool->tile_height = 0;
+	pool->tiles_across = 0;
+	pool->n_tiles = 0;
+	pool->deques = NULL;
+	pool->n_deques = 0;
+	pool->n_done = 0;
 
 	/* If this is a tiny image, we won't need all max_workers threads.
 	 * Guess how
@@ -732,3 +1106,169 @@ vips_threadpool_run(VipsImage *im,
 
 	return result;
 }
+
+/* Partition the tiles of a pool between one deque per worker.
+ */
+static int
+vips_threadpool_partition(VipsThreadpool *pool,
+	int tile_width, int tile_height)
+{
+	int tiles_down;
+	int i;
+
+	pool->tile_width = tile_width;
+	pool->tile_height = tile_height;
+	pool->tiles_across = VIPS_ROUND_UP(pool->im->Xsize, tile_width) /
+		tile_width;
+	tiles_down = VIPS_ROUND_UP(pool->im->Ysize, tile_height) /
+		tile_height;
+
+	/* Tile numbers must fit in an int.
+	 */
+	if ((gint64) pool->tiles_across * tiles_down > INT_MAX) {
+		vips_error("vips_threadpool_run_tiles",
+			"%s", _("too many tiles"));
+		return -1;
+	}
+	pool->n_tiles = pool->tiles_across * tiles_down;
+
+	/* No more workers than tiles.
+	 */
+	pool->max_workers = VIPS_CLIP(1, pool->max_workers, pool->n_tiles);
+
+	pool->n_deques = pool->max_workers;
+	if (!(pool->deques = VIPS_ARRAY(NULL, pool->n_deques, VipsTileDeque)))
+		return -1;
+
+	/* Contiguous ranges, so each worker starts with a band of the image.
+	 * In NUMA mode, each node gets a band of deques too.
+	 */
+	for (i = 0; i < pool->n_deques; i++) {
+		VipsTileDeque *deque = &pool->deques[i];
+
+		g_mutex_init(&deque->lock);
+		deque->front = (gint64) pool->n_tiles * i / pool->n_deques;
+		deque->back = (gint64) pool->n_tiles * (i + 1) / pool->n_deques;
+		deque->node = vips_numa_get()
+			? i * vips__numa_get_n_nodes() / pool->n_deques
+			: -1;
+		deque->claimed = FALSE;
+	}
+
+	return 0;
+}
+
+/**
+ * vips_threadpool_steal_set:
+ * @steal: %TRUE to enable work stealing
+ *
+ * Sinks which don't need to process tiles in top-to-bottom order, such as
+ * vips_sink() and vips_sink_memory(), can use a work-stealing scheduler.
+ * The image is partitioned into one range of tiles per worker, and workers
+ * which run out of tiles steal half the remaining work from the busiest
+ * worker. This avoids serialising every worker through a single allocate
+ * lock, so very cheap pipelines can scale to high core counts.
+ *
+ * Images opened in sequential mode always use the standard scheduler.
+ *
+ * You can also enable work stealing with the `VIPS_STEAL` environment
+ * variable.
+ *
+ * See also: vips_threadpool_steal_get(), vips_concurrency_set().
+ */
+void
+vips_threadpool_steal_set(gboolean steal)
+{
+	vips__steal = steal;
+}
+
+/**
+ * vips_threadpool_steal_get:
+ *
+ * See also: vips_threadpool_steal_set().
+ *
+ * Returns: %TRUE if sinks may use the work-stealing scheduler.
+ */
+gboolean
+vips_threadpool_steal_get(void)
+{
+	return vips__steal;
+}
+
+/* Like vips_threadpool_run(), but the pool does the allocation: the image
+ * is cut into @tile_width by @tile_height tiles and these are shared between
+ * workers with work stealing.
+ *
+ * @start is single-threaded, as before. @allocate is optional and is called
+ * with state->pos already set to the tile, but it runs concurrently, so it
+ * must only change per-thread state. Tiles are not processed in any
+ * particular order.
+ */
+int
+vips__threadpool_run_tiles(VipsImage *im,
+	int tile_width, int tile_height,
+	VipsThreadStartFn start,
+	VipsThreadpoolAllocateFn allocate,
+	VipsThreadpoolWorkFn work,
+	VipsThreadpoolProgressFn progress,
+	void *a)
+{
+	VipsThreadpool *pool;
+	int result;
+	int i;
+
+	g_assert(tile_width > 0);
+	g_assert(tile_height > 0);
+
+	if (!(pool = vips_threadpool_new(im)))
+		return -1;
+
+	pool->start = start;
+	pool->allocate = allocate;
+	pool->work = work;
+	pool->a = a;
+
+	if (vips_threadpool_partition(pool, tile_width, tile_height)) {
+		vips_threadpool_free(pool);
+		return -1;
+	}
+
+	VIPS_DEBUG_MSG("vips__threadpool_run_tiles: %d tiles, %d workers\n",
+		pool->n_tiles, pool->n_deques);
+
+	/* There's no allocate lock to queue on, so there's no load to
+	 * measure. Start all the workers at once.
+	 */
+	for (i = 0; i < pool->n_deques; i++)
+		if (vips_worker_new(pool)) {
+			pool->error = TRUE;
+			vips_threadpool_free(pool);
+			return -1;
+		}
+
+	for (;;) {
+		vips_semaphore_down(&pool->tick);
+
+		if (pool->stop ||
+			pool->error)
+			break;
+
+		if (progress &&
+			progress(pool->a))
+			pool->error = TRUE;
+
+		if (pool->stop ||
+			pool->error ||
+			g_atomic_int_get(&pool->n_done) >= pool->n_tiles)
+			break;
+	}
+
+	result = pool->error ? -1 : 0;
+
+	vips_threadpool_free(pool);
+
+	if (!vips_image_get_typeof(im, "vips-no-minimise"))
+		vips_image_minimise_all(im);
+
+	return result;
+}
@@ -75,6 +75,10 @@ typedef struct _VipsThreadsetMember {
 	/* Set by our controller to request exit.
 	 */
 	gboolean kill;
+
+	/* The NUMA node we bind to, or -1.
+	 */
+	int node;
 } VipsThreadsetMember;
 
 struct _VipsThreadset {
@@ -94,6 +98,11 @@ struct _VipsThreadset {
 	int n_threads;
 	int n_threads_highwater;
 	int max_threads;
+
+	/* In NUMA mode, the node we bind the next new thread to. We go
+	 * round-robin so threads spread evenly over nodes.
+	 */
+	int next_node;
 };
 
 /* The maximum relative time (in microseconds) that a thread waits
@@ -111,6 +120,15 @@ vips_threadset_work(void *pointer)
 
 	VIPS_DEBUG_MSG("vips_threadset_work: starting %p\n", member);
 
+	/* Bind before we allocate anything, so per-thread buffers are
+	 * node-local.
+	 */
+	if (member->node >= 0 &&
+		vips__numa_bind(member->node)) {
+		g_warning("%s", vips_error_buffer());
+		vips_error_clear();
+	}
+
 	for (;;) {
 		/* Wait for at least 15 seconds to be given work.
 		 */
@@ -184,6 +202,15 @@ vips_threadset_add(VipsThreadset *set)
 
 	member = g_new0(VipsThreadsetMember, 1);
 	member->set = set;
+	member->node = -1;
+
+	if (vips_numa_get()) {
+		g_mutex_lock(set->lock);
+		member->node = set->next_node;
+		set->next_node = (set->next_node + 1) %
+			vips__numa_get_n_nodes();
+		g_mutex_unlock(set->lock);
+	}
 
 	vips_semaphore_init(&member->idle, 0, "idle");
 
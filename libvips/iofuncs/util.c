@@ -573,6 +573,54 @@ vips__write(int fd, const void *buf, size_t count)
 	return 0;
 }
 
+/* Read @count bytes at @offset, without moving the file pointer, so several
+ * threads can read from one fd at once. Short reads are retried, and end of
+ * file is an error.
+ */
+int
+vips__pread(int fd, void *buf, size_t count, gint64 offset)
+{
+	while (count > 0) {
+#ifdef G_OS_WIN32
+		HANDLE handle = (HANDLE) _get_osfhandle(fd);
+		OVERLAPPED overlapped = { 0 };
+		DWORD nread;
+
+		overlapped.Offset = (DWORD) offset;
+		overlapped.OffsetHigh = (DWORD) (offset >> 32);
+		if (!ReadFile(handle, buf, (DWORD) VIPS_MIN(count, G_MAXINT32),
+				&nread, &overlapped)) {
+			vips_error_system(GetLastError(), "vips__pread",
+				"%s", _("read failed"));
+			return -1;
+		}
+#else  /*!G_OS_WIN32*/
+		gssize nread = pread(fd, buf, count, offset);
+
+		if (nread == -1) {
+			if (errno == EINTR)
+				continue;
+
+			vips_error_system(errno, "vips__pread",
+				"%s", _("read failed"));
+			return -1;
+		}
+#endif /*G_OS_WIN32*/
+
+		if (nread == 0) {
+			vips_error("vips__pread",
+				"%s", _("unexpected end of file"));
+			return -1;
+		}
+
+		buf = (void *) ((char *) buf + nread);
+		count -= nread;
+		offset += nread;
+	}
+
+	return 0;
+}
+
 #ifdef G_OS_WIN32
 /* Set the create date on a file. On Windows, the create date may be copied
  * over from an existing file of the same name, unless you reset it.
@@ -27,6 +27,9 @@
  * 	- escape ASCII control characters in XML
  * 29/8/19
  * 	- verify bands/format for coded images
+ * 16/10/26
+ * 	- add tiled, compressed images, see vipstiled.c
+ * 	- tiled images have their own magic
  */
 
 /*
@@ -235,6 +238,12 @@ image_pixel_length(VipsImage *image)
 {
 	gint64 psize;
 
+	/* Tiled images record the end of the compressed pixels.
+	 */
+	if (vips__vips_tiled(image) &&
+		(psize = vips__vips_tiled_pixel_length(image)) > 0)
+		return psize;
+
 	switch (image->Coding) {
 	case VIPS_CODING_LABQ:
 	case VIPS_CODING_RAD:
@@ -281,9 +290,19 @@ vips__file_magic(const char *filename)
 {
 	guint32 magic;
 
-	if (vips__get_bytes(filename, (unsigned char *) &magic, 4) == 4 &&
-		(magic == VIPS_MAGIC_INTEL ||
-			magic == VIPS_MAGIC_SPARC))
+	if (vips__get_bytes(filename, (unsigned char *) &magic, 4) != 4)
+		return 0;
+
+	/* Tiled files have their own magic, but the byte order is the
+	 * same.
+	 */
+	if (magic == VIPS__MAGIC_TILED_INTEL)
+		magic = VIPS_MAGIC_INTEL;
+	else if (magic == VIPS__MAGIC_TILED_SPARC)
+		magic = VIPS_MAGIC_SPARC;
+
+	if (magic == VIPS_MAGIC_INTEL ||
+		magic == VIPS_MAGIC_SPARC)
 		return magic;
 
 	return 0;
@@ -318,6 +337,7 @@ int
 vips__read_header_bytes(VipsImage *im, unsigned char *from)
 {
 	gboolean swap;
+	gboolean tiled;
 	int i;
 	GEnumValue *value;
 
@@ -332,6 +352,20 @@ vips__read_header_bytes(VipsImage *im, unsigned char *from)
 	vips__copy_4byte(!vips_amiMSBfirst(),
 		(unsigned char *) &im->magic, from);
 	from += 4;
+
+	/* Tiled images keep the plain magic in memory, it sets the byte
+	 * order.
+	 */
+	tiled = FALSE;
+	if (im->magic == VIPS__MAGIC_TILED_INTEL) {
+		im->magic = VIPS_MAGIC_INTEL;
+		tiled = TRUE;
+	}
+	else if (im->magic == VIPS__MAGIC_TILED_SPARC) {
+		im->magic = VIPS_MAGIC_SPARC;
+		tiled = TRUE;
+	}
+
 	if (im->magic != VIPS_MAGIC_INTEL &&
 		im->magic != VIPS_MAGIC_SPARC) {
 		vips_error("VipsImage",
@@ -355,6 +389,19 @@ vips__read_header_bytes(VipsImage *im, unsigned char *from)
 	 */
 	im->Bbits = vips_format_sizeof(im->BandFmt) << 3;
 
+	/* Only the magic can make an image tiled. Plain images have ignored
+	 * Compression since vips7.
+	 */
+	if (tiled &&
+		!vips__vips_tiled(im)) {
+		vips_error("VipsImage",
+			"%s", _("malformed tiled image"));
+		return -1;
+	}
+	if (!tiled &&
+		vips__vips_tiled(im))
+		im->Compression = 0;
+
 	/* We read xres/yres as floats to a staging area, then copy to double
 	 * in the main fields.
 	 */
@@ -432,6 +479,7 @@ vips__write_header_bytes(VipsImage *im, unsigned char *to)
 	 */
 	gboolean swap = vips_amiMSBfirst() != vips_image_isMSBfirst(im);
 
+	guint32 magic;
 	int i;
 	unsigned char *q;
 
@@ -441,10 +489,16 @@ vips__write_header_bytes(VipsImage *im, unsigned char *to)
 	im->Xres_float = im->Xres;
 	im->Yres_float = im->Yres;
 
-	/* Always write the magic number MSB first.
+	/* Always write the magic number MSB first. Tiled images get their
+	 * own magic.
 	 */
+	magic = im->magic;
+	if (vips__vips_tiled(im))
+		magic = magic == VIPS_MAGIC_SPARC
+			? VIPS__MAGIC_TILED_SPARC
+			: VIPS__MAGIC_TILED_INTEL;
 	vips__copy_4byte(!vips_amiMSBfirst(),
-		to, (unsigned char *) &im->magic);
+		to, (unsigned char *) &magic);
 	q = to + 4;
 
 	for (i = 0; i < VIPS_NUMBER(fields); i++) {
@@ -1045,14 +1099,21 @@ vips_image_open_input(VipsImage *image)
 		return -1;
 	}
 
+	if ((rsize = vips_file_length(image->fd)) == -1)
+		return -1;
+	image->file_length = rsize;
+
+	/* Tiled images need the tile index before we can find the XML.
+	 */
+	if (vips__vips_tiled(image) &&
+		vips__vips_tiled_open(image))
+		return -1;
+
 	/* Predict and check the file size. Only issue a warning, we want to be
 	 * able to read all the header fields we can, even if the actual data
 	 * isn't there.
 	 */
 	psize = image_pixel_length(image);
-	if ((rsize = vips_file_length(image->fd)) == -1)
-		return -1;
-	image->file_length = rsize;
 	if (psize > rsize)
 		g_warning(_("unable to read data for \"%s\", %s"),
 			image->filename, _("file has been truncated"));
@@ -1071,6 +1132,12 @@ vips_image_open_input(VipsImage *image)
 		vips_error_clear();
 	}
 
+	/* Tiled images decompress on demand.
+	 */
+	if (vips__vips_tiled(image) &&
+		vips__vips_tiled_attach(image))
+		return -1;
+
 	return 0;
 }
 
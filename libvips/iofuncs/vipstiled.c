@@ -0,0 +1,1221 @@
+/* Read and write tiled, compressed vips files.
+ *
+ * 16/10/26
+ * 	- from vips.c
+ * 	- add memory tiles with a process-wide budget
+ * 	- own magic, read tiles with pread(), hash the decoded tile cache
+ */
+
+/*
+
+	This file is part of VIPS.
+
+	VIPS is free software; you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+	02110-1301  USA
+
+ */
+
+/*
+
+	These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/*
+#define DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <glib/gi18n-lib.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif /*HAVE_UNISTD_H*/
+#ifdef HAVE_IO_H
+#include <io.h>
+#endif /*HAVE_IO_H*/
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif /*HAVE_ZLIB*/
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif /*HAVE_ZSTD*/
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif /*HAVE_LZ4*/
+
+#include <vips/vips.h>
+#include <vips/internal.h>
+#include <vips/debug.h>
+
+/* A tiled vips file has the usual 64-byte header, but with the magic
+ * VIPS__MAGIC_TILED_INTEL or VIPS__MAGIC_TILED_SPARC, Compression set to
+ * VIPS__COMPRESSION_TILED plus a VipsForeignVipsCompression, and Level set
+ * to the tile size. Readers which predate tiling reject the magic.
+ *
+ * The header is followed by the tile index, one VIPS_TILED_ENTRY_SIZE entry
+ * per tile in row-major order. Each entry is a little-endian 64-bit file
+ * offset, a 32-bit length and 4 bytes of padding. Next come the compressed
+ * tiles, in the order they were written, then the usual XML extension block.
+ *
+ * Tiles are clipped to the image edges. A tile whose length is equal to its
+ * uncompressed size is stored raw.
+ *
+ * Temporary images made by vips__vips_tiled_memory() keep compressed tiles in
+ * memory while vips_get_temp_memory() allows, and only append tiles to the
+ * file once the budget, shared by all such images in this process, is used
+ * up. They never write an index, the index stays in memory.
+ */
+#define VIPS_TILED_ENTRY_SIZE (16)
+
+/* Limits on tile size.
+ */
+#define VIPS_TILED_MIN_TILE_SIZE (16)
+#define VIPS_TILED_MAX_TILE_SIZE (8192)
+
+/* The number of strips we keep in flight when writing.
+ */
+#define VIPS_TILED_WRITE_DEPTH (4)
+
+typedef struct _VipsTiledEntry {
+	gint64 offset;
+	guint32 length;
+
+	/* Memory tiles have their compressed bytes here.
+	 */
+	VipsPel *mem;
+} VipsTiledEntry;
+
+/* A decompressed tile, shared between the threads reading this image.
+ */
+typedef struct _VipsTiledTile {
+	int tile;
+	int ref_count;
+	VipsPel *pixels;
+
+	/* Our link in the LRU queue, if we're in the cache.
+	 */
+	GList *link;
+} VipsTiledTile;
+
+typedef struct _VipsTiled {
+	/* Not a reference, we are attached to this image as qdata.
+	 */
+	VipsImage *image;
+
+	VipsForeignVipsCompression compression;
+	int tile_size;
+	int tiles_across;
+	int tiles_down;
+	int n_tiles;
+
+	VipsTiledEntry *index;
+
+	/* Keep tiles in memory while the budget allows, and the number of
+	 * bytes of budget we hold.
+	 */
+	gboolean memory;
+	size_t mem_used;
+
+	/* The end of the compressed pixels, and the start of the XML.
+	 */
+	gint64 data_end;
+
+	/* Protects the tile cache and the row buffers.
+	 */
+	GMutex lock;
+
+	/* Serialise seek/write on image->fd. Reads use vips__pread() and
+	 * need no lock.
+	 */
+	GMutex io_lock;
+
+	/* On read, recently decompressed tiles indexed by tile number, and
+	 * an LRU queue of them, most recently used at the head. Keep enough
+	 * for a row of tiles, plus one per thread, so thin strips decompress
+	 * each tile just once.
+	 */
+	GHashTable *tiles;
+	GQueue lru;
+	int max_tiles;
+
+	/* On write, assemble each row of tiles here, and count the scanlines
+	 * we have.
+	 */
+	VipsPel **rows;
+	int *rows_filled;
+
+	/* And the next free position in the file.
+	 */
+	gint64 append;
+} VipsTiled;
+
+/* Each thread needs a buffer to read compressed tiles into.
+ */
+typedef struct _VipsTiledSeq {
+	VipsTiled *tiled;
+
+	VipsPel *buf;
+	size_t buf_size;
+} VipsTiledSeq;
+
+/* Bytes of compressed memory tiles in this process.
+ */
+static gssize vips_tiled_memory_used = 0;
+
+static GQuark
+vips_tiled_quark(void)
+{
+	return g_quark_from_static_string("vips-tiled");
+}
+
+/* Marks images made by vips__vips_tiled_memory().
+ */
+static GQuark
+vips_tiled_memory_quark(void)
+{
+	return g_quark_from_static_string("vips-tiled-memory");
+}
+
+static VipsTiled *
+vips_tiled_get(VipsImage *image)
+{
+	return (VipsTiled *) g_object_get_qdata(G_OBJECT(image),
+		vips_tiled_quark());
+}
+
+/* Test if a codec was built in.
+ */
+gboolean
+vips__vips_tiled_supported(VipsForeignVipsCompression compression)
+{
+	switch (compression) {
+#ifdef HAVE_ZLIB
+	case VIPS_FOREIGN_VIPS_COMPRESSION_DEFLATE:
+		return TRUE;
+#endif /*HAVE_ZLIB*/
+
+#ifdef HAVE_ZSTD
+	case VIPS_FOREIGN_VIPS_COMPRESSION_ZSTD:
+		return TRUE;
+#endif /*HAVE_ZSTD*/
+
+#ifdef HAVE_LZ4
+	case VIPS_FOREIGN_VIPS_COMPRESSION_LZ4:
+		return TRUE;
+#endif /*HAVE_LZ4*/
+
+	default:
+		return FALSE;
+	}
+}
+
+/* Is this a tiled vips image?
+ */
+gboolean
+vips__vips_tiled(VipsImage *image)
+{
+	return image->Compression > VIPS__COMPRESSION_TILED;
+}
+
+static size_t
+vips_tiled_bound(VipsForeignVipsCompression compression, size_t length)
+{
+	switch (compression) {
+#ifdef HAVE_ZLIB
+	case VIPS_FOREIGN_VIPS_COMPRESSION_DEFLATE:
+		return compressBound(length);
+#endif /*HAVE_ZLIB*/
+
+#ifdef HAVE_ZSTD
+	case VIPS_FOREIGN_VIPS_COMPRESSION_ZSTD:
+		return ZSTD_compressBound(length);
+#endif /*HAVE_ZSTD*/
+
+#ifdef HAVE_LZ4
+	case VIPS_FOREIGN_VIPS_COMPRESSION_LZ4:
+		return LZ4_compressBound(length);
+#endif /*HAVE_LZ4*/
+
+	default:
+		return length;
+	}
+}
+
+/* Compress @in to @out. On entry, @out_length is the size of @out, on exit
+ * it's the number of bytes we wrote.
+ */
+static int
+vips_tiled_compress(VipsForeignVipsCompression compression,
+	VipsPel *in, size_t in_length, VipsPel *out, size_t *out_length)
+{
+	switch (compression) {
+#ifdef HAVE_ZLIB
+	case VIPS_FOREIGN_VIPS_COMPRESSION_DEFLATE: {
+		uLongf length = *out_length;
+
+		if (compress2(out, &length, in, in_length, Z_BEST_SPEED) != Z_OK)
+			break;
+		*out_length = length;
+
+		return 0;
+	}
+#endif /*HAVE_ZLIB*/
+
+#ifdef HAVE_ZSTD
+	case VIPS_FOREIGN_VIPS_COMPRESSION_ZSTD: {
+		size_t length;
+
+		length = ZSTD_compress(out, *out_length, in, in_length, 1);
+		if (ZSTD_isError(length))
+			break;
+		*out_length = length;
+
+		return 0;
+	}
+#endif /*HAVE_ZSTD*/
+
+#ifdef HAVE_LZ4
+	case VIPS_FOREIGN_VIPS_COMPRESSION_LZ4: {
+		int length;
+
+		length = LZ4_compress_default((const char *) in, (char *) out,
+			in_length, *out_length);
+		if (length <= 0)
+			break;
+		*out_length = length;
+
+		return 0;
+	}
+#endif /*HAVE_LZ4*/
+
+	default:
+		break;
+	}
+
+	vips_error("VipsImage", "%s", _("unable to compress tile"));
+
+	return -1;
+}
+
+/* Decompress @in to @out, which must be exactly @out_length bytes.
+ */
+static int
+vips_tiled_decompress(VipsForeignVipsCompression compression,
+	VipsPel *in, size_t in_length, VipsPel *out, size_t out_length)
+{
+	switch (compression) {
+#ifdef HAVE_ZLIB
+	case VIPS_FOREIGN_VIPS_COMPRESSION_DEFLATE: {
+		uLongf length = out_length;
+
+		if (uncompress(out, &length, in, in_length) != Z_OK ||
+			length != out_length)
+			break;
+
+		return 0;
+	}
+#endif /*HAVE_ZLIB*/
+
+#ifdef HAVE_ZSTD
+	case VIPS_FOREIGN_VIPS_COMPRESSION_ZSTD: {
+		size_t length;
+
+		length = ZSTD_decompress(out, out_length, in, in_length);
+		if (ZSTD_isError(length) ||
+			length != out_length)
+			break;
+
+		return 0;
+	}
+#endif /*HAVE_ZSTD*/
+
+#ifdef HAVE_LZ4
+	case VIPS_FOREIGN_VIPS_COMPRESSION_LZ4: {
+		int length;
+
+		length = LZ4_decompress_safe((const char *) in, (char *) out,
+			in_length, out_length);
+		if (length < 0 ||
+			(size_t) length != out_length)
+			break;
+
+		return 0;
+	}
+#endif /*HAVE_LZ4*/
+
+	default:
+		break;
+	}
+
+	vips_error("VipsImage", "%s", _("unable to decompress tile"));
+
+	return -1;
+}
+
+static void
+vips_tiled_tile_free(VipsTiledTile *tile)
+{
+	VIPS_FREEF(vips_tracked_free, tile->pixels);
+	g_free(tile);
+}
+
+static void
+vips_tiled_free(VipsTiled *tiled)
+{
+	VipsTiledTile *tile;
+	int i;
+
+	while ((tile = (VipsTiledTile *) g_queue_pop_head(&tiled->lru)))
+		vips_tiled_tile_free(tile);
+	VIPS_FREEF(g_hash_table_destroy, tiled->tiles);
+
+	for (i = 0; i < tiled->n_tiles; i++)
+		VIPS_FREEF(vips_tracked_free, tiled->index[i].mem);
+	if (tiled->mem_used)
+		g_atomic_pointer_add(&vips_tiled_memory_used,
+			-(gssize) tiled->mem_used);
+
+	if (tiled->rows) {
+		for (i = 0; i < tiled->tiles_down; i++)
+			VIPS_FREEF(vips_tracked_free, tiled->rows[i]);
+		VIPS_FREE(tiled->rows);
+	}
+	VIPS_FREE(tiled->rows_filled);
+	VIPS_FREE(tiled->index);
+
+	g_mutex_clear(&tiled->lock);
+	g_mutex_clear(&tiled->io_lock);
+
+	g_free(tiled);
+}
+
+/* Make a tiled state from the header fields and attach it to the image.
+ */
+static VipsTiled *
+vips_tiled_new(VipsImage *image)
+{
+	VipsForeignVipsCompression compression =
+		image->Compression - VIPS__COMPRESSION_TILED;
+	int tile_size = image->Level;
+
+	VipsTiled *tiled;
+	gint64 n_tiles;
+
+	if (compression <= VIPS_FOREIGN_VIPS_COMPRESSION_NONE ||
+		compression >= VIPS_FOREIGN_VIPS_COMPRESSION_LAST) {
+		vips_error("VipsImage", "%s", _("unknown compression"));
+		return NULL;
+	}
+	if (!vips__vips_tiled_supported(compression)) {
+		vips_error("VipsImage",
+			_("support for %s compression not built in"),
+			vips_enum_nick(VIPS_TYPE_FOREIGN_VIPS_COMPRESSION,
+				compression));
+		return NULL;
+	}
+	if (tile_size < VIPS_TILED_MIN_TILE_SIZE ||
+		tile_size > VIPS_TILED_MAX_TILE_SIZE) {
+		vips_error("VipsImage",
+			_("bad tile size %d"), tile_size);
+		return NULL;
+	}
+
+	/* Tiles must fit in an int for lz4, and the index must be sane.
+	 */
+	n_tiles = (gint64) VIPS_ROUND_UP(image->Xsize, tile_size) / tile_size *
+		(VIPS_ROUND_UP(image->Ysize, tile_size) / tile_size);
+	if ((gint64) tile_size * tile_size * VIPS_IMAGE_SIZEOF_PEL(image) >
+			INT_MAX / 2 ||
+		n_tiles > INT_MAX / VIPS_TILED_ENTRY_SIZE) {
+		vips_error("VipsImage", "%s", _("too many tiles"));
+		return NULL;
+	}
+
+	tiled = g_new0(VipsTiled, 1);
+	tiled->image = image;
+	tiled->compression = compression;
+	tiled->tile_size = tile_size;
+	tiled->tiles_across = VIPS_ROUND_UP(image->Xsize, tile_size) / tile_size;
+	tiled->tiles_down = VIPS_ROUND_UP(image->Ysize, tile_size) / tile_size;
+	tiled->n_tiles = n_tiles;
+	tiled->index = g_new0(VipsTiledEntry, n_tiles);
+	tiled->data_end = image->sizeof_header +
+		(gint64) n_tiles * VIPS_TILED_ENTRY_SIZE;
+	g_mutex_init(&tiled->lock);
+	g_mutex_init(&tiled->io_lock);
+	tiled->tiles = g_hash_table_new(g_direct_hash, g_direct_equal);
+	g_queue_init(&tiled->lru);
+	tiled->max_tiles = tiled->tiles_across + vips_concurrency_get();
+
+	/* Memory images keep their index in memory, so spilled tiles can go
+	 * straight after the header.
+	 */
+	if (g_object_get_qdata(G_OBJECT(image), vips_tiled_memory_quark())) {
+		tiled->memory = TRUE;
+		tiled->data_end = image->sizeof_header;
+	}
+	tiled->append = tiled->data_end;
+
+	g_object_set_qdata_full(G_OBJECT(image), vips_tiled_quark(),
+		tiled, (GDestroyNotify) vips_tiled_free);
+
+	return tiled;
+}
+
+/* The area of the image a tile covers.
+ */
+static void
+vips_tiled_rect(VipsTiled *tiled, int tile, VipsRect *rect)
+{
+	VipsRect image;
+
+	image.left = 0;
+	image.top = 0;
+	image.width = tiled->image->Xsize;
+	image.height = tiled->image->Ysize;
+
+	rect->left = (tile % tiled->tiles_across) * tiled->tile_size;
+	rect->top = (tile / tiled->tiles_across) * tiled->tile_size;
+	rect->width = tiled->tile_size;
+	rect->height = tiled->tile_size;
+	vips_rect_intersectrect(rect, &image, rect);
+}
+
+/* Where the compressed pixels end, or -1 for no tiled state.
+ */
+gint64
+vips__vips_tiled_pixel_length(VipsImage *image)
+{
+	VipsTiled *tiled;
+
+	if (!(tiled = vips_tiled_get(image)))
+		return -1;
+
+	return tiled->data_end;
+}
+
+/* Called from vips_image_open_input() after the header has been read: load
+ * and check the tile index.
+ */
+int
+vips__vips_tiled_open(VipsImage *image)
+{
+	VipsTiled *tiled;
+	size_t size;
+	VipsPel *buf;
+	int i;
+
+	/* A memory image being rewound after write: we already have the index.
+	 */
+	if ((tiled = vips_tiled_get(image)) &&
+		tiled->memory)
+		return 0;
+
+	if (!(tiled = vips_tiled_new(image)))
+		return -1;
+
+	size = (size_t) tiled->n_tiles * VIPS_TILED_ENTRY_SIZE;
+	if (!(buf = vips_malloc(NULL, size)))
+		return -1;
+	if (vips__pread(image->fd, buf, size, image->sizeof_header)) {
+		g_free(buf);
+		vips_error("VipsImage", "%s", _("unable to read tile index"));
+		return -1;
+	}
+
+	for (i = 0; i < tiled->n_tiles; i++) {
+		VipsPel *p = buf + (size_t) i * VIPS_TILED_ENTRY_SIZE;
+		VipsTiledEntry *entry = &tiled->index[i];
+
+		VipsRect rect;
+		size_t raw;
+		gint64 offset;
+		guint32 length;
+
+		memcpy(&offset, p, sizeof(offset));
+		memcpy(&length, p + 8, sizeof(length));
+		entry->offset = GINT64_FROM_LE(offset);
+		entry->length = GUINT32_FROM_LE(length);
+
+		vips_tiled_rect(tiled, i, &rect);
+		raw = (size_t) VIPS_IMAGE_SIZEOF_PEL(image) *
+			rect.width * rect.height;
+
+		if (entry->length == 0 ||
+			entry->length > VIPS_MAX(raw,
+								vips_tiled_bound(tiled->compression, raw)) ||
+			entry->offset < tiled->append ||
+			entry->offset + entry->length > image->file_length) {
+			g_free(buf);
+			vips_error("VipsImage", "%s", _("bad tile index"));
+			return -1;
+		}
+
+		tiled->data_end =
+			VIPS_MAX(tiled->data_end, entry->offset + entry->length);
+	}
+
+	g_free(buf);
+
+#ifdef DEBUG
+	printf("vips__vips_tiled_open: %d tiles of %d pixels, "
+		   "%" G_GINT64_FORMAT " bytes\n",
+		tiled->n_tiles, tiled->tile_size, tiled->data_end);
+#endif /*DEBUG*/
+
+	return 0;
+}
+
+static void
+vips_tiled_tile_unref(VipsTiled *tiled, VipsTiledTile *tile)
+{
+	gboolean dead;
+
+	g_mutex_lock(&tiled->lock);
+	tile->ref_count -= 1;
+	dead = tile->ref_count == 0;
+	g_mutex_unlock(&tiled->lock);
+
+	if (dead)
+		vips_tiled_tile_free(tile);
+}
+
+/* Decompress a tile into a new buffer.
+ */
+static VipsTiledTile *
+vips_tiled_tile_load(VipsTiledSeq *seq, int n)
+{
+	VipsTiled *tiled = seq->tiled;
+	VipsImage *image = tiled->image;
+	VipsTiledEntry *entry = &tiled->index[n];
+
+	VipsRect rect;
+	size_t raw;
+	VipsTiledTile *tile;
+	VipsPel *to;
+
+	vips_tiled_rect(tiled, n, &rect);
+	raw = (size_t) VIPS_IMAGE_SIZEOF_PEL(image) * rect.width * rect.height;
+
+	tile = g_new0(VipsTiledTile, 1);
+	tile->tile = n;
+	tile->ref_count = 1;
+	if (!(tile->pixels = vips_tracked_malloc(raw))) {
+		vips_tiled_tile_free(tile);
+		return NULL;
+	}
+
+	/* Memory tiles need no IO.
+	 */
+	if (entry->mem) {
+		if (entry->length == raw)
+			memcpy(tile->pixels, entry->mem, raw);
+		else if (vips_tiled_decompress(tiled->compression,
+					 entry->mem, entry->length, tile->pixels, raw)) {
+			vips_tiled_tile_free(tile);
+			return NULL;
+		}
+
+		return tile;
+	}
+
+	/* Raw tiles read straight into the pixel buffer.
+	 */
+	if (entry->length == raw)
+		to = tile->pixels;
+	else {
+		if (seq->buf_size < entry->length) {
+			VIPS_FREE(seq->buf);
+			seq->buf = g_malloc(entry->length);
+			seq->buf_size = entry->length;
+		}
+		to = seq->buf;
+	}
+
+	if (vips__pread(image->fd, to, entry->length, entry->offset)) {
+		vips_error("VipsImage",
+			_("unable to read tile from \"%s\""), image->filename);
+		vips_tiled_tile_free(tile);
+		return NULL;
+	}
+
+	if (entry->length != raw &&
+		vips_tiled_decompress(tiled->compression,
+			seq->buf, entry->length, tile->pixels, raw)) {
+		vips_tiled_tile_free(tile);
+		return NULL;
+	}
+
+	return tile;
+}
+
+/* Get a ref to a decompressed tile, from the cache if we can.
+ */
+static VipsTiledTile *
+vips_tiled_tile_get(VipsTiledSeq *seq, int n)
+{
+	VipsTiled *tiled = seq->tiled;
+
+	VipsTiledTile *tile;
+
+	g_mutex_lock(&tiled->lock);
+	if ((tile = (VipsTiledTile *)
+				g_hash_table_lookup(tiled->tiles, GINT_TO_POINTER(n)))) {
+		tile->ref_count += 1;
+		g_queue_unlink(&tiled->lru, tile->link);
+		g_queue_push_head_link(&tiled->lru, tile->link);
+	}
+	g_mutex_unlock(&tiled->lock);
+
+	if (tile)
+		return tile;
+
+	/* Decompress outside the lock, so threads can work in parallel.
+	 */
+	if (!(tile = vips_tiled_tile_load(seq, n)))
+		return NULL;
+
+	g_mutex_lock(&tiled->lock);
+
+	/* Another thread may have loaded this tile meanwhile. Just keep ours
+	 * out of the cache, it's harmless.
+	 */
+	if (!g_hash_table_lookup(tiled->tiles, GINT_TO_POINTER(n))) {
+		/* One ref for the cache, one for our caller.
+		 */
+		tile->ref_count += 1;
+		g_queue_push_head(&tiled->lru, tile);
+		tile->link = tiled->lru.head;
+		g_hash_table_insert(tiled->tiles, GINT_TO_POINTER(n), tile);
+
+		while ((int) g_queue_get_length(&tiled->lru) >
+			tiled->max_tiles) {
+			VipsTiledTile *old =
+				(VipsTiledTile *) g_queue_pop_tail(&tiled->lru);
+
+			g_hash_table_remove(tiled->tiles,
+				GINT_TO_POINTER(old->tile));
+			old->link = NULL;
+			old->ref_count -= 1;
+			if (old->ref_count == 0)
+				vips_tiled_tile_free(old);
+		}
+	}
+
+	g_mutex_unlock(&tiled->lock);
+
+	return tile;
+}
+
+static void *
+vips_tiled_start(VipsImage *out, void *a, void *b)
+{
+	VipsTiledSeq *seq;
+
+	seq = g_new0(VipsTiledSeq, 1);
+	seq->tiled = (VipsTiled *) a;
+
+	return seq;
+}
+
+static int
+vips_tiled_stop(void *vseq, void *a, void *b)
+{
+	VipsTiledSeq *seq = (VipsTiledSeq *) vseq;
+
+	VIPS_FREE(seq->buf);
+	g_free(seq);
+
+	return 0;
+}
+
+/* Copy pixels from the tiles a region touches. Only those tiles are
+ * decompressed, and each thread decompresses independently.
+ */
+static int
+vips_tiled_generate(VipsRegion *out_region,
+	void *vseq, void *a, void *b, gboolean *stop)
+{
+	VipsTiledSeq *seq = (VipsTiledSeq *) vseq;
+	VipsTiled *tiled = (VipsTiled *) a;
+	VipsRect *r = &out_region->valid;
+	int ps = VIPS_IMAGE_SIZEOF_PEL(tiled->image);
+
+	int x, y;
+
+	for (y = r->top / tiled->tile_size;
+		 y <= (VIPS_RECT_BOTTOM(r) - 1) / tiled->tile_size; y++)
+		for (x = r->left / tiled->tile_size;
+			 x <= (VIPS_RECT_RIGHT(r) - 1) / tiled->tile_size; x++) {
+			int n = y * tiled->tiles_across + x;
+
+			VipsTiledTile *tile;
+			VipsRect rect;
+			VipsRect overlap;
+			int z;
+
+			if (!(tile = vips_tiled_tile_get(seq, n)))
+				return -1;
+
+			vips_tiled_rect(tiled, n, &rect);
+			vips_rect_intersectrect(&rect, r, &overlap);
+
+			for (z = 0; z < overlap.height; z++) {
+				VipsPel *p = tile->pixels +
+					((size_t) (overlap.top + z - rect.top) * rect.width +
+						(overlap.left - rect.left)) *
+						ps;
+				VipsPel *q = VIPS_REGION_ADDR(out_region,
+					overlap.left, overlap.top + z);
+
+				memcpy(q, p, (size_t) overlap.width * ps);
+			}
+
+			vips_tiled_tile_unref(tiled, tile);
+		}
+
+	return 0;
+}
+
+/* Called at the end of vips_image_open_input(): turn the image into a partial
+ * image that decompresses tiles on demand.
+ */
+int
+vips__vips_tiled_attach(VipsImage *image)
+{
+	VipsTiled *tiled = vips_tiled_get(image);
+
+	g_assert(tiled);
+
+	image->dtype = VIPS_IMAGE_PARTIAL;
+
+	/* We might be rewinding an image we've just written, so there can be
+	 * callbacks left over from the write.
+	 */
+	image->start_fn = NULL;
+	image->generate_fn = NULL;
+	image->stop_fn = NULL;
+	image->client1 = NULL;
+	image->client2 = NULL;
+
+	if (vips_image_pipelinev(image, VIPS_DEMAND_STYLE_SMALLTILE, NULL) ||
+		vips_image_generate(image,
+			vips_tiled_start, vips_tiled_generate, vips_tiled_stop,
+			tiled, NULL))
+		return -1;
+
+	return 0;
+}
+
+/* Try to take @length bytes from the memory budget.
+ */
+static gboolean
+vips_tiled_reserve(VipsTiled *tiled, size_t length)
+{
+	gssize used;
+
+	used = g_atomic_pointer_add(&vips_tiled_memory_used, (gssize) length);
+	if ((guint64) used + length > vips_get_temp_memory()) {
+		g_atomic_pointer_add(&vips_tiled_memory_used, -(gssize) length);
+		return FALSE;
+	}
+
+	g_mutex_lock(&tiled->lock);
+	tiled->mem_used += length;
+	g_mutex_unlock(&tiled->lock);
+
+	return TRUE;
+}
+
+/* Compress and write a completed row of tiles.
+ */
+static int
+vips_tiled_write_row(VipsTiled *tiled, int y)
+{
+	VipsImage *image = tiled->image;
+	int ps = VIPS_IMAGE_SIZEOF_PEL(image);
+	size_t lsize = VIPS_IMAGE_SIZEOF_LINE(image);
+	size_t tile_bytes = (size_t) tiled->tile_size * tiled->tile_size * ps;
+	size_t buf_size = vips_tiled_bound(tiled->compression, tile_bytes);
+	VipsPel *row = tiled->rows[y];
+
+	VipsPel *tile_buf;
+	VipsPel *buf;
+	int x;
+
+	tile_buf = vips_tracked_malloc(tile_bytes);
+	buf = vips_tracked_malloc(buf_size);
+	if (!tile_buf ||
+		!buf) {
+		VIPS_FREEF(vips_tracked_free, tile_buf);
+		VIPS_FREEF(vips_tracked_free, buf);
+		return -1;
+	}
+
+	for (x = 0; x < tiled->tiles_across; x++) {
+		int n = y * tiled->tiles_across + x;
+		VipsTiledEntry *entry = &tiled->index[n];
+
+		VipsRect rect;
+		size_t raw;
+		size_t length;
+		VipsPel *from;
+		gboolean error;
+		int z;
+
+		vips_tiled_rect(tiled, n, &rect);
+		raw = (size_t) ps * rect.width * rect.height;
+
+		for (z = 0; z < rect.height; z++)
+			memcpy(tile_buf + (size_t) z * rect.width * ps,
+				row + z * lsize + (size_t) rect.left * ps,
+				(size_t) rect.width * ps);
+
+		length = buf_size;
+		if (vips_tiled_compress(tiled->compression,
+				tile_buf, raw, buf, &length)) {
+			vips_tracked_free(tile_buf);
+			vips_tracked_free(buf);
+			return -1;
+		}
+
+		/* Incompressible, store raw.
+		 */
+		if (length >= raw) {
+			from = tile_buf;
+			length = raw;
+		}
+		else
+			from = buf;
+
+		/* Keep it in memory if we can.
+		 */
+		if (tiled->memory &&
+			vips_tiled_reserve(tiled, length)) {
+			if (!(entry->mem = vips_tracked_malloc(length))) {
+				vips_tracked_free(tile_buf);
+				vips_tracked_free(buf);
+				return -1;
+			}
+			memcpy(entry->mem, from, length);
+			entry->length = length;
+
+			continue;
+		}
+
+		g_mutex_lock(&tiled->io_lock);
+		entry->offset = tiled->append;
+		entry->length = length;
+		tiled->append += length;
+		error = vips__seek(image->fd, entry->offset, SEEK_SET) == -1 ||
+			vips__write(image->fd, from, length);
+		g_mutex_unlock(&tiled->io_lock);
+
+		if (error) {
+			vips_tracked_free(tile_buf);
+			vips_tracked_free(buf);
+			return -1;
+		}
+	}
+
+	vips_tracked_free(tile_buf);
+	vips_tracked_free(buf);
+
+	VIPS_FREEF(vips_tracked_free, tiled->rows[y]);
+
+	return 0;
+}
+
+/* Add scanlines to the rows of tiles they touch. Whoever completes a row
+ * compresses and writes it.
+ */
+static int
+vips_tiled_add_lines(VipsTiled *tiled,
+	int top, int height, VipsPel *p, size_t bpl)
+{
+	VipsImage *image = tiled->image;
+	size_t lsize = VIPS_IMAGE_SIZEOF_LINE(image);
+
+	int y;
+
+	for (y = top / tiled->tile_size;
+		 y <= (top + height - 1) / tiled->tile_size; y++) {
+		int row_top = y * tiled->tile_size;
+		int row_height = VIPS_MIN(tiled->tile_size, image->Ysize - row_top);
+		int y0 = VIPS_MAX(row_top, top);
+		int y1 = VIPS_MIN(row_top + row_height, top + height);
+
+		VipsPel *row;
+		gboolean complete;
+		int z;
+
+		g_mutex_lock(&tiled->lock);
+		if (!tiled->rows[y])
+			tiled->rows[y] = vips_tracked_malloc(lsize * row_height);
+		row = tiled->rows[y];
+		g_mutex_unlock(&tiled->lock);
+
+		if (!row)
+			return -1;
+
+		for (z = y0; z < y1; z++)
+			memcpy(row + (z - row_top) * lsize,
+				p + (z - top) * bpl, lsize);
+
+		g_mutex_lock(&tiled->lock);
+		tiled->rows_filled[y] += y1 - y0;
+		complete = tiled->rows_filled[y] == row_height;
+		g_mutex_unlock(&tiled->lock);
+
+		if (complete &&
+			vips_tiled_write_row(tiled, y))
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Our VipsRegionWrite. We can be called from several threads at once, with
+ * strips in any order.
+ */
+static int
+vips_tiled_write(VipsRegion *region, VipsRect *area, void *a)
+{
+	VipsTiled *tiled = (VipsTiled *) a;
+
+	if (vips_tiled_add_lines(tiled, area->top, area->height,
+			VIPS_REGION_ADDR(region, 0, area->top), region->bpl))
+		return EIO;
+
+	return 0;
+}
+
+/* Start writing a tiled image. The header has already been written by
+ * vips_image_open_output().
+ */
+static VipsTiled *
+vips_tiled_write_begin(VipsImage *image)
+{
+	VipsTiled *tiled;
+
+	if (!(tiled = vips_tiled_new(image)))
+		return NULL;
+	tiled->rows = g_new0(VipsPel *, tiled->tiles_down);
+	tiled->rows_filled = g_new0(int, tiled->tiles_down);
+
+	return tiled;
+}
+
+/* All tiles are done, write the index.
+ */
+static int
+vips_tiled_write_end(VipsTiled *tiled)
+{
+	VipsImage *image = tiled->image;
+
+	size_t size;
+	VipsPel *buf;
+	int i;
+
+	tiled->data_end = tiled->append;
+
+	if (tiled->memory) {
+		int n_memory;
+
+		n_memory = 0;
+		for (i = 0; i < tiled->n_tiles; i++)
+			if (tiled->index[i].mem)
+				n_memory += 1;
+
+		g_info("vips_tiled_write_end: %s: %d tiles in memory, "
+			   "%d on disc",
+			image->filename, n_memory, tiled->n_tiles - n_memory);
+
+		return 0;
+	}
+
+	size = (size_t) tiled->n_tiles * VIPS_TILED_ENTRY_SIZE;
+	buf = g_malloc0(size);
+	for (i = 0; i < tiled->n_tiles; i++) {
+		VipsPel *p = buf + (size_t) i * VIPS_TILED_ENTRY_SIZE;
+		gint64 offset = GINT64_TO_LE(tiled->index[i].offset);
+		guint32 length = GUINT32_TO_LE(tiled->index[i].length);
+
+		memcpy(p, &offset, sizeof(offset));
+		memcpy(p + 8, &length, sizeof(length));
+	}
+
+	if (vips__seek(image->fd, image->sizeof_header, SEEK_SET) == -1 ||
+		vips__write(image->fd, buf, size)) {
+		g_free(buf);
+		return -1;
+	}
+	g_free(buf);
+
+	return 0;
+}
+
+/* Write a tiled vips image with vips_image_generate().
+ */
+int
+vips__vips_tiled_sink(VipsImage *image)
+{
+	VipsTiled *tiled;
+
+	if (!(tiled = vips_tiled_write_begin(image)) ||
+		vips__sink_disc_unordered(image,
+			VIPS_TILED_WRITE_DEPTH, vips_tiled_write, tiled) ||
+		vips_tiled_write_end(tiled))
+		return -1;
+
+	return 0;
+}
+
+/* Write a line of a tiled vips image for vips_image_write_line(). Lines
+ * arrive in order.
+ */
+int
+vips__vips_tiled_write_line(VipsImage *image, int ypos, VipsPel *linebuffer)
+{
+	VipsTiled *tiled;
+
+	/* Make the write state on first use.
+	 */
+	if ((!(tiled = vips_tiled_get(image)) ||
+			!tiled->rows) &&
+		!(tiled = vips_tiled_write_begin(image)))
+		return -1;
+
+	if (vips_tiled_add_lines(tiled,
+			ypos, 1, linebuffer, VIPS_IMAGE_SIZEOF_LINE(image)))
+		return -1;
+
+	if (ypos == image->Ysize - 1 &&
+		vips_tiled_write_end(tiled))
+		return -1;
+
+	return 0;
+}
+
+/* Temp files can be compressed too. Set VIPS_TEMP_COMPRESSION to the
+ * nickname of a VipsForeignVipsCompression to enable this.
+ */
+static void *
+vips_tiled_temp_compression_init(void *data)
+{
+	VipsForeignVipsCompression *compression =
+		(VipsForeignVipsCompression *) data;
+
+	const char *env;
+	int value;
+
+	*compression = VIPS_FOREIGN_VIPS_COMPRESSION_NONE;
+
+	if ((env = g_getenv("VIPS_TEMP_COMPRESSION"))) {
+		if ((value = vips_enum_from_nick("vips",
+				 VIPS_TYPE_FOREIGN_VIPS_COMPRESSION, env)) < 0) {
+			g_warning("%s", vips_error_buffer());
+			vips_error_clear();
+		}
+		else if (!vips__vips_tiled_supported(value))
+			g_warning(_("support for %s compression not built in"),
+				env);
+		else
+			*compression = value;
+	}
+
+	return NULL;
+}
+
+static VipsForeignVipsCompression
+vips_tiled_temp_compression(void)
+{
+	static GOnce once = G_ONCE_INIT;
+	static VipsForeignVipsCompression compression;
+
+	VIPS_ONCE(&once, vips_tiled_temp_compression_init, &compression);
+
+	return compression;
+}
+
+/* Called by vips_image_new_temp_file() to set up compression.
+ */
+void
+vips__vips_tiled_temp(VipsImage *image)
+{
+	VipsForeignVipsCompression compression = vips_tiled_temp_compression();
+
+	if (compression != VIPS_FOREIGN_VIPS_COMPRESSION_NONE) {
+		image->Compression = VIPS__COMPRESSION_TILED + compression;
+		image->Level = VIPS__TILED_TILE_SIZE;
+	}
+}
+
+/* Pick a codec for memory tiles: VIPS_TEMP_COMPRESSION if that's been set,
+ * otherwise the fastest we have.
+ */
+static VipsForeignVipsCompression
+vips_tiled_memory_compression(void)
+{
+	static const VipsForeignVipsCompression codecs[] = {
+		VIPS_FOREIGN_VIPS_COMPRESSION_LZ4,
+		VIPS_FOREIGN_VIPS_COMPRESSION_ZSTD,
+		VIPS_FOREIGN_VIPS_COMPRESSION_DEFLATE
+	};
+
+	VipsForeignVipsCompression compression = vips_tiled_temp_compression();
+	int i;
+
+	if (compression != VIPS_FOREIGN_VIPS_COMPRESSION_NONE)
+		return compression;
+
+	for (i = 0; i < VIPS_NUMBER(codecs); i++)
+		if (vips__vips_tiled_supported(codecs[i]))
+			return codecs[i];
+
+	return VIPS_FOREIGN_VIPS_COMPRESSION_NONE;
+}
+
+/* Make @image, a new temp file, keep compressed tiles in memory until the
+ * process-wide budget runs out. FALSE if we have no codec, or no budget.
+ */
+gboolean
+vips__vips_tiled_memory(VipsImage *image)
+{
+	VipsForeignVipsCompression compression;
+
+	if (vips_get_temp_memory() == 0 ||
+		(compression = vips_tiled_memory_compression()) ==
+			VIPS_FOREIGN_VIPS_COMPRESSION_NONE)
+		return FALSE;
+
+	image->Compression = VIPS__COMPRESSION_TILED + compression;
+	image->Level = VIPS__TILED_TILE_SIZE;
+	g_object_set_qdata(G_OBJECT(image),
+		vips_tiled_memory_quark(), GINT_TO_POINTER(TRUE));
+
+	return TRUE;
+}
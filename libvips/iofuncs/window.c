@@ -4,6 +4,11 @@
  *	- from region.c
  * 19/3/09
  *	- block mmaps of nodata images
+ * 16/10/26
+ * 	- add an interval-indexed window table with lock-free lookup
+ * 	- map whole files on 64-bit hosts
+ * 	- keep the table in qdata, fall back to private windows if the
+ * 	  whole-file map fails
  */
 
 /*
@@ -76,11 +81,69 @@ int vips__window_margin_pixels = VIPS__WINDOW_MARGIN_PIXELS;
  */
 int vips__window_margin_bytes = VIPS__WINDOW_MARGIN_BYTES;
 
+/* Map whole files, rather than a set of windows. There's plenty of address
+ * space on 64-bit hosts. Set VIPS_WINDOW_STRIPS to turn this off.
+ */
+#if GLIB_SIZEOF_VOID_P >= 8
+gboolean vips__window_whole = TRUE;
+#else  /*GLIB_SIZEOF_VOID_P < 8*/
+gboolean vips__window_whole = FALSE;
+#endif /*GLIB_SIZEOF_VOID_P >= 8*/
+
+/* The windows on an image. The image is divided into slots of @step lines,
+ * and each slot has a window covering it plus @margin lines above and below.
+ *
+ * Slot windows are made on demand and are not freed until the image is
+ * disposed, though they are unmapped when their ref count falls to zero. A
+ * ref count can only be raised from zero with the image's sslock held, so
+ * threads can look up and ref a mapped slot window without taking the lock.
+ *
+ * In whole-file mode there's a single slot and the table holds a ref to
+ * its window, so it's never unmapped. If the whole file can't be mapped,
+ * we fall back to private windows.
+ *
+ * Requests which don't fit in a slot get a private window from the
+ * image->windows list.
+ *
+ * The table is attached to the image as qdata.
+ */
+typedef struct _VipsWindowTable {
+	int step;
+	int margin;
+	gboolean whole;
+
+	/* Set if the whole-file map failed.
+	 */
+	int failed;
+
+	int n_slots;
+	VipsWindow **slots;
+} VipsWindowTable;
+
+/* VipsWindow is public, so we allocate this larger struct for every window
+ * to record where it belongs.
+ */
+typedef struct _VipsWindowEntry {
+	VipsWindow window;
+
+	/* The table and slot of a slot window, or NULL and -1 for a private
+	 * window.
+	 */
+	VipsWindowTable *table;
+	int slot;
+} VipsWindowEntry;
+
+#define VIPS_WINDOW_ENTRY(W) ((VipsWindowEntry *) (W))
+
+/* The qdata quark for the table, made on first use.
+ */
+static gint vips_window_table_quark = 0;
+
 /* Track global mmap usage.
  */
 #ifdef DEBUG_TOTAL
-static int total_mmap_usage = 0;
-static int max_mmap_usage = 0;
+static gssize total_mmap_usage = 0;
+static gssize max_mmap_usage = 0;
 #endif /*DEBUG_TOTAL*/
 
 static int
@@ -93,10 +156,7 @@ vips_window_unmap(VipsWindow *window)
 			return -1;
 
 #ifdef DEBUG_TOTAL
-		g_mutex_lock(vips__global_lock);
-		total_mmap_usage -= window->length;
-		g_assert(total_mmap_usage >= 0);
-		g_mutex_unlock(vips__global_lock);
+		g_atomic_pointer_add(&total_mmap_usage, -(gssize) window->length);
 #endif /*DEBUG_TOTAL*/
 
 		window->data = NULL;
@@ -113,6 +173,7 @@ vips_window_free(VipsWindow *window)
 	VipsImage *im = window->im;
 
 	g_assert(window->ref_count == 0);
+	g_assert(VIPS_WINDOW_ENTRY(window)->slot == -1);
 
 #ifdef DEBUG
 	printf("** vips_window_free: window top = %d, height = %d (%p)\n",
@@ -139,8 +200,6 @@ vips_window_unref(VipsWindow *window)
 {
 	VipsImage *im = window->im;
 
-	g_mutex_lock(im->sslock);
-
 #ifdef DEBUG
 	printf("vips_window_unref: window top = %d, height = %d, count = %d\n",
 		window->top, window->height, window->ref_count);
@@ -148,6 +207,28 @@ vips_window_unref(VipsWindow *window)
 
 	g_assert(window->ref_count > 0);
 
+	if (VIPS_WINDOW_ENTRY(window)->slot >= 0) {
+		/* A slot window. We only need the lock to unmap, and we must
+		 * check again inside the lock, since another thread may have
+		 * revived the window in the meantime.
+		 */
+		if (g_atomic_int_dec_and_test(&window->ref_count)) {
+			int result;
+
+			g_mutex_lock(im->sslock);
+			result = 0;
+			if (g_atomic_int_get(&window->ref_count) == 0)
+				result = vips_window_unmap(window);
+			g_mutex_unlock(im->sslock);
+
+			return result;
+		}
+
+		return 0;
+	}
+
+	g_mutex_lock(im->sslock);
+
 	window->ref_count -= 1;
 
 	if (window->ref_count == 0) {
@@ -166,20 +247,18 @@ vips_window_unref(VipsWindow *window)
 static void
 trace_mmap_usage(void)
 {
-	g_mutex_lock(vips__global_lock);
-	{
-		static int last_total = 0;
-		int total = total_mmap_usage / (1024 * 1024);
-		int max = max_mmap_usage / (1024 * 1024);
-
-		if (total != last_total) {
-			printf("vips_window_set: current mmap "
-				   "usage of ~%dMB (high water mark %dMB)\n",
-				total, max);
-			last_total = total;
-		}
+	static int last_total = 0;
+
+	int total = (gssize) g_atomic_pointer_get(&total_mmap_usage) /
+		(1024 * 1024);
+	int max = max_mmap_usage / (1024 * 1024);
+
+	if (total != last_total) {
+		printf("vips_window_set: current mmap "
+			   "usage of ~%dMB (high water mark %dMB)\n",
+			total, max);
+		last_total = total;
 	}
-	g_mutex_unlock(vips__global_lock);
 }
 #endif /*DEBUG_TOTAL*/
 
@@ -252,27 +331,36 @@ vips_window_set(VipsWindow *window, int top, int height)
 	vips__read_test &= window->data[0];
 
 #ifdef DEBUG_TOTAL
-	g_mutex_lock(vips__global_lock);
-	total_mmap_usage += window->length;
-	if (total_mmap_usage > max_mmap_usage)
-		max_mmap_usage = total_mmap_usage;
-	g_mutex_unlock(vips__global_lock);
+	{
+		gssize total = g_atomic_pointer_add(&total_mmap_usage,
+						   (gssize) window->length) +
+			window->length;
+
+		/* Racy, but this is just for debugging.
+		 */
+		if (total > max_mmap_usage)
+			max_mmap_usage = total;
+	}
 	trace_mmap_usage();
 #endif /*DEBUG_TOTAL*/
 
 	return 0;
 }
 
-/* Make a new window.
+/* Make a new private window.
  */
 static VipsWindow *
 vips_window_new(VipsImage *im, int top, int height)
 {
+	VipsWindowEntry *entry;
 	VipsWindow *window;
 
-	if (!(window = VIPS_NEW(NULL, VipsWindow)))
+	if (!(entry = VIPS_NEW(NULL, VipsWindowEntry)))
 		return NULL;
+	entry->table = NULL;
+	entry->slot = -1;
 
+	window = &entry->window;
 	window->ref_count = 0;
 	window->im = im;
 	window->top = 0;
@@ -339,19 +427,16 @@ vips_window_find(VipsImage *im, int top, int height)
 	return window;
 }
 
-/* Update a window to make it enclose top/height.
+/* Update a private window to make it enclose top/height.
  */
-VipsWindow *
-vips_window_take(VipsWindow *window, VipsImage *im, int top, int height)
+static VipsWindow *
+vips_window_take_private(VipsWindow *window,
+	VipsImage *im, int top, int height)
 {
 	int margin;
 
-	/* We have a window and it has the pixels we need.
-	 */
-	if (window &&
-		window->top <= top &&
-		window->top + window->height >= top + height)
-		return window;
+	g_assert(!window ||
+		VIPS_WINDOW_ENTRY(window)->slot == -1);
 
 	g_mutex_lock(im->sslock);
 
@@ -405,6 +490,249 @@ vips_window_take(VipsWindow *window, VipsImage *im, int top, int height)
 	return window;
 }
 
+static VipsWindowTable *
+vips_window_table_new(VipsImage *im)
+{
+	VipsWindowTable *table;
+
+	table = g_new0(VipsWindowTable, 1);
+
+	if (vips__window_whole) {
+		table->whole = TRUE;
+		table->step = im->Ysize;
+		table->margin = 0;
+	}
+	else {
+		table->whole = FALSE;
+		table->margin = VIPS_MIN(vips__window_margin_pixels,
+			vips__window_margin_bytes / VIPS_IMAGE_SIZEOF_LINE(im));
+		table->step = VIPS_MAX(1, table->margin);
+	}
+
+	table->n_slots = VIPS_ROUND_UP(im->Ysize, table->step) / table->step;
+	table->slots = g_new0(VipsWindow *, table->n_slots);
+
+	return table;
+}
+
+/* There can be no regions by the time the table is freed, and therefore no
+ * refs to slot windows except our own.
+ */
+static void
+vips_window_table_free(VipsWindowTable *table)
+{
+	int i;
+
+	for (i = 0; i < table->n_slots; i++) {
+		VipsWindow *window = table->slots[i];
+
+		if (window) {
+			/* In whole-file mode the table holds a ref, but only if
+			 * the map worked.
+			 */
+			g_assert(window->ref_count ==
+				(table->whole && window->baseaddr ? 1 : 0));
+
+			(void) vips_window_unmap(window);
+			g_free(VIPS_WINDOW_ENTRY(window));
+		}
+	}
+
+	g_free(table->slots);
+	g_free(table);
+}
+
+static GQuark
+vips_window_table_get_quark(void)
+{
+	GQuark quark;
+
+	if (!(quark = (GQuark) g_atomic_int_get(&vips_window_table_quark))) {
+		quark = g_quark_from_static_string("vips-window-table");
+		g_atomic_int_set(&vips_window_table_quark, (gint) quark);
+	}
+
+	return quark;
+}
+
+/* Called from vips_image_dispose(), so there are no regions.
+ */
+void
+vips__window_table_clear(VipsImage *image)
+{
+	GQuark quark;
+
+	if ((quark = (GQuark) g_atomic_int_get(&vips_window_table_quark)))
+		g_object_set_qdata(G_OBJECT(image), quark, NULL);
+}
+
+static VipsWindowTable *
+vips_window_table_get(VipsImage *im)
+{
+	GQuark quark = vips_window_table_get_quark();
+
+	VipsWindowTable *table;
+
+	if (!(table = g_object_get_qdata(G_OBJECT(im), quark))) {
+		g_mutex_lock(im->sslock);
+		if (!(table = g_object_get_qdata(G_OBJECT(im), quark))) {
+			table = vips_window_table_new(im);
+			g_object_set_qdata_full(G_OBJECT(im), quark, table,
+				(GDestroyNotify) vips_window_table_free);
+		}
+		g_mutex_unlock(im->sslock);
+	}
+
+	return table;
+}
+
+/* Add a ref to a window, but only if it has one already.
+ */
+static gboolean
+vips_window_ref_live(VipsWindow *window)
+{
+	int count;
+
+	do {
+		if ((count = g_atomic_int_get(&window->ref_count)) == 0)
+			return FALSE;
+	} while (!g_atomic_int_compare_and_exchange(&window->ref_count,
+		count, count + 1));
+
+	return TRUE;
+}
+
+/* Get a ref to the window for a slot, mapping it if necessary.
+ */
+static VipsWindow *
+vips_window_take_slot(VipsWindowTable *table, VipsImage *im, int slot)
+{
+	VipsWindow *window;
+
+	/* The common case: the window exists and someone else has it mapped.
+	 */
+	if ((window = g_atomic_pointer_get(&table->slots[slot])) &&
+		vips_window_ref_live(window))
+		return window;
+
+	g_mutex_lock(im->sslock);
+
+	if (!(window = table->slots[slot])) {
+		VipsWindowEntry *entry = g_new0(VipsWindowEntry, 1);
+
+		entry->table = table;
+		entry->slot = slot;
+		window = &entry->window;
+		window->im = im;
+		g_atomic_pointer_set(&table->slots[slot], window);
+	}
+
+	/* Nothing else can raise the count from zero while we hold the lock,
+	 * so we can safely remap.
+	 */
+	if (!vips_window_ref_live(window)) {
+		if (!window->baseaddr) {
+			int top = slot * table->step - table->margin;
+			int bottom = (slot + 1) * table->step + table->margin;
+
+			top = VIPS_MAX(0, top);
+			bottom = VIPS_MIN(im->Ysize, bottom);
+
+			if (vips_window_set(window, top, bottom - top)) {
+				/* Perhaps there's not enough address space
+				 * for the whole file. Private windows may
+				 * still work.
+				 */
+				if (table->whole)
+					g_atomic_int_set(&table->failed, TRUE);
+
+				g_mutex_unlock(im->sslock);
+				return NULL;
+			}
+		}
+
+		/* In whole-file mode, the table keeps a ref too.
+		 */
+		g_atomic_int_set(&window->ref_count, table->whole ? 2 : 1);
+	}
+
+	g_mutex_unlock(im->sslock);
+
+#ifdef DEBUG
+	printf("vips_window_take_slot: slot %d, top = %d, height = %d\n",
+		slot, window->top, window->height);
+#endif /*DEBUG*/
+
+	return window;
+}
+
+/* Update a window to make it enclose top/height.
+ */
+VipsWindow *
+vips_window_take(VipsWindow *window, VipsImage *im, int top, int height)
+{
+	VipsWindowTable *table;
+	int slot;
+	VipsWindow *new_window;
+
+	/* We have a window and it has the pixels we need.
+	 */
+	if (window &&
+		window->top <= top &&
+		window->top + window->height >= top + height)
+		return window;
+
+	/* Slot windows know their table, so we only need to search for it
+	 * the first time.
+	 */
+	if (!window ||
+		!(table = VIPS_WINDOW_ENTRY(window)->table))
+		table = vips_window_table_get(im);
+	slot = top / table->step;
+
+	/* Too tall for the slot, or no whole-file map? Use a private window
+	 * instead.
+	 */
+	if (g_atomic_int_get(&table->failed) ||
+		top + height >
+			VIPS_MIN(im->Ysize,
+				(slot + 1) * table->step + table->margin)) {
+		if (window &&
+			VIPS_WINDOW_ENTRY(window)->slot >= 0) {
+			vips_window_unref(window);
+			window = NULL;
+		}
+
+		return vips_window_take_private(window, im, top, height);
+	}
+
+	if (!(new_window = vips_window_take_slot(table, im, slot))) {
+		if (window &&
+			VIPS_WINDOW_ENTRY(window)->slot >= 0) {
+			vips_window_unref(window);
+			window = NULL;
+		}
+
+		/* The whole-file map failed, try a private window.
+		 */
+		if (g_atomic_int_get(&table->failed)) {
+			vips_error_clear();
+			return vips_window_take_private(window,
+				im, top, height);
+		}
+
+		if (window)
+			vips_window_unref(window);
+
+		return NULL;
+	}
+
+	if (window)
+		vips_window_unref(window);
+
+	return new_window;
+}
+
 void
 vips_window_print(VipsWindow *window)
 {
@@ -414,5 +742,6 @@ vips_window_print(VipsWindow *window)
 	printf("height = %d, ", window->height);
 	printf("data = %p, ", window->data);
 	printf("baseaddr = %p, ", window->baseaddr);
-	printf("length = %zd\n", window->length);
+	printf("length = %zd, ", window->length);
+	printf("slot = %d\n", VIPS_WINDOW_ENTRY(window)->slot);
 }
@@ -75,8 +75,26 @@ void vips_reduceh_uchar_hwy(VipsPel *pout, VipsPel *pin,
 	int n, int width, int bands,
 	short *restrict cs[VIPS_TRANSFORM_SCALE + 1],
 	double X, double hshrink);
+void vips_reduceh_ushort_hwy(VipsPel *pout, VipsPel *pin,
+	int n, int width, int bands,
+	short *restrict cs[VIPS_TRANSFORM_SCALE + 1],
+	double X, double hshrink);
+void vips_reduceh_short_hwy(VipsPel *pout, VipsPel *pin,
+	int n, int width, int bands,
+	short *restrict cs[VIPS_TRANSFORM_SCALE + 1],
+	double X, double hshrink);
+void vips_reduceh_float_hwy(VipsPel *pout, VipsPel *pin,
+	int n, int width, int bands,
+	double *restrict cs[VIPS_TRANSFORM_SCALE + 1],
+	double X, double hshrink);
 void vips_reducev_uchar_hwy(VipsPel *pout, VipsPel *pin,
 	int n, int ne, int lskip, const short *restrict k);
+void vips_reducev_ushort_hwy(VipsPel *pout, VipsPel *pin,
+	int n, int ne, int lskip, const short *restrict k);
+void vips_reducev_short_hwy(VipsPel *pout, VipsPel *pin,
+	int n, int ne, int lskip, const short *restrict k);
+void vips_reducev_float_hwy(VipsPel *pout, VipsPel *pin,
+	int n, int ne, int lskip, const double *restrict k);
 
 #ifdef __cplusplus
 }
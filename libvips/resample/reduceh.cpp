@@ -13,6 +13,8 @@
  * 	- fix pixel shift
  * 22/4/22 kleisauke
  * 	- add @gap option
+ * 16/10/26
+ * 	- add a vector path for ushort, short and float, any number of bands
  */
 
 /*
@@ -377,6 +379,86 @@ vips_reduceh_uchar_vector_gen(VipsRegion *out_region, void *seq,
 
 	return 0;
 }
+
+/* ushort, short, float and complex, any number of bands.
+ */
+static int
+vips_reduceh_wide_vector_gen(VipsRegion *out_region, void *seq,
+	void *a, void *b, gboolean *stop)
+{
+	VipsImage *in = (VipsImage *) a;
+	VipsReduceh *reduceh = (VipsReduceh *) b;
+	const int ps = VIPS_IMAGE_SIZEOF_PEL(in);
+	VipsRegion *ir = (VipsRegion *) seq;
+	VipsRect *r = &out_region->valid;
+
+	/* Double bands for complex.
+	 */
+	const int bands = in->Bands *
+		(vips_band_format_iscomplex(in->BandFmt) ? 2 : 1);
+
+	VipsRect s;
+
+#ifdef DEBUG
+	printf("vips_reduceh_wide_vector_gen: generating %d x %d at %d x %d\n",
+		r->width, r->height, r->left, r->top);
+#endif /*DEBUG*/
+
+	s.left = r->left * reduceh->hshrink - reduceh->hoffset;
+	s.top = r->top;
+	s.width = r->width * reduceh->hshrink + reduceh->n_point;
+	s.height = r->height;
+	if (vips_region_prepare(ir, &s))
+		return -1;
+
+	VIPS_GATE_START("vips_reduceh_wide_vector_gen: work");
+
+	for (int y = 0; y < r->height; y++) {
+		VipsPel *p0;
+		VipsPel *q;
+
+		double X;
+
+		q = VIPS_REGION_ADDR(out_region, r->left, r->top + y);
+
+		X = (r->left + 0.5) * reduceh->hshrink - 0.5 -
+			reduceh->hoffset;
+
+		p0 = VIPS_REGION_ADDR(ir, ir->valid.left, r->top + y) -
+			ir->valid.left * ps;
+
+		switch (in->BandFmt) {
+		case VIPS_FORMAT_USHORT:
+			vips_reduceh_ushort_hwy(q, p0, reduceh->n_point,
+				r->width, bands, reduceh->matrixs,
+				X, reduceh->hshrink);
+			break;
+
+		case VIPS_FORMAT_SHORT:
+			vips_reduceh_short_hwy(q, p0, reduceh->n_point,
+				r->width, bands, reduceh->matrixs,
+				X, reduceh->hshrink);
+			break;
+
+		case VIPS_FORMAT_FLOAT:
+		case VIPS_FORMAT_COMPLEX:
+			vips_reduceh_float_hwy(q, p0, reduceh->n_point,
+				r->width, bands, reduceh->matrixf,
+				X, reduceh->hshrink);
+			break;
+
+		default:
+			g_assert_not_reached();
+			break;
+		}
+	}
+
+	VIPS_GATE_STOP("vips_reduceh_wide_vector_gen: work");
+
+	VIPS_COUNT_PIXELS(out_region, "vips_reduceh_wide_vector_gen");
+
+	return 0;
+}
 #endif /*HAVE_HWY*/
 
 static int
@@ -513,6 +595,15 @@ vips_reduceh_build(VipsObject *object)
 		g_info("reduceh: using vector path");
 	}
 	else
+	if ((in->BandFmt == VIPS_FORMAT_USHORT ||
+			in->BandFmt == VIPS_FORMAT_SHORT ||
+			in->BandFmt == VIPS_FORMAT_FLOAT ||
+			in->BandFmt == VIPS_FORMAT_COMPLEX) &&
+		vips_vector_isenabled()) {
+		generate = vips_reduceh_wide_vector_gen;
+		g_info("reduceh: using vector path");
+	}
+	else
 #endif /*HAVE_HWY*/
 		/* Default to the C path.
 		 */
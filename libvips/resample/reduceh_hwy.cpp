@@ -1,5 +1,7 @@
 /* 22/07/23 kleisauke
  * 	- from reducev_hwy.cpp
+ * 16/10/26
+ * 	- add ushort, short and float paths for any number of bands
  */
 
 /*
@@ -37,6 +39,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <limits.h>
 
 #include <vips/vips.h>
 #include <vips/vector.h>
@@ -188,6 +191,321 @@ vips_reduceh_uchar_hwy(VipsPel *pout, VipsPel *pin,
 #endif
 }
 
+/* The generic kernels below work for any band count. 16-bit pixels are
+ * accumulated in int32 with the same fixed-point coefficients as the C path,
+ * so they match vips_reduceh_gen() exactly. Float pixels are promoted and
+ * accumulated in double, but summed in a different order, so they can differ
+ * from the C path in the last bit or so.
+ */
+#if HWY_HAVE_FLOAT64
+using DF64 = ScalableTag<double>;
+constexpr DF64 df64;
+#endif
+
+template <class D, typename T>
+HWY_INLINE Vec<D>
+load_promote(D d, const T *HWY_RESTRICT p)
+{
+	return PromoteTo(d, LoadU(Rebind<T, D>(), p));
+}
+
+HWY_INLINE Vec<DI32>
+load_coeff(DI32 d, const int16_t *HWY_RESTRICT k)
+{
+	return load_promote(d, k);
+}
+
+#if HWY_HAVE_FLOAT64
+HWY_INLINE Vec<DF64>
+load_coeff(DF64 d, const double *HWY_RESTRICT k)
+{
+	return LoadU(d, k);
+}
+#endif
+
+HWY_INLINE void
+round_store(uint16_t *HWY_RESTRICT q, int32_t sum)
+{
+	sum = (sum + (VIPS_INTERPOLATE_SCALE >> 1)) >> VIPS_INTERPOLATE_SHIFT;
+	*q = VIPS_CLIP(0, sum, USHRT_MAX);
+}
+
+HWY_INLINE void
+round_store(int16_t *HWY_RESTRICT q, int32_t sum)
+{
+	sum = sum >= 0
+		? (sum + (VIPS_INTERPOLATE_SCALE >> 1)) >> VIPS_INTERPOLATE_SHIFT
+		: (sum - (VIPS_INTERPOLATE_SCALE >> 1)) >> VIPS_INTERPOLATE_SHIFT;
+	*q = VIPS_CLIP(SHRT_MIN, sum, SHRT_MAX);
+}
+
+HWY_INLINE void
+round_store(float *HWY_RESTRICT q, double sum)
+{
+	*q = sum;
+}
+
+/* DemoteTo() saturates, so that takes care of the clip.
+ */
+HWY_INLINE void
+round_store(DI32 d, Vec<DI32> sum, uint16_t *HWY_RESTRICT q)
+{
+	sum = Add(sum, Set(d, VIPS_INTERPOLATE_SCALE >> 1));
+	sum = ShiftRight<VIPS_INTERPOLATE_SHIFT>(sum);
+	StoreU(DemoteTo(Rebind<uint16_t, DI32>(), sum),
+		Rebind<uint16_t, DI32>(), q);
+}
+
+HWY_INLINE void
+round_store(DI32 d, Vec<DI32> sum, int16_t *HWY_RESTRICT q)
+{
+	const auto half = Set(d, VIPS_INTERPOLATE_SCALE >> 1);
+
+	sum = IfThenElse(Lt(sum, Zero(d)), Sub(sum, half), Add(sum, half));
+	sum = ShiftRight<VIPS_INTERPOLATE_SHIFT>(sum);
+	StoreU(DemoteTo(Rebind<int16_t, DI32>(), sum),
+		Rebind<int16_t, DI32>(), q);
+}
+
+#if HWY_HAVE_FLOAT64
+HWY_INLINE void
+round_store(DF64 d, Vec<DF64> sum, float *HWY_RESTRICT q)
+{
+	StoreU(DemoteTo(Rebind<float, DF64>(), sum),
+		Rebind<float, DF64>(), q);
+}
+#endif
+
+/* One output pixel. With 1 band we vectorise along the kernel, with 2 to 4
+ * bands we deinterleave the bands and vectorise along the kernel, for more
+ * than 4 bands we vectorise across the bands.
+ */
+template <class D, typename T, typename K>
+HWY_INLINE void
+reduceh_pixel(D d, T *HWY_RESTRICT q, const T *HWY_RESTRICT p,
+	int32_t n, int32_t bands, const K *HWY_RESTRICT k)
+{
+	using A = TFromD<D>;
+	const Rebind<T, D> dt;
+	const int32_t N = Lanes(d);
+
+	int32_t i;
+
+	switch (bands) {
+	case 1: {
+		auto sum0 = Zero(d);
+
+		for (i = 0; i + N <= n; i += N)
+			sum0 = Add(sum0,
+				Mul(load_promote(d, p + i), load_coeff(d, k + i)));
+
+		A s0 = GetLane(SumOfLanes(d, sum0));
+
+		for (; i < n; i++)
+			s0 += (A) k[i] * p[i];
+
+		round_store(q, s0);
+		break;
+	}
+
+	case 2: {
+		auto sum0 = Zero(d);
+		auto sum1 = Zero(d);
+
+		for (i = 0; i + N <= n; i += N) {
+			const auto mmk = load_coeff(d, k + i);
+			Vec<Rebind<T, D>> v0, v1;
+
+			LoadInterleaved2(dt, p + i * 2, v0, v1);
+			sum0 = Add(sum0, Mul(PromoteTo(d, v0), mmk));
+			sum1 = Add(sum1, Mul(PromoteTo(d, v1), mmk));
+		}
+
+		A s0 = GetLane(SumOfLanes(d, sum0));
+		A s1 = GetLane(SumOfLanes(d, sum1));
+
+		for (; i < n; i++) {
+			s0 += (A) k[i] * p[i * 2];
+			s1 += (A) k[i] * p[i * 2 + 1];
+		}
+
+		round_store(q, s0);
+		round_store(q + 1, s1);
+		break;
+	}
+
+	case 3: {
+		auto sum0 = Zero(d);
+		auto sum1 = Zero(d);
+		auto sum2 = Zero(d);
+
+		for (i = 0; i + N <= n; i += N) {
+			const auto mmk = load_coeff(d, k + i);
+			Vec<Rebind<T, D>> v0, v1, v2;
+
+			LoadInterleaved3(dt, p + i * 3, v0, v1, v2);
+			sum0 = Add(sum0, Mul(PromoteTo(d, v0), mmk));
+			sum1 = Add(sum1, Mul(PromoteTo(d, v1), mmk));
+			sum2 = Add(sum2, Mul(PromoteTo(d, v2), mmk));
+		}
+
+		A s0 = GetLane(SumOfLanes(d, sum0));
+		A s1 = GetLane(SumOfLanes(d, sum1));
+		A s2 = GetLane(SumOfLanes(d, sum2));
+
+		for (; i < n; i++) {
+			s0 += (A) k[i] * p[i * 3];
+			s1 += (A) k[i] * p[i * 3 + 1];
+			s2 += (A) k[i] * p[i * 3 + 2];
+		}
+
+		round_store(q, s0);
+		round_store(q + 1, s1);
+		round_store(q + 2, s2);
+		break;
+	}
+
+	case 4: {
+		auto sum0 = Zero(d);
+		auto sum1 = Zero(d);
+		auto sum2 = Zero(d);
+		auto sum3 = Zero(d);
+
+		for (i = 0; i + N <= n; i += N) {
+			const auto mmk = load_coeff(d, k + i);
+			Vec<Rebind<T, D>> v0, v1, v2, v3;
+
+			LoadInterleaved4(dt, p + i * 4, v0, v1, v2, v3);
+			sum0 = Add(sum0, Mul(PromoteTo(d, v0), mmk));
+			sum1 = Add(sum1, Mul(PromoteTo(d, v1), mmk));
+			sum2 = Add(sum2, Mul(PromoteTo(d, v2), mmk));
+			sum3 = Add(sum3, Mul(PromoteTo(d, v3), mmk));
+		}
+
+		A s0 = GetLane(SumOfLanes(d, sum0));
+		A s1 = GetLane(SumOfLanes(d, sum1));
+		A s2 = GetLane(SumOfLanes(d, sum2));
+		A s3 = GetLane(SumOfLanes(d, sum3));
+
+		for (; i < n; i++) {
+			s0 += (A) k[i] * p[i * 4];
+			s1 += (A) k[i] * p[i * 4 + 1];
+			s2 += (A) k[i] * p[i * 4 + 2];
+			s3 += (A) k[i] * p[i * 4 + 3];
+		}
+
+		round_store(q, s0);
+		round_store(q + 1, s1);
+		round_store(q + 2, s2);
+		round_store(q + 3, s3);
+		break;
+	}
+
+	default: {
+		int32_t b;
+
+		for (b = 0; b + N <= bands; b += N) {
+			auto sum0 = Zero(d);
+
+			for (i = 0; i < n; i++)
+				sum0 = Add(sum0,
+					Mul(load_promote(d, p + i * bands + b),
+						Set(d, (A) k[i])));
+
+			round_store(d, sum0, q + b);
+		}
+
+		/* Any bands left over.
+		 */
+		for (; b < bands; b++) {
+			A s0 = 0;
+
+			for (i = 0; i < n; i++)
+				s0 += (A) k[i] * p[i * bands + b];
+
+			round_store(q + b, s0);
+		}
+		break;
+	}
+	}
+}
+
+template <class D, typename T, typename K>
+HWY_INLINE void
+reduceh_line(D d, VipsPel *pout, VipsPel *pin,
+	int32_t n, int32_t width, int32_t bands,
+	K *HWY_RESTRICT cs[VIPS_TRANSFORM_SCALE + 1],
+	double X, double hshrink)
+{
+	for (int32_t x = 0; x < width; ++x) {
+		const int ix = (int) X;
+		const int sx = X * VIPS_TRANSFORM_SCALE * 2;
+		const int six = sx & (VIPS_TRANSFORM_SCALE * 2 - 1);
+		const int tx = (six + 1) >> 1;
+
+		reduceh_pixel(d,
+			(T *) pout + x * bands, (T *) pin + ix * bands,
+			n, bands, cs[tx]);
+
+		X += hshrink;
+	}
+}
+
+HWY_ATTR void
+vips_reduceh_ushort_hwy(VipsPel *pout, VipsPel *pin,
+	int32_t n, int32_t width, int32_t bands,
+	int16_t *HWY_RESTRICT cs[VIPS_TRANSFORM_SCALE + 1],
+	double X, double hshrink)
+{
+	reduceh_line<DI32, uint16_t>(di32, pout, pin,
+		n, width, bands, cs, X, hshrink);
+}
+
+HWY_ATTR void
+vips_reduceh_short_hwy(VipsPel *pout, VipsPel *pin,
+	int32_t n, int32_t width, int32_t bands,
+	int16_t *HWY_RESTRICT cs[VIPS_TRANSFORM_SCALE + 1],
+	double X, double hshrink)
+{
+	reduceh_line<DI32, int16_t>(di32, pout, pin,
+		n, width, bands, cs, X, hshrink);
+}
+
+HWY_ATTR void
+vips_reduceh_float_hwy(VipsPel *pout, VipsPel *pin,
+	int32_t n, int32_t width, int32_t bands,
+	double *HWY_RESTRICT cs[VIPS_TRANSFORM_SCALE + 1],
+	double X, double hshrink)
+{
+#if HWY_HAVE_FLOAT64
+	reduceh_line<DF64, float>(df64, pout, pin,
+		n, width, bands, cs, X, hshrink);
+#else
+	/* No double vectors on this target, fall back to plain C.
+	 */
+	for (int32_t x = 0; x < width; ++x) {
+		const int ix = (int) X;
+		const int sx = X * VIPS_TRANSFORM_SCALE * 2;
+		const int six = sx & (VIPS_TRANSFORM_SCALE * 2 - 1);
+		const int tx = (six + 1) >> 1;
+		const double *HWY_RESTRICT k = cs[tx];
+		const float *HWY_RESTRICT p = (float *) pin + ix * bands;
+		float *HWY_RESTRICT q = (float *) pout + x * bands;
+
+		for (int32_t b = 0; b < bands; b++) {
+			double sum = 0;
+
+			for (int32_t i = 0; i < n; i++)
+				sum += k[i] * p[i * bands + b];
+
+			q[b] = sum;
+		}
+
+		X += hshrink;
+	}
+#endif
+}
+
 } /*namespace HWY_NAMESPACE*/
 
 #if HWY_ONCE
@@ -204,6 +522,46 @@ vips_reduceh_uchar_hwy(VipsPel *pout, VipsPel *pin,
 		n, width, bands, cs, X, hshrink);
 	/* clang-format on */
 }
+
+HWY_EXPORT(vips_reduceh_ushort_hwy);
+HWY_EXPORT(vips_reduceh_short_hwy);
+HWY_EXPORT(vips_reduceh_float_hwy);
+
+void
+vips_reduceh_ushort_hwy(VipsPel *pout, VipsPel *pin,
+	int n, int width, int bands,
+	short *restrict cs[VIPS_TRANSFORM_SCALE + 1],
+	double X, double hshrink)
+{
+	/* clang-format off */
+	HWY_DYNAMIC_DISPATCH(vips_reduceh_ushort_hwy)(pout, pin,
+		n, width, bands, cs, X, hshrink);
+	/* clang-format on */
+}
+
+void
+vips_reduceh_short_hwy(VipsPel *pout, VipsPel *pin,
+	int n, int width, int bands,
+	short *restrict cs[VIPS_TRANSFORM_SCALE + 1],
+	double X, double hshrink)
+{
+	/* clang-format off */
+	HWY_DYNAMIC_DISPATCH(vips_reduceh_short_hwy)(pout, pin,
+		n, width, bands, cs, X, hshrink);
+	/* clang-format on */
+}
+
+void
+vips_reduceh_float_hwy(VipsPel *pout, VipsPel *pin,
+	int n, int width, int bands,
+	double *restrict cs[VIPS_TRANSFORM_SCALE + 1],
+	double X, double hshrink)
+{
+	/* clang-format off */
+	HWY_DYNAMIC_DISPATCH(vips_reduceh_float_hwy)(pout, pin,
+		n, width, bands, cs, X, hshrink);
+	/* clang-format on */
+}
 #endif /*HWY_ONCE*/
 
 #endif /*HAVE_HWY*/
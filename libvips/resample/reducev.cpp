@@ -23,6 +23,8 @@
  * 	- speed up the mask construction for uchar/ushort images
  * 22/4/22 kleisauke
  * 	- add @gap option
+ * 16/10/26
+ * 	- add a vector path for ushort, short and float
  */
 
 /*
@@ -638,6 +640,85 @@ vips_reducev_uchar_vector_gen(VipsRegion *out_region, void *vseq,
 
 	return 0;
 }
+
+/* ushort, short, float and complex, any number of bands.
+ */
+static int
+vips_reducev_wide_vector_gen(VipsRegion *out_region, void *vseq,
+	void *a, void *b, gboolean *stop)
+{
+	VipsImage *in = (VipsImage *) a;
+	VipsReducev *reducev = (VipsReducev *) b;
+	VipsReducevSequence *seq = (VipsReducevSequence *) vseq;
+	VipsRegion *ir = seq->ir;
+	VipsRect *r = &out_region->valid;
+
+	/* Double bands for complex.
+	 */
+	const int bands = in->Bands *
+		(vips_band_format_iscomplex(in->BandFmt) ? 2 : 1);
+	int ne = r->width * bands;
+
+	VipsRect s;
+
+#ifdef DEBUG
+	printf("vips_reducev_wide_vector_gen: generating %d x %d at %d x %d\n",
+		r->width, r->height, r->left, r->top);
+#endif /*DEBUG*/
+
+	s.left = r->left;
+	s.top = r->top * reducev->vshrink - reducev->voffset;
+	s.width = r->width;
+	s.height = r->height * reducev->vshrink + reducev->n_point;
+	if (vips_region_prepare(ir, &s))
+		return -1;
+
+	VIPS_GATE_START("vips_reducev_wide_vector_gen: work");
+
+	double Y = (r->top + 0.5) * reducev->vshrink - 0.5 -
+		reducev->voffset;
+
+	for (int y = 0; y < r->height; y++) {
+		VipsPel *q =
+			VIPS_REGION_ADDR(out_region, r->left, r->top + y);
+		const int py = (int) Y;
+		VipsPel *p = VIPS_REGION_ADDR(ir, r->left, py);
+		const int sy = Y * VIPS_TRANSFORM_SCALE * 2;
+		const int siy = sy & (VIPS_TRANSFORM_SCALE * 2 - 1);
+		const int ty = (siy + 1) >> 1;
+		const int lskip = VIPS_REGION_LSKIP(ir);
+
+		switch (in->BandFmt) {
+		case VIPS_FORMAT_USHORT:
+			vips_reducev_ushort_hwy(q, p,
+				reducev->n_point, ne, lskip, reducev->matrixs[ty]);
+			break;
+
+		case VIPS_FORMAT_SHORT:
+			vips_reducev_short_hwy(q, p,
+				reducev->n_point, ne, lskip, reducev->matrixs[ty]);
+			break;
+
+		case VIPS_FORMAT_FLOAT:
+		case VIPS_FORMAT_COMPLEX:
+			vips_reducev_float_hwy(q, p,
+				reducev->n_point, ne, lskip, reducev->matrixf[ty]);
+			break;
+
+		default:
+			g_assert_not_reached();
+			break;
+		}
+
+		Y += reducev->vshrink;
+	}
+
+	VIPS_GATE_STOP("vips_reducev_wide_vector_gen: work");
+
+	VIPS_COUNT_PIXELS(out_region, "vips_reducev_wide_vector_gen");
+
+	return 0;
+}
 #elif defined(HAVE_ORC)
 
 /* Process uchar images with a vector path.
@@ -952,6 +1033,15 @@ vips_reducev_build(VipsObject *object)
 		g_info("reducev: using vector path");
 	}
 	else
+	if ((in->BandFmt == VIPS_FORMAT_USHORT ||
+			in->BandFmt == VIPS_FORMAT_SHORT ||
+			in->BandFmt == VIPS_FORMAT_FLOAT ||
+			in->BandFmt == VIPS_FORMAT_COMPLEX) &&
+		vips_vector_isenabled()) {
+		generate = vips_reducev_wide_vector_gen;
+		g_info("reducev: using vector path");
+	}
+	else
 #elif defined(HAVE_ORC)
 	if (in->BandFmt == VIPS_FORMAT_UCHAR &&
 		vips_vector_isenabled() &&
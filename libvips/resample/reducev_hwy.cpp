@@ -4,6 +4,8 @@
  * 	- implement using ReorderWidenMulAccumulate
  * 29/11/22 kleisauke
  * 	- prefer use of RearrangeToOddPlusEven
+ * 16/10/26
+ * 	- add ushort, short and float paths
  */
 
 /*
@@ -41,6 +43,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <limits.h>
 
 #include <vips/vips.h>
 #include <vips/vector.h>
@@ -281,6 +284,179 @@ vips_reducev_uchar_hwy(VipsPel *pout, VipsPel *pin,
 #endif
 }
 
+/* The generic kernels below work for any band count. 16-bit pixels are
+ * accumulated in int32 with the same fixed-point coefficients as the C path,
+ * float pixels are promoted and accumulated in double, so results match
+ * vips_reducev_gen() exactly.
+ */
+#if HWY_HAVE_FLOAT64
+using DF64 = ScalableTag<double>;
+constexpr DF64 df64;
+#endif
+
+template <class D, typename T>
+HWY_INLINE Vec<D>
+load_promote(D d, const T *HWY_RESTRICT p)
+{
+	return PromoteTo(d, LoadU(Rebind<T, D>(), p));
+}
+
+HWY_INLINE void
+round_store(uint16_t *HWY_RESTRICT q, int32_t sum)
+{
+	sum = (sum + (VIPS_INTERPOLATE_SCALE >> 1)) >> VIPS_INTERPOLATE_SHIFT;
+	*q = VIPS_CLIP(0, sum, USHRT_MAX);
+}
+
+HWY_INLINE void
+round_store(int16_t *HWY_RESTRICT q, int32_t sum)
+{
+	sum = sum >= 0
+		? (sum + (VIPS_INTERPOLATE_SCALE >> 1)) >> VIPS_INTERPOLATE_SHIFT
+		: (sum - (VIPS_INTERPOLATE_SCALE >> 1)) >> VIPS_INTERPOLATE_SHIFT;
+	*q = VIPS_CLIP(SHRT_MIN, sum, SHRT_MAX);
+}
+
+HWY_INLINE void
+round_store(float *HWY_RESTRICT q, double sum)
+{
+	*q = sum;
+}
+
+/* DemoteTo() saturates, so that takes care of the clip.
+ */
+HWY_INLINE void
+round_store(DI32 d, Vec<DI32> sum, uint16_t *HWY_RESTRICT q)
+{
+	sum = Add(sum, Set(d, VIPS_INTERPOLATE_SCALE >> 1));
+	sum = ShiftRight<VIPS_INTERPOLATE_SHIFT>(sum);
+	StoreU(DemoteTo(Rebind<uint16_t, DI32>(), sum),
+		Rebind<uint16_t, DI32>(), q);
+}
+
+HWY_INLINE void
+round_store(DI32 d, Vec<DI32> sum, int16_t *HWY_RESTRICT q)
+{
+	const auto half = Set(d, VIPS_INTERPOLATE_SCALE >> 1);
+
+	sum = IfThenElse(Lt(sum, Zero(d)), Sub(sum, half), Add(sum, half));
+	sum = ShiftRight<VIPS_INTERPOLATE_SHIFT>(sum);
+	StoreU(DemoteTo(Rebind<int16_t, DI32>(), sum),
+		Rebind<int16_t, DI32>(), q);
+}
+
+#if HWY_HAVE_FLOAT64
+HWY_INLINE void
+round_store(DF64 d, Vec<DF64> sum, float *HWY_RESTRICT q)
+{
+	StoreU(DemoteTo(Rebind<float, DF64>(), sum),
+		Rebind<float, DF64>(), q);
+}
+#endif
+
+/* Bands don't matter here, we just run down @ne columns.
+ */
+template <class D, typename T, typename K>
+HWY_INLINE void
+reducev_line(D d, VipsPel *pout, VipsPel *pin,
+	int32_t n, int32_t ne, int32_t lskip, const K *HWY_RESTRICT k)
+{
+	using A = TFromD<D>;
+	const auto l1 = lskip / sizeof(T);
+	const int32_t N = Lanes(d);
+
+	/* Main loop: two vectors at once.
+	 */
+	int32_t x = 0;
+	for (; x + 2 * N <= ne; x += 2 * N) {
+		auto *HWY_RESTRICT p = (T *) pin + x;
+		auto *HWY_RESTRICT q = (T *) pout + x;
+
+		auto sum0 = Zero(d);
+		auto sum1 = Zero(d);
+
+		for (int32_t i = 0; i < n; ++i) {
+			const auto mmk = Set(d, (A) k[i]);
+
+			sum0 = Add(sum0, Mul(load_promote(d, p), mmk));
+			sum1 = Add(sum1, Mul(load_promote(d, p + N), mmk));
+			p += l1;
+		}
+
+		round_store(d, sum0, q);
+		round_store(d, sum1, q + N);
+	}
+	for (; x + N <= ne; x += N) {
+		auto *HWY_RESTRICT p = (T *) pin + x;
+		auto *HWY_RESTRICT q = (T *) pout + x;
+
+		auto sum0 = Zero(d);
+
+		for (int32_t i = 0; i < n; ++i) {
+			sum0 = Add(sum0, Mul(load_promote(d, p), Set(d, (A) k[i])));
+			p += l1;
+		}
+
+		round_store(d, sum0, q);
+	}
+
+	/* `ne` was not a multiple of the vector length `N`;
+	 * proceed one by one.
+	 */
+	for (; x < ne; ++x) {
+		auto *HWY_RESTRICT p = (T *) pin + x;
+		auto *HWY_RESTRICT q = (T *) pout + x;
+
+		A sum = 0;
+
+		for (int32_t i = 0; i < n; ++i) {
+			sum += (A) k[i] * *p;
+			p += l1;
+		}
+
+		round_store(q, sum);
+	}
+}
+
+HWY_ATTR void
+vips_reducev_ushort_hwy(VipsPel *pout, VipsPel *pin,
+	int32_t n, int32_t ne, int32_t lskip, const int16_t *HWY_RESTRICT k)
+{
+	reducev_line<DI32, uint16_t>(di32, pout, pin, n, ne, lskip, k);
+}
+
+HWY_ATTR void
+vips_reducev_short_hwy(VipsPel *pout, VipsPel *pin,
+	int32_t n, int32_t ne, int32_t lskip, const int16_t *HWY_RESTRICT k)
+{
+	reducev_line<DI32, int16_t>(di32, pout, pin, n, ne, lskip, k);
+}
+
+HWY_ATTR void
+vips_reducev_float_hwy(VipsPel *pout, VipsPel *pin,
+	int32_t n, int32_t ne, int32_t lskip, const double *HWY_RESTRICT k)
+{
+#if HWY_HAVE_FLOAT64
+	reducev_line<DF64, float>(df64, pout, pin, n, ne, lskip, k);
+#else
+	/* No double vectors on this target, fall back to plain C.
+	 */
+	const auto l1 = lskip / sizeof(float);
+
+	for (int32_t x = 0; x < ne; ++x) {
+		const float *HWY_RESTRICT p = (float *) pin + x;
+		double sum = 0;
+
+		for (int32_t i = 0; i < n; ++i) {
+			sum += k[i] * *p;
+			p += l1;
+		}
+
+		((float *) pout)[x] = sum;
+	}
+#endif
+}
+
 } /*namespace HWY_NAMESPACE*/
 
 #if HWY_ONCE
@@ -294,6 +470,37 @@ vips_reducev_uchar_hwy(VipsPel *pout, VipsPel *pin,
 	HWY_DYNAMIC_DISPATCH(vips_reducev_uchar_hwy)(pout, pin, n, ne, lskip, k);
 	/* clang-format on */
 }
+
+HWY_EXPORT(vips_reducev_ushort_hwy);
+HWY_EXPORT(vips_reducev_short_hwy);
+HWY_EXPORT(vips_reducev_float_hwy);
+
+void
+vips_reducev_ushort_hwy(VipsPel *pout, VipsPel *pin,
+	int n, int ne, int lskip, const short *restrict k)
+{
+	/* clang-format off */
+	HWY_DYNAMIC_DISPATCH(vips_reducev_ushort_hwy)(pout, pin, n, ne, lskip, k);
+	/* clang-format on */
+}
+
+void
+vips_reducev_short_hwy(VipsPel *pout, VipsPel *pin,
+	int n, int ne, int lskip, const short *restrict k)
+{
+	/* clang-format off */
+	HWY_DYNAMIC_DISPATCH(vips_reducev_short_hwy)(pout, pin, n, ne, lskip, k);
+	/* clang-format on */
+}
+
+void
+vips_reducev_float_hwy(VipsPel *pout, VipsPel *pin,
+	int n, int ne, int lskip, const double *restrict k)
+{
+	/* clang-format off */
+	HWY_DYNAMIC_DISPATCH(vips_reducev_float_hwy)(pout, pin, n, ne, lskip, k);
+	/* clang-format on */
+}
 #endif /*HWY_ONCE*/
 
 #endif /*HAVE_HWY*/
@@ -0,0 +1,118 @@
+/* Shared timing code for the vector path benchmarks.
+ *
+ * Each benchmark runs an operation with and without vector paths and prints
+ * the time taken. The test suite checks that the paths agree.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vips/vips.h>
+#include <vips/vector.h>
+
+#include "bench.h"
+
+/* A noise image of @format with @bands bands, in memory.
+ */
+VipsImage *
+bench_source(VipsBandFormat format, int bands, double mean, double sigma)
+{
+	VipsImage *noise;
+	VipsImage *joined;
+	VipsImage *cast;
+	VipsImage *memory;
+
+	if (vips_gaussnoise(&noise, BENCH_WIDTH, BENCH_HEIGHT,
+			"mean", mean,
+			"sigma", sigma,
+			NULL))
+		return NULL;
+
+	joined = noise;
+	g_object_ref(joined);
+	while (joined->Bands < bands) {
+		VipsImage *t;
+
+		if (vips_bandjoin2(joined, noise, &t, NULL)) {
+			g_object_unref(joined);
+			g_object_unref(noise);
+			return NULL;
+		}
+		g_object_unref(joined);
+		joined = t;
+	}
+	g_object_unref(noise);
+
+	if (vips_cast(joined, &cast, format, NULL)) {
+		g_object_unref(joined);
+		return NULL;
+	}
+	g_object_unref(joined);
+
+	memory = vips_image_copy_memory(cast);
+	g_object_unref(cast);
+
+	return memory;
+}
+
+static int
+bench_time(VipsImage *in, BenchFn fn, void *a, gboolean vector,
+	double *time)
+{
+	GTimer *timer;
+	VipsImage *out;
+	VipsImage *memory;
+
+	vips_vector_set_enabled(vector);
+
+	timer = g_timer_new();
+
+	if (fn(in, &out, a)) {
+		g_timer_destroy(timer);
+		return -1;
+	}
+	memory = vips_image_copy_memory(out);
+	g_object_unref(out);
+	if (!memory) {
+		g_timer_destroy(timer);
+		return -1;
+	}
+	g_object_unref(memory);
+
+	*time = g_timer_elapsed(timer, NULL);
+	g_timer_destroy(timer);
+
+	return 0;
+}
+
+/* Time @fn on @in with and without vector paths.
+ */
+int
+bench_run(const char *name, VipsImage *in, BenchFn fn, void *a)
+{
+	double c_time;
+	double vector_time;
+
+	if (bench_time(in, fn, a, FALSE, &c_time) ||
+		bench_time(in, fn, a, TRUE, &vector_time)) {
+		printf("%s", vips_error_buffer());
+		return -1;
+	}
+
+	printf("%s: C %g s, vector %g s\n", name, c_time, vector_time);
+
+	return 0;
+}
+
+int
+bench_init(const char *argv0)
+{
+	if (VIPS_INIT(argv0))
+		return -1;
+
+	/* Each run must compute pixels again.
+	 */
+	vips_cache_set_max(0);
+
+	return 0;
+}
@@ -0,0 +1,21 @@
+/* Shared timing code for the vector path benchmarks.
+ */
+
+#ifndef VIPS_BENCH_H
+#define VIPS_BENCH_H
+
+#include <vips/vips.h>
+
+#define BENCH_WIDTH (2000)
+#define BENCH_HEIGHT (2000)
+
+/* Make the image to be processed from @in.
+ */
+typedef int (*BenchFn)(VipsImage *in, VipsImage **out, void *a);
+
+VipsImage *bench_source(VipsBandFormat format, int bands,
+	double mean, double sigma);
+int bench_run(const char *name, VipsImage *in, BenchFn fn, void *a);
+int bench_init(const char *argv0);
+
+#endif /*VIPS_BENCH_H*/
@@ -271,3 +271,53 @@ def run_image2(message, left, right, fn):
              lambda x, y: run_fn2(fn, x, y))
     run_cmp2(message, left, right, 10, 10,
              lambda x, y: run_fn2(fn, x, y))
+
+
+# the libvips vector switch ... not all pyvips versions declare it, but in ABI
+# mode we can add it ourselves
+def vector_lib():
+    if not hasattr(pyvips.vips_lib, 'vips_vector_set_enabled'):
+        if pyvips.API_mode:
+            pytest.skip('pyvips has no vips_vector_set_enabled()')
+
+        pyvips.ffi.cdef('''
+            int vips_vector_isenabled(void);
+            void vips_vector_set_enabled(int enabled);
+        ''', override=True)
+
+    return pyvips.vips_lib
+
+
+# run fn with vector paths off, then on, with the operation cache off so
+# each run computes pixels again ... return (c, vector) as memory images
+def run_vector(fn):
+    lib = vector_lib()
+    enabled = lib.vips_vector_isenabled()
+    cache_max = pyvips.cache_get_max()
+    pyvips.cache_set_max(0)
+
+    try:
+        lib.vips_vector_set_enabled(0)
+        c = fn().copy_memory()
+        lib.vips_vector_set_enabled(1)
+        vector = fn().copy_memory()
+    finally:
+        lib.vips_vector_set_enabled(enabled)
+        pyvips.cache_set_max(cache_max)
+
+    return c, vector
+
+
+# the largest absolute difference between two images, computed with vector
+# paths off, so a broken vector path can't hide its own errors
+def max_vector_difference(a, b):
+    lib = vector_lib()
+    enabled = lib.vips_vector_isenabled()
+
+    try:
+        lib.vips_vector_set_enabled(0)
+        diff = (a.cast('double') - b.cast('double')).abs().max()
+    finally:
+        lib.vips_vector_set_enabled(enabled)
+
+    return diff
@@ -5,8 +5,9 @@ import pytest
 
 import pyvips
 from helpers import unsigned_formats, float_formats, noncomplex_formats, \
+    int_formats, \
     all_formats, run_fn, run_image2, run_const, run_cmp, run_cmp2, \
-    assert_almost_equal_objects
+    assert_almost_equal_objects, run_vector, max_vector_difference
 
 
 class TestArithmetic:
@@ -287,6 +288,41 @@ class TestArithmetic:
         self.run_unary(self.all_images, my_invert,
                        fmt=[pyvips.BandFormat.UCHAR])
 
+    def test_fused(self):
+        # chains of point operations run as a single generate ... check
+        # repeated inputs
+        def my_chain(x):
+            y = abs(x * 2 - 100)
+            return y * y + x
+
+        self.run_unary(self.all_images, my_chain, fmt=noncomplex_formats)
+
+        # an intermediate with two consumers must still work
+        im = self.colour + 1
+        a = im * 2
+        b = im * 3
+        assert (a + b - im * 5).abs().max() < 1e-6
+
+    def test_linear_linear(self):
+        # a linear of a linear is merged into one, check vector constants
+        im = self.colour.linear([1, 2, 3], 4).linear(2, [5, 6, 7])
+        assert_almost_equal_objects(im(10, 10),
+                                    [2 * (x * y + 4) + z for x, y, z in
+                                     zip(self.colour(10, 10), [1, 2, 3],
+                                         [5, 6, 7])])
+
+    def test_rot_rot(self):
+        # a rot of a rot is folded into one, check against a pipeline
+        # broken by a copy to memory, which can't be folded
+        im = self.colour.crop(10, 20, 60, 40)
+        for first in ["d90", "d180", "d270"]:
+            for second in ["d90", "d180", "d270"]:
+                folded = im.rot(first).rot(second)
+                unfolded = im.rot(first).copy_memory().rot(second)
+                assert folded.width == unfolded.width
+                assert folded.height == unfolded.height
+                assert (folded - unfolded).abs().max() == 0
+
     # test the rest of VipsArithmetic
 
     def test_avg(self):
@@ -761,6 +797,48 @@ class TestArithmetic:
             im3 = pyvips.Image.sum(im2)
             assert pytest.approx(im3.max()) == sum(range(0, 100, 10))
 
+    def test_vector(self):
+        ops = {
+            'add': lambda a, b: a.add(b),
+            'subtract': lambda a, b: a.subtract(b),
+            'multiply': lambda a, b: a.multiply(b),
+            'divide': lambda a, b: a.divide(b),
+            'less': lambda a, b: a.relational(b, 'less'),
+            'moreeq': lambda a, b: a.relational(b, 'moreeq'),
+            'equal': lambda a, b: a.relational(b, 'equal'),
+            'and': lambda a, b: a.boolean(b, 'and'),
+            'eor': lambda a, b: a.boolean(b, 'eor'),
+            'sum': lambda a, b: pyvips.Image.sum([a, b, a]),
+            'linear': lambda a, b: a.linear(1.7, -3.2),
+            'linear uchar': lambda a, b: a.linear(1.7, -3.2, uchar=True),
+        }
+
+        # sigma gives some zeros, for divide, and some equal pixels, for
+        # equal ... odd width to test the scalar tail of each line
+        noise = [pyvips.Image.gaussnoise(199, 100,
+                                         mean=20, sigma=40, seed=seed)
+                 for seed in [1, 2]]
+
+        for fmt in [pyvips.BandFormat.UCHAR,
+                    pyvips.BandFormat.CHAR,
+                    pyvips.BandFormat.USHORT,
+                    pyvips.BandFormat.SHORT,
+                    pyvips.BandFormat.FLOAT]:
+            a, b = [x.cast(fmt).copy_memory() for x in noise]
+
+            for name, fn in ops.items():
+                c, vector = run_vector(lambda: fn(a, b))
+                d = max_vector_difference(c, vector)
+
+                # linear uchar truncates a float, so a fused multiply-add
+                # can move it by one
+                if name == 'linear uchar':
+                    assert d <= 1, name
+                elif c.format in int_formats:
+                    assert d == 0, name
+                else:
+                    assert d < 0.01, name
+
 
 if __name__ == '__main__':
     pytest.main()
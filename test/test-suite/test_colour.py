@@ -3,7 +3,8 @@ import pytest
 
 import pyvips
 from helpers import JPEG_FILE, SRGB_FILE, colour_colourspaces, \
-    mono_colourspaces, assert_almost_equal_objects, skip_if_no
+    mono_colourspaces, assert_almost_equal_objects, skip_if_no, \
+    run_vector, max_vector_difference
 
 
 class TestColour:
@@ -177,6 +178,49 @@ class TestColour:
 
         assert_almost_equal_objects(before, after, threshold=10)
 
+    def test_vector(self):
+        # odd width to test the partial vector at the end of each line
+        def noise(means, sigmas):
+            bands = [pyvips.Image.gaussnoise(199, 200,
+                                             mean=mean, sigma=sigma,
+                                             seed=i + 1)
+                     for i, (mean, sigma) in enumerate(zip(means, sigmas))]
+            return bands[0].bandjoin(bands[1:])
+
+        # the documented bound for XYZ: 1e-5 relative, or 1e-5 absolute
+        # for values below one
+        def relative_difference(c, vector):
+            scale = (c.abs() > 1).ifthenelse(c.abs(), 1)
+            return max_vector_difference(c / scale, vector / scale)
+
+        srgb = noise([128] * 4, [60] * 4).cast('uchar')
+        srgb = srgb.copy(interpretation='srgb')
+        scrgb = srgb.sRGB2scRGB().copy_memory()
+        xyz = scrgb.extract_band(0, n=3).scRGB2XYZ().copy_memory()
+        lab = noise([50, 0, 0], [30, 60, 60])
+        lab = lab.copy(interpretation='lab').copy_memory()
+
+        # wide enough to go out of gamut, so we test clipping
+        wide = noise([0.5] * 4, [0.4] * 4)
+        wide = wide.copy(interpretation='scrgb').copy_memory()
+
+        c, vector = run_vector(lambda: xyz.XYZ2Lab())
+        assert max_vector_difference(c, vector) <= 1e-3
+
+        c, vector = run_vector(lambda: lab.Lab2XYZ())
+        assert relative_difference(c, vector) <= 1e-5
+
+        for bands in [3, 4]:
+            im = scrgb.extract_band(0, n=bands)
+            c, vector = run_vector(lambda: im.scRGB2XYZ())
+            assert relative_difference(c, vector) <= 1e-5
+
+            # integer sRGB must match exactly
+            im = wide.extract_band(0, n=bands)
+            for depth in [8, 16]:
+                c, vector = run_vector(lambda: im.scRGB2sRGB(depth=depth))
+                assert max_vector_difference(c, vector) == 0
+
 
 if __name__ == '__main__':
     pytest.main()
@@ -4,8 +4,10 @@ from functools import reduce
 
 import os
 import pytest
+import struct
 import tempfile
 import shutil
+import sys
 
 import pyvips
 from helpers import IMAGES, JPEG_FILE, RGBA_FILE, unsigned_formats, \
@@ -13,7 +15,27 @@ from helpers import IMAGES, JPEG_FILE, RGBA_FILE, unsigned_formats, \
     noncomplex_formats, all_formats, max_value, \
     sizeof_format, rot45_angles, rot45_angle_bonds, \
     rot_angles, rot_angle_bonds, run_cmp, run_cmp2, \
-    assert_almost_equal_objects, temp_filename
+    assert_almost_equal_objects, temp_filename, run_vector, \
+    max_vector_difference
+
+
+# the checksum tilecache writes for each tile in a disc cache: FNV-1a a word
+# at a time, folded to 32 bits and never 0
+def disc_tile_checksum(tile, line_size):
+    mask = 0xffffffffffffffff
+    prime = 1099511628211
+    h = 14695981039346656037
+    for y in range(0, len(tile), line_size):
+        line = tile[y:y + line_size]
+        n = len(line) // 8 * 8
+        for i in range(0, n, 8):
+            h = ((h ^ int.from_bytes(line[i:i + 8], sys.byteorder)) *
+                 prime) & mask
+        for c in line[n:]:
+            h = ((h ^ c) * prime) & mask
+    h = (h ^ (h >> 32)) & 0xffffffff
+
+    return h if h != 0 else 1
 
 
 class TestConversion:
@@ -80,6 +102,64 @@ class TestConversion:
         im2 = im.cast("char")
         assert im2.avg() == max_value["char"]
 
+        # chains of casts must only skip casts that lose nothing
+        im = pyvips.Image.black(1, 1) + 300.5
+        assert im.cast("uchar").cast("float").avg() == 255
+        assert im.cast("int").cast("double").cast("ushort").avg() == 300
+        im = self.colour.cast("uchar")
+        assert (im.cast("int").cast("float").cast("uchar") - im).abs().max() == 0
+
+        # round sends ties to even, and still clips
+        for fmt in ["float", "double", "complex"]:
+            im = (pyvips.Image.black(1, 1) + 2.5).cast(fmt)
+            assert im.cast("uchar").avg() == 2
+            assert im.cast("uchar", round=True).avg() == 2
+            im = (pyvips.Image.black(1, 1) + 3.7).cast(fmt)
+            assert im.cast("uchar").avg() == 3
+            assert im.cast("uchar", round=True).avg() == 4
+            im = (pyvips.Image.black(1, 1) + 255.7).cast(fmt)
+            assert im.cast("uchar", round=True).avg() == 255
+            im = (pyvips.Image.black(1, 1) - 3.7).cast(fmt)
+            assert im.cast("char", round=True).avg() == -4
+            assert im.cast("ushort", round=True).avg() == 0
+
+    def test_cast_vector(self):
+        casts = [["uchar", "ushort", False, False],
+                 ["uchar", "ushort", True, False],
+                 ["uchar", "short", False, False],
+                 ["uchar", "float", False, False],
+                 ["char", "short", False, False],
+                 ["char", "float", False, False],
+                 ["ushort", "uchar", False, False],
+                 ["ushort", "uchar", True, False],
+                 ["ushort", "short", False, False],
+                 ["ushort", "float", False, False],
+                 ["short", "uchar", False, False],
+                 ["short", "ushort", False, False],
+                 ["short", "float", False, False],
+                 ["float", "uchar", False, False],
+                 ["float", "uchar", False, True],
+                 ["float", "char", False, True],
+                 ["float", "ushort", False, False],
+                 ["float", "ushort", False, True],
+                 ["float", "short", False, True]]
+
+        # wide enough to hit the clips, odd width to test the scalar tail of
+        # each line ... float sources are multiples of 0.5, so round has
+        # ties to break
+        noise = pyvips.Image.gaussnoise(199, 100, mean=100, sigma=20000)
+        sources = {fmt: noise.cast(fmt).copy_memory()
+                   for fmt in ["uchar", "char", "ushort", "short"]}
+        sources["float"] = (noise.cast("int") * 0.5).cast("float") \
+            .copy_memory()
+
+        for fmt_in, fmt_out, shift, rnd in casts:
+            im = sources[fmt_in]
+            c, vector = run_vector(lambda: im.cast(fmt_out,
+                                                   shift=shift, round=rnd))
+            assert max_vector_difference(c, vector) == 0, \
+                '%s -> %s' % (fmt_in, fmt_out)
+
     def test_band_and(self):
         def band_and(x):
             if isinstance(x, pyvips.Image):
@@ -165,6 +245,71 @@ class TestConversion:
 
         self.run_unary(self.all_images, cache)
 
+    def test_sequential_readahead(self):
+        im = pyvips.Image.new_from_file(JPEG_FILE)
+
+        for readahead in [1, 2, 8]:
+            seq = pyvips.Image.new_from_file(JPEG_FILE, access="sequential")
+            x = seq.sequential(readahead=readahead)
+            y = x.resize(0.5)
+            assert (y - im.resize(0.5)).abs().max() == 0
+
+    def test_tilecache_disc(self):
+        cache_dir = tempfile.mkdtemp(dir=self.tempdir)
+
+        im = pyvips.Image.new_from_file(JPEG_FILE).invert()
+
+        # tiles go to disc as they leave memory, which for a cache that's
+        # not persistent is at the end of each computation
+        a = im.tilecache(cache_dir=cache_dir, tile_width=32, tile_height=32)
+        assert (a - im).abs().max() == 0
+        files = os.listdir(cache_dir)
+        assert len(files) == 1
+
+        filename = os.path.join(cache_dir, files[0])
+        n_tiles = ((im.width + 31) // 32) * ((im.height + 31) // 32)
+        header_size = (40 + 4 * n_tiles + 4095) // 4096 * 4096
+        tile_size = 32 * 32 * im.bands
+        with open(filename, 'rb') as f:
+            f.seek(40)
+            checksums = struct.unpack('=2I', f.read(8))
+        assert checksums[0] != 0
+        assert checksums[1] != 0
+
+        # overwrite the first tile, with a matching checksum ... a new cache
+        # on the same pipeline must read it back from disc rather than
+        # calculate it
+        sevens = b'\x07' * tile_size
+        with open(filename, 'r+b') as f:
+            f.seek(40)
+            f.write(struct.pack('=I', disc_tile_checksum(sevens,
+                                                         32 * im.bands)))
+            f.seek(header_size)
+            f.write(sevens)
+
+            # damage the second tile, as a crash could ... the checksum no
+            # longer matches, so it must be calculated again
+            f.write(sevens)
+
+        b = im.tilecache(cache_dir=cache_dir, tile_width=32, tile_height=32,
+                         threaded=True)
+        assert b.crop(0, 0, 32, 32).min() == 7
+        assert b.crop(0, 0, 32, 32).max() == 7
+        second = b.crop(32, 0, 32, 32) - im.crop(32, 0, 32, 32)
+        assert second.abs().max() == 0
+        assert len(os.listdir(cache_dir)) == 1
+
+        # images from memory have no digest, so there's no disc cache
+        mem_dir = tempfile.mkdtemp(dir=self.tempdir)
+        mem = pyvips.Image.new_from_memory(self.colour.write_to_memory(),
+                                           self.colour.width,
+                                           self.colour.height,
+                                           self.colour.bands,
+                                           self.colour.format)
+        c = mem.tilecache(cache_dir=mem_dir)
+        assert (c - mem).abs().max() == 0
+        assert len(os.listdir(mem_dir)) == 0
+
     def test_copy(self):
         x = self.colour.copy(interpretation=pyvips.Interpretation.LAB)
         assert x.interpretation == pyvips.Interpretation.LAB
@@ -327,6 +472,10 @@ class TestConversion:
             pixel = sub(5, 5)
             assert_almost_equal_objects(pixel, [2, 3, 4])
 
+            # crop of crop reads straight from the first image
+            sub2 = test.crop(20, 10, 40, 50).crop(5, 15, 10, 10)
+            assert (sub2 - sub).abs().max() == 0
+
     @pytest.mark.skipif(pyvips.type_find("VipsOperation", "smartcrop") == 0,
                         reason="no smartcrop, skipping test")
     def test_smartcrop(self):
@@ -489,6 +638,10 @@ class TestConversion:
 
             assert diff == 0
 
+            # pairs of flips cancel
+            result = test.fliphor().fliphor().fliphor()
+            assert (test.fliphor() - result).abs().max() == 0
+
     def test_gamma(self):
         exponent = 2.4
         for fmt in noncomplex_formats:
@@ -5,7 +5,8 @@ from functools import reduce
 
 import pyvips
 from helpers import noncomplex_formats, run_fn2, run_fn, \
-    assert_almost_equal_objects, assert_less_threshold
+    assert_almost_equal_objects, assert_less_threshold, \
+    run_vector, max_vector_difference
 
 
 # point convolution
@@ -151,6 +152,29 @@ class TestConvolution:
 
                 assert_almost_equal_objects(a_point, b_point, threshold=0.1)
 
+    def test_convsep_vector(self):
+        # odd width to test the partial vector at the end of each line
+        noise = pyvips.Image.gaussnoise(199, 200, mean=128, sigma=50)
+
+        for precision in [pyvips.Precision.FLOAT,
+                          pyvips.Precision.APPROXIMATE]:
+            mask = pyvips.Image.gaussmat(5, 0.2,
+                                         separable=True,
+                                         precision=precision)
+            for fmt in [pyvips.BandFormat.UCHAR,
+                        pyvips.BandFormat.USHORT,
+                        pyvips.BandFormat.SHORT,
+                        pyvips.BandFormat.FLOAT]:
+                im = noise.cast(fmt).copy_memory()
+
+                c, vector = run_vector(lambda:
+                                       im.convsep(mask, precision=precision))
+                d = max_vector_difference(c, vector)
+                if precision == pyvips.Precision.APPROXIMATE:
+                    assert d == 0
+                else:
+                    assert d < 0.001
+
     def test_fastcor(self):
         for im in self.all_images:
             for fmt in noncomplex_formats:
@@ -145,6 +145,52 @@ class TestForeign:
 
         x = None
 
+    def test_vips_compressed(self):
+        # an odd tile size, so we have clipped edge tiles
+        filename = temp_filename(self.tempdir, ".v")
+        try:
+            self.colour.vipssave(filename, compression="deflate", tile_size=48)
+        except pyvips.Error:
+            pytest.skip("no deflate support")
+
+        x = pyvips.Image.new_from_file(filename)
+        assert x.width == self.colour.width
+        assert x.height == self.colour.height
+        assert x.bands == self.colour.bands
+        assert (x - self.colour).abs().max() == 0
+
+        # random access only touches some tiles
+        a = x.crop(100, 50, 37, 91)
+        b = self.colour.crop(100, 50, 37, 91)
+        assert (a - b).abs().max() == 0
+
+        # metadata survives after the tiles
+        assert len(x.get("exif-data")) == len(self.colour.get("exif-data"))
+
+        # compressible images get much smaller
+        plain = temp_filename(self.tempdir, ".v")
+        packed = temp_filename(self.tempdir, ".v")
+        im = pyvips.Image.black(1000, 1000) + 128
+        im.vipssave(plain)
+        im.vipssave(packed, compression="deflate")
+        assert os.path.getsize(packed) < os.path.getsize(plain) / 10
+        x = pyvips.Image.new_from_file(packed)
+        assert x.avg() == 128
+
+        # tiled files have their own magic, so old readers reject them
+        with open(plain, "rb") as f:
+            plain_magic = f.read(4)
+        with open(packed, "rb") as f:
+            packed_magic = f.read(4)
+        assert plain_magic in (b"\xb6\xa6\xf2\x08", b"\x08\xf2\xa6\xb6")
+        assert packed_magic in (b"\xb6\xa6\xf2\xa8", b"\xa8\xf2\xa6\xb6")
+
+        # many threads reading tiles at once
+        x = pyvips.Image.new_from_file(packed)
+        assert x.rotate(90).avg() == 128
+
+        x = None
+
     @skip_if_no("jpegload")
     def test_jpeg(self):
         def jpeg_valid(im):
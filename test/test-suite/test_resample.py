@@ -3,7 +3,8 @@ import pytest
 
 import pyvips
 from helpers import JPEG_FILE, JPEG_FILE_XYB, OME_FILE, HEIC_FILE, TIF_FILE, \
-    all_formats, have, RGBA_FILE, RGBA_CORRECT_FILE, AVIF_FILE
+    all_formats, have, RGBA_FILE, RGBA_CORRECT_FILE, AVIF_FILE, \
+    run_vector, max_vector_difference
 
 
 # Run a function expecting a complex image on a two-band image
@@ -101,6 +102,29 @@ class TestResample:
                 d = abs(shr.avg() - im.avg())
                 assert d == 0
 
+    def test_reduce_vector(self):
+        # wide enough to hit the clip for short formats, odd width to test
+        # the partial vector at the end of each line
+        noise = pyvips.Image.gaussnoise(199, 200, mean=1000, sigma=20000)
+
+        # 1 to 4 bands have their own paths, more than 4 vectorise across
+        # the bands: test whole vectors of bands for AVX2 and AVX-512, plus
+        # one left over
+        for fmt in [pyvips.BandFormat.USHORT,
+                    pyvips.BandFormat.SHORT,
+                    pyvips.BandFormat.FLOAT]:
+            for bands in [1, 2, 3, 4, 5, 8, 9, 16, 17]:
+                im = noise.bandjoin([noise + 100 * i
+                                     for i in range(1, bands)])
+                im = im.cast(fmt).copy_memory()
+
+                c, vector = run_vector(lambda: im.reduce(2.5, 2.5))
+                d = max_vector_difference(c, vector)
+                if fmt == pyvips.BandFormat.FLOAT:
+                    assert d < 0.01
+                else:
+                    assert d == 0
+
     def test_resize(self):
         im = pyvips.Image.new_from_file(JPEG_FILE)
         im2 = im.resize(0.25)
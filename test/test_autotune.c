@@ -0,0 +1,122 @@
+/* Check tile autotuning.
+ *
+ * Computes a pipeline with and without autotuning and checks the results
+ * match, then checks that the tuned geometry was saved to the cache file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib/gstdio.h>
+
+#include <vips/vips.h>
+
+/* Tall enough for a warm-up area and all candidates, even with many
+ * threads.
+ */
+#define WIDTH (1000)
+#define HEIGHT (8000)
+
+static VipsImage *
+run_pipeline(void)
+{
+	VipsImage *xyz;
+	VipsImage *linear;
+	VipsImage *memory;
+
+	if (vips_xyz(&xyz, WIDTH, HEIGHT, NULL))
+		return NULL;
+	if (vips_linear1(xyz, &linear, 2.0, 1.0, NULL)) {
+		g_object_unref(xyz);
+		return NULL;
+	}
+	g_object_unref(xyz);
+
+	memory = vips_image_copy_memory(linear);
+	g_object_unref(linear);
+
+	return memory;
+}
+
+static gboolean
+same_pixels(VipsImage *a, VipsImage *b)
+{
+	VipsImage *equal;
+	double min;
+
+	if (vips_equal(a, b, &equal, NULL))
+		return FALSE;
+	if (vips_min(equal, &min, NULL)) {
+		g_object_unref(equal);
+		return FALSE;
+	}
+	g_object_unref(equal);
+
+	return min == 255.0;
+}
+
+int
+main(int argc, char **argv)
+{
+	GError *error = NULL;
+	char *filename;
+	char *contents;
+	VipsImage *plain;
+	VipsImage *tuned;
+	int fd;
+
+	if (VIPS_INIT(argv[0]))
+		vips_error_exit(NULL);
+
+	/* Each run must compute pixels again.
+	 */
+	vips_cache_set_max(0);
+	vips_concurrency_set(4);
+
+	if ((fd = g_file_open_tmp("vips-autotune-XXXXXX.txt",
+			 &filename, &error)) < 0)
+		vips_error_exit("%s", error->message);
+	g_close(fd, NULL);
+
+	vips_tile_autotune_set(FALSE);
+	if (!(plain = run_pipeline()))
+		vips_error_exit(NULL);
+
+	vips_tile_autotune_set_cache(filename);
+	if (!(tuned = run_pipeline()))
+		vips_error_exit(NULL);
+
+	if (!same_pixels(plain, tuned)) {
+		printf("autotuned pipeline computed different pixels\n");
+		return 1;
+	}
+	g_object_unref(tuned);
+
+	if (!g_file_get_contents(filename, &contents, NULL, &error))
+		vips_error_exit("%s", error->message);
+	printf("tuned: %s", contents);
+	if (strlen(contents) < 40) {
+		printf("no result saved\n");
+		return 1;
+	}
+	g_free(contents);
+
+	/* A second run should use the saved result.
+	 */
+	if (!(tuned = run_pipeline()))
+		vips_error_exit(NULL);
+	if (!same_pixels(plain, tuned)) {
+		printf("second autotuned run computed different pixels\n");
+		return 1;
+	}
+	g_object_unref(tuned);
+	g_object_unref(plain);
+
+	g_unlink(filename);
+	g_free(filename);
+
+	vips_shutdown();
+
+	return 0;
+}
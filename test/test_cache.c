@@ -0,0 +1,389 @@
+/* Check the operation cache counters and the tile caches.
+ *
+ * A repeated operation should hit, a new one should miss, operations which
+ * are never cached should not count as misses, and overfilling the cache
+ * should evict. Memory that worker threads keep for reuse should not make the
+ * cache trim. The shared tile store should supply tiles to a second cache
+ * over the same image and stay within budget. A disc tile cache directory
+ * over budget should lose its least-recently-used files.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib/gstdio.h>
+
+#include <vips/vips.h>
+
+#define CACHE_MAX (10)
+
+static int
+check(gboolean ok, const char *message)
+{
+	if (!ok) {
+		printf("%s\n", message);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+test_counters(void)
+{
+	guint64 hits;
+	guint64 misses;
+	guint64 evictions;
+	VipsImage *image;
+	VipsImage *copy;
+	int i;
+
+	hits = vips_cache_get_hits();
+	misses = vips_cache_get_misses();
+
+	if (vips_black(&image, 17, 17, NULL))
+		return -1;
+	g_object_unref(image);
+	if (check(vips_cache_get_misses() == misses + 1,
+			"first black did not miss"))
+		return -1;
+
+	if (vips_black(&image, 17, 17, NULL))
+		return -1;
+	if (check(vips_cache_get_hits() == hits + 1,
+			"second black did not hit"))
+		return -1;
+
+	/* copy is never cached, so it's not a miss.
+	 */
+	misses = vips_cache_get_misses();
+	if (vips_copy(image, &copy, NULL)) {
+		g_object_unref(image);
+		return -1;
+	}
+	g_object_unref(copy);
+	g_object_unref(image);
+	if (check(vips_cache_get_misses() == misses,
+			"nocache operation counted as a miss"))
+		return -1;
+
+	/* Build more distinct operations than the cache can hold.
+	 */
+	evictions = vips_cache_get_evictions();
+	for (i = 0; i < 4 * CACHE_MAX; i++) {
+		if (vips_black(&image, 100 + i, 17, NULL))
+			return -1;
+		g_object_unref(image);
+	}
+	if (check(vips_cache_get_evictions() >= evictions + 3 * CACHE_MAX,
+			"overfull cache did not evict"))
+		return -1;
+	if (check(vips_cache_get_size() <= CACHE_MAX,
+			"cache larger than max"))
+		return -1;
+
+	return 0;
+}
+
+/* Pixel memory that workers keep for reuse must not make the operation
+ * cache trim.
+ */
+static int
+test_arena(void)
+{
+	size_t limit;
+	VipsImage *black;
+	VipsImage *cast;
+	VipsImage *image;
+	double avg;
+	guint64 hits;
+	int i;
+
+	limit = vips_tracked_get_mem() + 256 * 1024;
+	vips_cache_set_max_mem(limit);
+
+	/* Several threads, each with a few tiles of 128 x 128 x 3 doubles,
+	 * well over the limit between them.
+	 */
+	vips_concurrency_set(4);
+	if (vips_black(&black, 2000, 2000, "bands", 3, NULL))
+		return -1;
+	if (vips_cast(black, &cast, VIPS_FORMAT_DOUBLE, NULL)) {
+		g_object_unref(black);
+		return -1;
+	}
+	g_object_unref(black);
+	if (vips_avg(cast, &avg, NULL)) {
+		g_object_unref(cast);
+		return -1;
+	}
+	g_object_unref(cast);
+
+	/* Workers free their buffer reserves into their arenas as they
+	 * finish, which can be just after the sink returns.
+	 */
+	for (i = 0; i < 100 && vips_tracked_get_mem() > limit; i++)
+		g_usleep(10000);
+	if (check(vips_tracked_get_mem() <= limit,
+			"idle pixel memory counted as in use"))
+		return -1;
+
+	/* ... but it is reported, and bounded by concurrency.
+	 */
+	if (check(vips_tracked_get_idle() > 0,
+			"idle pixel memory not reported") ||
+		check(vips_tracked_get_idle() <= 4 * 8 * 1024 * 1024,
+			"idle pixel memory not bounded"))
+		return -1;
+
+	hits = vips_cache_get_hits();
+	if (vips_black(&image, 23, 23, NULL))
+		return -1;
+	g_object_unref(image);
+	if (vips_black(&image, 23, 23, NULL))
+		return -1;
+	g_object_unref(image);
+	if (check(vips_cache_get_hits() == hits + 1,
+			"operation cache trimmed after a threaded pipeline"))
+		return -1;
+
+	vips_cache_set_max_mem(100 * 1024 * 1024);
+
+	return 0;
+}
+
+/* Average a 64 x 64 black image of this height through a tile cache of
+ * 16 x 16 tiles.
+ */
+static int
+stored_avg(int height, int max_tiles)
+{
+	VipsImage *black;
+	VipsImage *cache;
+	double avg;
+
+	if (vips_black(&black, 64, height, NULL))
+		return -1;
+	if (vips_tilecache(black, &cache,
+			"tile_width", 16,
+			"tile_height", 16,
+			"max_tiles", max_tiles,
+			NULL)) {
+		g_object_unref(black);
+		return -1;
+	}
+	g_object_unref(black);
+	if (vips_avg(cache, &avg, NULL)) {
+		g_object_unref(cache);
+		return -1;
+	}
+	g_object_unref(cache);
+
+	return 0;
+}
+
+static int
+test_store(void)
+{
+	guint64 hits;
+	guint64 misses;
+
+	/* Room for all 16 tiles of a 64 x 64 uchar image.
+	 */
+	vips_cache_set_max_tile_mem(64 * 64);
+
+	/* The first cache must calculate every tile.
+	 */
+	hits = vips_cache_get_tile_hits();
+	misses = vips_cache_get_tile_misses();
+	if (stored_avg(64, 100))
+		return -1;
+	if (check(vips_cache_get_tile_misses() == misses + 16 &&
+			vips_cache_get_tile_hits() == hits,
+			"first tile cache did not miss"))
+		return -1;
+	if (check(vips_cache_get_tile_mem() == 64 * 64,
+			"tile store did not keep tiles"))
+		return -1;
+
+	/* A different cache over the same image should find every tile in
+	 * the store.
+	 */
+	misses = vips_cache_get_tile_misses();
+	if (stored_avg(64, 101))
+		return -1;
+	if (check(vips_cache_get_tile_hits() == hits + 16 &&
+			vips_cache_get_tile_misses() == misses,
+			"second tile cache did not hit"))
+		return -1;
+
+	/* A taller image won't fit, so older tiles must go.
+	 */
+	misses = vips_cache_get_tile_misses();
+	if (stored_avg(128, 100))
+		return -1;
+	if (check(vips_cache_get_tile_misses() == misses + 32,
+			"new image did not miss"))
+		return -1;
+	if (check(vips_cache_get_tile_mem() <= 64 * 64,
+			"tile store larger than max"))
+		return -1;
+
+	vips_cache_set_max_tile_mem(0);
+	if (check(vips_cache_get_tile_mem() == 0,
+			"tile store not emptied"))
+		return -1;
+
+	return 0;
+}
+
+static int
+count_files(const char *dir, const char *only)
+{
+	GDir *gdir;
+	const char *name;
+	int n;
+
+	if (!(gdir = g_dir_open(dir, 0, NULL)))
+		return -1;
+
+	n = 0;
+	while ((name = g_dir_read_name(gdir)))
+		if (!only ||
+			strcmp(name, only) == 0)
+			n += 1;
+	g_dir_close(gdir);
+
+	return n;
+}
+
+static int
+remove_dir(const char *dir)
+{
+	GDir *gdir;
+	const char *name;
+
+	if (!(gdir = g_dir_open(dir, 0, NULL)))
+		return -1;
+
+	while ((name = g_dir_read_name(gdir))) {
+		char *filename = g_build_filename(dir, name, NULL);
+
+		g_unlink(filename);
+		g_free(filename);
+	}
+	g_dir_close(gdir);
+
+	return g_rmdir(dir);
+}
+
+/* Make a disc cache for a black image of this width, return the name of the
+ * file it made.
+ */
+static char *
+disc_cache(const char *dir, int width)
+{
+	VipsImage *black;
+	VipsImage *cache;
+	GDir *gdir;
+	const char *name;
+	char *newest;
+	gint64 newest_mtime;
+
+	if (vips_black(&black, width, 100, NULL))
+		return NULL;
+	if (vips_tilecache(black, &cache,
+			"cache_dir", dir,
+			"tile_width", 16,
+			"tile_height", 16,
+			NULL)) {
+		g_object_unref(black);
+		return NULL;
+	}
+	g_object_unref(black);
+	g_object_unref(cache);
+
+	if (!(gdir = g_dir_open(dir, 0, NULL)))
+		return NULL;
+
+	newest = NULL;
+	newest_mtime = 0;
+	while ((name = g_dir_read_name(gdir))) {
+		char *filename = g_build_filename(dir, name, NULL);
+		GStatBuf st;
+
+		if (!g_stat(filename, &st) &&
+			(!newest || st.st_mtime >= newest_mtime)) {
+			g_free(newest);
+			newest = g_strdup(name);
+			newest_mtime = st.st_mtime;
+		}
+		g_free(filename);
+	}
+	g_dir_close(gdir);
+
+	return newest;
+}
+
+static int
+test_disc(void)
+{
+	char *dir;
+	char *first;
+	char *second;
+	int result;
+
+	if (!(dir = g_dir_make_tmp("vips-test-cache-XXXXXX", NULL)))
+		return -1;
+
+	/* The input was built before the cache, but it must still have a
+	 * digest and get a file.
+	 */
+	result = -1;
+	second = NULL;
+	if ((first = disc_cache(dir, 100)) &&
+		count_files(dir, NULL) == 1) {
+		/* Each file is a page of header plus 49 tiles of 256 bytes,
+		 * so there's room for one but not two.
+		 */
+		vips_cache_set_max_tile_disc(20000);
+
+		if ((second = disc_cache(dir, 101)) &&
+			strcmp(first, second) != 0 &&
+			count_files(dir, NULL) == 1 &&
+			count_files(dir, second) == 1)
+			result = 0;
+	}
+
+	if (check(result == 0, "disc cache not trimmed"))
+		result = -1;
+
+	g_free(first);
+	g_free(second);
+	remove_dir(dir);
+	g_free(dir);
+
+	return result;
+}
+
+int
+main(int argc, char **argv)
+{
+	if (VIPS_INIT(argv[0]))
+		vips_error_exit(NULL);
+
+	vips_cache_set_max(CACHE_MAX);
+
+	if (test_counters() ||
+		test_arena() ||
+		test_disc() ||
+		test_store()) {
+		printf("%s", vips_error_buffer());
+		return 1;
+	}
+
+	vips_shutdown();
+
+	return 0;
+}
@@ -81,3 +81,36 @@ test_size $tmp/t1.jpg 66 100
 cat $image | $vipsthumbnail stdin -s 100 -o .jpg | cat > $tmp/t1.jpg
 echo ok
 test_size $tmp/t1.jpg 66 100
+
+# a threaded op should write a Chrome trace with a named track per thread,
+# spans for tile work and a memory counter
+test_trace() {
+	trace=$1
+
+	$PYTHON - $trace <<'PY'
+import json
+import sys
+
+with open(sys.argv[1]) as f:
+    events = json.load(f)
+
+names = [e["name"] for e in events if e["ph"] == "M"]
+phases = set(e["ph"] for e in events)
+if "thread_name" not in names or not {"X", "C"} <= phases:
+    sys.exit("bad trace, phases %s" % sorted(phases))
+PY
+}
+
+echo -n "testing --vips-profile-trace ... "
+rm -f $tmp/trace.json
+$vips --vips-concurrency=4 --vips-profile-trace=$tmp/trace.json \
+	avg $image > /dev/null
+test_trace $tmp/trace.json || exit 1
+echo ok
+
+echo -n "testing VIPS_PROFILE_TRACE ... "
+rm -f $tmp/trace.json
+VIPS_PROFILE_TRACE=$tmp/trace.json $vips --vips-concurrency=4 \
+	avg $image > /dev/null
+test_trace $tmp/trace.json || exit 1
+echo ok
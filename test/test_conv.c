@@ -0,0 +1,98 @@
+/* Benchmark the vector convolution paths against the C path.
+ *
+ * Runs float and approximate separable convolutions on 8-bit, 16-bit and
+ * float images with and without vector paths, and prints the time taken for
+ * each.
+ *
+ * Run with "meson test --benchmark conv". test_convolution.py checks that
+ * the paths agree.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vips/vips.h>
+
+#include "bench.h"
+
+#define SIGMA (5.0)
+
+typedef struct _Conv {
+	VipsImage *mask;
+	VipsPrecision precision;
+} Conv;
+
+static int
+conv(VipsImage *in, VipsImage **out, void *a)
+{
+	Conv *args = (Conv *) a;
+
+	return vips_convsep(in, out, args->mask,
+		"precision", args->precision,
+		NULL);
+}
+
+static int
+bench_conv(VipsImage *in, VipsPrecision precision)
+{
+	Conv args;
+	char name[256];
+	int result;
+
+	args.precision = precision;
+	if (vips_gaussmat(&args.mask, SIGMA, 0.2,
+			"separable", TRUE,
+			"precision", precision,
+			NULL)) {
+		printf("%s", vips_error_buffer());
+		return -1;
+	}
+
+	g_snprintf(name, 256, "%s, %s",
+		vips_enum_nick(VIPS_TYPE_BAND_FORMAT, in->BandFmt),
+		vips_enum_nick(VIPS_TYPE_PRECISION, precision));
+	result = bench_run(name, in, conv, &args);
+	g_object_unref(args.mask);
+
+	return result;
+}
+
+int
+main(int argc, char **argv)
+{
+	static const VipsBandFormat formats[] = {
+		VIPS_FORMAT_UCHAR,
+		VIPS_FORMAT_USHORT,
+		VIPS_FORMAT_SHORT,
+		VIPS_FORMAT_FLOAT
+	};
+
+	int i;
+
+	if (bench_init(argv[0]))
+		vips_error_exit(NULL);
+
+	for (i = 0; i < VIPS_NUMBER(formats); i++) {
+		VipsImage *in;
+		int result;
+
+		if (!(in = bench_source(formats[i], 1, 128.0, 50.0)))
+			vips_error_exit(NULL);
+
+		result = bench_conv(in, VIPS_PRECISION_FLOAT);
+
+		/* The approximate vector path is integer only.
+		 */
+		if (!result &&
+			formats[i] != VIPS_FORMAT_FLOAT)
+			result = bench_conv(in, VIPS_PRECISION_APPROXIMATE);
+
+		g_object_unref(in);
+		if (result)
+			return 1;
+	}
+
+	vips_shutdown();
+
+	return 0;
+}
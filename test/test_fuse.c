@@ -0,0 +1,173 @@
+/* Check that chains of arithmetic operations fuse.
+ *
+ * An add that only feeds a multiply should run inside the multiply, so it
+ * should compute no pixels of its own. That must hold for x * x too, where
+ * the multiply reads the add twice.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vips/vips.h>
+
+#define WIDTH (200)
+#define HEIGHT (100)
+
+/* (2 + 3) * 3 over a black image.
+ */
+static int
+run_chain(double *avg)
+{
+	VipsImage *black;
+	VipsImage *two;
+	VipsImage *three;
+	VipsImage *sum;
+	VipsImage *product;
+
+	if (vips_black(&black, WIDTH, HEIGHT, NULL))
+		return -1;
+	if (vips_linear1(black, &two, 1.0, 2.0, NULL)) {
+		g_object_unref(black);
+		return -1;
+	}
+	if (vips_linear1(black, &three, 1.0, 3.0, NULL)) {
+		g_object_unref(two);
+		g_object_unref(black);
+		return -1;
+	}
+	g_object_unref(black);
+	if (vips_add(two, three, &sum, NULL)) {
+		g_object_unref(three);
+		g_object_unref(two);
+		return -1;
+	}
+	g_object_unref(two);
+	if (vips_multiply(sum, three, &product, NULL)) {
+		g_object_unref(sum);
+		g_object_unref(three);
+		return -1;
+	}
+	g_object_unref(sum);
+	g_object_unref(three);
+
+	if (vips_avg(product, avg, NULL)) {
+		g_object_unref(product);
+		return -1;
+	}
+	g_object_unref(product);
+
+	return 0;
+}
+
+/* (1 + 4) * (1 + 4) over a black image. We don't reuse the constants from
+ * run_chain(), or the add could be a cache hit on an image the earlier
+ * multiply is still attached to.
+ */
+static int
+run_square(double *avg)
+{
+	VipsImage *black;
+	VipsImage *one;
+	VipsImage *four;
+	VipsImage *sum;
+	VipsImage *square;
+
+	if (vips_black(&black, WIDTH, HEIGHT, NULL))
+		return -1;
+	if (vips_linear1(black, &one, 1.0, 1.0, NULL)) {
+		g_object_unref(black);
+		return -1;
+	}
+	if (vips_linear1(black, &four, 1.0, 4.0, NULL)) {
+		g_object_unref(one);
+		g_object_unref(black);
+		return -1;
+	}
+	g_object_unref(black);
+	if (vips_add(one, four, &sum, NULL)) {
+		g_object_unref(four);
+		g_object_unref(one);
+		return -1;
+	}
+	g_object_unref(one);
+	g_object_unref(four);
+	if (vips_multiply(sum, sum, &square, NULL)) {
+		g_object_unref(sum);
+		return -1;
+	}
+	g_object_unref(sum);
+
+	if (vips_avg(square, avg, NULL)) {
+		g_object_unref(square);
+		return -1;
+	}
+	g_object_unref(square);
+
+	return 0;
+}
+
+/* multiply must have made every output pixel, add none.
+ */
+static int
+check_fused(void)
+{
+	VipsMetrics metrics;
+
+	if (!vips_metrics_get("multiply", &metrics) ||
+		metrics.pixels != WIDTH * HEIGHT) {
+		printf("multiply did not compute the output\n");
+		return -1;
+	}
+
+	/* If add was fused, its output image was never generated.
+	 */
+	if (vips_metrics_get("add", &metrics) &&
+		metrics.pixels != 0) {
+		printf("add computed %" G_GUINT64_FORMAT " pixels, "
+			   "it was not fused\n",
+			metrics.pixels);
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	double avg;
+
+	if (VIPS_INIT(argv[0]))
+		vips_error_exit(NULL);
+
+	vips_metrics_set(TRUE);
+	vips_metrics_reset();
+
+	if (run_chain(&avg))
+		vips_error_exit("chain failed");
+
+	if (avg != 15.0) {
+		printf("bad result %g, expected 15\n", avg);
+		return 1;
+	}
+
+	if (check_fused())
+		return 1;
+
+	vips_metrics_reset();
+
+	if (run_square(&avg))
+		vips_error_exit("square failed");
+
+	if (avg != 25.0) {
+		printf("bad square %g, expected 25\n", avg);
+		return 1;
+	}
+
+	if (check_fused())
+		return 1;
+
+	vips_shutdown();
+
+	return 0;
+}
@@ -0,0 +1,154 @@
+/* Check the per-operation counters.
+ *
+ * Runs a small pipeline twice, then checks that pixels and memory were
+ * counted against the right operations and that the second run was a
+ * cache hit. Operations which are never cached must not count as misses,
+ * and nothing must be counted while counting is off.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vips/vips.h>
+
+static void *
+count_entries(VipsMetrics *metrics, void *a, void *b)
+{
+	int *n = (int *) a;
+
+	*n += 1;
+
+	return NULL;
+}
+
+static int
+run_pipeline(void)
+{
+	VipsImage *black;
+	VipsImage *linear;
+	double avg;
+
+	if (vips_black(&black, 1000, 1000, NULL))
+		return -1;
+	if (vips_linear1(black, &linear, 2.0, 1.0, NULL)) {
+		g_object_unref(black);
+		return -1;
+	}
+	g_object_unref(black);
+	if (vips_avg(linear, &avg, NULL)) {
+		g_object_unref(linear);
+		return -1;
+	}
+	g_object_unref(linear);
+
+	return avg == 1.0 ? 0 : -1;
+}
+
+/* copy is never cached, so it's built each time.
+ */
+static int
+run_copy(void)
+{
+	VipsImage *black;
+	VipsImage *copy;
+	double avg;
+
+	if (vips_black(&black, 100, 100, NULL))
+		return -1;
+	if (vips_copy(black, &copy, NULL)) {
+		g_object_unref(black);
+		return -1;
+	}
+	g_object_unref(black);
+	if (vips_avg(copy, &avg, NULL)) {
+		g_object_unref(copy);
+		return -1;
+	}
+	g_object_unref(copy);
+
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	VipsMetrics metrics;
+	int n;
+
+	if (VIPS_INIT(argv[0]))
+		vips_error_exit(NULL);
+
+	vips_metrics_reset();
+
+	if (run_pipeline() ||
+		run_pipeline())
+		vips_error_exit("pipeline failed");
+
+	if (!vips_metrics_get("linear", &metrics)) {
+		printf("no counts for linear\n");
+		return 1;
+	}
+	printf("linear: %" G_GUINT64_FORMAT " hits, "
+		   "%" G_GUINT64_FORMAT " misses, "
+		   "%" G_GUINT64_FORMAT " pixels, "
+		   "%" G_GUINT64_FORMAT " us, "
+		   "%" G_GUINT64_FORMAT " bytes\n",
+		metrics.hits, metrics.misses, metrics.pixels,
+		metrics.time, metrics.memory);
+
+	/* The second run should find everything in the operation cache, so
+	 * no pixels are computed again.
+	 */
+	if (metrics.misses != 1 ||
+		metrics.hits != 1) {
+		printf("bad hit/miss counts for linear\n");
+		return 1;
+	}
+	if (metrics.pixels != 1000 * 1000) {
+		printf("bad pixel count for linear\n");
+		return 1;
+	}
+	if (metrics.memory == 0) {
+		printf("no buffer memory counted for linear\n");
+		return 1;
+	}
+
+	n = 0;
+	vips_metrics_map(count_entries, &n, NULL);
+	if (n < 3) {
+		printf("expected black, linear and avg, saw %d operations\n", n);
+		return 1;
+	}
+
+	vips_metrics_reset();
+	if (!vips_metrics_get("linear", &metrics) ||
+		metrics.pixels != 0) {
+		printf("reset failed\n");
+		return 1;
+	}
+
+	if (run_copy())
+		vips_error_exit("copy failed");
+	if (!vips_metrics_get("copy", &metrics) ||
+		metrics.misses != 0 ||
+		metrics.pixels == 0) {
+		printf("bad counts for copy\n");
+		return 1;
+	}
+
+	vips_metrics_reset();
+	vips_metrics_set(FALSE);
+	if (run_copy())
+		vips_error_exit("copy failed");
+	vips_metrics_set(TRUE);
+	if (!vips_metrics_get("copy", &metrics) ||
+		metrics.pixels != 0 ||
+		metrics.memory != 0) {
+		printf("counted while counting was off\n");
+		return 1;
+	}
+
+	vips_shutdown();
+
+	return 0;
+}
@@ -0,0 +1,194 @@
+/* Check background prefetch.
+ *
+ * A slow source behind a threaded tile cache, hinted with
+ * vips_reorder_prefetch_hint(), is read by a sink which prefetches a tile it
+ * will never use. That tile should be computed once, and before the sink
+ * returns. Prefetches from outside a sink should do nothing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vips/vips.h>
+
+#define TILE (32)
+#define ACROSS (8)
+#define DOWN (2)
+
+/* How many times each source tile has been computed.
+ */
+static int computed[ACROSS * DOWN];
+
+/* Each pixel is set to the index of its tile.
+ */
+static int
+source_gen(VipsRegion *out_region,
+	void *seq, void *a, void *b, gboolean *stop)
+{
+	VipsRect *r = &out_region->valid;
+
+	int x, y;
+
+	/* Slow, so the sink is still running when the prefetch starts.
+	 */
+	g_usleep(50000);
+
+	for (y = 0; y < r->height; y++) {
+		VipsPel *q = VIPS_REGION_ADDR(out_region, r->left, r->top + y);
+
+		for (x = 0; x < r->width; x++)
+			q[x] = (r->left + x) / TILE +
+				ACROSS * ((r->top + y) / TILE);
+	}
+
+	g_atomic_int_add(&computed[r->left / TILE + ACROSS * (r->top / TILE)],
+		1);
+
+	return 0;
+}
+
+/* Pass pixels through, but the first tile also asks for the top tile in
+ * the column we don't output.
+ */
+static int
+consumer_gen(VipsRegion *out_region,
+	void *seq, void *a, void *b, gboolean *stop)
+{
+	VipsRegion *ir = (VipsRegion *) seq;
+	VipsRect *r = &out_region->valid;
+
+	if (r->left == 0 &&
+		r->top == 0) {
+		VipsRect unused = { (ACROSS - 1) * TILE, 0, TILE, TILE };
+
+		vips_reorder_prefetch(ir, &unused);
+	}
+
+	if (vips_region_prepare(ir, r) ||
+		vips_region_region(out_region, ir, r, r->left, r->top))
+		return -1;
+
+	return 0;
+}
+
+static VipsImage *
+make_cache(void)
+{
+	VipsImage *source;
+	VipsImage *cache;
+
+	source = vips_image_new();
+	vips_image_init_fields(source, ACROSS * TILE, DOWN * TILE,
+		1, VIPS_FORMAT_UCHAR, VIPS_CODING_NONE,
+		VIPS_INTERPRETATION_B_W, 1.0, 1.0);
+	if (vips_image_pipelinev(source, VIPS_DEMAND_STYLE_ANY, NULL) ||
+		vips_image_generate(source,
+			NULL, source_gen, NULL, NULL, NULL)) {
+		g_object_unref(source);
+		return NULL;
+	}
+
+	if (vips_tilecache(source, &cache,
+			"tile_width", TILE,
+			"tile_height", TILE,
+			"max_tiles", ACROSS * DOWN,
+			"threaded", TRUE,
+			NULL)) {
+		g_object_unref(source);
+		return NULL;
+	}
+	g_object_unref(source);
+
+	vips_reorder_prefetch_hint(cache);
+
+	return cache;
+}
+
+static VipsImage *
+make_consumer(VipsImage *cache)
+{
+	VipsImage *consumer;
+
+	consumer = vips_image_new();
+	if (vips_image_pipelinev(consumer, VIPS_DEMAND_STYLE_SMALLTILE,
+			cache, NULL)) {
+		g_object_unref(consumer);
+		return NULL;
+	}
+	consumer->Xsize = (ACROSS - 1) * TILE;
+	if (vips_image_generate(consumer,
+			vips_start_one, consumer_gen, vips_stop_one, cache, NULL)) {
+		g_object_unref(consumer);
+		return NULL;
+	}
+
+	return consumer;
+}
+
+int
+main(int argc, char **argv)
+{
+	VipsImage *cache;
+	VipsImage *consumer;
+	VipsRegion *region;
+	VipsRect unused;
+	double avg;
+	int i;
+
+	if (VIPS_INIT(argv[0]))
+		vips_error_exit(NULL);
+
+	if (!(cache = make_cache()) ||
+		!(consumer = make_consumer(cache)) ||
+		vips_avg(consumer, &avg, NULL))
+		vips_error_exit("pipeline failed");
+	g_object_unref(consumer);
+
+	/* Columns 0 to 6 of rows 0 and 1.
+	 */
+	if (avg != (ACROSS - 2) / 2.0 + ACROSS / 2.0) {
+		printf("bad average %g\n", avg);
+		return 1;
+	}
+
+	/* Every tile the sink used must have been computed exactly once.
+	 */
+	for (i = 0; i < ACROSS * DOWN; i++)
+		if (i % ACROSS != ACROSS - 1 &&
+			computed[i] != 1) {
+			printf("tile %d computed %d times\n", i, computed[i]);
+			return 1;
+		}
+
+	/* The prefetched tile must be done by the time the sink returns.
+	 */
+	if (computed[ACROSS - 1] != 1) {
+		printf("prefetch not finished with its sink\n");
+		return 1;
+	}
+	if (computed[2 * ACROSS - 1] != 0) {
+		printf("unrequested tile computed\n");
+		return 1;
+	}
+
+	/* Outside a sink, prefetch should do nothing.
+	 */
+	unused.left = (ACROSS - 1) * TILE;
+	unused.top = TILE;
+	unused.width = TILE;
+	unused.height = TILE;
+	region = vips_region_new(cache);
+	vips_reorder_prefetch(region, &unused);
+	g_object_unref(region);
+	g_usleep(200000);
+	if (computed[2 * ACROSS - 1] != 0) {
+		printf("prefetch outside a sink\n");
+		return 1;
+	}
+
+	g_object_unref(cache);
+
+	vips_shutdown();
+
+	return 0;
+}
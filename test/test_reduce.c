@@ -0,0 +1,66 @@
+/* Benchmark the vector reduce paths against the C path.
+ *
+ * Runs reduce on ushort, short and float images with 1 to 16 bands, with
+ * and without vector paths, and prints the time taken for each.
+ *
+ * Run with "meson test --benchmark reduce". test_resample.py checks that
+ * the paths agree.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vips/vips.h>
+
+#include "bench.h"
+
+#define SHRINK (2.5)
+
+static int
+reduce(VipsImage *in, VipsImage **out, void *a)
+{
+	return vips_reduce(in, out, SHRINK, SHRINK, NULL);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const VipsBandFormat formats[] = {
+		VIPS_FORMAT_USHORT,
+		VIPS_FORMAT_SHORT,
+		VIPS_FORMAT_FLOAT
+	};
+	static const int bands[] = { 1, 2, 3, 4, 5, 8, 16 };
+
+	int i;
+	int j;
+
+	if (bench_init(argv[0]))
+		vips_error_exit(NULL);
+
+	for (i = 0; i < VIPS_NUMBER(formats); i++)
+		for (j = 0; j < VIPS_NUMBER(bands); j++) {
+			VipsImage *in;
+			char name[256];
+			int result;
+
+			/* Mean and sigma chosen to hit the clip for short
+			 * types.
+			 */
+			if (!(in = bench_source(formats[i], bands[j],
+					  1000.0, 20000.0)))
+				vips_error_exit(NULL);
+
+			g_snprintf(name, 256, "%s, %d bands",
+				vips_enum_nick(VIPS_TYPE_BAND_FORMAT, formats[i]),
+				bands[j]);
+			result = bench_run(name, in, reduce, NULL);
+			g_object_unref(in);
+			if (result)
+				return 1;
+		}
+
+	vips_shutdown();
+
+	return 0;
+}
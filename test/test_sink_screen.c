@@ -0,0 +1,252 @@
+/* Check background rendering with several renders, deadlines and
+ * cancellation.
+ *
+ * Starts a few renders with different priorities and deadlines, cancels
+ * some waiting tiles, then checks that every tile that's asked for again
+ * is painted with the right pixels.
+ *
+ * Then makes a render with a small max_tiles, cancels it and pans to a new
+ * area, which can only be painted if the cancelled tiles are reused.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vips/vips.h>
+
+#define N_RENDERS (4)
+#define SIZE (512)
+#define TILE (64)
+
+/* Enough tiles for a VIEW x VIEW viewport.
+ */
+#define VIEW (256)
+#define MAX_TILES ((VIEW / TILE) * (VIEW / TILE))
+
+static int n_notify = 0;
+
+static void
+notify(VipsImage *image, VipsRect *rect, void *a)
+{
+	g_atomic_int_inc(&n_notify);
+}
+
+/* Slow tiles, so there's something waiting for vips_sink_screen_cancel().
+ */
+static int
+slow_gen(VipsRegion *out_region, void *seq, void *a, void *b, gboolean *stop)
+{
+	int value = GPOINTER_TO_INT(a);
+	VipsRect *r = &out_region->valid;
+	int y;
+
+	g_usleep(20000);
+
+	for (y = 0; y < r->height; y++)
+		memset(VIPS_REGION_ADDR(out_region, r->left, r->top + y),
+			value, r->width);
+
+	return 0;
+}
+
+static VipsImage *
+slow_new(int value)
+{
+	VipsImage *image;
+
+	image = vips_image_new();
+	vips_image_init_fields(image, SIZE, SIZE, 1,
+		VIPS_FORMAT_UCHAR, VIPS_CODING_NONE, VIPS_INTERPRETATION_B_W,
+		1.0, 1.0);
+	if (vips_image_pipelinev(image, VIPS_DEMAND_STYLE_SMALLTILE, NULL) ||
+		vips_image_generate(image,
+			NULL, slow_gen, NULL, GINT_TO_POINTER(value), NULL))
+		vips_error_exit(NULL);
+
+	return image;
+}
+
+/* Request @area of @out and check the mask. TRUE if all painted.
+ */
+static gboolean
+area_painted(VipsImage *out, VipsImage *mask, VipsRect *area)
+{
+	VipsRegion *out_region;
+	VipsRegion *mask_region;
+	gboolean painted;
+	int x, y;
+
+	out_region = vips_region_new(out);
+	mask_region = vips_region_new(mask);
+	if (vips_region_prepare(out_region, area) ||
+		vips_region_prepare(mask_region, area))
+		vips_error_exit(NULL);
+
+	painted = TRUE;
+	for (y = area->top; y < VIPS_RECT_BOTTOM(area) && painted; y++)
+		for (x = area->left; x < VIPS_RECT_RIGHT(area); x++)
+			if (*VIPS_REGION_ADDR(mask_region, x, y) != 255) {
+				painted = FALSE;
+				break;
+			}
+
+	g_object_unref(mask_region);
+	g_object_unref(out_region);
+
+	return painted;
+}
+
+static gboolean
+all_painted(VipsImage *out, VipsImage *mask)
+{
+	VipsRect all = { 0, 0, SIZE, SIZE };
+
+	return area_painted(out, mask, &all);
+}
+
+/* Paint one viewport of a render with only MAX_TILES tiles, cancel it, then
+ * pan to the opposite corner. The new viewport needs every tile, so it can
+ * only complete if cancelled tiles are reused.
+ */
+static gboolean
+test_bounded(void)
+{
+	VipsRect view = { 0, 0, VIEW, VIEW };
+	VipsRect pan = { SIZE - VIEW, SIZE - VIEW, VIEW, VIEW };
+	VipsImage *in;
+	VipsImage *out;
+	VipsImage *mask;
+	gboolean done;
+	int loops;
+
+	in = slow_new(42);
+	out = vips_image_new();
+	mask = vips_image_new();
+	if (vips_sink_screen(in, out, mask,
+			TILE, TILE, MAX_TILES, 0, notify, NULL))
+		vips_error_exit(NULL);
+
+	(void) area_painted(out, mask, &view);
+	vips_sink_screen_cancel(out, NULL);
+
+	done = FALSE;
+	for (loops = 0; loops < 1000 && !done; loops++) {
+		done = area_painted(out, mask, &pan);
+		if (!done)
+			g_usleep(10000);
+	}
+
+	g_object_unref(mask);
+	g_object_unref(out);
+	g_object_unref(in);
+
+	return done;
+}
+
+static gboolean
+check_pixels(VipsImage *out, int n)
+{
+	VipsRect all = { 0, 0, SIZE, SIZE };
+	VipsRegion *region;
+	gboolean ok;
+	int x, y;
+
+	region = vips_region_new(out);
+	if (vips_region_prepare(region, &all))
+		vips_error_exit(NULL);
+
+	ok = TRUE;
+	for (y = 0; y < SIZE && ok; y++)
+		for (x = 0; x < SIZE; x++)
+			if (*VIPS_REGION_ADDR(region, x, y) != n + 1) {
+				ok = FALSE;
+				break;
+			}
+
+	g_object_unref(region);
+
+	return ok;
+}
+
+int
+main(int argc, char **argv)
+{
+	VipsImage *in[N_RENDERS];
+	VipsImage *out[N_RENDERS];
+	VipsImage *mask[N_RENDERS];
+	VipsRect corner = { 0, 0, TILE, TILE };
+	gboolean done;
+	int i;
+	int loops;
+
+	if (VIPS_INIT(argv[0]))
+		vips_error_exit(NULL);
+
+	for (i = 0; i < N_RENDERS; i++) {
+		VipsImage *black;
+
+		if (vips_black(&black, SIZE, SIZE, NULL) ||
+			vips_linear1(black, &in[i], 1.0, i + 1,
+				"uchar", TRUE,
+				NULL))
+			vips_error_exit(NULL);
+		g_object_unref(black);
+
+		out[i] = vips_image_new();
+		mask[i] = vips_image_new();
+		if (vips_sink_screen(in[i], out[i], mask[i],
+				TILE, TILE, -1, i - N_RENDERS / 2, notify, NULL))
+			vips_error_exit(NULL);
+
+		vips_sink_screen_set_deadline(out[i], 10 * (i + 1));
+	}
+
+	/* Queue every tile, then cancel all but the top-left corner on half
+	 * of the renders.
+	 */
+	for (i = 0; i < N_RENDERS; i++)
+		(void) all_painted(out[i], mask[i]);
+	for (i = 0; i < N_RENDERS; i += 2)
+		vips_sink_screen_cancel(out[i], &corner);
+
+	/* Cancelled tiles must come back when we ask again.
+	 */
+	done = FALSE;
+	for (loops = 0; loops < 1000 && !done; loops++) {
+		done = TRUE;
+		for (i = 0; i < N_RENDERS; i++)
+			if (!all_painted(out[i], mask[i]))
+				done = FALSE;
+
+		if (!done)
+			g_usleep(10000);
+	}
+
+	if (!done) {
+		printf("renders did not complete\n");
+		return 1;
+	}
+	printf("%d notifications\n", g_atomic_int_get(&n_notify));
+
+	for (i = 0; i < N_RENDERS; i++)
+		if (!check_pixels(out[i], i)) {
+			printf("render %d has bad pixels\n", i);
+			return 1;
+		}
+
+	for (i = 0; i < N_RENDERS; i++) {
+		g_object_unref(mask[i]);
+		g_object_unref(out[i]);
+		g_object_unref(in[i]);
+	}
+
+	if (!test_bounded()) {
+		printf("panned render with cancelled tiles did not complete\n");
+		return 1;
+	}
+
+	vips_shutdown();
+
+	return 0;
+}
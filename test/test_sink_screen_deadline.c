@@ -0,0 +1,140 @@
+/* Check that vips_sink_screen_set_deadline() reorders waiting renders.
+ *
+ * With a single bg render thread held up by a slow render, queue a render
+ * with a long deadline, then one with a shorter deadline, then tighten the
+ * deadline of the first. The first must now be painted before the second.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vips/vips.h>
+
+#define TILE (64)
+
+static int order[3];
+static int n_painted = 0;
+
+static void
+notify(VipsImage *image, VipsRect *rect, void *a)
+{
+	int i = g_atomic_int_add(&n_painted, 1);
+
+	if (i < VIPS_NUMBER(order))
+		order[i] = GPOINTER_TO_INT(a);
+}
+
+/* Hold up the bg thread.
+ */
+static int
+slow_gen(VipsRegion *out_region, void *seq, void *a, void *b, gboolean *stop)
+{
+	VipsRect *r = &out_region->valid;
+	int y;
+
+	g_usleep(500000);
+
+	for (y = 0; y < r->height; y++)
+		memset(VIPS_REGION_ADDR(out_region, r->left, r->top + y),
+			0, r->width);
+
+	return 0;
+}
+
+static VipsImage *
+render_new(int id, gboolean slow)
+{
+	VipsImage *in;
+	VipsImage *out;
+
+	if (slow) {
+		in = vips_image_new();
+		vips_image_init_fields(in, TILE, TILE, 1,
+			VIPS_FORMAT_UCHAR, VIPS_CODING_NONE,
+			VIPS_INTERPRETATION_B_W, 1.0, 1.0);
+		if (vips_image_pipelinev(in, VIPS_DEMAND_STYLE_SMALLTILE,
+				NULL) ||
+			vips_image_generate(in,
+				NULL, slow_gen, NULL, NULL, NULL))
+			vips_error_exit(NULL);
+	}
+	else if (vips_black(&in, TILE, TILE, NULL))
+		vips_error_exit(NULL);
+
+	out = vips_image_new();
+	if (vips_sink_screen(in, out, NULL,
+			TILE, TILE, -1, 0, notify, GINT_TO_POINTER(id)))
+		vips_error_exit(NULL);
+	g_object_unref(in);
+
+	return out;
+}
+
+/* Ask for the single tile of @out.
+ */
+static void
+request(VipsImage *out)
+{
+	VipsRect all = { 0, 0, TILE, TILE };
+	VipsRegion *region;
+
+	region = vips_region_new(out);
+	if (vips_region_prepare(region, &all))
+		vips_error_exit(NULL);
+	g_object_unref(region);
+}
+
+int
+main(int argc, char **argv)
+{
+	VipsImage *blocker;
+	VipsImage *first;
+	VipsImage *second;
+	int loops;
+
+	g_setenv("VIPS_RENDER_THREADS", "1", TRUE);
+
+	if (VIPS_INIT(argv[0]))
+		vips_error_exit(NULL);
+
+	blocker = render_new(0, TRUE);
+	first = render_new(1, FALSE);
+	second = render_new(2, FALSE);
+
+	/* Give the bg thread time to start on the blocker.
+	 */
+	request(blocker);
+	g_usleep(100000);
+
+	vips_sink_screen_set_deadline(first, 10000);
+	request(first);
+	vips_sink_screen_set_deadline(second, 1000);
+	request(second);
+	vips_sink_screen_set_deadline(first, 10);
+
+	for (loops = 0; loops < 500 && g_atomic_int_get(&n_painted) < 3;
+		 loops++)
+		g_usleep(10000);
+
+	if (g_atomic_int_get(&n_painted) < 3) {
+		printf("renders did not complete\n");
+		return 1;
+	}
+
+	if (order[0] != 0 ||
+		order[1] != 1 ||
+		order[2] != 2) {
+		printf("renders painted in order %d, %d, %d\n",
+			order[0], order[1], order[2]);
+		return 1;
+	}
+
+	g_object_unref(second);
+	g_object_unref(first);
+	g_object_unref(blocker);
+
+	vips_shutdown();
+
+	return 0;
+}
@@ -0,0 +1,61 @@
+#!/bin/sh
+
+# check that large temp images survive the compressed memory tier, and the
+# spill to disc when the memory budget runs out
+
+# set -x
+set -e
+
+. ./variables.sh
+
+if ! test_supported pngload; then
+	exit 0
+fi
+
+# 16 tiles of incompressible noise, so each tile is stored raw and takes 64kb
+# of budget
+$vips gaussnoise $tmp/noise.v 1024 1024 --mean 128 --sigma 40
+$vips cast $tmp/noise.v $tmp/noise8.v uchar
+$vips pngsave $tmp/noise8.v $tmp/noise.png --compression 0
+
+if ! $vips vipssave $tmp/noise8.v $tmp/packed.v --compression deflate \
+	> /dev/null 2>&1; then
+	echo "no temp compression, skipping test"
+	exit 0
+fi
+
+# load via a temp file with the given memory budget, check the pixels, and
+# report where the tiles went
+load_temp() {
+	budget=$1
+
+	G_MESSAGES_DEBUG=VIPS VIPS_DISC_THRESHOLD=1k VIPS_TEMP_MEMORY=$budget \
+		$vips copy $tmp/noise.png $tmp/loaded.v > $tmp/log 2>&1
+	test_difference $tmp/noise8.v $tmp/loaded.v 0
+}
+
+echo -n "checking temp images with no memory tier ... "
+load_temp 0
+if grep -q "tiles in memory" $tmp/log; then
+	echo FAILED, memory tier used by default
+	exit 1
+fi
+echo ok
+
+echo -n "checking temp images in memory ... "
+load_temp 100m
+if ! grep -q "16 tiles in memory, 0 on disc" $tmp/log; then
+	echo FAILED
+	cat $tmp/log
+	exit 1
+fi
+echo ok
+
+echo -n "checking temp images spilling to disc ... "
+load_temp 300k
+if ! grep -q "[1-9][0-9]* tiles in memory, [1-9][0-9]* on disc" $tmp/log; then
+	echo FAILED
+	cat $tmp/log
+	exit 1
+fi
+echo ok
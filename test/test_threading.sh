@@ -55,3 +55,46 @@ if [ $exit_code -ne 0 ]; then
 fi
 echo ok
 
+
+# the work-stealing scheduler should give the same result as the standard one
+echo -n "checking work-stealing scheduler ... "
+avg=$($vips avg $image)
+for cpus in 1 2 3 8 99; do
+	avg_steal=$(VIPS_STEAL=1 $vips --vips-concurrency=$cpus avg $image)
+	if [ "$avg" != "$avg_steal" ]; then
+		echo FAILED, $avg != $avg_steal
+		exit 1
+	fi
+
+	# NUMA mode does nothing on single-node hosts, but must still work
+	avg_numa=$(VIPS_NUMA=1 VIPS_STEAL=1 \
+		$vips --vips-concurrency=$cpus avg $image)
+	if [ "$avg" != "$avg_numa" ]; then
+		echo FAILED, $avg != $avg_numa
+		exit 1
+	fi
+done
+echo ok
+
+# many threads reading an mmaped file, with one whole-file window or many
+# strip windows, should see the same pixels
+echo -n "checking mmap windows ... "
+$vips replicate $image $tmp/w1.v 1 20
+avg=$($vips avg $tmp/w1.v)
+for cpus in 1 2 8 99; do
+	$vips --vips-concurrency=$cpus rot $tmp/w1.v $tmp/w2.v d90
+	avg_whole=$($vips avg $tmp/w2.v)
+	if [ "$avg" != "$avg_whole" ]; then
+		echo FAILED, $avg != $avg_whole
+		exit 1
+	fi
+
+	VIPS_WINDOW_STRIPS=1 \
+		$vips --vips-concurrency=$cpus rot $tmp/w1.v $tmp/w2.v d90
+	avg_strips=$(VIPS_WINDOW_STRIPS=1 $vips avg $tmp/w2.v)
+	if [ "$avg" != "$avg_strips" ]; then
+		echo FAILED, $avg != $avg_strips
+		exit 1
+	fi
+done
+echo ok
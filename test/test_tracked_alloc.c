@@ -0,0 +1,160 @@
+/* Hammer the tracked allocator from many threads and check the counters.
+ *
+ * Prints the time taken for each thread count, then checks that the memory
+ * and allocation counts return to their starting values and that the
+ * highwater mark covers the peaks we created, including a peak spread over
+ * several threads.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vips/vips.h>
+
+#define N_LOOPS (200000)
+#define N_LIVE (16)
+
+static void *
+alloc_thread(void *data)
+{
+	void *live[N_LIVE] = { 0 };
+	int i;
+
+	for (i = 0; i < N_LOOPS; i++) {
+		int j = i % N_LIVE;
+		size_t size = 64 + (i % 37) * 128;
+
+		if (live[j]) {
+			if (j & 1)
+				vips_tracked_aligned_free(live[j]);
+			else
+				vips_tracked_free(live[j]);
+			live[j] = NULL;
+		}
+
+		if (j & 1)
+			live[j] = vips_tracked_aligned_alloc(size, 64);
+		else
+			live[j] = vips_tracked_malloc(size);
+		if (!live[j])
+			return GINT_TO_POINTER(-1);
+	}
+
+	for (i = 0; i < N_LIVE; i++)
+		if (live[i]) {
+			if (i & 1)
+				vips_tracked_aligned_free(live[i]);
+			else
+				vips_tracked_free(live[i]);
+		}
+
+	return NULL;
+}
+
+/* Hold a block from another thread's shard while main rises again.
+ */
+static void *
+hold_thread(void *data)
+{
+	return vips_tracked_malloc(GPOINTER_TO_SIZE(data));
+}
+
+static int
+run_threads(int n_threads)
+{
+	GThread **threads = g_new(GThread *, n_threads);
+	GTimer *timer = g_timer_new();
+	int result = 0;
+	int i;
+
+	for (i = 0; i < n_threads; i++)
+		threads[i] = g_thread_new("alloc", alloc_thread, NULL);
+	for (i = 0; i < n_threads; i++)
+		if (g_thread_join(threads[i]))
+			result = -1;
+
+	printf("%d threads, %d allocs each: %g s\n",
+		n_threads, N_LOOPS, g_timer_elapsed(timer, NULL));
+
+	g_timer_destroy(timer);
+	g_free(threads);
+
+	return result;
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t mem;
+	int allocs;
+	void *big;
+	void *held;
+	int n;
+
+	if (VIPS_INIT(argv[0]))
+		vips_error_exit(NULL);
+
+	mem = vips_tracked_get_mem();
+	allocs = vips_tracked_get_allocs();
+
+	/* A transient peak must show up in the highwater mark, even though
+	 * it's gone before we look.
+	 */
+	if (!(big = vips_tracked_malloc(512 * 1024)))
+		vips_error_exit(NULL);
+	vips_tracked_free(big);
+	if (vips_tracked_get_mem_highwater() < mem + 512 * 1024) {
+		printf("transient peak missing from highwater mark\n");
+		return 1;
+	}
+
+	/* A peak in the total across shards must show up, even when no one
+	 * shard goes past its own earlier peak. Main peaks at 8MB and frees,
+	 * another thread takes 4MB, then main takes 6MB, so the total reaches
+	 * 10MB.
+	 */
+	if (!(big = vips_tracked_malloc(8 * 1024 * 1024)))
+		vips_error_exit(NULL);
+	vips_tracked_free(big);
+	if (!(held = g_thread_join(g_thread_new("hold", hold_thread,
+			  GSIZE_TO_POINTER(4 * 1024 * 1024)))))
+		vips_error_exit(NULL);
+	if (!(big = vips_tracked_malloc(6 * 1024 * 1024)))
+		vips_error_exit(NULL);
+	vips_tracked_free(big);
+	vips_tracked_free(held);
+	if (vips_tracked_get_mem_highwater() < mem + 10 * 1024 * 1024) {
+		printf("peak across threads missing from highwater mark\n");
+		return 1;
+	}
+
+	for (n = 1; n <= 2 * vips_concurrency_get(); n *= 2)
+		if (run_threads(n)) {
+			printf("allocation failed\n");
+			return 1;
+		}
+
+	if (vips_tracked_get_mem() != mem ||
+		vips_tracked_get_allocs() != allocs) {
+		printf("counters did not return to baseline: "
+			   "mem %zu (was %zu), allocs %d (was %d)\n",
+			vips_tracked_get_mem(), mem,
+			vips_tracked_get_allocs(), allocs);
+		return 1;
+	}
+
+	/* A single large allocation must always show up in the highwater
+	 * mark while it's live.
+	 */
+	if (!(big = vips_tracked_malloc(10 * 1024 * 1024)))
+		vips_error_exit(NULL);
+	if (vips_tracked_get_mem_highwater() < mem + 10 * 1024 * 1024) {
+		printf("highwater mark too low\n");
+		return 1;
+	}
+	vips_tracked_free(big);
+
+	vips_shutdown();
+
+	return 0;
+}